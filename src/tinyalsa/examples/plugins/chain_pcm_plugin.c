@@ -0,0 +1,377 @@
+/* chain_pcm_plugin.c
+**
+** Copyright 2026, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+/*
+ * A filter made of the stages of other filter plugins, run one after the
+ * other in the same process, so a stream goes through several filters
+ * without a PCM, and its copy of the samples, between each two of them.
+ *
+ * Each stage is the stage of another device of the card, a filter plugin
+ * that is loaded for its filter_stage_ops, with the settings of that
+ * device; its slave is not used. The samples pass between the stages in
+ * two buffers of a period, allocated when the stream is configured. A
+ * stage that works in place filters the buffer it reads, the others write
+ * to the other buffer. The first stage reads the samples of the
+ * application, or of the device for capture, and the last one writes those
+ * of the other side, so a chain of stages that work in place uses a single
+ * buffer, and one of a single stage none.
+ *
+ * The time spent in each stage is a control of the card, see shared_ctl.h,
+ * in microseconds for each second of the stream, updated every second.
+ *
+ * Settings in the device definition:
+ *   stages  - devices of the card, separated by ',', from the application
+ *             to the device, such as "6,5,4"; a chain can not be a stage
+ *   control - name of the time control, "Chain Playback Stage Time" or
+ *             "Chain Capture Stage Time" by default
+ */
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <tinyalsa/pcm.h>
+#include <tinyalsa/plugin.h>
+
+#include "filter_pcm_plugin.h"
+#include "shared_ctl.h"
+
+#define CHAIN_MAX_STAGES 8
+/* the time of a stage that takes all of the time of the stream */
+#define CHAIN_MAX_TIME 1000000
+
+/* the buffers stages read and write */
+enum chain_buf {
+    CHAIN_SRC,
+    CHAIN_DST,
+    CHAIN_WORK_A,
+    CHAIN_WORK_B,
+    CHAIN_NUM_BUFS,
+};
+
+struct chain_stage {
+    void *handle;
+    const struct filter_stage_ops *ops;
+    void *stage;
+    /* the device of the stage, for its settings */
+    struct pcm_plugin plugin;
+    struct filter_format in;
+    struct filter_format out;
+    enum chain_buf from;
+    enum chain_buf to;
+    unsigned long long ns;
+};
+
+struct chain {
+    int capture;
+    /* in the order of the device definition, from the application */
+    struct chain_stage stages[CHAIN_MAX_STAGES];
+    unsigned int count;
+    void *bufs[CHAIN_NUM_BUFS];
+
+    struct shctl *shctl;
+    struct shctl_entry *ctl;
+    unsigned int rate;
+    /* frames since the last update of the control */
+    unsigned int frames;
+};
+
+/* this plugin, which a stage that is a chain would be too */
+extern const struct filter_stage_ops filter_stage_ops;
+
+static size_t chain_frame_bytes(const struct filter_format *format)
+{
+    return (size_t) format->channels * pcm_format_to_bits(format->format) / 8;
+}
+
+/* the stage that runs k-th, the samples flow to the application for capture */
+static struct chain_stage *chain_step(struct chain *ch, unsigned int k)
+{
+    return &ch->stages[ch->capture ? ch->count - 1 - k : k];
+}
+
+static void chain_update_ctl(struct chain *ch)
+{
+    int32_t values[CHAIN_MAX_STAGES];
+    unsigned long long us;
+    unsigned int i;
+
+    for (i = 0; i < ch->count; i++) {
+        us = ch->stages[i].ns * ch->rate / ch->frames / 1000;
+        values[i] = us > CHAIN_MAX_TIME ? CHAIN_MAX_TIME : us;
+        ch->stages[i].ns = 0;
+    }
+    ch->frames = 0;
+
+    shctl_write(ch->shctl, ch->ctl, values, ch->count * sizeof(values[0]));
+}
+
+static void chain_process(void *stage, const void *src, void *dst, unsigned int frames)
+{
+    struct chain *ch = stage;
+    struct chain_stage *st;
+    struct timespec start, end;
+    unsigned int k;
+
+    /* the stages never write the source */
+    ch->bufs[CHAIN_SRC] = (void *) src;
+    ch->bufs[CHAIN_DST] = dst;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (k = 0; k < ch->count; k++) {
+        st = chain_step(ch, k);
+        st->ops->process(st->stage, ch->bufs[st->from], ch->bufs[st->to], frames);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        st->ns += (end.tv_sec - start.tv_sec) * 1000000000LL + end.tv_nsec - start.tv_nsec;
+        start = end;
+    }
+
+    ch->frames += frames;
+    if (ch->ctl && ch->frames >= ch->rate)
+        chain_update_ctl(ch);
+}
+
+static void chain_reset(void *stage)
+{
+    struct chain *ch = stage;
+    unsigned int i;
+
+    for (i = 0; i < ch->count; i++) {
+        ch->stages[i].ops->reset(ch->stages[i].stage);
+        ch->stages[i].ns = 0;
+    }
+    ch->frames = 0;
+}
+
+/* resizes a work buffer, or frees it if it is not used */
+static int chain_alloc(struct chain *ch, enum chain_buf buf, size_t size)
+{
+    void *p;
+
+    if (!size) {
+        free(ch->bufs[buf]);
+        ch->bufs[buf] = NULL;
+        return 0;
+    }
+
+    p = realloc(ch->bufs[buf], size);
+    if (!p)
+        return -ENOMEM;
+    ch->bufs[buf] = p;
+    return 0;
+}
+
+static int chain_configure(void *stage, struct filter_format *in, struct filter_format *out)
+{
+    struct chain *ch = stage;
+    struct filter_format format = ch->capture ? *out : *in;
+    struct chain_stage *st;
+    enum chain_buf buf = CHAIN_SRC;
+    size_t sizes[CHAIN_NUM_BUFS] = { 0 }, size;
+    unsigned int i, k;
+    int ret;
+
+    /* each stage gets the format the one before it gives the device side */
+    for (i = 0; i < ch->count; i++) {
+        st = &ch->stages[i];
+        st->in = format;
+        st->out = format;
+        ret = st->ops->configure(st->stage, &st->in, &st->out);
+        if (ret)
+            return ret;
+
+        format = ch->capture ? st->in : st->out;
+        if (format.rate != in->rate || format.period_size != in->period_size ||
+            format.channels == 0 || pcm_format_to_bits(format.format) == 0)
+            return -EINVAL;
+    }
+    if (ch->capture)
+        *in = format;
+    else
+        *out = format;
+
+    /* in place where the stage can, in the other buffer where it can not */
+    for (k = 0; k < ch->count; k++) {
+        st = chain_step(ch, k);
+        st->from = buf;
+        if (k == ch->count - 1)
+            st->to = CHAIN_DST;
+        else if (buf != CHAIN_SRC && st->ops->in_place &&
+                 chain_frame_bytes(&st->in) == chain_frame_bytes(&st->out))
+            st->to = buf;
+        else
+            st->to = buf == CHAIN_WORK_A ? CHAIN_WORK_B : CHAIN_WORK_A;
+        buf = st->to;
+
+        size = (size_t) st->out.period_size * chain_frame_bytes(&st->out);
+        if (sizes[buf] < size)
+            sizes[buf] = size;
+    }
+
+    ret = chain_alloc(ch, CHAIN_WORK_A, sizes[CHAIN_WORK_A]);
+    if (!ret)
+        ret = chain_alloc(ch, CHAIN_WORK_B, sizes[CHAIN_WORK_B]);
+    if (ret)
+        return ret;
+
+    ch->rate = in->rate;
+    chain_reset(ch);
+    return 0;
+}
+
+static void chain_close(void *stage)
+{
+    struct chain *ch = stage;
+    struct chain_stage *st;
+
+    while (ch->count) {
+        st = &ch->stages[--ch->count];
+        st->ops->close(st->stage);
+        dlclose(st->handle);
+    }
+    free(ch->bufs[CHAIN_WORK_A]);
+    free(ch->bufs[CHAIN_WORK_B]);
+    shctl_close(ch->shctl);
+    free(ch);
+}
+
+/* loads the plugin of a device and opens its stage with its settings */
+static int chain_open_stage(struct chain *ch, struct pcm_plugin *plugin, unsigned int device)
+{
+    struct chain_stage *st = &ch->stages[ch->count];
+    char *so_name;
+    int ret;
+
+    st->plugin.card = plugin->card;
+    st->plugin.device = device;
+    st->plugin.mode = plugin->mode;
+    if (device == plugin->device || pcm_plugin_get_str(&st->plugin, "so-name", &so_name)) {
+        fprintf(stderr, "%s: no stage device %u,%u\n", __func__, plugin->card, device);
+        return -EINVAL;
+    }
+
+    st->handle = dlopen(so_name, RTLD_NOW);
+    if (!st->handle) {
+        fprintf(stderr, "%s: unable to open %s: %s\n", __func__, so_name, dlerror());
+        return -ENOENT;
+    }
+
+    dlerror();
+
+    st->ops = dlsym(st->handle, "filter_stage_ops");
+    if (!st->ops || st->ops == &filter_stage_ops) {
+        fprintf(stderr, "%s: %s has no filter stage\n", __func__, so_name);
+        dlclose(st->handle);
+        return -EINVAL;
+    }
+
+    ret = st->ops->open(&st->stage, &st->plugin);
+    if (ret) {
+        dlclose(st->handle);
+        return ret;
+    }
+
+    ch->count++;
+    return 0;
+}
+
+static int chain_open(void **stage, struct pcm_plugin *plugin)
+{
+    struct shctl_entry tmpl;
+    struct chain *ch;
+    char *stages, *name, *end;
+    const char *p;
+    long device;
+    int ret;
+
+    ch = calloc(1, sizeof(*ch));
+    if (!ch)
+        return -ENOMEM;
+
+    ch->capture = !!(plugin->mode & PCM_IN);
+
+    if (pcm_plugin_get_str(plugin, "stages", &stages)) {
+        fprintf(stderr, "%s: no stages for %u,%u\n", __func__, plugin->card, plugin->device);
+        chain_close(ch);
+        return -EINVAL;
+    }
+
+    for (p = stages; *p; ) {
+        device = strtol(p, &end, 10);
+        if (end == p || device < 0 || ch->count == CHAIN_MAX_STAGES) {
+            fprintf(stderr, "%s: bad stages \"%s\"\n", __func__, stages);
+            chain_close(ch);
+            return -EINVAL;
+        }
+
+        ret = chain_open_stage(ch, plugin, device);
+        if (ret) {
+            chain_close(ch);
+            return ret;
+        }
+
+        p = end;
+        while (*p == ' ' || *p == ',')
+            p++;
+    }
+
+    if (!ch->count) {
+        chain_close(ch);
+        return -EINVAL;
+    }
+
+    memset(&tmpl, 0, sizeof(tmpl));
+    if (pcm_plugin_get_str(plugin, "control", &name))
+        name = ch->capture ? "Chain Capture Stage Time" : "Chain Playback Stage Time";
+    snprintf(tmpl.name, sizeof(tmpl.name), "%s", name);
+    tmpl.type = SHCTL_TYPE_INTEGER;
+    tmpl.count = ch->count;
+    tmpl.min = 0;
+    tmpl.max = CHAIN_MAX_TIME;
+    tmpl.step = 1;
+
+    ch->shctl = shctl_open(plugin->card, 1);
+    if (ch->shctl)
+        ch->ctl = shctl_add(ch->shctl, &tmpl);
+    if (!ch->ctl)
+        fprintf(stderr, "%s: no control \"%s\", the stage times are not reported\n",
+                __func__, tmpl.name);
+
+    *stage = ch;
+    return 0;
+}
+
+const struct filter_stage_ops filter_stage_ops = {
+    .open = chain_open,
+    .configure = chain_configure,
+    .process = chain_process,
+    .reset = chain_reset,
+    .close = chain_close,
+};
@@ -0,0 +1,542 @@
+/* chmap_pcm_plugin.c
+**
+** Copyright 2026, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+/*
+ * A filter that maps the channels of the application to those of the
+ * device, so a stream of any number of channels plays on, or records from,
+ * a device of a fixed number.
+ *
+ * Each channel of the output is a mix of the channels of the input, by a
+ * matrix. The common shapes, 1 to 2, 2 to 1, 6 to 2 and 2 to 8 channels,
+ * have vector kernels of their own; other mixes are done a frame at a
+ * time. A matrix that only moves channels, each output a copy of an input
+ * or silent, copies the samples exactly.
+ *
+ * Settings in the device definition:
+ *   channels - channels of the device, 2 by default
+ *   matrix   - rows of gains, one for each output channel, separated by ';',
+ *              with a gain for each input channel, such as "0 1; 1 0" for
+ *              swapping stereo channels; it is used for streams of as many
+ *              channels as its rows are long
+ *
+ * Without a matrix for the stream, the channels are in WAVE order (FL, FR,
+ * FC, LFE, BL, BR, ...) and:
+ *   - mono plays on FL and FR, and stereo is mixed to mono at half gain
+ *   - 5.1 and quad are mixed down to stereo, the centre and back at -3 dB
+ *     and the LFE dropped, scaled not to clip
+ *   - otherwise channels go through by position, the missing ones silent
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tinyalsa/pcm.h>
+#include <tinyalsa/plugin.h>
+
+#include "filter_pcm_plugin.h"
+#include "filter_vec.h"
+
+#define CHMAP_MAX_VECS (FILTER_MAX_CHANNELS / FILTER_VEC_WIDTH)
+/* -3 dB */
+#define CHMAP_HALF_POWER 0.70710678f
+
+enum chmap_kernel {
+    CHMAP_COPY,
+    CHMAP_ROUTE,
+    CHMAP_1_TO_2,
+    CHMAP_2_TO_1,
+    CHMAP_6_TO_2,
+    CHMAP_2_TO_8,
+    CHMAP_MATRIX,
+};
+
+struct chmap {
+    int capture;
+    unsigned int dev_channels;
+    /* the matrix of the device definition, and its size */
+    float def[FILTER_MAX_CHANNELS][FILTER_MAX_CHANNELS];
+    unsigned int def_rows;
+    unsigned int def_cols;
+
+    enum pcm_format format;
+    unsigned int in_channels;
+    unsigned int out_channels;
+    /* the gain of each input channel in each output channel */
+    float matrix[FILTER_MAX_CHANNELS][FILTER_MAX_CHANNELS];
+    enum chmap_kernel kernel;
+
+    /* the input channel of each output, or -1 for silence, to route */
+    int route[FILTER_MAX_CHANNELS];
+    /* the gains of the shape kernels, by lane */
+    filter_v4sf gain[FILTER_MAX_CHANNELS];
+    /* the column of each input channel, by vectors of outputs */
+    filter_v4sf column[FILTER_MAX_CHANNELS][CHMAP_MAX_VECS];
+};
+
+/* mono on FL and FR, 5.1 and quad down to stereo, others by position */
+static void chmap_default_matrix(struct chmap *cm)
+{
+    unsigned int in = cm->in_channels, out = cm->out_channels;
+    float (*m)[FILTER_MAX_CHANNELS] = cm->matrix;
+    unsigned int c;
+
+    if (in == 1 && out >= 2) {
+        m[0][0] = 1.0f;
+        m[1][0] = 1.0f;
+    } else if (in == 2 && out == 1) {
+        m[0][0] = 0.5f;
+        m[0][1] = 0.5f;
+    } else if (in == 6 && out == 2) {
+        float scale = 1.0f / (1.0f + 2.0f * CHMAP_HALF_POWER);
+
+        m[0][0] = scale;
+        m[0][2] = CHMAP_HALF_POWER * scale;
+        m[0][4] = CHMAP_HALF_POWER * scale;
+        m[1][1] = scale;
+        m[1][2] = CHMAP_HALF_POWER * scale;
+        m[1][5] = CHMAP_HALF_POWER * scale;
+    } else if (in == 4 && out == 2) {
+        float scale = 1.0f / (1.0f + CHMAP_HALF_POWER);
+
+        m[0][0] = scale;
+        m[0][2] = CHMAP_HALF_POWER * scale;
+        m[1][1] = scale;
+        m[1][3] = CHMAP_HALF_POWER * scale;
+    } else {
+        for (c = 0; c < in && c < out; c++)
+            m[c][c] = 1.0f;
+    }
+}
+
+/* whether each output is a copy of an input, or silent */
+static int chmap_is_route(struct chmap *cm)
+{
+    unsigned int o, i;
+
+    for (o = 0; o < cm->out_channels; o++) {
+        cm->route[o] = -1;
+        for (i = 0; i < cm->in_channels; i++) {
+            if (cm->matrix[o][i] == 0.0f)
+                continue;
+            if (cm->matrix[o][i] != 1.0f || cm->route[o] >= 0)
+                return 0;
+            cm->route[o] = i;
+        }
+    }
+
+    return 1;
+}
+
+static void chmap_choose_kernel(struct chmap *cm)
+{
+    float (*m)[FILTER_MAX_CHANNELS] = cm->matrix;
+    unsigned int in = cm->in_channels, out = cm->out_channels;
+    int route = chmap_is_route(cm);
+    unsigned int o, i, l;
+
+    if (route && in == out) {
+        for (o = 0; o < out && cm->route[o] == (int) o; o++)
+            ;
+        if (o == out) {
+            cm->kernel = CHMAP_COPY;
+            return;
+        }
+    }
+
+    /*
+     * The shape kernels, in float, copy S16 and float samples exactly, and
+     * faster than a route does. They would round S32 samples to 24 bits.
+     */
+    if (route && cm->format == PCM_FORMAT_S32_LE)
+        cm->kernel = CHMAP_ROUTE;
+    else if (in == 1 && out == 2)
+        cm->kernel = CHMAP_1_TO_2;
+    else if (in == 2 && out == 1)
+        cm->kernel = CHMAP_2_TO_1;
+    else if (in == 6 && out == 2)
+        cm->kernel = CHMAP_6_TO_2;
+    else if (in == 2 && out == 8)
+        cm->kernel = CHMAP_2_TO_8;
+    else
+        cm->kernel = route ? CHMAP_ROUTE : CHMAP_MATRIX;
+
+    /* the gains in the order the kernels use them */
+    switch (cm->kernel) {
+    case CHMAP_1_TO_2:
+        cm->gain[0] = (filter_v4sf) { m[0][0], m[1][0], m[0][0], m[1][0] };
+        break;
+    case CHMAP_2_TO_1:
+        cm->gain[0] = filter_vsplat(m[0][0]);
+        cm->gain[1] = filter_vsplat(m[0][1]);
+        break;
+    case CHMAP_6_TO_2:
+        for (i = 0; i < 6; i++)
+            cm->gain[i] = (filter_v4sf) { m[0][i], m[1][i], m[0][i], m[1][i] };
+        break;
+    case CHMAP_2_TO_8:
+        for (i = 0; i < 2; i++) {
+            cm->gain[2 * i] = (filter_v4sf) { m[0][i], m[1][i], m[2][i], m[3][i] };
+            cm->gain[2 * i + 1] = (filter_v4sf) { m[4][i], m[5][i], m[6][i], m[7][i] };
+        }
+        break;
+    default:
+        break;
+    }
+
+    /* for the frames the shape kernels leave over, too */
+    memset(cm->column, 0, sizeof(cm->column));
+    for (i = 0; i < in; i++) {
+        for (o = 0; o < out; o++) {
+            l = o % FILTER_VEC_WIDTH;
+            cm->column[i][o / FILTER_VEC_WIDTH][l] = m[o][i];
+        }
+    }
+}
+
+FILTER_VINLINE void chmap_route(struct chmap *cm, enum pcm_format format, const char *src,
+                                char *dst, unsigned int frames)
+{
+    unsigned int bytes = filter_sample_bytes(format);
+    unsigned int in = cm->in_channels, out = cm->out_channels;
+    /* a copy, the stores to dst could change cm for all the compiler knows */
+    int route[FILTER_MAX_CHANNELS];
+    unsigned int i, o;
+
+    memcpy(route, cm->route, sizeof(route));
+
+    for (i = 0; i < frames; i++, src += in * bytes) {
+        for (o = 0; o < out; o++, dst += bytes) {
+            if (route[o] >= 0)
+                memcpy(dst, src + route[o] * bytes, bytes);
+            else
+                memset(dst, 0, bytes);
+        }
+    }
+}
+
+/* mixes frames a frame at a time, an output vector at a time */
+FILTER_VINLINE void chmap_matrix(struct chmap *cm, enum pcm_format format, const char *src,
+                                 char *dst, unsigned int frames)
+{
+    unsigned int bytes = filter_sample_bytes(format);
+    unsigned int in = cm->in_channels, out = cm->out_channels;
+    unsigned int vecs = (out + FILTER_VEC_WIDTH - 1) / FILTER_VEC_WIDTH;
+    unsigned int i, c, v, l;
+
+    for (i = 0; i < frames; i++) {
+        filter_v4sf acc[CHMAP_MAX_VECS];
+
+        for (v = 0; v < vecs; v++)
+            acc[v] = filter_vsplat(0.0f);
+        for (c = 0; c < in; c++, src += bytes) {
+            filter_v4sf x = filter_vsplat(filter_load(format, src));
+
+            for (v = 0; v < vecs; v++)
+                acc[v] += x * cm->column[c][v];
+        }
+
+        for (v = 0; v < vecs; v++) {
+            if ((v + 1) * FILTER_VEC_WIDTH <= out) {
+                filter_vstore(format, dst, acc[v]);
+                dst += FILTER_VEC_WIDTH * bytes;
+                continue;
+            }
+            for (l = 0; v * FILTER_VEC_WIDTH + l < out; l++, dst += bytes)
+                filter_store(format, dst, acc[v][l]);
+        }
+    }
+}
+
+/* 4 frames: a vector in, 2 out */
+FILTER_VINLINE void chmap_1_to_2(struct chmap *cm, enum pcm_format format, const char *src,
+                                 char *dst, unsigned int frames)
+{
+    unsigned int bytes = filter_sample_bytes(format);
+    unsigned int i;
+
+    for (i = 0; i + 4 <= frames; i += 4) {
+        filter_v4sf x = filter_vload(format, src);
+
+        filter_vstore(format, dst, (filter_v4sf) { x[0], x[0], x[1], x[1] } * cm->gain[0]);
+        filter_vstore(format, dst + 4 * bytes,
+                      (filter_v4sf) { x[2], x[2], x[3], x[3] } * cm->gain[0]);
+        src += 4 * bytes;
+        dst += 8 * bytes;
+    }
+
+    chmap_matrix(cm, format, src, dst, frames - i);
+}
+
+/* 4 frames: 2 vectors in, 1 out */
+FILTER_VINLINE void chmap_2_to_1(struct chmap *cm, enum pcm_format format, const char *src,
+                                 char *dst, unsigned int frames)
+{
+    unsigned int bytes = filter_sample_bytes(format);
+    unsigned int i;
+
+    for (i = 0; i + 4 <= frames; i += 4) {
+        filter_v4sf a = filter_vload(format, src);
+        filter_v4sf b = filter_vload(format, src + 4 * bytes);
+        filter_v4sf l = { a[0], a[2], b[0], b[2] };
+        filter_v4sf r = { a[1], a[3], b[1], b[3] };
+
+        filter_vstore(format, dst, l * cm->gain[0] + r * cm->gain[1]);
+        src += 8 * bytes;
+        dst += 4 * bytes;
+    }
+
+    chmap_matrix(cm, format, src, dst, frames - i);
+}
+
+/* 2 frames: 3 vectors in, 1 out */
+FILTER_VINLINE void chmap_6_to_2(struct chmap *cm, enum pcm_format format, const char *src,
+                                 char *dst, unsigned int frames)
+{
+    const filter_v4sf *g = cm->gain;
+    unsigned int bytes = filter_sample_bytes(format);
+    unsigned int i;
+
+    for (i = 0; i + 2 <= frames; i += 2) {
+        filter_v4sf a = filter_vload(format, src);
+        filter_v4sf b = filter_vload(format, src + 4 * bytes);
+        filter_v4sf c = filter_vload(format, src + 8 * bytes);
+        /* channel n of both frames, twice, for the left and right gains */
+        filter_v4sf y = (filter_v4sf) { a[0], a[0], b[2], b[2] } * g[0] +
+                        (filter_v4sf) { a[1], a[1], b[3], b[3] } * g[1] +
+                        (filter_v4sf) { a[2], a[2], c[0], c[0] } * g[2] +
+                        (filter_v4sf) { a[3], a[3], c[1], c[1] } * g[3] +
+                        (filter_v4sf) { b[0], b[0], c[2], c[2] } * g[4] +
+                        (filter_v4sf) { b[1], b[1], c[3], c[3] } * g[5];
+
+        filter_vstore(format, dst, y);
+        src += 12 * bytes;
+        dst += 4 * bytes;
+    }
+
+    chmap_matrix(cm, format, src, dst, frames - i);
+}
+
+/* 2 frames: a vector in, 4 out */
+FILTER_VINLINE void chmap_2_to_8(struct chmap *cm, enum pcm_format format, const char *src,
+                                 char *dst, unsigned int frames)
+{
+    const filter_v4sf *g = cm->gain;
+    unsigned int bytes = filter_sample_bytes(format);
+    unsigned int i, f;
+
+    for (i = 0; i + 2 <= frames; i += 2) {
+        filter_v4sf x = filter_vload(format, src);
+
+        for (f = 0; f < 2; f++) {
+            filter_v4sf l = filter_vsplat(x[2 * f]);
+            filter_v4sf r = filter_vsplat(x[2 * f + 1]);
+
+            filter_vstore(format, dst, l * g[0] + r * g[2]);
+            filter_vstore(format, dst + 4 * bytes, l * g[1] + r * g[3]);
+            dst += 8 * bytes;
+        }
+        src += 4 * bytes;
+    }
+
+    chmap_matrix(cm, format, src, dst, frames - i);
+}
+
+FILTER_VINLINE void chmap_mix(struct chmap *cm, enum pcm_format format, const char *src,
+                              char *dst, unsigned int frames)
+{
+    switch (cm->kernel) {
+    case CHMAP_ROUTE:
+        chmap_route(cm, format, src, dst, frames);
+        break;
+    case CHMAP_1_TO_2:
+        chmap_1_to_2(cm, format, src, dst, frames);
+        break;
+    case CHMAP_2_TO_1:
+        chmap_2_to_1(cm, format, src, dst, frames);
+        break;
+    case CHMAP_6_TO_2:
+        chmap_6_to_2(cm, format, src, dst, frames);
+        break;
+    case CHMAP_2_TO_8:
+        chmap_2_to_8(cm, format, src, dst, frames);
+        break;
+    default:
+        chmap_matrix(cm, format, src, dst, frames);
+        break;
+    }
+}
+
+static void chmap_process(void *stage, const void *src, void *dst, unsigned int frames)
+{
+    struct chmap *cm = stage;
+
+    if (cm->kernel == CHMAP_COPY) {
+        if (src != dst)
+            memcpy(dst, src, (size_t) frames * cm->in_channels *
+                   filter_sample_bytes(cm->format));
+        return;
+    }
+
+    switch (cm->format) {
+    case PCM_FORMAT_S16_LE:
+        chmap_mix(cm, PCM_FORMAT_S16_LE, src, dst, frames);
+        break;
+    case PCM_FORMAT_S32_LE:
+        chmap_mix(cm, PCM_FORMAT_S32_LE, src, dst, frames);
+        break;
+    default:
+        chmap_mix(cm, PCM_FORMAT_FLOAT_LE, src, dst, frames);
+        break;
+    }
+}
+
+static void chmap_reset(void *stage)
+{
+    (void) stage;
+}
+
+static int chmap_configure(void *stage, struct filter_format *in, struct filter_format *out)
+{
+    struct chmap *cm = stage;
+    unsigned int o;
+
+    if (in->channels > FILTER_MAX_CHANNELS)
+        return -EINVAL;
+
+    /* the device is on the output side for playback, the input for capture */
+    if (cm->capture)
+        in->channels = cm->dev_channels;
+    else
+        out->channels = cm->dev_channels;
+
+    cm->format = in->format;
+    cm->in_channels = in->channels;
+    cm->out_channels = out->channels;
+
+    memset(cm->matrix, 0, sizeof(cm->matrix));
+    if (cm->def_rows == cm->out_channels && cm->def_cols == cm->in_channels) {
+        for (o = 0; o < cm->out_channels; o++)
+            memcpy(cm->matrix[o], cm->def[o], sizeof(cm->def[o]));
+    } else {
+        chmap_default_matrix(cm);
+    }
+
+    chmap_choose_kernel(cm);
+    return 0;
+}
+
+static void chmap_close(void *stage)
+{
+    free(stage);
+}
+
+/* parses rows of gains, separated by ';', of the same length */
+static int chmap_parse_matrix(struct chmap *cm, const char *str)
+{
+    unsigned int rows = 0, cols = 0;
+    const char *p = str;
+    char *end;
+
+    while (*p) {
+        unsigned int n = 0;
+
+        if (rows == FILTER_MAX_CHANNELS)
+            return -EINVAL;
+
+        for (;;) {
+            float gain = strtof(p, &end);
+
+            if (end == p)
+                break;
+            if (n == FILTER_MAX_CHANNELS)
+                return -EINVAL;
+            cm->def[rows][n++] = gain;
+            p = end;
+            while (*p == ' ' || *p == ',' || *p == '\t')
+                p++;
+        }
+
+        if (n == 0 || (rows && n != cols) || (*p && *p != ';'))
+            return -EINVAL;
+        cols = n;
+        rows++;
+        if (*p == ';')
+            p++;
+    }
+
+    cm->def_rows = rows;
+    cm->def_cols = cols;
+    return 0;
+}
+
+static int chmap_open(void **stage, struct pcm_plugin *plugin)
+{
+    struct chmap *cm;
+    char *matrix;
+    int channels;
+
+    cm = calloc(1, sizeof(*cm));
+    if (!cm)
+        return -ENOMEM;
+
+    cm->capture = !!(plugin->mode & PCM_IN);
+
+    if (pcm_plugin_get_int(plugin, "channels", &channels))
+        channels = 2;
+    if (channels < 1 || channels > FILTER_MAX_CHANNELS) {
+        free(cm);
+        return -EINVAL;
+    }
+    cm->dev_channels = channels;
+
+    if (!pcm_plugin_get_str(plugin, "matrix", &matrix) && chmap_parse_matrix(cm, matrix)) {
+        fprintf(stderr, "%s: bad matrix \"%s\"\n", __func__, matrix);
+        free(cm);
+        return -EINVAL;
+    }
+
+    /* the rows are outputs, the device channels for playback */
+    if (cm->def_rows && (cm->capture ? cm->def_cols : cm->def_rows) != cm->dev_channels) {
+        fprintf(stderr, "%s: the matrix is not for %u device channels\n", __func__,
+                cm->dev_channels);
+        free(cm);
+        return -EINVAL;
+    }
+
+    *stage = cm;
+    return 0;
+}
+
+const struct filter_stage_ops filter_stage_ops = {
+    .open = chmap_open,
+    .configure = chmap_configure,
+    .process = chmap_process,
+    .reset = chmap_reset,
+    .close = chmap_close,
+};
@@ -0,0 +1,679 @@
+/* eq_pcm_plugin.c
+**
+** Copyright 2026, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+/*
+ * A filter that equalizes the signal with a cascade of biquads, such as
+ * the low cut and presence boost a small speaker needs.
+ *
+ * The bands are the value of a bytes control of the card, shared with its
+ * mixer plugin (see shared_ctl.h), so they can be changed with tinymix
+ * while the stream runs. The value is EQ_MAX_BANDS records of struct
+ * eq_band, in host byte order, unused bands off. After a change, the
+ * output fades from the old bands to the new ones over a period, both
+ * filters starting from the same state, so the change does not click.
+ *
+ * Each vector holds 4 channels of a frame, which the biquads filter in
+ * parallel, in float. A tiny offset is added to the output of every
+ * biquad, which keeps its history out of the denormals, slow on most CPUs,
+ * when the signal decays to silence.
+ *
+ * Settings in the device definition:
+ *   control - name of the control, "EQ Playback Coefficients" or
+ *             "EQ Capture Coefficients" by default
+ *   config  - file of bands the control starts with, flat without one
+ *
+ * The file has a band per line, with # starting a comment:
+ *   peak|lowshelf|highshelf <Hz> <Q> <dB>
+ *   lowpass|highpass <Hz> <Q>
+ *   biquad <b0> <b1> <b2> <a1> <a2>
+ * A biquad is given normalized to a0 for the rate of the stream; the other
+ * bands are designed for it, after the Audio EQ Cookbook of R. Bristow-Johnson.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tinyalsa/pcm.h>
+#include <tinyalsa/plugin.h>
+
+#include "filter_pcm_plugin.h"
+#include "filter_vec.h"
+#include "shared_ctl.h"
+
+#define EQ_MAX_BANDS 10
+#define EQ_MAX_VECS (FILTER_MAX_CHANNELS / FILTER_VEC_WIDTH)
+/* the coefficients of biquad bands, in the control */
+#define EQ_COEF_ONE (1 << 28)
+/* added to the output of each biquad, -360 dB */
+#define EQ_DENORMAL_BIAS 1e-18f
+
+#define EQ_PI 3.14159265358979323846
+
+enum eq_band_type {
+    EQ_BAND_OFF,
+    EQ_BAND_PEAK,
+    EQ_BAND_LOW_SHELF,
+    EQ_BAND_HIGH_SHELF,
+    EQ_BAND_LOW_PASS,
+    EQ_BAND_HIGH_PASS,
+    EQ_BAND_BIQUAD,
+};
+
+/* A band in the control */
+struct eq_band {
+    int32_t type;
+    /*
+     * the frequency in Hz, the Q in thousandths and the gain in hundredths
+     * of a dB, or b0, b1, b2, a1 and a2 of a biquad, by EQ_COEF_ONE
+     */
+    int32_t param[5];
+};
+
+struct eq_biquad {
+    filter_v4sf b0, b1, b2, a1, a2;
+};
+
+struct eq_cascade {
+    unsigned int bands;
+    struct eq_biquad biquad[EQ_MAX_BANDS];
+    /*
+     * the last two inputs of each biquad, direct form I, and the last two
+     * outputs of the last one; the outputs of a biquad are the inputs of
+     * the next
+     */
+    filter_v4sf hist[EQ_MAX_BANDS + 1][EQ_MAX_VECS][2];
+};
+
+struct eq {
+    struct shctl *shctl;
+    struct shctl_entry *ctl;
+    uint32_t seq;
+    struct eq_band bands[EQ_MAX_BANDS];
+
+    struct filter_format format;
+    unsigned int vecs;
+
+    struct eq_cascade cur;
+    /* the bands faded out, after a change */
+    struct eq_cascade old;
+    unsigned int fade_left;
+
+    /* a period of frames, each in vecs vectors */
+    filter_v4sf *buf;
+    filter_v4sf *fade_buf;
+};
+
+static const char *const eq_band_names[] = {
+    [EQ_BAND_PEAK] = "peak",
+    [EQ_BAND_LOW_SHELF] = "lowshelf",
+    [EQ_BAND_HIGH_SHELF] = "highshelf",
+    [EQ_BAND_LOW_PASS] = "lowpass",
+    [EQ_BAND_HIGH_PASS] = "highpass",
+    [EQ_BAND_BIQUAD] = "biquad",
+};
+
+/* designs the biquad of a band, returns -1 for a band that is off or unstable */
+static int eq_design(const struct eq_band *band, unsigned int rate, double c[5])
+{
+    double w0, cw, alpha, a, sa, a0;
+    unsigned int i;
+
+    if (band->type == EQ_BAND_BIQUAD) {
+        for (i = 0; i < 5; i++)
+            c[i] = (double) band->param[i] / EQ_COEF_ONE;
+        /* the poles are inside the unit circle */
+        return fabs(c[4]) < 1.0 && fabs(c[3]) < 1.0 + c[4] ? 0 : -1;
+    }
+
+    if (band->type <= EQ_BAND_OFF || band->type > EQ_BAND_BIQUAD ||
+        band->param[0] <= 0 || band->param[0] >= (int32_t) rate / 2 || band->param[1] <= 0)
+        return -1;
+
+    w0 = 2.0 * EQ_PI * band->param[0] / rate;
+    cw = cos(w0);
+    alpha = sin(w0) / (2.0 * band->param[1] / 1000.0);
+    a = pow(10.0, band->param[2] / 4000.0);
+    sa = 2.0 * sqrt(a) * alpha;
+
+    switch (band->type) {
+    case EQ_BAND_PEAK:
+        a0 = 1.0 + alpha / a;
+        c[0] = 1.0 + alpha * a;
+        c[1] = -2.0 * cw;
+        c[2] = 1.0 - alpha * a;
+        c[3] = -2.0 * cw;
+        c[4] = 1.0 - alpha / a;
+        break;
+    case EQ_BAND_LOW_SHELF:
+        a0 = (a + 1.0) + (a - 1.0) * cw + sa;
+        c[0] = a * ((a + 1.0) - (a - 1.0) * cw + sa);
+        c[1] = 2.0 * a * ((a - 1.0) - (a + 1.0) * cw);
+        c[2] = a * ((a + 1.0) - (a - 1.0) * cw - sa);
+        c[3] = -2.0 * ((a - 1.0) + (a + 1.0) * cw);
+        c[4] = (a + 1.0) + (a - 1.0) * cw - sa;
+        break;
+    case EQ_BAND_HIGH_SHELF:
+        a0 = (a + 1.0) - (a - 1.0) * cw + sa;
+        c[0] = a * ((a + 1.0) + (a - 1.0) * cw + sa);
+        c[1] = -2.0 * a * ((a - 1.0) + (a + 1.0) * cw);
+        c[2] = a * ((a + 1.0) + (a - 1.0) * cw - sa);
+        c[3] = 2.0 * ((a - 1.0) - (a + 1.0) * cw);
+        c[4] = (a + 1.0) - (a - 1.0) * cw - sa;
+        break;
+    case EQ_BAND_LOW_PASS:
+        a0 = 1.0 + alpha;
+        c[0] = (1.0 - cw) / 2.0;
+        c[1] = 1.0 - cw;
+        c[2] = (1.0 - cw) / 2.0;
+        c[3] = -2.0 * cw;
+        c[4] = 1.0 - alpha;
+        break;
+    default:
+        a0 = 1.0 + alpha;
+        c[0] = (1.0 + cw) / 2.0;
+        c[1] = -(1.0 + cw);
+        c[2] = (1.0 + cw) / 2.0;
+        c[3] = -2.0 * cw;
+        c[4] = 1.0 - alpha;
+        break;
+    }
+
+    for (i = 0; i < 5; i++)
+        c[i] /= a0;
+    return 0;
+}
+
+/*
+ * Sets the biquads of the cascade from the bands. The history of each
+ * biquad is kept, so the signal goes on through a changed band.
+ */
+static void eq_set_bands(struct eq *eq, struct eq_cascade *cc)
+{
+    unsigned int b, n = 0;
+    double c[5];
+
+    for (b = 0; b < EQ_MAX_BANDS; b++) {
+        if (eq_design(&eq->bands[b], eq->format.rate, c))
+            continue;
+
+        cc->biquad[n].b0 = filter_vsplat(c[0]);
+        cc->biquad[n].b1 = filter_vsplat(c[1]);
+        cc->biquad[n].b2 = filter_vsplat(c[2]);
+        cc->biquad[n].a1 = filter_vsplat(c[3]);
+        cc->biquad[n].a2 = filter_vsplat(c[4]);
+        n++;
+    }
+
+    /* new biquads start from silence */
+    for (b = cc->bands + 1; b <= n; b++)
+        memset(cc->hist[b], 0, sizeof(cc->hist[b]));
+    cc->bands = n;
+}
+
+/* reads the control, if it changed, and returns whether it did */
+static int eq_read_ctl(struct eq *eq)
+{
+    if (!eq->ctl || shctl_seq(eq->ctl) == eq->seq)
+        return 0;
+
+    /* keeps the bands it has, and tries again next period */
+    return !shctl_read(eq->ctl, eq->bands, sizeof(eq->bands), &eq->seq);
+}
+
+FILTER_VINLINE filter_v4sf eq_biquad(const struct eq_biquad *bq, filter_v4sf x,
+                                     filter_v4sf x1, filter_v4sf x2,
+                                     filter_v4sf y1, filter_v4sf y2)
+{
+    /* the recursion through y1 comes last, it is the critical path */
+    return bq->b0 * x + bq->b1 * x1 + (bq->b2 * x2 - bq->a2 * y2) +
+           filter_vsplat(EQ_DENORMAL_BIAS) - bq->a1 * y1;
+}
+
+/* filters the frames of the buffer through a biquad */
+static void eq_filter_one(struct eq_cascade *cc, unsigned int b, filter_v4sf *buf,
+                          unsigned int vecs, unsigned int frames)
+{
+    const struct eq_biquad *bq = &cc->biquad[b];
+    unsigned int v, i;
+
+    for (v = 0; v < vecs; v++) {
+        filter_v4sf x1 = cc->hist[b][v][0], x2 = cc->hist[b][v][1];
+        filter_v4sf y1 = cc->hist[b + 1][v][0], y2 = cc->hist[b + 1][v][1];
+        filter_v4sf *p = buf + v;
+
+        for (i = 0; i < frames; i++, p += vecs) {
+            filter_v4sf x = *p;
+            filter_v4sf y = eq_biquad(bq, x, x1, x2, y1, y2);
+
+            x2 = x1;
+            x1 = x;
+            y2 = y1;
+            y1 = y;
+            *p = y;
+        }
+
+        cc->hist[b][v][0] = x1;
+        cc->hist[b][v][1] = x2;
+        cc->hist[b + 1][v][0] = y1;
+        cc->hist[b + 1][v][1] = y2;
+    }
+}
+
+/*
+ * Filters the frames of the buffer through two biquads. The recursion of
+ * a biquad waits on its last output, so the CPU works on the second biquad
+ * while the first waits.
+ */
+static void eq_filter_two(struct eq_cascade *cc, unsigned int b, filter_v4sf *buf,
+                          unsigned int vecs, unsigned int frames)
+{
+    const struct eq_biquad *bq = &cc->biquad[b];
+    unsigned int v, i;
+
+    for (v = 0; v < vecs; v++) {
+        filter_v4sf x1 = cc->hist[b][v][0], x2 = cc->hist[b][v][1];
+        filter_v4sf y1 = cc->hist[b + 1][v][0], y2 = cc->hist[b + 1][v][1];
+        filter_v4sf z1 = cc->hist[b + 2][v][0], z2 = cc->hist[b + 2][v][1];
+        filter_v4sf *p = buf + v;
+
+        for (i = 0; i < frames; i++, p += vecs) {
+            filter_v4sf x = *p;
+            filter_v4sf y = eq_biquad(&bq[0], x, x1, x2, y1, y2);
+            filter_v4sf z = eq_biquad(&bq[1], y, y1, y2, z1, z2);
+
+            x2 = x1;
+            x1 = x;
+            y2 = y1;
+            y1 = y;
+            z2 = z1;
+            z1 = z;
+            *p = z;
+        }
+
+        cc->hist[b][v][0] = x1;
+        cc->hist[b][v][1] = x2;
+        cc->hist[b + 1][v][0] = y1;
+        cc->hist[b + 1][v][1] = y2;
+        cc->hist[b + 2][v][0] = z1;
+        cc->hist[b + 2][v][1] = z2;
+    }
+}
+
+static void eq_filter(struct eq_cascade *cc, filter_v4sf *buf, unsigned int vecs,
+                      unsigned int frames)
+{
+    unsigned int b;
+
+    for (b = 0; b + 2 <= cc->bands; b += 2)
+        eq_filter_two(cc, b, buf, vecs, frames);
+    if (b < cc->bands)
+        eq_filter_one(cc, b, buf, vecs, frames);
+}
+
+/* fades from the frames of the old bands, in from, to those of the new ones */
+static void eq_fade(struct eq *eq, const filter_v4sf *from, filter_v4sf *to,
+                    unsigned int frames)
+{
+    float step = 1.0f / eq->format.period_size;
+    float t = (eq->format.period_size - eq->fade_left) * step;
+    unsigned int vecs = eq->vecs;
+    unsigned int i, v;
+
+    for (i = 0; i < frames; i++) {
+        filter_v4sf tv = filter_vsplat(t);
+
+        for (v = 0; v < vecs; v++, from++, to++)
+            *to = *from + (*to - *from) * tv;
+        t += step;
+    }
+}
+
+/* the last channels of a frame, fewer than a vector, with the other lanes 0 */
+FILTER_VINLINE filter_v4sf eq_load_lanes(enum pcm_format format, const char *src,
+                                         unsigned int lanes)
+{
+    filter_v4sf v = filter_vsplat(0.0f);
+    unsigned int l;
+
+    for (l = 0; l < lanes; l++)
+        v[l] = filter_load(format, src + l * filter_sample_bytes(format));
+    return v;
+}
+
+FILTER_VINLINE void eq_store_lanes(enum pcm_format format, char *dst, filter_v4sf v,
+                                   unsigned int lanes)
+{
+    unsigned int l;
+
+    for (l = 0; l < lanes; l++)
+        filter_store(format, dst + l * filter_sample_bytes(format), v[l]);
+}
+
+/*
+ * Loads frames to the buffer, each padded to whole vectors. The lanes of
+ * the last vector are built in registers, writing them to the buffer one
+ * at a time would stall the vector reads of the biquads.
+ */
+FILTER_VINLINE void eq_load(struct eq *eq, enum pcm_format format, const char *src,
+                            unsigned int frames, unsigned int tail)
+{
+    unsigned int full = eq->format.channels / FILTER_VEC_WIDTH;
+    unsigned int bytes = filter_sample_bytes(format);
+    filter_v4sf *dst = eq->buf;
+    unsigned int i, v;
+
+    if (!tail)
+        full *= frames;
+
+    for (i = 0; i < (tail ? frames : 1); i++) {
+        for (v = 0; v < full; v++, src += FILTER_VEC_WIDTH * bytes)
+            *dst++ = filter_vload(format, src);
+        if (tail) {
+            *dst++ = eq_load_lanes(format, src, tail);
+            src += tail * bytes;
+        }
+    }
+}
+
+FILTER_VINLINE void eq_store(struct eq *eq, enum pcm_format format, char *dst,
+                             unsigned int frames, unsigned int tail)
+{
+    unsigned int full = eq->format.channels / FILTER_VEC_WIDTH;
+    unsigned int bytes = filter_sample_bytes(format);
+    const filter_v4sf *src = eq->buf;
+    unsigned int i, v;
+
+    if (!tail)
+        full *= frames;
+
+    for (i = 0; i < (tail ? frames : 1); i++) {
+        for (v = 0; v < full; v++, dst += FILTER_VEC_WIDTH * bytes)
+            filter_vstore(format, dst, *src++);
+        if (tail) {
+            eq_store_lanes(format, dst, *src++, tail);
+            dst += tail * bytes;
+        }
+    }
+}
+
+/* the number of channels beyond whole vectors is made a constant, as the format */
+FILTER_VINLINE void eq_load_frames(struct eq *eq, enum pcm_format format, const char *src,
+                                   unsigned int frames)
+{
+    switch (eq->format.channels % FILTER_VEC_WIDTH) {
+    case 0:
+        eq_load(eq, format, src, frames, 0);
+        break;
+    case 1:
+        eq_load(eq, format, src, frames, 1);
+        break;
+    case 2:
+        eq_load(eq, format, src, frames, 2);
+        break;
+    default:
+        eq_load(eq, format, src, frames, 3);
+        break;
+    }
+}
+
+FILTER_VINLINE void eq_store_frames(struct eq *eq, enum pcm_format format, char *dst,
+                                    unsigned int frames)
+{
+    switch (eq->format.channels % FILTER_VEC_WIDTH) {
+    case 0:
+        eq_store(eq, format, dst, frames, 0);
+        break;
+    case 1:
+        eq_store(eq, format, dst, frames, 1);
+        break;
+    case 2:
+        eq_store(eq, format, dst, frames, 2);
+        break;
+    default:
+        eq_store(eq, format, dst, frames, 3);
+        break;
+    }
+}
+
+static void eq_process(void *stage, const void *src, void *dst, unsigned int frames)
+{
+    struct eq *eq = stage;
+    unsigned int n;
+
+    if (eq_read_ctl(eq)) {
+        eq->old = eq->cur;
+        eq_set_bands(eq, &eq->cur);
+        eq->fade_left = eq->format.period_size;
+    }
+
+    if (!eq->cur.bands && !eq->fade_left) {
+        if (src != dst)
+            memcpy(dst, src, (size_t) frames * eq->format.channels *
+                   filter_sample_bytes(eq->format.format));
+        return;
+    }
+
+    switch (eq->format.format) {
+    case PCM_FORMAT_S16_LE:
+        eq_load_frames(eq, PCM_FORMAT_S16_LE, src, frames);
+        break;
+    case PCM_FORMAT_S32_LE:
+        eq_load_frames(eq, PCM_FORMAT_S32_LE, src, frames);
+        break;
+    default:
+        eq_load_frames(eq, PCM_FORMAT_FLOAT_LE, src, frames);
+        break;
+    }
+
+    if (eq->fade_left) {
+        n = frames < eq->fade_left ? frames : eq->fade_left;
+        memcpy(eq->fade_buf, eq->buf, (size_t) frames * eq->vecs * sizeof(filter_v4sf));
+        eq_filter(&eq->old, eq->fade_buf, eq->vecs, frames);
+        eq_filter(&eq->cur, eq->buf, eq->vecs, frames);
+        eq_fade(eq, eq->fade_buf, eq->buf, n);
+        eq->fade_left -= n;
+    } else {
+        eq_filter(&eq->cur, eq->buf, eq->vecs, frames);
+    }
+
+    switch (eq->format.format) {
+    case PCM_FORMAT_S16_LE:
+        eq_store_frames(eq, PCM_FORMAT_S16_LE, dst, frames);
+        break;
+    case PCM_FORMAT_S32_LE:
+        eq_store_frames(eq, PCM_FORMAT_S32_LE, dst, frames);
+        break;
+    default:
+        eq_store_frames(eq, PCM_FORMAT_FLOAT_LE, dst, frames);
+        break;
+    }
+}
+
+static void eq_reset(void *stage)
+{
+    struct eq *eq = stage;
+
+    /* nothing was played with the old bands, there is nothing to fade */
+    eq_read_ctl(eq);
+    memset(&eq->cur, 0, sizeof(eq->cur));
+    eq_set_bands(eq, &eq->cur);
+    eq->fade_left = 0;
+}
+
+static int eq_configure(void *stage, struct filter_format *in, struct filter_format *out)
+{
+    struct eq *eq = stage;
+    size_t size;
+
+    (void) out;
+
+    if (in->channels > FILTER_MAX_CHANNELS || in->period_size == 0)
+        return -EINVAL;
+
+    eq->format = *in;
+    eq->vecs = (in->channels + FILTER_VEC_WIDTH - 1) / FILTER_VEC_WIDTH;
+
+    free(eq->buf);
+    free(eq->fade_buf);
+    eq->fade_buf = NULL;
+    size = (size_t) in->period_size * eq->vecs * sizeof(filter_v4sf);
+    if (posix_memalign((void **) &eq->buf, sizeof(filter_v4sf), size) ||
+        posix_memalign((void **) &eq->fade_buf, sizeof(filter_v4sf), size)) {
+        free(eq->buf);
+        eq->buf = NULL;
+        return -ENOMEM;
+    }
+
+    /* the coefficients depend on the rate */
+    eq_reset(eq);
+    return 0;
+}
+
+static void eq_close(void *stage)
+{
+    struct eq *eq = stage;
+
+    shctl_close(eq->shctl);
+    free(eq->buf);
+    free(eq->fade_buf);
+    free(eq);
+}
+
+/* reads the bands of a config file, which the control starts with */
+static int eq_parse_config(const char *path, struct eq_band *bands)
+{
+    char line[256], name[16];
+    double p[5];
+    unsigned int n = 0, lineno = 0;
+    int type, count;
+    FILE *file;
+
+    file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "%s: no config %s, the EQ is flat\n", __func__, path);
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        char *comment = strchr(line, '#');
+
+        lineno++;
+        if (comment)
+            *comment = '\0';
+        count = sscanf(line, "%15s %lf %lf %lf %lf %lf", name, &p[0], &p[1], &p[2], &p[3], &p[4]);
+        if (count <= 0)
+            continue;
+
+        for (type = EQ_BAND_PEAK; type <= EQ_BAND_BIQUAD; type++) {
+            if (!strcmp(name, eq_band_names[type]))
+                break;
+        }
+
+        if (type > EQ_BAND_BIQUAD || n == EQ_MAX_BANDS ||
+            count < (type == EQ_BAND_BIQUAD ? 6 :
+                     type >= EQ_BAND_LOW_PASS ? 3 : 4)) {
+            fprintf(stderr, "%s: %s:%u: bad band\n", __func__, path, lineno);
+            fclose(file);
+            return -EINVAL;
+        }
+
+        bands[n].type = type;
+        if (type == EQ_BAND_BIQUAD) {
+            for (count = 0; count < 5; count++) {
+                if (fabs(p[count]) >= 8.0) {
+                    fprintf(stderr, "%s: %s:%u: coefficient out of range\n", __func__,
+                            path, lineno);
+                    fclose(file);
+                    return -EINVAL;
+                }
+                bands[n].param[count] = lrint(p[count] * EQ_COEF_ONE);
+            }
+        } else {
+            bands[n].param[0] = lrint(p[0]);
+            bands[n].param[1] = lrint(p[1] * 1000.0);
+            bands[n].param[2] = type >= EQ_BAND_LOW_PASS ? 0 : lrint(p[2] * 100.0);
+        }
+        n++;
+    }
+
+    fclose(file);
+    return 0;
+}
+
+static int eq_open(void **stage, struct pcm_plugin *plugin)
+{
+    struct shctl_entry tmpl;
+    struct eq *eq;
+    char *name = NULL, *config = NULL;
+    int ret;
+
+    eq = calloc(1, sizeof(*eq));
+    if (!eq)
+        return -ENOMEM;
+
+    if (!pcm_plugin_get_str(plugin, "config", &config)) {
+        ret = eq_parse_config(config, eq->bands);
+        if (ret) {
+            free(eq);
+            return ret;
+        }
+    }
+
+    memset(&tmpl, 0, sizeof(tmpl));
+    if (pcm_plugin_get_str(plugin, "control", &name))
+        name = (plugin->mode & PCM_IN) ? "EQ Capture Coefficients" : "EQ Playback Coefficients";
+    snprintf(tmpl.name, sizeof(tmpl.name), "%s", name);
+    tmpl.type = SHCTL_TYPE_BYTES;
+    tmpl.count = sizeof(eq->bands);
+    memcpy(tmpl.data.bytes, eq->bands, sizeof(eq->bands));
+
+    eq->shctl = shctl_open(plugin->card, 1);
+    if (eq->shctl)
+        eq->ctl = shctl_add(eq->shctl, &tmpl);
+    if (eq->ctl) {
+        /* odd, so that the first period reads the control if this cannot */
+        eq->seq = 1;
+        shctl_read(eq->ctl, eq->bands, sizeof(eq->bands), &eq->seq);
+    } else {
+        fprintf(stderr, "%s: no control \"%s\", the bands are fixed\n", __func__, tmpl.name);
+    }
+
+    *stage = eq;
+    return 0;
+}
+
+const struct filter_stage_ops filter_stage_ops = {
+    .open = eq_open,
+    .configure = eq_configure,
+    .process = eq_process,
+    .reset = eq_reset,
+    .close = eq_close,
+    .in_place = 1,
+};
@@ -0,0 +1,649 @@
+/* filter_pcm_plugin.c
+**
+** Copyright 2026, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <linux/ioctl.h>
+#include <sound/asound.h>
+#include <tinyalsa/asoundlib.h>
+#include <tinyalsa/plugin.h>
+
+#include "filter_pcm_plugin.h"
+
+/* 2 words of uint32_t = 64 bits of mask */
+#define PCM_MASK_SIZE (2)
+#define PCM_FORMAT_BIT(x) (1ULL << x)
+
+#define FILTER_NS_PER_SEC 1000000000LL
+
+/* defined by the stage the host is built with */
+extern const struct filter_stage_ops filter_stage_ops;
+
+struct filter_priv {
+    const struct filter_stage_ops *ops;
+    void *stage;
+
+    int capture;
+    int nonblock;
+    int slave_card;
+    int slave_device;
+    struct pcm *slave;
+    struct pcm_config config;
+
+    /* the application side, and the slave side, of the stage */
+    struct filter_format app;
+    struct filter_format dev;
+    unsigned int app_frame_bytes;
+    unsigned int dev_frame_bytes;
+    unsigned int buffer_size;
+    /* one period of samples in the format of the slave */
+    char *scratch;
+
+    unsigned long boundary;
+    unsigned long appl_ptr;
+    unsigned long avail_min;
+    int tstamp_type;
+};
+
+static struct pcm_plugin_hw_constraints filter_constrs = {
+    .access = PCM_FORMAT_BIT(SNDRV_PCM_ACCESS_RW_INTERLEAVED),
+    .format = (PCM_FORMAT_BIT(SNDRV_PCM_FORMAT_S16_LE) |
+               PCM_FORMAT_BIT(SNDRV_PCM_FORMAT_S32_LE) |
+               PCM_FORMAT_BIT(SNDRV_PCM_FORMAT_FLOAT_LE)),
+    .bit_width = {
+        .min = 16,
+        .max = 32,
+    },
+    .channels = {
+        .min = 1,
+        .max = 8,
+    },
+    .rate = {
+        .min = 8000,
+        .max = 192000,
+    },
+    .periods = {
+        .min = 2,
+        .max = 1024,
+    },
+    .period_bytes = {
+        .min = 32,
+        .max = 1048576,
+    },
+};
+
+static inline struct snd_interval *param_to_interval(struct snd_pcm_hw_params *p,
+                                                  int n)
+{
+    return &(p->intervals[n - SNDRV_PCM_HW_PARAM_FIRST_INTERVAL]);
+}
+
+static unsigned int param_get_int(struct snd_pcm_hw_params *p, int n)
+{
+    struct snd_interval *i = param_to_interval(p, n);
+
+    if (i->integer)
+        return i->max;
+    return 0;
+}
+
+static inline struct snd_mask *param_to_mask(struct snd_pcm_hw_params *p, int n)
+{
+    return &(p->masks[n - SNDRV_PCM_HW_PARAM_FIRST_MASK]);
+}
+
+static int param_get_mask_val(struct snd_pcm_hw_params *p, int n)
+{
+    struct snd_mask *mask = param_to_mask(p, n);
+    int i;
+
+    for (i = 0; i < PCM_MASK_SIZE * 32; i++) {
+        if (mask->bits[i >> 5] & (1U << (i & 31)))
+            return i;
+    }
+    return -1;
+}
+
+static enum pcm_format alsaformat_to_format(int format)
+{
+    switch (format) {
+    case SNDRV_PCM_FORMAT_S16_LE:
+        return PCM_FORMAT_S16_LE;
+    case SNDRV_PCM_FORMAT_S32_LE:
+        return PCM_FORMAT_S32_LE;
+    case SNDRV_PCM_FORMAT_FLOAT_LE:
+        return PCM_FORMAT_FLOAT_LE;
+    default:
+        return PCM_FORMAT_INVALID;
+    };
+}
+
+static unsigned long filter_ptr_add(struct filter_priv *priv, unsigned long ptr,
+                                    long frames)
+{
+    if (frames < 0)
+        frames += priv->boundary;
+    ptr += frames;
+    if (ptr >= priv->boundary)
+        ptr -= priv->boundary;
+    return ptr;
+}
+
+/* follows the slave, which moves itself to running and xrun */
+static void filter_update_state(struct pcm_plugin *plugin)
+{
+    struct filter_priv *priv = plugin->priv;
+
+    switch (pcm_state(priv->slave)) {
+    case PCM_STATE_RUNNING:
+    case PCM_STATE_DRAINING:
+        plugin->state = PCM_PLUG_STATE_RUNNING;
+        break;
+    case PCM_STATE_XRUN:
+        plugin->state = PCM_PLUG_STATE_XRUN;
+        break;
+    case PCM_STATE_SETUP:
+        plugin->state = PCM_PLUG_STATE_SETUP;
+        break;
+    default:
+        break;
+    }
+}
+
+/* the result of a failed transfer of the slave, as a negative errno */
+static int filter_slave_error(struct pcm_plugin *plugin)
+{
+    int err = errno ? errno : EIO;
+
+    if (err == EPIPE)
+        plugin->state = PCM_PLUG_STATE_XRUN;
+    return -err;
+}
+
+static int filter_writei_frames(struct pcm_plugin *plugin, struct snd_xferi *x)
+{
+    struct filter_priv *priv = plugin->priv;
+    const char *src = x->buf;
+    unsigned long done = 0;
+    int ret = 0;
+
+    while (done < (unsigned long) x->frames) {
+        unsigned int n = x->frames - done;
+
+        if (n > priv->app.period_size)
+            n = priv->app.period_size;
+
+        /* filter no more than the slave takes, the stage keeps history */
+        if (priv->nonblock) {
+            unsigned int avail;
+            struct timespec tstamp;
+
+            if (pcm_get_htimestamp(priv->slave, &avail, &tstamp) < 0) {
+                ret = -EPIPE;
+                break;
+            }
+            if (avail == 0) {
+                ret = -EAGAIN;
+                break;
+            }
+            if (n > avail)
+                n = avail;
+        }
+
+        priv->ops->process(priv->stage, src + (size_t) done * priv->app_frame_bytes,
+                           priv->scratch, n);
+
+        errno = 0;
+        ret = pcm_writei(priv->slave, priv->scratch, n);
+        if (ret < 0) {
+            ret = filter_slave_error(plugin);
+            break;
+        }
+
+        done += ret;
+        priv->appl_ptr = filter_ptr_add(priv, priv->appl_ptr, ret);
+        if ((unsigned int) ret < n)
+            break;
+    }
+
+    if (plugin->state != PCM_PLUG_STATE_XRUN)
+        filter_update_state(plugin);
+
+    if (!done && ret < 0)
+        return ret;
+
+    x->result = done;
+    return 0;
+}
+
+static int filter_readi_frames(struct pcm_plugin *plugin, struct snd_xferi *x)
+{
+    struct filter_priv *priv = plugin->priv;
+    char *dst = x->buf;
+    unsigned long done = 0;
+    int ret = 0;
+
+    while (done < (unsigned long) x->frames) {
+        unsigned int n = x->frames - done;
+
+        if (n > priv->app.period_size)
+            n = priv->app.period_size;
+
+        errno = 0;
+        ret = pcm_readi(priv->slave, priv->scratch, n);
+        if (ret < 0) {
+            ret = filter_slave_error(plugin);
+            break;
+        }
+
+        priv->ops->process(priv->stage, priv->scratch,
+                           dst + (size_t) done * priv->app_frame_bytes, ret);
+
+        done += ret;
+        priv->appl_ptr = filter_ptr_add(priv, priv->appl_ptr, ret);
+        if ((unsigned int) ret < n)
+            break;
+    }
+
+    if (plugin->state != PCM_PLUG_STATE_XRUN)
+        filter_update_state(plugin);
+
+    if (!done && ret < 0)
+        return ret;
+
+    x->result = done;
+    return 0;
+}
+
+static int filter_hw_params(struct pcm_plugin *plugin,
+                            struct snd_pcm_hw_params *params)
+{
+    struct filter_priv *priv = plugin->priv;
+    struct filter_format in, out;
+    char *scratch;
+    int ret;
+
+    if (param_get_mask_val(params, SNDRV_PCM_HW_PARAM_ACCESS) !=
+        SNDRV_PCM_ACCESS_RW_INTERLEAVED)
+        return -EINVAL;
+
+    priv->app.format = alsaformat_to_format(param_get_mask_val(params,
+                                                               SNDRV_PCM_HW_PARAM_FORMAT));
+    priv->app.channels = param_get_int(params, SNDRV_PCM_HW_PARAM_CHANNELS);
+    priv->app.rate = param_get_int(params, SNDRV_PCM_HW_PARAM_RATE);
+    priv->app.period_size = param_get_int(params, SNDRV_PCM_HW_PARAM_PERIOD_SIZE);
+    priv->buffer_size = priv->app.period_size * param_get_int(params, SNDRV_PCM_HW_PARAM_PERIODS);
+    if (priv->app.format == PCM_FORMAT_INVALID || priv->app.channels == 0 ||
+        priv->app.rate == 0 || priv->buffer_size == 0)
+        return -EINVAL;
+
+    /* the slave is opened again with the new parameters by filter_sw_params() */
+    if (priv->slave) {
+        pcm_close(priv->slave);
+        priv->slave = NULL;
+    }
+
+    in = priv->app;
+    out = priv->app;
+    ret = priv->ops->configure(priv->stage, &in, &out);
+    if (ret)
+        return ret;
+
+    /* stages convert samples, the clock of both sides is the same */
+    priv->dev = priv->capture ? in : out;
+    if (priv->dev.rate != priv->app.rate || priv->dev.period_size != priv->app.period_size ||
+        priv->dev.channels == 0 || pcm_format_to_bits(priv->dev.format) == 0)
+        return -EINVAL;
+
+    priv->app_frame_bytes = priv->app.channels * pcm_format_to_bits(priv->app.format) / 8;
+    priv->dev_frame_bytes = priv->dev.channels * pcm_format_to_bits(priv->dev.format) / 8;
+
+    scratch = realloc(priv->scratch, (size_t) priv->dev.period_size * priv->dev_frame_bytes);
+    if (!scratch)
+        return -ENOMEM;
+    priv->scratch = scratch;
+
+    /* like the kernel, the largest multiple of the buffer size that fits */
+    priv->boundary = priv->buffer_size;
+    while (priv->boundary * 2 <= (unsigned long) LONG_MAX - priv->buffer_size)
+        priv->boundary *= 2;
+
+    return 0;
+}
+
+static unsigned int filter_threshold(unsigned long frames)
+{
+    return frames > UINT_MAX ? UINT_MAX : frames;
+}
+
+static int filter_sw_params(struct pcm_plugin *plugin,
+                            struct snd_pcm_sw_params *sparams)
+{
+    struct filter_priv *priv = plugin->priv;
+    unsigned int flags = (priv->capture ? PCM_IN : PCM_OUT) | PCM_MONOTONIC |
+                         (priv->nonblock ? PCM_NONBLOCK : 0);
+    struct pcm_config *config = &priv->config;
+    int ret;
+
+    memset(config, 0, sizeof(*config));
+    config->channels = priv->dev.channels;
+    config->rate = priv->dev.rate;
+    config->format = priv->dev.format;
+    config->period_size = priv->dev.period_size;
+    config->period_count = priv->buffer_size / priv->dev.period_size;
+    config->start_threshold = filter_threshold(sparams->start_threshold);
+    config->stop_threshold = filter_threshold(sparams->stop_threshold);
+    config->silence_threshold = filter_threshold(sparams->silence_threshold);
+    config->silence_size = filter_threshold(sparams->silence_size);
+    config->avail_min = filter_threshold(sparams->avail_min);
+
+    /*
+     * The slave is opened by the first call after the hardware parameters.
+     * Later calls, such as those of the xrun policy of the application on a
+     * prepared or running stream, keep the frames queued on it.
+     */
+    if (priv->slave) {
+        ret = pcm_set_thresholds(priv->slave, config);
+        if (ret)
+            return ret;
+    } else {
+        priv->slave = pcm_open(priv->slave_card, priv->slave_device, flags, config);
+        if (!pcm_is_ready(priv->slave)) {
+            fprintf(stderr, "%s: %s\n", __func__, pcm_get_error(priv->slave));
+            pcm_close(priv->slave);
+            priv->slave = NULL;
+            return -ENODEV;
+        }
+        /* the application recovers from xruns, through this plugin */
+        pcm_set_xrun_policy(priv->slave, PCM_XRUN_REPORT, 0);
+    }
+
+    priv->avail_min = sparams->avail_min ? sparams->avail_min : 1;
+    sparams->boundary = priv->boundary;
+
+    return 0;
+}
+
+static int filter_sync_ptr(struct pcm_plugin *plugin,
+                           struct snd_pcm_sync_ptr *sync_ptr)
+{
+    struct filter_priv *priv = plugin->priv;
+    unsigned int avail = 0;
+    struct timespec tstamp = { 0, 0 };
+    long long ns;
+
+    if (!(sync_ptr->flags & SNDRV_PCM_SYNC_PTR_APPL))
+        priv->appl_ptr = sync_ptr->c.control.appl_ptr;
+    else
+        sync_ptr->c.control.appl_ptr = priv->appl_ptr;
+
+    if (!(sync_ptr->flags & SNDRV_PCM_SYNC_PTR_AVAIL_MIN))
+        priv->avail_min = sync_ptr->c.control.avail_min;
+    else
+        sync_ptr->c.control.avail_min = priv->avail_min;
+
+    if (!priv->slave)
+        return -EBADFD;
+
+    if (pcm_get_htimestamp(priv->slave, &avail, &tstamp) < 0)
+        avail = priv->capture ? 0 : priv->buffer_size;
+    if (plugin->state != PCM_PLUG_STATE_XRUN)
+        filter_update_state(plugin);
+
+    /* the frames the stage has passed on are all with the slave */
+    if (avail > priv->buffer_size)
+        avail = priv->buffer_size;
+    if (priv->capture)
+        sync_ptr->s.status.hw_ptr = filter_ptr_add(priv, priv->appl_ptr, avail);
+    else
+        sync_ptr->s.status.hw_ptr = filter_ptr_add(priv, priv->appl_ptr,
+                                                   -(long) (priv->buffer_size - avail));
+
+    ns = tstamp.tv_sec * FILTER_NS_PER_SEC + tstamp.tv_nsec;
+    if (priv->tstamp_type != SNDRV_PCM_TSTAMP_TYPE_MONOTONIC) {
+        struct timespec real, mono;
+
+        clock_gettime(CLOCK_REALTIME, &real);
+        clock_gettime(CLOCK_MONOTONIC, &mono);
+        ns += (real.tv_sec - mono.tv_sec) * FILTER_NS_PER_SEC + real.tv_nsec - mono.tv_nsec;
+    }
+    sync_ptr->s.status.tstamp.tv_sec = ns / FILTER_NS_PER_SEC;
+    sync_ptr->s.status.tstamp.tv_nsec = ns % FILTER_NS_PER_SEC;
+
+    return 0;
+}
+
+static int filter_ttstamp(struct pcm_plugin *plugin, int *tstamp)
+{
+    struct filter_priv *priv = plugin->priv;
+
+    priv->tstamp_type = *tstamp;
+    return 0;
+}
+
+static int filter_prepare(struct pcm_plugin *plugin)
+{
+    struct filter_priv *priv = plugin->priv;
+
+    if (!priv->slave)
+        return -EBADFD;
+
+    if (pcm_prepare(priv->slave))
+        return -EIO;
+
+    priv->ops->reset(priv->stage);
+    priv->appl_ptr = 0;
+
+    return 0;
+}
+
+static int filter_start(struct pcm_plugin *plugin)
+{
+    struct filter_priv *priv = plugin->priv;
+
+    return pcm_start(priv->slave) ? -EIO : 0;
+}
+
+static int filter_drain(struct pcm_plugin *plugin)
+{
+    struct filter_priv *priv = plugin->priv;
+
+    errno = 0;
+    if (pcm_drain(priv->slave))
+        return filter_slave_error(plugin);
+
+    plugin->state = PCM_PLUG_STATE_SETUP;
+    return 0;
+}
+
+static int filter_drop(struct pcm_plugin *plugin)
+{
+    struct filter_priv *priv = plugin->priv;
+
+    if (priv->slave)
+        pcm_stop(priv->slave);
+
+    return 0;
+}
+
+static int filter_ioctl(struct pcm_plugin *plugin, int cmd, void *arg)
+{
+    struct filter_priv *priv = plugin->priv;
+    long delay;
+
+    switch ((unsigned int) cmd) {
+    case SNDRV_PCM_IOCTL_HWSYNC:
+        return 0;
+    case SNDRV_PCM_IOCTL_DELAY:
+        delay = priv->slave ? pcm_get_delay(priv->slave) : -1;
+        if (delay < 0)
+            return -EBADFD;
+        *(snd_pcm_sframes_t *) arg = delay;
+        return 0;
+    default:
+        return -ENOTTY;
+    }
+}
+
+static int filter_poll(struct pcm_plugin *plugin, struct pollfd *pfd,
+                       nfds_t nfds, int timeout)
+{
+    struct filter_priv *priv = plugin->priv;
+    int ret;
+
+    if (nfds == 0)
+        return 0;
+
+    ret = priv->slave ? pcm_wait(priv->slave, timeout) : -EBADFD;
+    if (ret == 0)
+        return 0;
+
+    if (ret > 0)
+        pfd->revents = priv->capture ? POLLIN : POLLOUT;
+    else
+        pfd->revents = POLLERR;
+    if (plugin->state != PCM_PLUG_STATE_XRUN)
+        filter_update_state(plugin);
+
+    pfd->revents &= pfd->events | POLLERR;
+    return pfd->revents ? 1 : 0;
+}
+
+static void *filter_mmap(struct pcm_plugin *plugin, void *addr, size_t length, int prot,
+                         int flags, off_t offset)
+{
+    (void) plugin;
+    (void) addr;
+    (void) length;
+    (void) prot;
+    (void) flags;
+    (void) offset;
+
+    /* the samples pass through the stage, they are never mapped */
+    return MAP_FAILED;
+}
+
+static int filter_munmap(struct pcm_plugin *plugin, void *addr, size_t length)
+{
+    (void) plugin;
+    (void) addr;
+    (void) length;
+
+    return 0;
+}
+
+static int filter_close(struct pcm_plugin *plugin)
+{
+    struct filter_priv *priv = plugin->priv;
+
+    if (priv->slave)
+        pcm_close(priv->slave);
+    priv->ops->close(priv->stage);
+    free(priv->scratch);
+    free(priv);
+    free(plugin);
+
+    return 0;
+}
+
+int filter_open(struct pcm_plugin **plugin, unsigned int card,
+                unsigned int device, unsigned int mode)
+{
+    struct pcm_plugin *filter_plugin;
+    struct filter_priv *priv;
+    int ret;
+
+    filter_plugin = calloc(1, sizeof(struct pcm_plugin));
+    if (!filter_plugin)
+        return -ENOMEM;
+
+    priv = calloc(1, sizeof(struct filter_priv));
+    if (!priv) {
+        free(filter_plugin);
+        return -ENOMEM;
+    }
+
+    filter_plugin->card = card;
+    filter_plugin->device = device;
+    filter_plugin->mode = mode;
+    filter_plugin->constraints = &filter_constrs;
+    filter_plugin->priv = priv;
+
+    priv->ops = &filter_stage_ops;
+    priv->capture = !!(mode & PCM_IN);
+    priv->nonblock = !!(mode & PCM_NONBLOCK);
+    priv->tstamp_type = SNDRV_PCM_TSTAMP_TYPE_GETTIMEOFDAY;
+
+    priv->slave_card = card;
+    pcm_plugin_get_int(filter_plugin, "slave-card", &priv->slave_card);
+    ret = pcm_plugin_get_int(filter_plugin, "slave-device", &priv->slave_device);
+    if (ret || priv->slave_card < 0 || priv->slave_device < 0 ||
+        ((unsigned int) priv->slave_card == card && (unsigned int) priv->slave_device == device)) {
+        fprintf(stderr, "%s: no slave device for %u,%u\n", __func__, card, device);
+        ret = -EINVAL;
+        goto err;
+    }
+
+    ret = priv->ops->open(&priv->stage, filter_plugin);
+    if (ret)
+        goto err;
+
+    *plugin = filter_plugin;
+    return 0;
+
+err:
+    free(priv);
+    free(filter_plugin);
+    return ret;
+}
+
+struct pcm_plugin_ops pcm_plugin_ops = {
+    .open = filter_open,
+    .close = filter_close,
+    .hw_params = filter_hw_params,
+    .sw_params = filter_sw_params,
+    .sync_ptr = filter_sync_ptr,
+    .writei_frames = filter_writei_frames,
+    .readi_frames = filter_readi_frames,
+    .ttstamp = filter_ttstamp,
+    .prepare = filter_prepare,
+    .start = filter_start,
+    .drain = filter_drain,
+    .drop = filter_drop,
+    .ioctl = filter_ioctl,
+    .mmap = filter_mmap,
+    .munmap = filter_munmap,
+    .poll = filter_poll,
+};
@@ -0,0 +1,79 @@
+/* filter_pcm_plugin.h
+**
+** Copyright 2026, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+/*
+ * A PCM plugin that filters the samples of another PCM, its slave.
+ *
+ * The host does the PCM plugin work: it opens the slave with the
+ * parameters the application asks for and moves the stream through its
+ * states, and it passes the samples a period at a time through a stage,
+ * which does the filtering. Each filter plugin is the host built with a
+ * stage of its own, which it exports as filter_stage_ops.
+ *
+ * The slave is given by the device definition of the card:
+ *   slave-card   - card of the slave, the card of the plugin by default
+ *   slave-device - device of the slave
+ *
+ * Only interleaved reads and writes are supported.
+ */
+
+#ifndef TINYALSA_FILTER_PCM_PLUGIN_H
+#define TINYALSA_FILTER_PCM_PLUGIN_H
+
+#include <tinyalsa/pcm.h>
+#include <tinyalsa/plugin.h>
+
+/* The samples on one side of a stage */
+struct filter_format {
+    enum pcm_format format;
+    unsigned int channels;
+    unsigned int rate;
+    /* the most frames passed to process() at a time */
+    unsigned int period_size;
+};
+
+struct filter_stage_ops {
+    /* Reads the settings of the stage from the device definition */
+    int (*open) (void **stage, struct pcm_plugin *plugin);
+    /*
+     * Sets up the stage for a stream. Both formats are filled in with the
+     * format of the application. The stage changes the format of the
+     * device side, out for playback and in for capture, if it converts
+     * between formats, or fails if it does not support them.
+     */
+    int (*configure) (void *stage, struct filter_format *in, struct filter_format *out);
+    /* Filters frames from src, in the in format, to dst, in the out format */
+    void (*process) (void *stage, const void *src, void *dst, unsigned int frames);
+    /* Forgets the history of the signal, before the stream starts again */
+    void (*reset) (void *stage);
+    void (*close) (void *stage);
+    /* Nonzero if process() takes dst equal to src, when in and out frames are the same size */
+    int in_place;
+};
+
+#endif /* TINYALSA_FILTER_PCM_PLUGIN_H */
@@ -0,0 +1,195 @@
+/* filter_vec.h
+**
+** Copyright 2026, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+/*
+ * Vectors of samples for the filter stages.
+ *
+ * Samples are processed in vectors of FILTER_VEC_WIDTH floats, scaled to
+ * the range -1 to 1 whatever their format. A group of lcm(channels,
+ * FILTER_VEC_WIDTH) samples maps every vector lane to a fixed channel, so
+ * interleaved data needs no shuffling. Samples are stored rounded to the
+ * nearest integer and clipped to the range of their format.
+ */
+
+#ifndef TINYALSA_FILTER_VEC_H
+#define TINYALSA_FILTER_VEC_H
+
+#include <stdint.h>
+#include <string.h>
+#include <tinyalsa/pcm.h>
+
+#define FILTER_VEC_WIDTH 4
+#define FILTER_MAX_CHANNELS 8
+/* lcm(channels, FILTER_VEC_WIDTH) / FILTER_VEC_WIDTH is at most channels */
+#define FILTER_MAX_VECS FILTER_MAX_CHANNELS
+#define FILTER_MAX_LANES (FILTER_MAX_VECS * FILTER_VEC_WIDTH)
+
+typedef float filter_v4sf __attribute__((vector_size(FILTER_VEC_WIDTH * sizeof(float))));
+typedef int32_t filter_v4si __attribute__((vector_size(FILTER_VEC_WIDTH * sizeof(int32_t))));
+typedef int16_t filter_v4hi __attribute__((vector_size(FILTER_VEC_WIDTH * sizeof(int16_t))));
+
+/* the kernels must be inlined into a loop with a constant format */
+#define FILTER_VINLINE static inline __attribute__((always_inline))
+
+static inline unsigned int filter_group_lanes(unsigned int channels)
+{
+    unsigned int a = channels, b = FILTER_VEC_WIDTH;
+
+    while (b) {
+        unsigned int t = a % b;
+        a = b;
+        b = t;
+    }
+    return channels / a * FILTER_VEC_WIDTH;
+}
+
+static inline unsigned int filter_sample_bytes(enum pcm_format format)
+{
+    return format == PCM_FORMAT_S16_LE ? 2 : 4;
+}
+
+FILTER_VINLINE filter_v4sf filter_vsplat(float f)
+{
+    filter_v4sf v = { f, f, f, f };
+    return v;
+}
+
+FILTER_VINLINE filter_v4sf filter_vmin(filter_v4sf a, filter_v4sf b)
+{
+    filter_v4si m = a < b;
+    return (filter_v4sf) (((filter_v4si) a & m) | ((filter_v4si) b & ~m));
+}
+
+FILTER_VINLINE filter_v4sf filter_vmax(filter_v4sf a, filter_v4sf b)
+{
+    filter_v4si m = a > b;
+    return (filter_v4sf) (((filter_v4si) a & m) | ((filter_v4si) b & ~m));
+}
+
+FILTER_VINLINE filter_v4sf filter_vload(enum pcm_format format, const char *p)
+{
+    filter_v4hi s;
+    filter_v4si i;
+    filter_v4sf f;
+
+    switch (format) {
+    case PCM_FORMAT_S16_LE:
+        memcpy(&s, p, sizeof(s));
+        /* widened first, which has vector instructions, unlike int16 to float */
+        i = __builtin_convertvector(s, filter_v4si);
+        return __builtin_convertvector(i, filter_v4sf) * filter_vsplat(1.0f / 32768.0f);
+    case PCM_FORMAT_S32_LE:
+        memcpy(&i, p, sizeof(i));
+        return __builtin_convertvector(i, filter_v4sf) * filter_vsplat(1.0f / 2147483648.0f);
+    default:
+        memcpy(&f, p, sizeof(f));
+        return f;
+    }
+}
+
+/* rounds half away from zero, the conversion alone truncates */
+FILTER_VINLINE filter_v4si filter_vround(filter_v4sf v)
+{
+    const filter_v4si sign = { INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN };
+    filter_v4sf half = filter_vsplat(0.5f);
+
+    half = (filter_v4sf) (((filter_v4si) v & sign) | (filter_v4si) half);
+    return __builtin_convertvector(v + half, filter_v4si);
+}
+
+FILTER_VINLINE void filter_vstore(enum pcm_format format, char *p, filter_v4sf v)
+{
+    filter_v4hi s;
+    filter_v4si i;
+
+    switch (format) {
+    case PCM_FORMAT_S16_LE:
+        v = filter_vmin(filter_vmax(v * filter_vsplat(32768.0f), filter_vsplat(-32768.0f)),
+                        filter_vsplat(32767.0f));
+        /* clamped, the narrowing keeps the value */
+        s = __builtin_convertvector(filter_vround(v), filter_v4hi);
+        memcpy(p, &s, sizeof(s));
+        break;
+    case PCM_FORMAT_S32_LE:
+        /* the largest float below 2^31 */
+        v = filter_vmin(filter_vmax(v * filter_vsplat(2147483648.0f),
+                                    filter_vsplat(-2147483648.0f)),
+                        filter_vsplat(2147483520.0f));
+        i = filter_vround(v);
+        memcpy(p, &i, sizeof(i));
+        break;
+    default:
+        memcpy(p, &v, sizeof(v));
+        break;
+    }
+}
+
+static inline float filter_load(enum pcm_format format, const char *p)
+{
+    int16_t s16;
+    int32_t s32;
+    float f;
+
+    switch (format) {
+    case PCM_FORMAT_S16_LE:
+        memcpy(&s16, p, sizeof(s16));
+        return s16 / 32768.0f;
+    case PCM_FORMAT_S32_LE:
+        memcpy(&s32, p, sizeof(s32));
+        return s32 / 2147483648.0f;
+    default:
+        memcpy(&f, p, sizeof(f));
+        return f;
+    }
+}
+
+static inline void filter_store(enum pcm_format format, char *p, float f)
+{
+    int16_t s16;
+    int32_t s32;
+
+    switch (format) {
+    case PCM_FORMAT_S16_LE:
+        f *= 32768.0f;
+        f = f < -32768.0f ? -32768.0f : f > 32767.0f ? 32767.0f : f;
+        s16 = (int16_t) (f + (f < 0 ? -0.5f : 0.5f));
+        memcpy(p, &s16, sizeof(s16));
+        break;
+    case PCM_FORMAT_S32_LE:
+        f *= 2147483648.0f;
+        f = f < -2147483648.0f ? -2147483648.0f : f > 2147483520.0f ? 2147483520.0f : f;
+        s32 = (int32_t) (f + (f < 0 ? -0.5f : 0.5f));
+        memcpy(p, &s32, sizeof(s32));
+        break;
+    default:
+        memcpy(p, &f, sizeof(f));
+        break;
+    }
+}
+
+#endif /* TINYALSA_FILTER_VEC_H */
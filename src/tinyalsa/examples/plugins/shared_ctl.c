@@ -0,0 +1,268 @@
+/* shared_ctl.c
+**
+** Copyright 2026, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "shared_ctl.h"
+
+/* "TACT", changed with the layout of the table */
+#define SHCTL_MAGIC 0x54434154u
+
+/* how many times a reader tries before it keeps the value it has */
+#define SHCTL_READ_TRIES 4
+
+struct shctl_table {
+    uint32_t magic;
+    uint32_t count;
+    struct shctl_entry entries[SHCTL_MAX_CTLS];
+};
+
+struct shctl {
+    int fd;
+    struct shctl_table *table;
+};
+
+/* the size of the value, or 0 for an entry the table was given garbage for */
+static size_t shctl_size(const struct shctl_entry *entry)
+{
+    uint32_t type = __atomic_load_n(&entry->type, __ATOMIC_RELAXED);
+    uint32_t count = __atomic_load_n(&entry->count, __ATOMIC_RELAXED);
+
+    if (type == SHCTL_TYPE_INTEGER && count <= SHCTL_MAX_VALUES)
+        return count * sizeof(entry->data.values[0]);
+    if (type == SHCTL_TYPE_BYTES && count <= SHCTL_MAX_BYTES)
+        return count;
+    return 0;
+}
+
+int shctl_valid(const struct shctl_entry *entry)
+{
+    return shctl_size(entry) != 0;
+}
+
+/*
+ * Called with the file locked. A writer that died in the copy left the
+ * sequence of its control odd, which would keep readers from ever taking
+ * the value: make it even again, the value being whatever was copied.
+ */
+static void shctl_repair(struct shctl_table *table)
+{
+    unsigned int count = table->count < SHCTL_MAX_CTLS ? table->count : SHCTL_MAX_CTLS;
+    unsigned int i;
+    uint32_t seq;
+
+    for (i = 0; i < count; i++) {
+        seq = table->entries[i].seq;
+        if (seq & 1)
+            __atomic_store_n(&table->entries[i].seq, seq + 1, __ATOMIC_RELEASE);
+    }
+}
+
+struct shctl *shctl_open(unsigned int card, int create)
+{
+    const char *dir = getenv("TINYALSA_SHCTL_DIR");
+    struct shctl *shctl;
+    struct stat st;
+    char path[256];
+    void *table;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/tinyalsa-ctl-%u", dir ? dir : "/dev/shm", card);
+
+    fd = open(path, O_RDWR | O_CLOEXEC | O_NOFOLLOW | (create ? O_CREAT : 0), 0660);
+    if (fd < 0)
+        return NULL;
+
+    /* the first user sizes the file, which zero fills it */
+    flock(fd, LOCK_EX);
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+        (st.st_size < (off_t) sizeof(struct shctl_table) &&
+         (!create || ftruncate(fd, sizeof(struct shctl_table)) < 0)))
+        goto err_unlock;
+
+    table = mmap(NULL, sizeof(struct shctl_table), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (table == MAP_FAILED)
+        goto err_unlock;
+
+    if (st.st_size < (off_t) sizeof(struct shctl_table))
+        ((struct shctl_table *) table)->magic = SHCTL_MAGIC;
+    else if (((struct shctl_table *) table)->magic == SHCTL_MAGIC)
+        shctl_repair(table);
+    flock(fd, LOCK_UN);
+
+    shctl = calloc(1, sizeof(*shctl));
+    if (!shctl || ((struct shctl_table *) table)->magic != SHCTL_MAGIC) {
+        munmap(table, sizeof(struct shctl_table));
+        free(shctl);
+        close(fd);
+        return NULL;
+    }
+
+    shctl->fd = fd;
+    shctl->table = table;
+    return shctl;
+
+err_unlock:
+    flock(fd, LOCK_UN);
+    close(fd);
+    return NULL;
+}
+
+void shctl_close(struct shctl *shctl)
+{
+    if (!shctl)
+        return;
+
+    munmap(shctl->table, sizeof(*shctl->table));
+    close(shctl->fd);
+    free(shctl);
+}
+
+unsigned int shctl_count(struct shctl *shctl)
+{
+    unsigned int count = __atomic_load_n(&shctl->table->count, __ATOMIC_ACQUIRE);
+
+    return count < SHCTL_MAX_CTLS ? count : SHCTL_MAX_CTLS;
+}
+
+struct shctl_entry *shctl_get(struct shctl *shctl, unsigned int index)
+{
+    if (index >= shctl_count(shctl) || !shctl_valid(&shctl->table->entries[index]))
+        return NULL;
+    return &shctl->table->entries[index];
+}
+
+struct shctl_entry *shctl_find(struct shctl *shctl, const char *name)
+{
+    unsigned int count = shctl_count(shctl);
+    unsigned int i;
+
+    for (i = 0; i < count; i++) {
+        if (!strncmp(shctl->table->entries[i].name, name, SHCTL_NAME_SIZE))
+            return &shctl->table->entries[i];
+    }
+
+    return NULL;
+}
+
+struct shctl_entry *shctl_add(struct shctl *shctl, const struct shctl_entry *tmpl)
+{
+    struct shctl_entry *entry;
+    unsigned int count;
+
+    if (tmpl->count == 0 || !shctl_valid(tmpl) ||
+        !memchr(tmpl->name, '\0', SHCTL_NAME_SIZE))
+        return NULL;
+
+    flock(shctl->fd, LOCK_EX);
+    entry = shctl_find(shctl, tmpl->name);
+    if (entry) {
+        if (entry->type != tmpl->type || entry->count != tmpl->count || !shctl_valid(entry))
+            entry = NULL;
+        goto out;
+    }
+
+    count = shctl_count(shctl);
+    if (count == SHCTL_MAX_CTLS)
+        goto out;
+
+    entry = &shctl->table->entries[count];
+    memcpy(entry, tmpl, sizeof(*entry));
+    entry->seq = 0;
+    /* publishes the entry */
+    __atomic_store_n(&shctl->table->count, count + 1, __ATOMIC_RELEASE);
+
+out:
+    flock(shctl->fd, LOCK_UN);
+    return entry;
+}
+
+int shctl_read(const struct shctl_entry *entry, void *data, size_t size, uint32_t *seq)
+{
+    unsigned char value[SHCTL_MAX_BYTES];
+    size_t max = shctl_size(entry);
+    unsigned int tries;
+    uint32_t start;
+
+    if (size > max)
+        size = max;
+
+    /* a writer holds the sequence odd only for a copy, unless it died */
+    for (tries = 0; tries < SHCTL_READ_TRIES; tries++) {
+        start = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+        if (start & 1) {
+            sched_yield();
+            continue;
+        }
+        memcpy(value, &entry->data, size);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) == start) {
+            memcpy(data, value, size);
+            if (seq)
+                *seq = start;
+            return 0;
+        }
+    }
+
+    return -EBUSY;
+}
+
+int shctl_write(struct shctl *shctl, struct shctl_entry *entry,
+                const void *data, size_t size)
+{
+    int changed = 0;
+    uint32_t seq;
+
+    if (size == 0 || size > shctl_size(entry))
+        return -EINVAL;
+
+    flock(shctl->fd, LOCK_EX);
+    /* odd under the lock, a writer died in the copy: rewrite the value */
+    seq = entry->seq;
+    if ((seq & 1) || memcmp(&entry->data, data, size)) {
+        if (!(seq & 1)) {
+            __atomic_store_n(&entry->seq, ++seq, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+        }
+        memcpy(&entry->data, data, size);
+        __atomic_store_n(&entry->seq, seq + 1, __ATOMIC_RELEASE);
+        changed = 1;
+    }
+    flock(shctl->fd, LOCK_UN);
+
+    return changed;
+}
@@ -0,0 +1,124 @@
+/* shared_ctl.h
+**
+** Copyright 2026, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+/*
+ * Controls shared between the PCM plugins of a card and its mixer plugin.
+ *
+ * A PCM plugin that has settings, such as a gain, adds a control for each
+ * of them to the table of its card. The mixer plugin lists the controls of
+ * the table with its own, so they are set with tinymix like any other, from
+ * any process. The table is a file mapped by every user, in the directory
+ * named by TINYALSA_SHCTL_DIR, or /dev/shm, open to its owner and group.
+ *
+ * Writers take a file lock. Readers never wait: each control carries a
+ * sequence number, odd while it is written, and a reader copies the value
+ * again, a few times at most, if the number changed under it. A PCM plugin
+ * compares the number with the one it last read once a period, which costs
+ * one load.
+ */
+
+#ifndef TINYALSA_SHARED_CTL_H
+#define TINYALSA_SHARED_CTL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHCTL_MAX_CTLS 32
+#define SHCTL_NAME_SIZE 44
+#define SHCTL_MAX_VALUES 64
+#define SHCTL_MAX_BYTES 1024
+
+enum shctl_type {
+    SHCTL_TYPE_INTEGER = 1,
+    SHCTL_TYPE_BYTES,
+};
+
+struct shctl_entry {
+    /* odd while the value is written */
+    uint32_t seq;
+    uint32_t type;
+    char name[SHCTL_NAME_SIZE];
+    /* number of values, or of bytes */
+    uint32_t count;
+    int32_t min;
+    int32_t max;
+    int32_t step;
+    /* the dB scale TLV of an integer control, all zero without one */
+    uint32_t db_scale[4];
+    union {
+        int32_t values[SHCTL_MAX_VALUES];
+        unsigned char bytes[SHCTL_MAX_BYTES];
+    } data;
+};
+
+struct shctl;
+
+/* Maps the table of a card, creating the file if asked to */
+struct shctl *shctl_open(unsigned int card, int create);
+
+void shctl_close(struct shctl *shctl);
+
+unsigned int shctl_count(struct shctl *shctl);
+
+/* The control at index, or NULL if there is none or its type or count is bad */
+struct shctl_entry *shctl_get(struct shctl *shctl, unsigned int index);
+
+struct shctl_entry *shctl_find(struct shctl *shctl, const char *name);
+
+/*
+ * Finds the control with the name of the template, or adds it with the
+ * value of the template. An existing control keeps its value, but must
+ * have the type and count of the template.
+ */
+struct shctl_entry *shctl_add(struct shctl *shctl, const struct shctl_entry *tmpl);
+
+/*
+ * Whether the type and count of a control fit its value. Other processes
+ * write the table, so a reader checks it before it trusts the count.
+ */
+int shctl_valid(const struct shctl_entry *entry);
+
+/* The sequence number of the value, for a cheap check for changes */
+static inline uint32_t shctl_seq(const struct shctl_entry *entry)
+{
+    return __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Copies a consistent value and, if seq is not NULL, its sequence number.
+ * Returns -EBUSY, leaving data as it was, if the value was written during
+ * each of a few tries, so that a writer that died in the copy cannot stall
+ * the audio path; the next write or shctl_open() repairs the sequence.
+ */
+int shctl_read(const struct shctl_entry *entry, void *data, size_t size, uint32_t *seq);
+
+/* Returns 1 if the value changed, 0 if not, or a negative errno */
+int shctl_write(struct shctl *shctl, struct shctl_entry *entry,
+                const void *data, size_t size);
+
+#endif /* TINYALSA_SHARED_CTL_H */
@@ -0,0 +1,394 @@
+/* softvol_pcm_plugin.c
+**
+** Copyright 2026, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+/*
+ * A filter that sets the volume of each channel in software.
+ *
+ * The volume is a control of the card, shared with its mixer plugin (see
+ * shared_ctl.h), so it is set with tinymix like a codec volume, in steps
+ * of a dB scale with mute at the lowest step. A change is applied as a
+ * ramp over one period, from the gain of the last period, so it does not
+ * click. The control is added when the device is opened for the first time.
+ *
+ * Settings in the device definition:
+ *   control    - name of the control, "Softvol Playback Volume" or
+ *                "Softvol Capture Volume" by default
+ *   channels   - values of the control, the last one is used for the
+ *                channels beyond them, 2 by default
+ *   resolution - steps of the control, 256 by default
+ *   min-db     - gain of the lowest step above mute, in hundredths of a dB,
+ *                -5100 by default, rounded up to a whole number of steps
+ *   max-db     - gain of the highest step, 0 by default
+ *   ramp       - "linear" in amplitude or "exp" in dB, linear by default
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sound/asound.h>
+#include <sound/tlv.h>
+#include <tinyalsa/pcm.h>
+#include <tinyalsa/plugin.h>
+
+#include "filter_pcm_plugin.h"
+#include "filter_vec.h"
+#include "shared_ctl.h"
+
+/* an exponential ramp to or from mute ends or starts here, -100 dB */
+#define SOFTVOL_FLOOR 1e-5f
+
+struct softvol {
+    struct shctl *shctl;
+    struct shctl_entry *ctl;
+    uint32_t seq;
+    int32_t values[SHCTL_MAX_VALUES];
+
+    int db_min;
+    int db_step;
+    int exp_ramp;
+
+    struct filter_format format;
+    unsigned int lanes;
+
+    /* per channel; the ramp step is added, or multiplied for exp ramps */
+    float gain[FILTER_MAX_CHANNELS];
+    float target[FILTER_MAX_CHANNELS];
+    float step[FILTER_MAX_CHANNELS];
+    unsigned int ramp_left;
+    int unity;
+    int mute;
+};
+
+static int softvol_get_int(struct pcm_plugin *plugin, const char *prop, int def)
+{
+    int val;
+
+    return pcm_plugin_get_int(plugin, prop, &val) ? def : val;
+}
+
+static float softvol_value_to_gain(const struct softvol *sv, int32_t value)
+{
+    if (value <= 0)
+        return 0.0f;
+    return powf(10.0f, (sv->db_min + (value - 1) * sv->db_step) / 2000.0f);
+}
+
+/* reads the control, if it changed, and returns whether it did */
+static int softvol_read_ctl(struct softvol *sv, int force)
+{
+    unsigned int c, count;
+
+    if (!sv->ctl || (!force && shctl_seq(sv->ctl) == sv->seq))
+        return 0;
+
+    /* keeps the gain it has, and tries again next period */
+    if (shctl_read(sv->ctl, sv->values, sizeof(sv->values), &sv->seq))
+        return 0;
+    count = sv->ctl->count;
+    for (c = 0; c < sv->format.channels; c++)
+        sv->target[c] = softvol_value_to_gain(sv, sv->values[c < count ? c : count - 1]);
+
+    return 1;
+}
+
+static void softvol_settle(struct softvol *sv)
+{
+    unsigned int c;
+
+    sv->unity = 1;
+    sv->mute = 1;
+    for (c = 0; c < sv->format.channels; c++) {
+        sv->gain[c] = sv->target[c];
+        sv->unity &= sv->gain[c] == 1.0f;
+        sv->mute &= sv->gain[c] == 0.0f;
+    }
+    sv->ramp_left = 0;
+}
+
+static void softvol_start_ramp(struct softvol *sv)
+{
+    unsigned int n = sv->format.period_size;
+    unsigned int c;
+
+    for (c = 0; c < sv->format.channels; c++) {
+        if (sv->exp_ramp) {
+            float from = sv->gain[c] > SOFTVOL_FLOOR ? sv->gain[c] : SOFTVOL_FLOOR;
+            float to = sv->target[c] > SOFTVOL_FLOOR ? sv->target[c] : SOFTVOL_FLOOR;
+
+            sv->gain[c] = from;
+            sv->step[c] = powf(to / from, 1.0f / n);
+        } else {
+            sv->step[c] = (sv->target[c] - sv->gain[c]) / n;
+        }
+    }
+
+    sv->unity = 0;
+    sv->mute = 0;
+    sv->ramp_left = n;
+}
+
+/*
+ * Applies the gain to frames, a group of vectors at a time. Ramping, the
+ * gain of each lane is moved on by a group of frames after each group,
+ * and the gain of each channel by the frames done at the end.
+ */
+FILTER_VINLINE void softvol_apply(struct softvol *sv, enum pcm_format format, int ramp,
+                                  const char *src, char *dst, unsigned int frames)
+{
+    unsigned int channels = sv->format.channels;
+    unsigned int lanes = sv->lanes;
+    unsigned int vecs = lanes / FILTER_VEC_WIDTH;
+    unsigned int fpg = lanes / channels;
+    unsigned int bytes = filter_sample_bytes(format);
+    unsigned int groups = frames / fpg;
+    filter_v4sf gain[FILTER_MAX_VECS], step[FILTER_MAX_VECS];
+    unsigned int g, v, l, c, i;
+
+    for (l = 0; l < lanes; l++) {
+        c = l % channels;
+        if (!ramp) {
+            gain[l / FILTER_VEC_WIDTH][l % FILTER_VEC_WIDTH] = sv->gain[c];
+            step[l / FILTER_VEC_WIDTH][l % FILTER_VEC_WIDTH] = 0.0f;
+        } else if (sv->exp_ramp) {
+            gain[l / FILTER_VEC_WIDTH][l % FILTER_VEC_WIDTH] =
+                    sv->gain[c] * powf(sv->step[c], l / channels);
+            step[l / FILTER_VEC_WIDTH][l % FILTER_VEC_WIDTH] = powf(sv->step[c], fpg);
+        } else {
+            gain[l / FILTER_VEC_WIDTH][l % FILTER_VEC_WIDTH] =
+                    sv->gain[c] + sv->step[c] * (l / channels);
+            step[l / FILTER_VEC_WIDTH][l % FILTER_VEC_WIDTH] = sv->step[c] * fpg;
+        }
+    }
+
+    for (g = 0; g < groups; g++) {
+        for (v = 0; v < vecs; v++) {
+            filter_vstore(format, dst, filter_vload(format, src) * gain[v]);
+            if (ramp && sv->exp_ramp)
+                gain[v] *= step[v];
+            else if (ramp)
+                gain[v] += step[v];
+            src += FILTER_VEC_WIDTH * bytes;
+            dst += FILTER_VEC_WIDTH * bytes;
+        }
+    }
+
+    if (ramp) {
+        for (c = 0; c < channels; c++) {
+            if (sv->exp_ramp)
+                sv->gain[c] *= powf(sv->step[c], groups * fpg);
+            else
+                sv->gain[c] += sv->step[c] * (groups * fpg);
+        }
+    }
+
+    for (i = groups * fpg; i < frames; i++) {
+        for (c = 0; c < channels; c++) {
+            filter_store(format, dst, filter_load(format, src) * sv->gain[c]);
+            if (ramp && sv->exp_ramp)
+                sv->gain[c] *= sv->step[c];
+            else if (ramp)
+                sv->gain[c] += sv->step[c];
+            src += bytes;
+            dst += bytes;
+        }
+    }
+}
+
+static void softvol_gain(struct softvol *sv, const char *src, char *dst, unsigned int frames)
+{
+    switch (sv->format.format) {
+    case PCM_FORMAT_S16_LE:
+        softvol_apply(sv, PCM_FORMAT_S16_LE, 0, src, dst, frames);
+        break;
+    case PCM_FORMAT_S32_LE:
+        softvol_apply(sv, PCM_FORMAT_S32_LE, 0, src, dst, frames);
+        break;
+    default:
+        softvol_apply(sv, PCM_FORMAT_FLOAT_LE, 0, src, dst, frames);
+        break;
+    }
+}
+
+static void softvol_ramp(struct softvol *sv, const char *src, char *dst, unsigned int frames)
+{
+    switch (sv->format.format) {
+    case PCM_FORMAT_S16_LE:
+        softvol_apply(sv, PCM_FORMAT_S16_LE, 1, src, dst, frames);
+        break;
+    case PCM_FORMAT_S32_LE:
+        softvol_apply(sv, PCM_FORMAT_S32_LE, 1, src, dst, frames);
+        break;
+    default:
+        softvol_apply(sv, PCM_FORMAT_FLOAT_LE, 1, src, dst, frames);
+        break;
+    }
+}
+
+static void softvol_process(void *stage, const void *src, void *dst, unsigned int frames)
+{
+    struct softvol *sv = stage;
+    size_t frame_bytes = (size_t) sv->format.channels * filter_sample_bytes(sv->format.format);
+    unsigned int n;
+
+    if (softvol_read_ctl(sv, 0))
+        softvol_start_ramp(sv);
+
+    if (sv->ramp_left) {
+        n = frames < sv->ramp_left ? frames : sv->ramp_left;
+        softvol_ramp(sv, src, dst, n);
+        sv->ramp_left -= n;
+        if (!sv->ramp_left)
+            softvol_settle(sv);
+        src = (const char *) src + n * frame_bytes;
+        dst = (char *) dst + n * frame_bytes;
+        frames -= n;
+    }
+
+    if (!frames)
+        return;
+
+    if (sv->unity) {
+        if (src != dst)
+            memcpy(dst, src, frames * frame_bytes);
+    } else if (sv->mute) {
+        memset(dst, 0, frames * frame_bytes);
+    } else {
+        softvol_gain(sv, src, dst, frames);
+    }
+}
+
+static void softvol_reset(void *stage)
+{
+    struct softvol *sv = stage;
+
+    /* nothing was played at the old gain, there is nothing to ramp from */
+    softvol_read_ctl(sv, 0);
+    softvol_settle(sv);
+}
+
+static int softvol_configure(void *stage, struct filter_format *in, struct filter_format *out)
+{
+    struct softvol *sv = stage;
+    unsigned int c;
+
+    (void) out;
+
+    if (in->channels > FILTER_MAX_CHANNELS || in->period_size == 0)
+        return -EINVAL;
+
+    sv->format = *in;
+    sv->lanes = filter_group_lanes(in->channels);
+    for (c = 0; c < FILTER_MAX_CHANNELS; c++)
+        sv->target[c] = 1.0f;
+    softvol_read_ctl(sv, 1);
+    softvol_settle(sv);
+
+    return 0;
+}
+
+static void softvol_close(void *stage)
+{
+    struct softvol *sv = stage;
+
+    shctl_close(sv->shctl);
+    free(sv);
+}
+
+static int softvol_open(void **stage, struct pcm_plugin *plugin)
+{
+    struct shctl_entry tmpl;
+    struct softvol *sv;
+    char *name = NULL, *ramp = NULL;
+    int resolution, db_max, count, value;
+
+    sv = calloc(1, sizeof(*sv));
+    if (!sv)
+        return -ENOMEM;
+
+    memset(&tmpl, 0, sizeof(tmpl));
+    if (pcm_plugin_get_str(plugin, "control", &name))
+        name = (plugin->mode & PCM_IN) ? "Softvol Capture Volume" : "Softvol Playback Volume";
+    snprintf(tmpl.name, sizeof(tmpl.name), "%s", name);
+
+    count = softvol_get_int(plugin, "channels", 2);
+    resolution = softvol_get_int(plugin, "resolution", 256);
+    sv->db_min = softvol_get_int(plugin, "min-db", -5100);
+    db_max = softvol_get_int(plugin, "max-db", 0);
+    if (count < 1 || count > FILTER_MAX_CHANNELS || resolution < 2 || db_max <= sv->db_min) {
+        free(sv);
+        return -EINVAL;
+    }
+
+    /* whole steps above mute, the top one at max-db */
+    sv->db_step = (db_max - sv->db_min) / (resolution - 2);
+    if (sv->db_step > SNDRV_CTL_TLVD_DB_SCALE_MASK)
+        sv->db_step = SNDRV_CTL_TLVD_DB_SCALE_MASK;
+    if (sv->db_step == 0) {
+        free(sv);
+        return -EINVAL;
+    }
+    sv->db_min = db_max - sv->db_step * (resolution - 2);
+    sv->exp_ramp = !pcm_plugin_get_str(plugin, "ramp", &ramp) && !strcmp(ramp, "exp");
+
+    tmpl.type = SHCTL_TYPE_INTEGER;
+    tmpl.count = count;
+    tmpl.min = 0;
+    tmpl.max = resolution - 1;
+    tmpl.step = 1;
+    /* the dB scale of the mixer counts its steps from the mute step */
+    tmpl.db_scale[0] = SNDRV_CTL_TLVT_DB_SCALE;
+    tmpl.db_scale[1] = 2 * sizeof(unsigned int);
+    tmpl.db_scale[2] = (unsigned int) (sv->db_min - sv->db_step);
+    tmpl.db_scale[3] = sv->db_step | SNDRV_CTL_TLVD_DB_SCALE_MUTE;
+    /* 0 dB, or the nearest step below it */
+    value = -sv->db_min / sv->db_step + 1;
+    value = value < 1 ? 1 : value > tmpl.max ? tmpl.max : value;
+    while (count--)
+        tmpl.data.values[count] = value;
+
+    sv->shctl = shctl_open(plugin->card, 1);
+    if (sv->shctl)
+        sv->ctl = shctl_add(sv->shctl, &tmpl);
+    if (!sv->ctl)
+        fprintf(stderr, "%s: no control \"%s\", the gain is fixed at 0 dB\n",
+                __func__, tmpl.name);
+
+    *stage = sv;
+    return 0;
+}
+
+const struct filter_stage_ops filter_stage_ops = {
+    .open = softvol_open,
+    .configure = softvol_configure,
+    .process = softvol_process,
+    .reset = softvol_reset,
+    .close = softvol_close,
+    .in_place = 1,
+};
@@ -0,0 +1,1079 @@
+/* virtual_mixer_plugin.c
+**
+** Copyright 2026, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+/*
+ * A mixer plugin that behaves like the control set of a codec, without one.
+ *
+ * The controls are read from a description file, one control per line:
+ *
+ *   int   "Name" count min max [step] [dB min step [mute]]
+ *   bool  "Name" count
+ *   enum  "Name" "Item" "Item" ...
+ *   bytes "Name" size
+ *   tlv   "Name" size
+ *   repeat n
+ *
+ * dB values are in hundredths of a dB. "repeat n" creates the next control
+ * n times, replacing %u in its name with 1 to n. Text after # is ignored.
+ * Without a file, a built-in set modelled on a phone codec is used.
+ *
+ * The controls shared by the PCM plugins of the card, such as a software
+ * volume (see shared_ctl.h), follow the controls of the description.
+ *
+ * Control values are kept for as long as the mixer is open. Writing a new
+ * value to a control raises a change event; up to 256 unread events are
+ * queued. The plugin is configured with environment variables:
+ *   TINYALSA_VMIX_FILE       - the control description
+ *   TINYALSA_VMIX_LATENCY_US - delay of each control read and write
+ *   TINYALSA_VMIX_ERROR_RATE - fail every nth control read and write
+ *   TINYALSA_VMIX_EVENT_US   - change a control from a background thread
+ *                              at this interval, as a jack or DSP would
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <linux/ioctl.h>
+#include <sound/asound.h>
+#include <sound/tlv.h>
+#include <tinyalsa/plugin.h>
+
+#include "shared_ctl.h"
+
+#define VMIX_MAX_TOKENS 64
+#define VMIX_MAX_VALUES 128
+#define VMIX_MAX_TLV_BYTES (64 * 1024)
+#define VMIX_EVENT_QUEUE 256
+
+static const char vmix_default_controls[] =
+    "int   \"Headphone Playback Volume\"  2 0 63 1 dB -5700 100 mute\n"
+    "bool  \"Headphone Playback Switch\"  2\n"
+    "int   \"Speaker Playback Volume\"    2 0 39 1 dB -5700 150 mute\n"
+    "bool  \"Speaker Playback Switch\"    2\n"
+    "int   \"Earpiece Playback Volume\"   1 0 31 1 dB -3100 100 mute\n"
+    "int   \"DAC Playback Volume\"        2 0 255 1 dB -12750 50 mute\n"
+    "int   \"ADC Capture Volume\"         2 0 127 1 dB -1725 75\n"
+    "bool  \"ADC Capture Switch\"         2\n"
+    "int   \"Mic1 Boost Volume\"          1 0 3 1 dB 0 1000\n"
+    "int   \"Mic2 Boost Volume\"          1 0 3 1 dB 0 1000\n"
+    "enum  \"ADC Left Mux\"   \"Mic1\" \"Mic2\" \"Line\" \"DMIC\"\n"
+    "enum  \"ADC Right Mux\"  \"Mic1\" \"Mic2\" \"Line\" \"DMIC\"\n"
+    "enum  \"Headphone Mux\"  \"DAC\" \"Bypass\"\n"
+    "enum  \"Speaker Mux\"    \"DAC\" \"Bypass\"\n"
+    "enum  \"DAC Mono Mix\"   \"Stereo\" \"Mono\"\n"
+    "enum  \"ADC HPF Mode\"   \"Off\" \"Hi-fi\" \"Voice 1\" \"Voice 2\" \"Voice 3\"\n"
+    "bool  \"Headphone Jack\" 1\n"
+    "bool  \"Headset Mic Jack\" 1\n"
+    "repeat 5\n"
+    "int   \"EQ%u Band Gain\" 1 0 24 1 dB -1200 100\n"
+    "repeat 4\n"
+    "bool  \"DAI%u Loopback Switch\" 1\n"
+    "bytes \"DSP Coefficients\" 256\n"
+    "tlv   \"DSP Firmware\" 4096\n";
+
+struct vmix_ctl {
+    union {
+        struct snd_value_int_tlv integer;
+        struct snd_value_enum enumerated;
+        struct snd_value_bytes bytes;
+        struct snd_value_tlv_bytes tlv;
+    } value;
+    unsigned int db_scale[4];
+    unsigned int count;
+    long *values;
+    unsigned char *data;
+    /* the value of a control shared with the PCM plugins */
+    struct shctl_entry *shared;
+};
+
+struct vmix_event {
+    unsigned int seq;
+    struct snd_ctl_event ev;
+};
+
+struct vmix_priv {
+    struct snd_control *ctls;
+    unsigned int ctl_count;
+    unsigned int ctl_space;
+    struct shctl *shctl;
+
+    pthread_mutex_t lock;
+    mixer_event_callback event_cb;
+    /* Lock-free ring of unread events, see vmix_push_event */
+    struct vmix_event events[VMIX_EVENT_QUEUE];
+    unsigned int event_tail;
+    unsigned int event_head;
+
+    long long latency_ns;
+    unsigned long error_rate;
+    unsigned long accesses;
+
+    long long event_ns;
+    pthread_t event_thread;
+    pthread_cond_t event_cond;
+    int event_thread_running;
+    int stopping;
+};
+
+static void vmix_delay(long long ns)
+{
+    struct timespec ts;
+
+    if (ns <= 0)
+        return;
+
+    ts.tv_sec = ns / 1000000000LL;
+    ts.tv_nsec = ns % 1000000000LL;
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+        ;
+}
+
+/* Simulates the bus latency and failures of a control access */
+static int vmix_access(struct vmix_priv *priv)
+{
+    unsigned long n;
+
+    vmix_delay(priv->latency_ns);
+
+    if (!priv->error_rate)
+        return 0;
+
+    pthread_mutex_lock(&priv->lock);
+    n = ++priv->accesses;
+    pthread_mutex_unlock(&priv->lock);
+
+    return n % priv->error_rate ? 0 : -EIO;
+}
+
+/*
+ * The event ring has many producers, the threads that change controls, and
+ * one consumer, the reader of the mixer, so a reader draining a burst of
+ * events never waits for a writer. The sequence number of a slot tells
+ * whose turn it is: it equals the position a producer may fill, and the
+ * position plus one once the event can be read.
+ */
+static int vmix_push_event(struct vmix_priv *priv, const struct snd_ctl_event *ev)
+{
+    unsigned int pos = __atomic_load_n(&priv->event_tail, __ATOMIC_RELAXED);
+    struct vmix_event *slot;
+    int diff;
+
+    for (;;) {
+        slot = &priv->events[pos % VMIX_EVENT_QUEUE];
+        diff = (int)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff < 0)
+            return -ENOSPC;
+        if (!diff && __atomic_compare_exchange_n(&priv->event_tail, &pos, pos + 1,
+                                                 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            break;
+        if (diff)
+            pos = __atomic_load_n(&priv->event_tail, __ATOMIC_RELAXED);
+    }
+
+    slot->ev = *ev;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+static int vmix_pop_event(struct vmix_priv *priv, struct snd_ctl_event *ev)
+{
+    unsigned int pos = priv->event_head;
+    struct vmix_event *slot = &priv->events[pos % VMIX_EVENT_QUEUE];
+
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+        return 0;
+
+    *ev = slot->ev;
+    __atomic_store_n(&slot->seq, pos + VMIX_EVENT_QUEUE, __ATOMIC_RELEASE);
+    priv->event_head = pos + 1;
+
+    return 1;
+}
+
+/* Called with priv->lock held */
+static void vmix_raise_event(struct mixer_plugin *plugin, struct snd_control *ctl)
+{
+    struct vmix_priv *priv = plugin->priv;
+    struct snd_ctl_event ev;
+
+    if (!priv->event_cb)
+        return;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.type = SNDRV_CTL_EVENT_ELEM;
+    ev.data.elem.mask = SNDRV_CTL_EVENT_MASK_VALUE;
+    /* numid values start at 1 */
+    ev.data.elem.id.numid = ctl - priv->ctls + 1;
+    ev.data.elem.id.iface = ctl->iface;
+    strncpy((char *)ev.data.elem.id.name, ctl->name,
+            sizeof(ev.data.elem.id.name) - 1);
+
+    if (vmix_push_event(priv, &ev))
+        return;
+
+    priv->event_cb(plugin);
+}
+
+static int vmix_int_ctl_get(struct mixer_plugin *plugin,
+                struct snd_control *ctl, struct snd_ctl_elem_value *ev)
+{
+    struct vmix_priv *priv = plugin->priv;
+    struct vmix_ctl *vctl = ctl->private_data;
+    unsigned int i;
+    int ret;
+
+    ret = vmix_access(priv);
+    if (ret)
+        return ret;
+
+    pthread_mutex_lock(&priv->lock);
+    for (i = 0; i < vctl->count; i++)
+        ev->value.integer.value[i] = vctl->values[i];
+    pthread_mutex_unlock(&priv->lock);
+
+    return 0;
+}
+
+static int vmix_int_ctl_put(struct mixer_plugin *plugin,
+                struct snd_control *ctl, struct snd_ctl_elem_value *ev)
+{
+    struct vmix_priv *priv = plugin->priv;
+    struct vmix_ctl *vctl = ctl->private_data;
+    struct snd_value_int *val = &vctl->value.integer.integer;
+    int changed = 0;
+    unsigned int i;
+    int ret;
+
+    for (i = 0; i < vctl->count; i++) {
+        if (ev->value.integer.value[i] < val->min ||
+            ev->value.integer.value[i] > val->max)
+            return -EINVAL;
+    }
+
+    ret = vmix_access(priv);
+    if (ret)
+        return ret;
+
+    pthread_mutex_lock(&priv->lock);
+    for (i = 0; i < vctl->count; i++) {
+        if (vctl->values[i] != ev->value.integer.value[i]) {
+            vctl->values[i] = ev->value.integer.value[i];
+            changed = 1;
+        }
+    }
+    if (changed)
+        vmix_raise_event(plugin, ctl);
+    pthread_mutex_unlock(&priv->lock);
+
+    return 0;
+}
+
+static int vmix_enum_ctl_get(struct mixer_plugin *plugin,
+                struct snd_control *ctl, struct snd_ctl_elem_value *ev)
+{
+    struct vmix_priv *priv = plugin->priv;
+    struct vmix_ctl *vctl = ctl->private_data;
+    int ret;
+
+    ret = vmix_access(priv);
+    if (ret)
+        return ret;
+
+    pthread_mutex_lock(&priv->lock);
+    ev->value.enumerated.item[0] = vctl->values[0];
+    pthread_mutex_unlock(&priv->lock);
+
+    return 0;
+}
+
+static int vmix_enum_ctl_put(struct mixer_plugin *plugin,
+                struct snd_control *ctl, struct snd_ctl_elem_value *ev)
+{
+    struct vmix_priv *priv = plugin->priv;
+    struct vmix_ctl *vctl = ctl->private_data;
+    unsigned int item = ev->value.enumerated.item[0];
+    int ret;
+
+    if (item >= vctl->value.enumerated.items)
+        return -EINVAL;
+
+    ret = vmix_access(priv);
+    if (ret)
+        return ret;
+
+    pthread_mutex_lock(&priv->lock);
+    if (vctl->values[0] != item) {
+        vctl->values[0] = item;
+        vmix_raise_event(plugin, ctl);
+    }
+    pthread_mutex_unlock(&priv->lock);
+
+    return 0;
+}
+
+static int vmix_bytes_ctl_get(struct mixer_plugin *plugin,
+                struct snd_control *ctl, struct snd_ctl_elem_value *ev)
+{
+    struct vmix_priv *priv = plugin->priv;
+    struct vmix_ctl *vctl = ctl->private_data;
+    int ret;
+
+    ret = vmix_access(priv);
+    if (ret)
+        return ret;
+
+    pthread_mutex_lock(&priv->lock);
+    memcpy(ev->value.bytes.data, vctl->data, vctl->count);
+    pthread_mutex_unlock(&priv->lock);
+
+    return 0;
+}
+
+static int vmix_bytes_ctl_put(struct mixer_plugin *plugin,
+                struct snd_control *ctl, struct snd_ctl_elem_value *ev)
+{
+    struct vmix_priv *priv = plugin->priv;
+    struct vmix_ctl *vctl = ctl->private_data;
+    int ret;
+
+    ret = vmix_access(priv);
+    if (ret)
+        return ret;
+
+    pthread_mutex_lock(&priv->lock);
+    if (memcmp(vctl->data, ev->value.bytes.data, vctl->count)) {
+        memcpy(vctl->data, ev->value.bytes.data, vctl->count);
+        vmix_raise_event(plugin, ctl);
+    }
+    pthread_mutex_unlock(&priv->lock);
+
+    return 0;
+}
+
+static int vmix_tlv_ctl_get(struct mixer_plugin *plugin,
+                struct snd_control *ctl, struct snd_ctl_tlv *tlv)
+{
+    struct vmix_priv *priv = plugin->priv;
+    struct vmix_ctl *vctl = ctl->private_data;
+    int ret;
+
+    if (tlv->length > vctl->count)
+        return -EINVAL;
+
+    ret = vmix_access(priv);
+    if (ret)
+        return ret;
+
+    pthread_mutex_lock(&priv->lock);
+    memcpy(tlv->tlv, vctl->data, tlv->length);
+    pthread_mutex_unlock(&priv->lock);
+
+    return 0;
+}
+
+static int vmix_tlv_ctl_put(struct mixer_plugin *plugin,
+                struct snd_control *ctl, struct snd_ctl_tlv *tlv)
+{
+    struct vmix_priv *priv = plugin->priv;
+    struct vmix_ctl *vctl = ctl->private_data;
+    int ret;
+
+    if (tlv->length > vctl->count)
+        return -EINVAL;
+
+    ret = vmix_access(priv);
+    if (ret)
+        return ret;
+
+    pthread_mutex_lock(&priv->lock);
+    if (memcmp(vctl->data, tlv->tlv, tlv->length)) {
+        memcpy(vctl->data, tlv->tlv, tlv->length);
+        vmix_raise_event(plugin, ctl);
+    }
+    pthread_mutex_unlock(&priv->lock);
+
+    return 0;
+}
+
+static int vmix_shared_int_get(struct mixer_plugin *plugin,
+                struct snd_control *ctl, struct snd_ctl_elem_value *ev)
+{
+    struct vmix_priv *priv = plugin->priv;
+    struct vmix_ctl *vctl = ctl->private_data;
+    int32_t values[SHCTL_MAX_VALUES];
+    unsigned int i;
+    int ret;
+
+    ret = vmix_access(priv);
+    if (ret)
+        return ret;
+
+    if (!shctl_valid(vctl->shared))
+        return -EIO;
+    ret = shctl_read(vctl->shared, values, sizeof(values), NULL);
+    if (ret)
+        return ret;
+    for (i = 0; i < vctl->count; i++)
+        ev->value.integer.value[i] = values[i];
+
+    return 0;
+}
+
+static int vmix_shared_int_put(struct mixer_plugin *plugin,
+                struct snd_control *ctl, struct snd_ctl_elem_value *ev)
+{
+    struct vmix_priv *priv = plugin->priv;
+    struct vmix_ctl *vctl = ctl->private_data;
+    struct snd_value_int *val = &vctl->value.integer.integer;
+    int32_t values[SHCTL_MAX_VALUES];
+    unsigned int i;
+    int ret;
+
+    for (i = 0; i < vctl->count; i++) {
+        if (ev->value.integer.value[i] < val->min ||
+            ev->value.integer.value[i] > val->max)
+            return -EINVAL;
+        values[i] = ev->value.integer.value[i];
+    }
+
+    ret = vmix_access(priv);
+    if (ret)
+        return ret;
+
+    if (!shctl_valid(vctl->shared))
+        return -EIO;
+
+    pthread_mutex_lock(&priv->lock);
+    ret = shctl_write(priv->shctl, vctl->shared, values, vctl->count * sizeof(values[0]));
+    if (ret > 0)
+        vmix_raise_event(plugin, ctl);
+    pthread_mutex_unlock(&priv->lock);
+
+    return ret < 0 ? ret : 0;
+}
+
+static int vmix_shared_tlv_get(struct mixer_plugin *plugin,
+                struct snd_control *ctl, struct snd_ctl_tlv *tlv)
+{
+    struct vmix_priv *priv = plugin->priv;
+    struct vmix_ctl *vctl = ctl->private_data;
+    int ret;
+
+    if (tlv->length > vctl->count)
+        return -EINVAL;
+
+    ret = vmix_access(priv);
+    if (ret)
+        return ret;
+
+    if (!shctl_valid(vctl->shared))
+        return -EIO;
+    return shctl_read(vctl->shared, tlv->tlv, tlv->length, NULL);
+}
+
+static int vmix_shared_tlv_put(struct mixer_plugin *plugin,
+                struct snd_control *ctl, struct snd_ctl_tlv *tlv)
+{
+    struct vmix_priv *priv = plugin->priv;
+    struct vmix_ctl *vctl = ctl->private_data;
+    int ret;
+
+    if (tlv->length > vctl->count)
+        return -EINVAL;
+
+    ret = vmix_access(priv);
+    if (ret)
+        return ret;
+
+    if (!shctl_valid(vctl->shared))
+        return -EIO;
+
+    pthread_mutex_lock(&priv->lock);
+    ret = shctl_write(priv->shctl, vctl->shared, tlv->tlv, tlv->length);
+    if (ret > 0)
+        vmix_raise_event(plugin, ctl);
+    pthread_mutex_unlock(&priv->lock);
+
+    return ret < 0 ? ret : 0;
+}
+
+/* Splits a line into words, keeping quoted words whole */
+static int vmix_tokenize(char *line, char **tokens)
+{
+    int n = 0;
+
+    while (*line) {
+        while (isspace((unsigned char)*line))
+            line++;
+        if (!*line || *line == '#')
+            break;
+        if (n == VMIX_MAX_TOKENS)
+            return -EINVAL;
+
+        if (*line == '"') {
+            tokens[n++] = ++line;
+            line = strchr(line, '"');
+            if (!line)
+                return -EINVAL;
+        } else {
+            tokens[n++] = line;
+            while (*line && !isspace((unsigned char)*line))
+                line++;
+            if (!*line)
+                break;
+        }
+        *line++ = '\0';
+    }
+
+    return n;
+}
+
+static int vmix_parse_int(const char *token, long min, long max, long *val)
+{
+    char *end;
+
+    errno = 0;
+    *val = strtol(token, &end, 0);
+    if (errno || end == token || *end || *val < min || *val > max)
+        return -EINVAL;
+
+    return 0;
+}
+
+/* Replaces %u in a repeated control name with its index */
+static char *vmix_ctl_name(const char *name, unsigned int index)
+{
+    const char *pos = index ? strstr(name, "%u") : NULL;
+    char *ctl_name;
+    size_t size;
+
+    if (!pos)
+        return strdup(name);
+
+    size = strlen(name) + 16;
+    ctl_name = malloc(size);
+    if (ctl_name)
+        snprintf(ctl_name, size, "%.*s%u%s", (int)(pos - name), name, index, pos + 2);
+
+    return ctl_name;
+}
+
+static struct snd_control *vmix_new_ctl(struct vmix_priv *priv)
+{
+    struct snd_control *ctls;
+    struct vmix_ctl *vctl;
+    unsigned int space;
+
+    if (priv->ctl_count == priv->ctl_space) {
+        space = priv->ctl_space ? priv->ctl_space * 2 : 32;
+        ctls = realloc(priv->ctls, space * sizeof(*ctls));
+        if (!ctls)
+            return NULL;
+        priv->ctls = ctls;
+        priv->ctl_space = space;
+    }
+
+    vctl = calloc(1, sizeof(*vctl));
+    if (!vctl)
+        return NULL;
+
+    memset(&priv->ctls[priv->ctl_count], 0, sizeof(*priv->ctls));
+    priv->ctls[priv->ctl_count].private_data = vctl;
+    return &priv->ctls[priv->ctl_count++];
+}
+
+static int vmix_add_integer(struct snd_control *ctl, char **tokens, int n, int boolean)
+{
+    struct vmix_ctl *vctl = ctl->private_data;
+    long count, min = 0, max = 1, step = 1, db_min, db_step;
+    int pos = boolean ? 3 : 5;
+    int ret;
+
+    if (n < pos)
+        return -EINVAL;
+
+    ret = vmix_parse_int(tokens[2], 1, VMIX_MAX_VALUES, &count);
+    if (!boolean && !ret)
+        ret = vmix_parse_int(tokens[3], INT32_MIN, INT32_MAX, &min);
+    if (!boolean && !ret)
+        ret = vmix_parse_int(tokens[4], min + 1, INT32_MAX, &max);
+    if (!boolean && !ret && n > pos && strcmp(tokens[pos], "dB"))
+        ret = vmix_parse_int(tokens[pos++], 1, max - min, &step);
+    if (ret)
+        return ret;
+
+    /* the optional dB scale */
+    tokens += pos;
+    n -= pos;
+    if (n > 0) {
+        if (n < 3 || n > 4 || strcmp(tokens[0], "dB") ||
+            vmix_parse_int(tokens[1], INT32_MIN, INT32_MAX, &db_min) ||
+            vmix_parse_int(tokens[2], 0, SNDRV_CTL_TLVD_DB_SCALE_MASK, &db_step))
+            return -EINVAL;
+        if (n == 4 && strcmp(tokens[3], "mute"))
+            return -EINVAL;
+
+        vctl->db_scale[0] = SNDRV_CTL_TLVT_DB_SCALE;
+        vctl->db_scale[1] = 2 * sizeof(unsigned int);
+        vctl->db_scale[2] = (unsigned int)db_min;
+        vctl->db_scale[3] = db_step | (n == 4 ? SNDRV_CTL_TLVD_DB_SCALE_MUTE : 0);
+        vctl->value.integer.tlv = vctl->db_scale;
+    }
+
+    vctl->values = malloc(count * sizeof(*vctl->values));
+    if (!vctl->values)
+        return -ENOMEM;
+    vctl->count = count;
+    while (count--)
+        vctl->values[count] = min;
+
+    vctl->value.integer.integer.count = vctl->count;
+    vctl->value.integer.integer.min = min;
+    vctl->value.integer.integer.max = max;
+    vctl->value.integer.integer.step = step;
+
+    if (vctl->value.integer.tlv)
+        INIT_SND_CONTROL_INTEGER_TLV(ctl, ctl->name, vmix_int_ctl_get, vmix_int_ctl_put,
+                vctl->value.integer, 0, vctl)
+    else
+        INIT_SND_CONTROL_INTEGER(ctl, ctl->name, vmix_int_ctl_get, vmix_int_ctl_put,
+                vctl->value.integer.integer, 0, vctl)
+    if (boolean)
+        ctl->type = SNDRV_CTL_ELEM_TYPE_BOOLEAN;
+
+    return 0;
+}
+
+static int vmix_add_enum(struct snd_control *ctl, char **tokens, int n)
+{
+    struct vmix_ctl *vctl = ctl->private_data;
+    struct snd_value_enum *e = &vctl->value.enumerated;
+    int i;
+
+    if (n < 3)
+        return -EINVAL;
+
+    /* set early, so that vmix_free_ctls() frees the texts on failure */
+    ctl->type = SNDRV_CTL_ELEM_TYPE_ENUMERATED;
+    vctl->values = calloc(1, sizeof(*vctl->values));
+    e->texts = calloc(n - 2, sizeof(*e->texts));
+    if (!vctl->values || !e->texts)
+        return -ENOMEM;
+    vctl->count = 1;
+
+    for (i = 2; i < n; i++) {
+        e->texts[e->items] = strdup(tokens[i]);
+        if (!e->texts[e->items])
+            return -ENOMEM;
+        e->items++;
+    }
+
+    INIT_SND_CONTROL_ENUM(ctl, ctl->name, vmix_enum_ctl_get, vmix_enum_ctl_put,
+            e, 0, vctl);
+    return 0;
+}
+
+static int vmix_add_bytes(struct snd_control *ctl, char **tokens, int n, int tlv)
+{
+    struct vmix_ctl *vctl = ctl->private_data;
+    struct snd_ctl_elem_value *ev;
+    long size;
+
+    if (n != 3 || vmix_parse_int(tokens[2], 1,
+            tlv ? VMIX_MAX_TLV_BYTES : (long)sizeof(ev->value.bytes.data), &size))
+        return -EINVAL;
+
+    vctl->data = calloc(1, size);
+    if (!vctl->data)
+        return -ENOMEM;
+    vctl->count = size;
+
+    if (tlv) {
+        vctl->value.tlv.size = size;
+        vctl->value.tlv.get = vmix_tlv_ctl_get;
+        vctl->value.tlv.put = vmix_tlv_ctl_put;
+        INIT_SND_CONTROL_TLV_BYTES(ctl, ctl->name, vctl->value.tlv, 0, vctl);
+    } else {
+        vctl->value.bytes.size = size;
+        INIT_SND_CONTROL_BYTES(ctl, ctl->name, vmix_bytes_ctl_get, vmix_bytes_ctl_put,
+                vctl->value.bytes, 0, vctl);
+    }
+
+    return 0;
+}
+
+static int vmix_add_ctl(struct vmix_priv *priv, char **tokens, int n, unsigned int index)
+{
+    struct snd_control *ctl;
+
+    if (n < 2)
+        return -EINVAL;
+
+    ctl = vmix_new_ctl(priv);
+    if (!ctl)
+        return -ENOMEM;
+
+    ctl->name = vmix_ctl_name(tokens[1], index);
+    if (!ctl->name)
+        return -ENOMEM;
+
+    if (!strcmp(tokens[0], "int"))
+        return vmix_add_integer(ctl, tokens, n, 0);
+    if (!strcmp(tokens[0], "bool"))
+        return vmix_add_integer(ctl, tokens, n, 1);
+    if (!strcmp(tokens[0], "enum"))
+        return vmix_add_enum(ctl, tokens, n);
+    if (!strcmp(tokens[0], "bytes"))
+        return vmix_add_bytes(ctl, tokens, n, 0);
+    if (!strcmp(tokens[0], "tlv"))
+        return vmix_add_bytes(ctl, tokens, n, 1);
+
+    return -EINVAL;
+}
+
+/* Adds the controls the PCM plugins of the card have shared so far */
+static int vmix_add_shared(struct vmix_priv *priv, unsigned int card)
+{
+    struct shctl_entry *entry;
+    struct snd_control *ctl;
+    struct vmix_ctl *vctl;
+    unsigned int count, i;
+    uint32_t type, size;
+
+    priv->shctl = shctl_open(card, 0);
+    if (!priv->shctl)
+        return 0;
+
+    count = shctl_count(priv->shctl);
+    for (i = 0; i < count; i++) {
+        entry = shctl_get(priv->shctl, i);
+        if (!entry)
+            continue;
+        /* checked as copied, the table can change at any time */
+        type = entry->type;
+        size = entry->count;
+        if (size == 0 || size > (type == SHCTL_TYPE_BYTES ? SHCTL_MAX_BYTES : SHCTL_MAX_VALUES))
+            continue;
+
+        ctl = vmix_new_ctl(priv);
+        if (!ctl)
+            return -ENOMEM;
+        ctl->name = strndup(entry->name, SHCTL_NAME_SIZE - 1);
+        if (!ctl->name)
+            return -ENOMEM;
+
+        vctl = ctl->private_data;
+        vctl->shared = entry;
+        vctl->count = size;
+
+        if (type == SHCTL_TYPE_BYTES) {
+            vctl->value.tlv.size = vctl->count;
+            vctl->value.tlv.get = vmix_shared_tlv_get;
+            vctl->value.tlv.put = vmix_shared_tlv_put;
+            INIT_SND_CONTROL_TLV_BYTES(ctl, ctl->name, vctl->value.tlv, 0, vctl);
+            continue;
+        }
+
+        vctl->value.integer.integer.count = vctl->count;
+        vctl->value.integer.integer.min = entry->min;
+        vctl->value.integer.integer.max = entry->max;
+        vctl->value.integer.integer.step = entry->step;
+        if (entry->db_scale[0]) {
+            memcpy(vctl->db_scale, entry->db_scale, sizeof(vctl->db_scale));
+            vctl->value.integer.tlv = vctl->db_scale;
+            INIT_SND_CONTROL_INTEGER_TLV(ctl, ctl->name, vmix_shared_int_get,
+                    vmix_shared_int_put, vctl->value.integer, 0, vctl)
+        } else {
+            INIT_SND_CONTROL_INTEGER(ctl, ctl->name, vmix_shared_int_get,
+                    vmix_shared_int_put, vctl->value.integer.integer, 0, vctl)
+        }
+    }
+
+    return 0;
+}
+
+static int vmix_parse(struct vmix_priv *priv, char *text, const char *source)
+{
+    char *tokens[VMIX_MAX_TOKENS];
+    char *line, *next;
+    unsigned int line_no = 0;
+    long repeat = 0, i;
+    int n, ret = 0;
+
+    for (line = text; line && !ret; line = next) {
+        next = strchr(line, '\n');
+        if (next)
+            *next++ = '\0';
+        line_no++;
+
+        n = vmix_tokenize(line, tokens);
+        if (n == 0)
+            continue;
+
+        if (n > 0 && !strcmp(tokens[0], "repeat")) {
+            if (n != 2 || vmix_parse_int(tokens[1], 1, 65536, &repeat))
+                ret = -EINVAL;
+            continue;
+        }
+
+        ret = n < 0 ? n : 0;
+        for (i = 0; i < (repeat ? repeat : 1) && !ret; i++)
+            ret = vmix_add_ctl(priv, tokens, n, repeat ? i + 1 : 0);
+        repeat = 0;
+    }
+
+    if (ret == -EINVAL)
+        fprintf(stderr, "%s:%u: invalid control description\n", source, line_no);
+
+    return ret;
+}
+
+static char *vmix_read_file(const char *path)
+{
+    FILE *file;
+    char *text = NULL;
+    long size;
+
+    file = fopen(path, "r");
+    if (!file)
+        return NULL;
+
+    if (fseek(file, 0, SEEK_END) || (size = ftell(file)) < 0 ||
+        fseek(file, 0, SEEK_SET))
+        goto out;
+
+    text = malloc(size + 1);
+    if (text && fread(text, 1, size, file) != (size_t)size) {
+        free(text);
+        text = NULL;
+    } else if (text) {
+        text[size] = '\0';
+    }
+
+out:
+    fclose(file);
+    return text;
+}
+
+/* Changes integer controls in turn, as jack detection or a DSP would */
+static void *vmix_event_thread(void *arg)
+{
+    struct mixer_plugin *plugin = arg;
+    struct vmix_priv *priv = plugin->priv;
+    struct snd_control *ctl;
+    struct vmix_ctl *vctl;
+    struct snd_value_int *val;
+    struct timespec ts;
+    unsigned int next = 0, i;
+
+    pthread_mutex_lock(&priv->lock);
+    clock_gettime(CLOCK_REALTIME, &ts);
+    while (!priv->stopping) {
+        ts.tv_nsec += priv->event_ns;
+        ts.tv_sec += ts.tv_nsec / 1000000000LL;
+        ts.tv_nsec %= 1000000000LL;
+        if (pthread_cond_timedwait(&priv->event_cond, &priv->lock, &ts) != ETIMEDOUT)
+            continue;
+
+        for (i = 0; i < priv->ctl_count; i++) {
+            ctl = &priv->ctls[(next + i) % priv->ctl_count];
+            vctl = ctl->private_data;
+            if ((ctl->type == SNDRV_CTL_ELEM_TYPE_INTEGER ||
+                 ctl->type == SNDRV_CTL_ELEM_TYPE_BOOLEAN) && !vctl->shared)
+                break;
+        }
+        if (i == priv->ctl_count)
+            continue;
+        next = (next + i + 1) % priv->ctl_count;
+
+        val = &vctl->value.integer.integer;
+        vctl->values[0] = vctl->values[0] < val->max ? vctl->values[0] + 1 : val->min;
+        vmix_raise_event(plugin, ctl);
+    }
+    pthread_mutex_unlock(&priv->lock);
+
+    return NULL;
+}
+
+static ssize_t vmix_read_event(struct mixer_plugin *plugin,
+                              struct snd_ctl_event *ev, size_t size)
+{
+    struct vmix_priv *priv = plugin->priv;
+    size_t count = 0;
+
+    while ((count + 1) * sizeof(*ev) <= size && vmix_pop_event(priv, ev + count))
+        count++;
+
+    return count * sizeof(*ev);
+}
+
+static int vmix_subscribe_events(struct mixer_plugin *plugin,
+                                  mixer_event_callback event_cb)
+{
+    struct vmix_priv *priv = plugin->priv;
+    struct snd_ctl_event ev;
+
+    pthread_mutex_lock(&priv->lock);
+    priv->event_cb = event_cb;
+    if (!event_cb) {
+        while (vmix_pop_event(priv, &ev))
+            ;
+    }
+    pthread_mutex_unlock(&priv->lock);
+
+    return 0;
+}
+
+static void vmix_free_ctls(struct vmix_priv *priv)
+{
+    struct snd_control *ctl;
+    struct vmix_ctl *vctl;
+    unsigned int i, j;
+
+    for (i = 0; i < priv->ctl_count; i++) {
+        ctl = &priv->ctls[i];
+        vctl = ctl->private_data;
+        if (ctl->type == SNDRV_CTL_ELEM_TYPE_ENUMERATED) {
+            for (j = 0; j < vctl->value.enumerated.items; j++)
+                free(vctl->value.enumerated.texts[j]);
+            free(vctl->value.enumerated.texts);
+        }
+        free(vctl->values);
+        free(vctl->data);
+        free(vctl);
+        free((void *)ctl->name);
+    }
+
+    free(priv->ctls);
+    priv->ctls = NULL;
+    priv->ctl_count = 0;
+}
+
+static void vmix_close(struct mixer_plugin **plugin)
+{
+    struct mixer_plugin *mp = *plugin;
+    struct vmix_priv *priv = mp->priv;
+
+    if (priv->event_thread_running) {
+        pthread_mutex_lock(&priv->lock);
+        priv->stopping = 1;
+        pthread_cond_signal(&priv->event_cond);
+        pthread_mutex_unlock(&priv->lock);
+        pthread_join(priv->event_thread, NULL);
+    }
+
+    vmix_subscribe_events(mp, NULL);
+    vmix_free_ctls(priv);
+    shctl_close(priv->shctl);
+    pthread_cond_destroy(&priv->event_cond);
+    pthread_mutex_destroy(&priv->lock);
+    free(priv);
+    free(mp);
+    *plugin = NULL;
+}
+
+static long long vmix_getenv(const char *name)
+{
+    const char *value = getenv(name);
+
+    return value ? atoll(value) : 0;
+}
+
+int vmix_open(struct mixer_plugin **plugin, unsigned int card)
+{
+    struct mixer_plugin *mp;
+    struct vmix_priv *priv;
+    const char *path = getenv("TINYALSA_VMIX_FILE");
+    char *text;
+    unsigned int i;
+    int ret;
+
+    mp = calloc(1, sizeof(*mp));
+    if (!mp)
+        return -ENOMEM;
+
+    priv = calloc(1, sizeof(*priv));
+    if (!priv) {
+        free(mp);
+        return -ENOMEM;
+    }
+
+    pthread_mutex_init(&priv->lock, NULL);
+    pthread_cond_init(&priv->event_cond, NULL);
+    for (i = 0; i < VMIX_EVENT_QUEUE; i++)
+        priv->events[i].seq = i;
+    priv->latency_ns = vmix_getenv("TINYALSA_VMIX_LATENCY_US") * 1000;
+    priv->error_rate = vmix_getenv("TINYALSA_VMIX_ERROR_RATE");
+    priv->event_ns = vmix_getenv("TINYALSA_VMIX_EVENT_US") * 1000;
+    mp->priv = priv;
+    mp->card = card;
+
+    text = path ? vmix_read_file(path) : strdup(vmix_default_controls);
+    if (!text) {
+        ret = path ? -errno : -ENOMEM;
+        goto err;
+    }
+
+    ret = vmix_parse(priv, text, path ? path : "built-in");
+    free(text);
+    if (!ret)
+        ret = vmix_add_shared(priv, card);
+    if (ret)
+        goto err;
+
+    if (priv->event_ns > 0 && priv->ctl_count) {
+        ret = -pthread_create(&priv->event_thread, NULL, vmix_event_thread, mp);
+        if (ret)
+            goto err;
+        priv->event_thread_running = 1;
+    }
+
+    mp->controls = priv->ctls;
+    mp->num_controls = priv->ctl_count;
+    *plugin = mp;
+
+    return 0;
+
+err:
+    vmix_close(&mp);
+    return ret;
+}
+
+struct mixer_plugin_ops mixer_plugin_ops = {
+    .open = vmix_open,
+    .close = vmix_close,
+    .subscribe_events = vmix_subscribe_events,
+    .read_event = vmix_read_event,
+};
@@ -0,0 +1,909 @@
+/* virtual_pcm_plugin.c
+**
+** Copyright 2026, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+/*
+ * A PCM plugin that behaves like sound hardware, without any.
+ *
+ * A simulated DMA moves one period at a time through the ring buffer,
+ * clocked by CLOCK_MONOTONIC at the configured rate. The hardware pointer,
+ * timestamps, poll, mmap and xruns behave as they do for a kernel driver,
+ * so the PCM layer can be tested and benchmarked on machines without a
+ * sound card.
+ *
+ * Devices:
+ *   0, 1 - loopback; playback on one device is captured on the other
+ *   2    - null; playback is discarded, capture is silence
+ *   3    - file; playback is written to and capture is read from a file
+ *
+ * The clock is configured with environment variables:
+ *   TINYALSA_VPCM_JITTER_US   - maximum delay of each period, in microseconds
+ *   TINYALSA_VPCM_PPM         - deviation of the clock from its nominal rate
+ *   TINYALSA_VPCM_CAPTURE_PPM - overrides TINYALSA_VPCM_PPM for capture streams,
+ *                               to run them from a clock of their own
+ *   TINYALSA_VPCM_FILE        - the file used by the file device
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <linux/ioctl.h>
+#include <sound/asound.h>
+#include <tinyalsa/plugin.h>
+#include <tinyalsa/asoundlib.h>
+
+/* 2 words of uint32_t = 64 bits of mask */
+#define PCM_MASK_SIZE (2)
+#define PCM_FORMAT_BIT(x) (1ULL << x)
+
+#define VPCM_LOOPBACK_DEVICES 2
+#define VPCM_DEVICE_NULL 2
+#define VPCM_DEVICE_FILE 3
+
+/* the loopback wire holds this many capture buffers */
+#define VPCM_WIRE_BUFFERS 4
+
+#define VPCM_NS_PER_SEC 1000000000LL
+
+enum vpcm_sink {
+    VPCM_SINK_LOOPBACK,
+    VPCM_SINK_NULL,
+    VPCM_SINK_FILE,
+};
+
+/*
+ * Carries the periods played on a loopback device to the capture stream
+ * of the other one, while that stream is running.
+ */
+struct vpcm_wire {
+    pthread_mutex_t lock;
+    char *data;
+    size_t size;
+    size_t head;
+    size_t fill;
+    /* frame size of the running capture stream, or zero */
+    unsigned int frame_bytes;
+};
+
+static struct vpcm_wire vpcm_wires[VPCM_LOOPBACK_DEVICES] = {
+    { .lock = PTHREAD_MUTEX_INITIALIZER },
+    { .lock = PTHREAD_MUTEX_INITIALIZER },
+};
+
+struct vpcm_priv {
+    unsigned int device;
+    enum vpcm_sink sink;
+    int capture;
+    int nonblock;
+    FILE *file;
+
+    int access;
+    unsigned int rate;
+    unsigned int channels;
+    unsigned int frame_bytes;
+    unsigned int period_size;
+    unsigned int buffer_size;
+    char *buffer;
+
+    unsigned long boundary;
+    unsigned long hw_ptr;
+    unsigned long appl_ptr;
+    unsigned long avail_min;
+    unsigned long start_threshold;
+    unsigned long stop_threshold;
+    int draining;
+
+    /* the simulated clock */
+    double ppm;
+    long long jitter_ns;
+    uint32_t seed;
+    long long start_ns;
+    long long next_ns;
+    unsigned long long periods;
+    long long tstamp_ns;
+    int tstamp_type;
+};
+
+static struct pcm_plugin_hw_constraints vpcm_constrs = {
+    .access = 0,
+    .format = 0,
+    .bit_width = {
+        .min = 8,
+        .max = 32,
+    },
+    .channels = {
+        .min = 1,
+        .max = 32,
+    },
+    .rate = {
+        .min = 8000,
+        .max = 768000,
+    },
+    .periods = {
+        .min = 1,
+        .max = 1024,
+    },
+    .period_bytes = {
+        .min = 32,
+        .max = 1048576,
+    },
+};
+
+static inline struct snd_interval *param_to_interval(struct snd_pcm_hw_params *p,
+                                                  int n)
+{
+    return &(p->intervals[n - SNDRV_PCM_HW_PARAM_FIRST_INTERVAL]);
+}
+
+static unsigned int param_get_int(struct snd_pcm_hw_params *p, int n)
+{
+    struct snd_interval *i = param_to_interval(p, n);
+
+    if (i->integer)
+        return i->max;
+    return 0;
+}
+
+static inline struct snd_mask *param_to_mask(struct snd_pcm_hw_params *p, int n)
+{
+    return &(p->masks[n - SNDRV_PCM_HW_PARAM_FIRST_MASK]);
+}
+
+static int param_get_mask_val(struct snd_pcm_hw_params *p, int n)
+{
+    struct snd_mask *mask = param_to_mask(p, n);
+    int i;
+
+    for (i = 0; i < PCM_MASK_SIZE * 32; i++) {
+        if (mask->bits[i >> 5] & (1U << (i & 31)))
+            return i;
+    }
+    return -1;
+}
+
+static int alsaformat_to_bitwidth(int format)
+{
+    switch (format) {
+    case SNDRV_PCM_FORMAT_S8:
+        return 8;
+    case SNDRV_PCM_FORMAT_S16_LE:
+        return 16;
+    case SNDRV_PCM_FORMAT_S24_3LE:
+        return 24;
+    case SNDRV_PCM_FORMAT_S24_LE:
+    case SNDRV_PCM_FORMAT_S32_LE:
+    case SNDRV_PCM_FORMAT_FLOAT_LE:
+        return 32;
+    default:
+        return 0;
+    };
+}
+
+static long long vpcm_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * VPCM_NS_PER_SEC + ts.tv_nsec;
+}
+
+static void vpcm_sleep_until(long long ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ns / VPCM_NS_PER_SEC;
+    ts.tv_nsec = ns % VPCM_NS_PER_SEC;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+static uint32_t vpcm_random(struct vpcm_priv *priv)
+{
+    /* xorshift32 */
+    priv->seed ^= priv->seed << 13;
+    priv->seed ^= priv->seed >> 17;
+    priv->seed ^= priv->seed << 5;
+    return priv->seed;
+}
+
+/* schedules the end of the next period, with the clock's deviation and jitter */
+static void vpcm_schedule(struct vpcm_priv *priv)
+{
+    double rate = priv->rate * (1.0 + priv->ppm * 1e-6);
+
+    priv->next_ns = priv->start_ns +
+            (long long) ((priv->periods + 1) * (double) priv->period_size *
+                         VPCM_NS_PER_SEC / rate);
+    if (priv->jitter_ns)
+        priv->next_ns += vpcm_random(priv) % (unsigned long long) priv->jitter_ns;
+}
+
+static unsigned long vpcm_ptr_add(struct vpcm_priv *priv, unsigned long ptr,
+                                  unsigned long frames)
+{
+    ptr += frames;
+    if (ptr >= priv->boundary)
+        ptr -= priv->boundary;
+    return ptr;
+}
+
+/* a - b, for ring pointers that wrap at the boundary */
+static long vpcm_ptr_delta(struct vpcm_priv *priv, unsigned long a, unsigned long b)
+{
+    unsigned long d = a >= b ? a - b : a + (priv->boundary - b);
+
+    if (d > priv->boundary / 2)
+        return (long) d - (long) priv->boundary;
+    return (long) d;
+}
+
+static long vpcm_avail(struct vpcm_priv *priv)
+{
+    if (priv->capture)
+        return vpcm_ptr_delta(priv, priv->hw_ptr, priv->appl_ptr);
+
+    return priv->buffer_size - vpcm_ptr_delta(priv, priv->appl_ptr, priv->hw_ptr);
+}
+
+static void vpcm_wire_attach(struct vpcm_priv *priv)
+{
+    struct vpcm_wire *wire = &vpcm_wires[priv->device ^ 1];
+    size_t size = (size_t) priv->buffer_size * priv->frame_bytes * VPCM_WIRE_BUFFERS;
+
+    pthread_mutex_lock(&wire->lock);
+    if (wire->size < size) {
+        char *data = realloc(wire->data, size);
+        if (data) {
+            wire->data = data;
+            wire->size = size;
+        }
+    }
+    wire->head = 0;
+    wire->fill = 0;
+    if (wire->size >= size)
+        wire->frame_bytes = priv->frame_bytes;
+    pthread_mutex_unlock(&wire->lock);
+}
+
+static void vpcm_wire_detach(struct vpcm_priv *priv)
+{
+    struct vpcm_wire *wire = &vpcm_wires[priv->device ^ 1];
+
+    pthread_mutex_lock(&wire->lock);
+    wire->frame_bytes = 0;
+    wire->fill = 0;
+    pthread_mutex_unlock(&wire->lock);
+}
+
+static void vpcm_wire_push(struct vpcm_priv *priv, const char *src, size_t bytes)
+{
+    struct vpcm_wire *wire = &vpcm_wires[priv->device];
+
+    pthread_mutex_lock(&wire->lock);
+    if (wire->frame_bytes == priv->frame_bytes && bytes <= wire->size) {
+        size_t tail, n;
+
+        /* drop the oldest data if the capture side is not keeping up */
+        if (wire->fill + bytes > wire->size) {
+            size_t drop = wire->fill + bytes - wire->size;
+            wire->head = (wire->head + drop) % wire->size;
+            wire->fill -= drop;
+        }
+
+        tail = (wire->head + wire->fill) % wire->size;
+        n = wire->size - tail < bytes ? wire->size - tail : bytes;
+        memcpy(wire->data + tail, src, n);
+        memcpy(wire->data, src + n, bytes - n);
+        wire->fill += bytes;
+    }
+    pthread_mutex_unlock(&wire->lock);
+}
+
+static void vpcm_wire_pull(struct vpcm_priv *priv, char *dst, size_t bytes)
+{
+    struct vpcm_wire *wire = &vpcm_wires[priv->device ^ 1];
+    size_t count = 0;
+
+    pthread_mutex_lock(&wire->lock);
+    if (wire->frame_bytes == priv->frame_bytes) {
+        size_t n;
+
+        count = wire->fill < bytes ? wire->fill : bytes;
+        n = wire->size - wire->head < count ? wire->size - wire->head : count;
+        memcpy(dst, wire->data + wire->head, n);
+        memcpy(dst + n, wire->data, count - n);
+        wire->head = (wire->head + count) % wire->size;
+        wire->fill -= count;
+    }
+    pthread_mutex_unlock(&wire->lock);
+
+    /* the playback side has fallen behind, or is not running */
+    memset(dst + count, 0, bytes - count);
+}
+
+static void vpcm_file_read(struct vpcm_priv *priv, char *dst, size_t bytes)
+{
+    size_t count = 0;
+
+    while (priv->file && count < bytes) {
+        size_t n = fread(dst + count, 1, bytes - count, priv->file);
+        if (n == 0) {
+            /* loop the file, unless it is empty */
+            if (ftell(priv->file) == 0)
+                break;
+            rewind(priv->file);
+        }
+        count += n;
+    }
+    memset(dst + count, 0, bytes - count);
+}
+
+static void vpcm_start(struct pcm_plugin *plugin)
+{
+    struct vpcm_priv *priv = plugin->priv;
+
+    priv->start_ns = vpcm_now();
+    priv->periods = 0;
+    priv->tstamp_ns = priv->start_ns;
+    priv->draining = 0;
+    vpcm_schedule(priv);
+
+    if (priv->capture && priv->sink == VPCM_SINK_LOOPBACK)
+        vpcm_wire_attach(priv);
+
+    plugin->state = PCM_PLUG_STATE_RUNNING;
+}
+
+static void vpcm_stop(struct pcm_plugin *plugin, int state)
+{
+    struct vpcm_priv *priv = plugin->priv;
+
+    if (priv->capture && priv->sink == VPCM_SINK_LOOPBACK &&
+        plugin->state == PCM_PLUG_STATE_RUNNING)
+        vpcm_wire_detach(priv);
+
+    priv->draining = 0;
+    plugin->state = state;
+}
+
+/* the simulated DMA transfers one period */
+static void vpcm_period(struct pcm_plugin *plugin)
+{
+    struct vpcm_priv *priv = plugin->priv;
+    size_t bytes = (size_t) priv->period_size * priv->frame_bytes;
+    char *period = priv->buffer +
+            (size_t) (priv->hw_ptr % priv->buffer_size) * priv->frame_bytes;
+
+    if (priv->capture) {
+        switch (priv->sink) {
+        case VPCM_SINK_LOOPBACK:
+            vpcm_wire_pull(priv, period, bytes);
+            break;
+        case VPCM_SINK_FILE:
+            vpcm_file_read(priv, period, bytes);
+            break;
+        default:
+            memset(period, 0, bytes);
+            break;
+        }
+    } else {
+        switch (priv->sink) {
+        case VPCM_SINK_LOOPBACK:
+            vpcm_wire_push(priv, period, bytes);
+            break;
+        case VPCM_SINK_FILE:
+            if (priv->file)
+                fwrite(period, 1, bytes, priv->file);
+            break;
+        default:
+            break;
+        }
+    }
+
+    priv->hw_ptr = vpcm_ptr_add(priv, priv->hw_ptr, priv->period_size);
+    priv->tstamp_ns = priv->next_ns;
+    priv->periods++;
+    vpcm_schedule(priv);
+
+    if (priv->draining && vpcm_avail(priv) >= (long) priv->buffer_size)
+        vpcm_stop(plugin, PCM_PLUG_STATE_SETUP);
+    else if (vpcm_avail(priv) >= (long) priv->stop_threshold)
+        vpcm_stop(plugin, PCM_PLUG_STATE_XRUN);
+}
+
+/* runs the simulated DMA up to the current time */
+static void vpcm_update(struct pcm_plugin *plugin)
+{
+    struct vpcm_priv *priv = plugin->priv;
+    long long now = vpcm_now();
+
+    while (plugin->state == PCM_PLUG_STATE_RUNNING && now >= priv->next_ns)
+        vpcm_period(plugin);
+}
+
+/* waits for the next period, or until the deadline if it is sooner */
+static void vpcm_wait(struct pcm_plugin *plugin, long long deadline_ns)
+{
+    struct vpcm_priv *priv = plugin->priv;
+    long long until;
+
+    if (plugin->state == PCM_PLUG_STATE_RUNNING)
+        until = priv->next_ns;
+    else
+        /* another thread may start the stream */
+        until = vpcm_now() + VPCM_NS_PER_SEC / 1000;
+
+    if (deadline_ns >= 0 && deadline_ns < until)
+        until = deadline_ns;
+
+    vpcm_sleep_until(until);
+}
+
+static void vpcm_copy(struct vpcm_priv *priv, unsigned long offset, void *data,
+                      int planar, unsigned long user_offset, unsigned long frames)
+{
+    char *ring = priv->buffer + (size_t) offset * priv->frame_bytes;
+    unsigned int width = priv->frame_bytes / priv->channels;
+    unsigned long i;
+    unsigned int c;
+
+    if (!planar) {
+        char *user = (char *) data + (size_t) user_offset * priv->frame_bytes;
+
+        if (priv->capture)
+            memcpy(user, ring, (size_t) frames * priv->frame_bytes);
+        else
+            memcpy(ring, user, (size_t) frames * priv->frame_bytes);
+        return;
+    }
+
+    for (c = 0; c < priv->channels; c++) {
+        char *user = ((char **) data)[c] + (size_t) user_offset * width;
+        char *sample = ring + c * width;
+
+        for (i = 0; i < frames; i++) {
+            if (priv->capture)
+                memcpy(user, sample, width);
+            else
+                memcpy(sample, user, width);
+            user += width;
+            sample += priv->frame_bytes;
+        }
+    }
+}
+
+static int vpcm_transfer(struct pcm_plugin *plugin, void *data, int planar,
+                         unsigned long frames, snd_pcm_uframes_t *result)
+{
+    struct vpcm_priv *priv = plugin->priv;
+    unsigned long done = 0;
+
+    if (priv->capture && plugin->state == PCM_PLUG_STATE_PREPARED &&
+        frames >= priv->start_threshold)
+        vpcm_start(plugin);
+
+    while (done < frames) {
+        unsigned long offset, n;
+        long avail;
+
+        vpcm_update(plugin);
+        if (plugin->state == PCM_PLUG_STATE_XRUN) {
+            if (done)
+                break;
+            return -EPIPE;
+        }
+
+        avail = vpcm_avail(priv);
+        if (avail > (long) priv->buffer_size)
+            avail = priv->buffer_size;
+        if (avail <= 0) {
+            if (priv->nonblock) {
+                if (done)
+                    break;
+                return -EAGAIN;
+            }
+            vpcm_wait(plugin, -1);
+            continue;
+        }
+
+        offset = priv->appl_ptr % priv->buffer_size;
+        n = frames - done;
+        if (n > (unsigned long) avail)
+            n = avail;
+        if (n > priv->buffer_size - offset)
+            n = priv->buffer_size - offset;
+
+        vpcm_copy(priv, offset, data, planar, done, n);
+        priv->appl_ptr = vpcm_ptr_add(priv, priv->appl_ptr, n);
+        done += n;
+
+        if (!priv->capture && plugin->state == PCM_PLUG_STATE_PREPARED &&
+            vpcm_ptr_delta(priv, priv->appl_ptr, priv->hw_ptr) >= (long) priv->start_threshold)
+            vpcm_start(plugin);
+    }
+
+    *result = done;
+    return 0;
+}
+
+static int vpcm_hw_params(struct pcm_plugin *plugin,
+                          struct snd_pcm_hw_params *params)
+{
+    struct vpcm_priv *priv = plugin->priv;
+    int format, bits;
+
+    priv->access = param_get_mask_val(params, SNDRV_PCM_HW_PARAM_ACCESS);
+    format = param_get_mask_val(params, SNDRV_PCM_HW_PARAM_FORMAT);
+    bits = alsaformat_to_bitwidth(format);
+    if (priv->access < 0 || bits == 0)
+        return -EINVAL;
+
+    priv->rate = param_get_int(params, SNDRV_PCM_HW_PARAM_RATE);
+    priv->channels = param_get_int(params, SNDRV_PCM_HW_PARAM_CHANNELS);
+    priv->period_size = param_get_int(params, SNDRV_PCM_HW_PARAM_PERIOD_SIZE);
+    priv->buffer_size = priv->period_size * param_get_int(params, SNDRV_PCM_HW_PARAM_PERIODS);
+    priv->frame_bytes = priv->channels * bits / 8;
+    if (priv->rate == 0 || priv->frame_bytes == 0 || priv->buffer_size == 0)
+        return -EINVAL;
+
+    free(priv->buffer);
+    priv->buffer = calloc(priv->buffer_size, priv->frame_bytes);
+    if (!priv->buffer)
+        return -ENOMEM;
+
+    /* like the kernel, the largest multiple of the buffer size that fits */
+    priv->boundary = priv->buffer_size;
+    while (priv->boundary * 2 <= (unsigned long) LONG_MAX - priv->buffer_size)
+        priv->boundary *= 2;
+
+    /* periods may be delayed, but never reordered */
+    if (priv->jitter_ns * 2 > (long long) priv->period_size * VPCM_NS_PER_SEC / priv->rate)
+        priv->jitter_ns = (long long) priv->period_size * VPCM_NS_PER_SEC / priv->rate / 2;
+
+    return 0;
+}
+
+static int vpcm_sw_params(struct pcm_plugin *plugin,
+                          struct snd_pcm_sw_params *sparams)
+{
+    struct vpcm_priv *priv = plugin->priv;
+
+    priv->avail_min = sparams->avail_min ? sparams->avail_min : 1;
+    priv->start_threshold = sparams->start_threshold;
+    priv->stop_threshold = sparams->stop_threshold ? sparams->stop_threshold : priv->boundary;
+    sparams->boundary = priv->boundary;
+
+    return 0;
+}
+
+static int vpcm_sync_ptr(struct pcm_plugin *plugin,
+                         struct snd_pcm_sync_ptr *sync_ptr)
+{
+    struct vpcm_priv *priv = plugin->priv;
+    long long ns = priv->tstamp_ns;
+
+    if (!(sync_ptr->flags & SNDRV_PCM_SYNC_PTR_APPL))
+        priv->appl_ptr = sync_ptr->c.control.appl_ptr;
+    else
+        sync_ptr->c.control.appl_ptr = priv->appl_ptr;
+
+    if (!(sync_ptr->flags & SNDRV_PCM_SYNC_PTR_AVAIL_MIN))
+        priv->avail_min = sync_ptr->c.control.avail_min;
+    else
+        sync_ptr->c.control.avail_min = priv->avail_min;
+
+    vpcm_update(plugin);
+
+    if (priv->tstamp_type != SNDRV_PCM_TSTAMP_TYPE_MONOTONIC) {
+        struct timespec real;
+
+        clock_gettime(CLOCK_REALTIME, &real);
+        ns += real.tv_sec * VPCM_NS_PER_SEC + real.tv_nsec - vpcm_now();
+    }
+
+    sync_ptr->s.status.hw_ptr = priv->hw_ptr;
+    sync_ptr->s.status.tstamp.tv_sec = ns / VPCM_NS_PER_SEC;
+    sync_ptr->s.status.tstamp.tv_nsec = ns % VPCM_NS_PER_SEC;
+
+    return 0;
+}
+
+static int vpcm_writei_frames(struct pcm_plugin *plugin, struct snd_xferi *x)
+{
+    struct vpcm_priv *priv = plugin->priv;
+
+    if (priv->access != SNDRV_PCM_ACCESS_RW_INTERLEAVED)
+        return -EINVAL;
+
+    return vpcm_transfer(plugin, x->buf, 0, x->frames, (snd_pcm_uframes_t *) &x->result);
+}
+
+static int vpcm_readi_frames(struct pcm_plugin *plugin, struct snd_xferi *x)
+{
+    struct vpcm_priv *priv = plugin->priv;
+
+    if (priv->access != SNDRV_PCM_ACCESS_RW_INTERLEAVED)
+        return -EINVAL;
+
+    return vpcm_transfer(plugin, x->buf, 0, x->frames, (snd_pcm_uframes_t *) &x->result);
+}
+
+static int vpcm_ttstamp(struct pcm_plugin *plugin, int *tstamp)
+{
+    struct vpcm_priv *priv = plugin->priv;
+
+    priv->tstamp_type = *tstamp;
+    return 0;
+}
+
+static int vpcm_prepare(struct pcm_plugin *plugin)
+{
+    struct vpcm_priv *priv = plugin->priv;
+
+    vpcm_stop(plugin, plugin->state);
+    priv->hw_ptr = 0;
+    priv->appl_ptr = 0;
+    priv->tstamp_ns = vpcm_now();
+
+    return 0;
+}
+
+static int vpcm_start_op(struct pcm_plugin *plugin)
+{
+    vpcm_start(plugin);
+    return 0;
+}
+
+static int vpcm_drain(struct pcm_plugin *plugin)
+{
+    struct vpcm_priv *priv = plugin->priv;
+
+    if (priv->capture) {
+        vpcm_stop(plugin, PCM_PLUG_STATE_SETUP);
+        return 0;
+    }
+
+    priv->draining = 1;
+    for (;;) {
+        vpcm_update(plugin);
+        if (plugin->state != PCM_PLUG_STATE_RUNNING)
+            break;
+        vpcm_wait(plugin, -1);
+    }
+
+    if (plugin->state == PCM_PLUG_STATE_XRUN)
+        return -EPIPE;
+    return 0;
+}
+
+static int vpcm_drop(struct pcm_plugin *plugin)
+{
+    vpcm_stop(plugin, PCM_PLUG_STATE_SETUP);
+    return 0;
+}
+
+static int vpcm_ioctl(struct pcm_plugin *plugin, int cmd, void *arg)
+{
+    struct vpcm_priv *priv = plugin->priv;
+    struct snd_xfern *xfern = arg;
+
+    switch ((unsigned int) cmd) {
+    case SNDRV_PCM_IOCTL_HWSYNC:
+        vpcm_update(plugin);
+        return 0;
+    case SNDRV_PCM_IOCTL_DELAY:
+        vpcm_update(plugin);
+        if (priv->capture)
+            *(snd_pcm_sframes_t *) arg = vpcm_avail(priv);
+        else
+            *(snd_pcm_sframes_t *) arg = vpcm_ptr_delta(priv, priv->appl_ptr, priv->hw_ptr);
+        return 0;
+    case SNDRV_PCM_IOCTL_WRITEN_FRAMES:
+    case SNDRV_PCM_IOCTL_READN_FRAMES:
+        if (plugin->state == PCM_PLUG_STATE_XRUN)
+            return -EPIPE;
+        if (plugin->state != PCM_PLUG_STATE_PREPARED &&
+            plugin->state != PCM_PLUG_STATE_RUNNING)
+            return -EBADFD;
+        if (priv->access != SNDRV_PCM_ACCESS_RW_NONINTERLEAVED)
+            return -EINVAL;
+        return vpcm_transfer(plugin, xfern->bufs, 1, xfern->frames,
+                             (snd_pcm_uframes_t *) &xfern->result);
+    default:
+        return -ENOTTY;
+    }
+}
+
+static int vpcm_poll(struct pcm_plugin *plugin, struct pollfd *pfd,
+                     nfds_t nfds, int timeout)
+{
+    struct vpcm_priv *priv = plugin->priv;
+    long long deadline = timeout < 0 ? -1 : vpcm_now() + timeout * 1000000LL;
+
+    if (nfds == 0)
+        return 0;
+
+    for (;;) {
+        vpcm_update(plugin);
+
+        pfd->revents = 0;
+        if (plugin->state == PCM_PLUG_STATE_XRUN)
+            pfd->revents = POLLERR;
+        else if ((plugin->state == PCM_PLUG_STATE_PREPARED ||
+                  plugin->state == PCM_PLUG_STATE_RUNNING) &&
+                 vpcm_avail(priv) >= (long) priv->avail_min)
+            pfd->revents = priv->capture ? POLLIN : POLLOUT;
+
+        pfd->revents &= pfd->events | POLLERR;
+        if (pfd->revents)
+            return 1;
+
+        if (deadline >= 0 && vpcm_now() >= deadline)
+            return 0;
+
+        vpcm_wait(plugin, deadline);
+    }
+}
+
+static void *vpcm_mmap(struct pcm_plugin *plugin, void *addr, size_t length, int prot,
+                       int flags, off_t offset)
+{
+    struct vpcm_priv *priv = plugin->priv;
+
+    (void) addr;
+    (void) prot;
+    (void) flags;
+
+    /* status and control are exchanged with sync_ptr */
+    if (offset != 0 || !priv->buffer ||
+        length > (size_t) priv->buffer_size * priv->frame_bytes)
+        return MAP_FAILED;
+
+    return priv->buffer;
+}
+
+static int vpcm_munmap(struct pcm_plugin *plugin, void *addr, size_t length)
+{
+    (void) plugin;
+    (void) addr;
+    (void) length;
+
+    return 0;
+}
+
+static int vpcm_close(struct pcm_plugin *plugin)
+{
+    struct vpcm_priv *priv = plugin->priv;
+
+    vpcm_stop(plugin, PCM_PLUG_STATE_OPEN);
+    if (priv->file)
+        fclose(priv->file);
+    free(priv->buffer);
+    free(priv);
+    free(plugin);
+
+    return 0;
+}
+
+static double vpcm_getenv(const char *name)
+{
+    const char *value = getenv(name);
+
+    return value ? strtod(value, NULL) : 0;
+}
+
+int vpcm_open(struct pcm_plugin **plugin, unsigned int card,
+              unsigned int device, unsigned int mode)
+{
+    struct pcm_plugin *vpcm_plugin;
+    struct vpcm_priv *priv;
+
+    if (device > VPCM_DEVICE_FILE)
+        return -ENODEV;
+
+    vpcm_plugin = calloc(1, sizeof(struct pcm_plugin));
+    if (!vpcm_plugin)
+        return -ENOMEM;
+
+    priv = calloc(1, sizeof(struct vpcm_priv));
+    if (!priv) {
+        free(vpcm_plugin);
+        return -ENOMEM;
+    }
+
+    priv->device = device;
+    priv->capture = !!(mode & PCM_IN);
+    priv->nonblock = !!(mode & PCM_NONBLOCK);
+    priv->ppm = vpcm_getenv("TINYALSA_VPCM_PPM");
+    if (priv->capture && getenv("TINYALSA_VPCM_CAPTURE_PPM"))
+        priv->ppm = vpcm_getenv("TINYALSA_VPCM_CAPTURE_PPM");
+    priv->jitter_ns = vpcm_getenv("TINYALSA_VPCM_JITTER_US") * 1000;
+    priv->seed = 0x9e3779b9u ^ (device << 1 | priv->capture);
+    priv->tstamp_type = SNDRV_PCM_TSTAMP_TYPE_GETTIMEOFDAY;
+
+    if (device < VPCM_LOOPBACK_DEVICES) {
+        priv->sink = VPCM_SINK_LOOPBACK;
+    } else if (device == VPCM_DEVICE_NULL) {
+        priv->sink = VPCM_SINK_NULL;
+    } else {
+        const char *path = getenv("TINYALSA_VPCM_FILE");
+
+        priv->sink = VPCM_SINK_FILE;
+        priv->file = fopen(path ? path : "vpcm_data.raw", priv->capture ? "rb" : "wb");
+        if (!priv->file) {
+            int ret = -errno;
+            free(priv);
+            free(vpcm_plugin);
+            return ret;
+        }
+    }
+
+    vpcm_constrs.access = (PCM_FORMAT_BIT(SNDRV_PCM_ACCESS_MMAP_INTERLEAVED) |
+                           PCM_FORMAT_BIT(SNDRV_PCM_ACCESS_RW_INTERLEAVED) |
+                           PCM_FORMAT_BIT(SNDRV_PCM_ACCESS_RW_NONINTERLEAVED));
+    vpcm_constrs.format = (PCM_FORMAT_BIT(SNDRV_PCM_FORMAT_S8) |
+                           PCM_FORMAT_BIT(SNDRV_PCM_FORMAT_S16_LE) |
+                           PCM_FORMAT_BIT(SNDRV_PCM_FORMAT_S24_LE) |
+                           PCM_FORMAT_BIT(SNDRV_PCM_FORMAT_S24_3LE) |
+                           PCM_FORMAT_BIT(SNDRV_PCM_FORMAT_S32_LE) |
+                           PCM_FORMAT_BIT(SNDRV_PCM_FORMAT_FLOAT_LE));
+
+    vpcm_plugin->card = card;
+    vpcm_plugin->device = device;
+    vpcm_plugin->mode = mode;
+    vpcm_plugin->constraints = &vpcm_constrs;
+    vpcm_plugin->priv = priv;
+
+    *plugin = vpcm_plugin;
+    return 0;
+}
+
+struct pcm_plugin_ops pcm_plugin_ops = {
+    .open = vpcm_open,
+    .close = vpcm_close,
+    .hw_params = vpcm_hw_params,
+    .sw_params = vpcm_sw_params,
+    .sync_ptr = vpcm_sync_ptr,
+    .writei_frames = vpcm_writei_frames,
+    .readi_frames = vpcm_readi_frames,
+    .ttstamp = vpcm_ttstamp,
+    .prepare = vpcm_prepare,
+    .start = vpcm_start_op,
+    .drain = vpcm_drain,
+    .drop = vpcm_drop,
+    .ioctl = vpcm_ioctl,
+    .mmap = vpcm_mmap,
+    .munmap = vpcm_munmap,
+    .poll = vpcm_poll,
+};
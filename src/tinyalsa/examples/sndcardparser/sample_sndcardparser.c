@@ -76,7 +76,8 @@ struct snd_dev_def {
     const char *so_name;
     int playback; //used only for pcm node
     int capture;  //used only for pcm node
-    /* add custom props here */
+    /* custom props, pairs of name and value ended by NULL */
+    const char *const *props;
 };
 
 struct snd_dev_def_card {
@@ -90,13 +91,60 @@ struct snd_dev_def_card {
     struct snd_dev_def *mixer_dev_def;
 };
 
+static const char *const softvol_props[] = {
+    "slave-card", "100",
+    "slave-device", "0",
+    "control", "Softvol Playback Volume",
+    "resolution", "256",
+    "min-db", "-5100",
+    "ramp", "exp",
+    NULL,
+};
+
+static const char *const eq_props[] = {
+    "slave-card", "100",
+    "slave-device", "0",
+    /* relative to the working directory, see examples/plugins */
+    "config", "speaker_eq.conf",
+    NULL,
+};
+
+/* any number of channels, on a stereo device */
+static const char *const chmap_props[] = {
+    "slave-card", "100",
+    "slave-device", "0",
+    "channels", "2",
+    NULL,
+};
+
+/* the stages of the channel map, eq and softvol devices, in one plugin */
+static const char *const chain_props[] = {
+    "slave-card", "100",
+    "slave-device", "0",
+    "stages", "6,5,4",
+    NULL,
+};
+
 struct snd_dev_def pcm_devs[] = {
-    {100, NODE_TYPE_PLUGIN, "PCM100", "libtinyalsav2_example_plugin_pcm.so", 1, 0},
+    /* virtual devices, see virtual_pcm_plugin.c */
+    {0, NODE_TYPE_PLUGIN, "virtual-loopback-0", "libtinyalsav2_virtual_plugin_pcm.so", 1, 1, NULL},
+    {1, NODE_TYPE_PLUGIN, "virtual-loopback-1", "libtinyalsav2_virtual_plugin_pcm.so", 1, 1, NULL},
+    {2, NODE_TYPE_PLUGIN, "virtual-null", "libtinyalsav2_virtual_plugin_pcm.so", 1, 1, NULL},
+    {3, NODE_TYPE_PLUGIN, "virtual-file", "libtinyalsav2_virtual_plugin_pcm.so", 1, 1, NULL},
+    {100, NODE_TYPE_PLUGIN, "PCM100", "libtinyalsav2_example_plugin_pcm.so", 1, 0, NULL},
+    /* filters in front of loopback device 0, see filter_pcm_plugin.c */
+    {4, NODE_TYPE_PLUGIN, "virtual-softvol", "libtinyalsav2_softvol_plugin_pcm.so", 1, 1,
+     softvol_props},
+    {5, NODE_TYPE_PLUGIN, "virtual-eq", "libtinyalsav2_eq_plugin_pcm.so", 1, 1, eq_props},
+    {6, NODE_TYPE_PLUGIN, "virtual-chmap", "libtinyalsav2_chmap_plugin_pcm.so", 1, 1,
+     chmap_props},
+    {7, NODE_TYPE_PLUGIN, "virtual-chain", "libtinyalsav2_chain_plugin_pcm.so", 1, 1,
+     chain_props},
     /* Add other plugin info here */
 };
 
 struct snd_dev_def mixer_dev =
-    {VIRTUAL_SND_CARD_ID, NODE_TYPE_PLUGIN, "virtual-snd-card", "libtinyalsav2_example_plugin_mixer.so", 0, 0};
+    {VIRTUAL_SND_CARD_ID, NODE_TYPE_PLUGIN, "virtual-snd-card", "libtinyalsav2_virtual_plugin_mixer.so", 0, 0, NULL};
 
 void *snd_card_def_open_card(unsigned int card)
 {
@@ -194,9 +242,23 @@ void *snd_card_def_get_node(void *card_node, unsigned int id, int type)
     return NULL;
 }
 
+static const char *snd_card_def_get_prop(struct snd_dev_def *dev_def, const char *prop)
+{
+    const char *const *p;
+
+    for (p = dev_def->props; p && p[0] && p[1]; p += 2) {
+        if (!strcmp(p[0], prop))
+            return p[1];
+    }
+
+    return NULL;
+}
+
 int snd_card_def_get_int(void *node, const char *prop, int *val)
 {
     struct snd_dev_def *dev_def = (struct snd_dev_def *)node;
+    const char *str;
+    char *end;
     int ret = -EINVAL;
 
     if (!dev_def || !prop || !val)
@@ -216,12 +278,22 @@ int snd_card_def_get_int(void *node, const char *prop, int *val)
         return 0;
     }
 
+    str = snd_card_def_get_prop(dev_def, prop);
+    if (str) {
+        long num = strtol(str, &end, 0);
+        if (end != str && !*end) {
+            *val = num;
+            return 0;
+        }
+    }
+
     return ret;
 }
 
 int snd_card_def_get_str(void *node, const char *prop, char **val)
 {
     struct snd_dev_def *dev_def = (struct snd_dev_def *)node;
+    const char *str;
     int ret = -EINVAL;
 
     if (!dev_def || !prop)
@@ -241,6 +313,12 @@ int snd_card_def_get_str(void *node, const char *prop, char **val)
         }
     }
 
+    str = snd_card_def_get_prop(dev_def, prop);
+    if (str) {
+        *val = (char *)str;
+        return 0;
+    }
+
     return ret;
 }
 
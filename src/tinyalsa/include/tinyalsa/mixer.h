@@ -161,6 +161,9 @@ unsigned int mixer_ctl_get_device(const struct mixer_ctl *ctl);
 
 int mixer_read_event(struct mixer *mixer, struct mixer_ctl_event *event);
 
+int mixer_read_events(struct mixer *mixer, struct mixer_ctl_event *events,
+                      unsigned int count);
+
 int mixer_consume_event(struct mixer *mixer);
 #if defined(__cplusplus)
 }  /* extern "C" */
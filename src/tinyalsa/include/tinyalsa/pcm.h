@@ -38,6 +38,7 @@
 #include <tinyalsa/attributes.h>
 
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <stddef.h>
 
 /** A flag that specifies that the PCM is an output.
@@ -62,6 +63,8 @@
 
 /** Specifies no interrupt requests.
  * May only be bitwise AND'd with @ref PCM_MMAP.
+ * Transfers sleep until the hardware pointer is predicted to reach avail_min,
+ * using the timestamps of the PCM and its measured rate.
  * Used in @ref pcm_open.
  * @ingroup libtinyalsa-pcm
  */
@@ -95,6 +98,41 @@
  * */
 #define PCM_NONBLOCK 0x00000010
 
+/** If used with @ref pcm_open, the PCM keeps runtime statistics
+ * that can be read with @ref pcm_get_stats.
+ * @ingroup libtinyalsa-pcm
+ */
+#define PCM_STATS 0x00000020
+
+/** Specifies that the PCM will use non-interleaved (planar) access,
+ * so that @ref pcm_writen and @ref pcm_readn transfer without interleaving.
+ * May not be bitwise AND'd with @ref PCM_MMAP.
+ * PCMs opened with this flag only support @ref pcm_writen and @ref pcm_readn.
+ * Used in @ref pcm_open.
+ * @ingroup libtinyalsa-pcm
+ */
+#define PCM_NONINTERLEAVED 0x00000040
+
+/** If used with @ref pcm_open, the PCM uses the deep-buffer profile, trading
+ * latency for few wakeups: the period size and count of the config are replaced
+ * by the largest period and buffer the device allows, and the avail_min, start
+ * and stop thresholds by ones that only wake the caller once all but one period
+ * of the buffer can be transferred. Writes fill the buffer in bursts of that size.
+ * The config chosen can be read back with @ref pcm_get_config.
+ * @ingroup libtinyalsa-pcm
+ */
+#define PCM_DEEP_BUFFER 0x00000080
+
+/** If used with @ref pcm_open, the read, write and wait functions of the PCM
+ * are safe to call from a real-time thread: they do no stdio, allocation or
+ * string formatting. Errors are recorded as a code, see @ref pcm_get_error_code,
+ * and their message is only formatted by @ref pcm_get_error, without the
+ * values it would have held. The mmap buffer, status and control are
+ * prefaulted and locked in memory at open, which fails if they cannot be.
+ * @ingroup libtinyalsa-pcm
+ */
+#define PCM_RT 0x00000100
+
 /** Means a PCM is opened
  * @ingroup libtinyalsa-pcm
  */
@@ -290,8 +328,176 @@ int pcm_params_to_string(struct pcm_params *params, char *string, unsigned int s
  */
 int pcm_params_format_test(struct pcm_params *params, enum pcm_format format);
 
+/** Test signals that can be used by @ref pcm_measure_latency.
+ * @ingroup libtinyalsa-pcm
+ */
+enum pcm_latency_signal {
+    /** A maximum length sequence, robust against noise on acoustic paths */
+    PCM_LATENCY_MLS,
+    /** A single full scale frame, suited to digital loopback paths */
+    PCM_LATENCY_IMPULSE,
+};
+
+/** Latency of a playback to capture path, as measured by @ref pcm_measure_latency.
+ * Frame counts are in terms of the rate of both PCMs.
+ * @ingroup libtinyalsa-pcm
+ */
+struct pcm_latency {
+    /** Frames queued in the playback buffer ahead of the test signal */
+    long output_frames;
+    /** Frames between the signal leaving the playback buffer and entering the capture buffer */
+    long path_frames;
+    /** Frames captured after the test signal by the time it was read */
+    long input_frames;
+    /** The sum of the output, path and input latencies, in frames */
+    long round_trip_frames;
+    /** The output latency, in microseconds */
+    long output_us;
+    /** The path latency, in microseconds */
+    long path_us;
+    /** The input latency, in microseconds */
+    long input_us;
+    /** The round trip latency, in microseconds */
+    long round_trip_us;
+    /** Share of the captured energy that matches the test signal, from 0 to 1 */
+    float correlation;
+};
+
+/** The number of most recent xrun and suspend timestamps kept in @ref pcm_stats.
+ * @ingroup libtinyalsa-pcm
+ */
+#define PCM_STATS_EVENTS 8
+
+/** The number of buckets of the avail histogram in @ref pcm_stats.
+ * @ingroup libtinyalsa-pcm
+ */
+#define PCM_STATS_AVAIL_BUCKETS 8
+
+/** Runtime statistics of a PCM opened with @ref PCM_STATS.
+ * Timestamps and durations are measured with CLOCK_MONOTONIC.
+ * @ingroup libtinyalsa-pcm
+ */
+struct pcm_stats {
+    /** The number of xruns detected by the read and write functions */
+    unsigned int xruns;
+    /** The number of suspends detected by the read and write functions */
+    unsigned int suspends;
+    /** Times of the most recent xruns; xrun n is at index (n - 1) % PCM_STATS_EVENTS */
+    struct timespec xrun_tstamp[PCM_STATS_EVENTS];
+    /** Times of the most recent suspends, indexed like @ref pcm_stats.xrun_tstamp */
+    struct timespec suspend_tstamp[PCM_STATS_EVENTS];
+    /** The number of times @ref pcm_wait returned with frames available */
+    unsigned int wakeups;
+    /** Frames available at each wakeup, bucket i counting wakeups with
+     * i to i + 1 eighths of the buffer available */
+    unsigned int avail_histogram[PCM_STATS_AVAIL_BUCKETS];
+    /** Number of calls to the read and write functions */
+    unsigned long long transfers;
+    /** Frames transferred by the read and write functions */
+    unsigned long long frames;
+    /** Number of ioctls issued by the read, write, wait and state functions */
+    unsigned long long ioctls;
+    /** Nanoseconds spent waiting for the PCM; for read/write (non mmap) transfers
+     * this includes the copy made by the kernel */
+    unsigned long long blocked_ns;
+    /** Nanoseconds spent copying to or from the mmap buffer */
+    unsigned long long copy_ns;
+    /** Nanoseconds from the start of the first transfer to the end of the latest,
+     * the time over which wakeups per second are counted */
+    unsigned long long active_ns;
+    /** Xruns that happened before a buffer of frames was transferred since
+     * recovering from the previous one */
+    unsigned int consecutive_xruns;
+    /** Nanoseconds from detecting an xrun or suspend to the retried transfer
+     * completing, summed over all recoveries */
+    unsigned long long recovery_ns;
+    /** The longest recovery, in nanoseconds */
+    unsigned long long recovery_max_ns;
+};
+
+/** How the read and write functions recover from an xrun, set with
+ * @ref pcm_set_xrun_policy.
+ * The prefill and threshold strategies only apply to playback; capture
+ * streams recover with @ref PCM_XRUN_RESTART.
+ * @ingroup libtinyalsa-pcm
+ */
+enum pcm_xrun_policy {
+    /** Prepare the PCM and retry the transfer, which restarts it at the
+     * start threshold; the default */
+    PCM_XRUN_RESTART,
+    /** Prepare the PCM and write silence up to the safe level before
+     * retrying, so the stream restarts with that much queued */
+    PCM_XRUN_PREFILL,
+    /** Prepare the PCM and raise the start threshold to the safe level until
+     * the stream has run for a second without an xrun */
+    PCM_XRUN_RAISE_THRESHOLD,
+    /** Leave the PCM in the xrun state and fail the transfer, with errno set
+     * to EPIPE, for the caller to recover with @ref pcm_prepare */
+    PCM_XRUN_REPORT,
+};
+
+/** The position and time stamp of a PCM, captured when a read or write
+ * completed a period, see @ref pcm_set_period_stamps. An A/V sync consumer
+ * may take them with @ref pcm_get_period_stamps from its own thread.
+ * @ingroup libtinyalsa-pcm
+ */
+struct pcm_period_stamp {
+    /** Frames transferred by the read and write functions since the stamps
+     * were enabled, up to the end of the transfer */
+    unsigned long long frames;
+    /** The hardware position, in frames, wrapping at the PCM boundary */
+    unsigned long hw_ptr;
+    /** The application position, in frames, wrapping at the PCM boundary */
+    unsigned long appl_ptr;
+    /** When the hardware position was last updated */
+    struct timespec tstamp;
+};
+
+/** The levels of one channel over a window of frames, measured by the meter
+ * of a PCM, see @ref pcm_set_meter.
+ * @ingroup libtinyalsa-pcm
+ */
+struct pcm_meter_level {
+    /** The largest absolute sample value, where 1.0 is full scale */
+    float peak;
+    /** The root mean square of the samples, where 1.0 is full scale */
+    float rms;
+    /** The number of samples at full scale, or beyond it for floating point formats */
+    unsigned int clips;
+};
+
 struct pcm;
 
+/** The maximum number of PCMs in a @ref pcm_group.
+ * @ingroup libtinyalsa-pcm
+ */
+#define PCM_GROUP_MAX 32
+
+struct pcm_group;
+
+/** The state of a @ref pcm_bridge, see @ref pcm_bridge_get_status.
+ * @ingroup libtinyalsa-pcm
+ */
+struct pcm_bridge_status {
+    /** Input frames consumed per output frame, as currently resampled */
+    double ratio;
+    /** The measured deviation of the input clock from the output clock,
+     * in parts per million; zero until both clocks were measured for a second */
+    double drift_ppm;
+    /** Frames queued in the output buffer, averaged */
+    double fill;
+    /** The number of frames the bridge keeps queued in the output buffer */
+    unsigned int target;
+    /** Frames read from the input */
+    unsigned long long frames_in;
+    /** Frames written to the output */
+    unsigned long long frames_out;
+    /** Xruns of the input and the output since the bridge was opened */
+    unsigned int xruns;
+};
+
+struct pcm_bridge;
+
 struct pcm *pcm_open(unsigned int card,
                      unsigned int device,
                      unsigned int flags,
@@ -317,8 +523,12 @@ int pcm_get_file_descriptor(const struct pcm *pcm);
 
 const char *pcm_get_error(const struct pcm *pcm);
 
+int pcm_get_error_code(const struct pcm *pcm);
+
 int pcm_set_config(struct pcm *pcm, const struct pcm_config *config);
 
+int pcm_set_thresholds(struct pcm *pcm, const struct pcm_config *config);
+
 unsigned int pcm_format_to_bits(enum pcm_format format);
 
 unsigned int pcm_get_buffer_size(const struct pcm *pcm);
@@ -329,12 +539,40 @@ unsigned int pcm_bytes_to_frames(const struct pcm *pcm, unsigned int bytes);
 
 int pcm_get_htimestamp(struct pcm *pcm, unsigned int *avail, struct timespec *tstamp);
 
+int pcm_state(struct pcm *pcm);
+
 unsigned int pcm_get_subdevice(const struct pcm *pcm);
 
+int pcm_get_xruns(const struct pcm *pcm);
+
+int pcm_get_stats(const struct pcm *pcm, struct pcm_stats *stats);
+
+int pcm_set_xrun_policy(struct pcm *pcm, enum pcm_xrun_policy policy, unsigned int level);
+
+int pcm_set_period_stamps(struct pcm *pcm, unsigned int count);
+
+int pcm_get_period_stamps(struct pcm *pcm, struct pcm_period_stamp *stamps, unsigned int count);
+
+int pcm_set_meter(struct pcm *pcm, unsigned int window);
+
+int pcm_get_meter(const struct pcm *pcm, struct pcm_meter_level *levels, unsigned int count,
+                  unsigned long long *frames);
+
+int pcm_measure_latency(struct pcm *out, struct pcm *in, enum pcm_latency_signal signal,
+                        struct pcm_latency *latency);
+
 int pcm_writei(struct pcm *pcm, const void *data, unsigned int frame_count) TINYALSA_WARN_UNUSED_RESULT;
 
 int pcm_readi(struct pcm *pcm, void *data, unsigned int frame_count) TINYALSA_WARN_UNUSED_RESULT;
 
+int pcm_writen(struct pcm *pcm, void **data, unsigned int frame_count) TINYALSA_WARN_UNUSED_RESULT;
+
+int pcm_readn(struct pcm *pcm, void **data, unsigned int frame_count) TINYALSA_WARN_UNUSED_RESULT;
+
+int pcm_writev(struct pcm *pcm, const struct iovec *iov, int iovcnt) TINYALSA_WARN_UNUSED_RESULT;
+
+int pcm_readv(struct pcm *pcm, const struct iovec *iov, int iovcnt) TINYALSA_WARN_UNUSED_RESULT;
+
 int pcm_write(struct pcm *pcm, const void *data, unsigned int count) TINYALSA_DEPRECATED;
 
 int pcm_read(struct pcm *pcm, void *data, unsigned int count) TINYALSA_DEPRECATED;
@@ -357,6 +595,26 @@ int pcm_link(struct pcm *pcm1, struct pcm *pcm2);
 
 int pcm_unlink(struct pcm *pcm);
 
+struct pcm_group *pcm_group_open(void);
+
+int pcm_group_add(struct pcm_group *group, struct pcm *pcm);
+
+int pcm_group_start(struct pcm_group *group);
+
+int pcm_group_stop(struct pcm_group *group);
+
+int pcm_group_wait(struct pcm_group *group, int timeout, unsigned int *ready_mask);
+
+void pcm_group_close(struct pcm_group *group);
+
+struct pcm_bridge *pcm_bridge_open(struct pcm *in, struct pcm *out, unsigned int target);
+
+int pcm_bridge_transfer(struct pcm_bridge *bridge);
+
+int pcm_bridge_get_status(const struct pcm_bridge *bridge, struct pcm_bridge_status *status);
+
+void pcm_bridge_close(struct pcm_bridge *bridge);
+
 int pcm_prepare(struct pcm *pcm);
 
 int pcm_start(struct pcm *pcm);
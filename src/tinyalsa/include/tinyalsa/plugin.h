@@ -53,6 +53,9 @@
 #define SND_VALUE_TLV_BYTES(csize, cget, cput)       \
     {.size = csize, .get = cget, .put = cput }
 
+#define SND_VALUE_INTEGER_TLV(icount, imin, imax, istep, itlv) \
+    {.integer = SND_VALUE_INTEGER(icount, imin, imax, istep), .tlv = itlv }
+
 /* pointer based initializers */
 #define INIT_SND_CONTROL_INTEGER(c, cname, cget, cput, cint, pval, pdata)   \
     {                                                                       \
@@ -63,6 +66,16 @@
         c->private_value = pval; c->private_data = pdata;                   \
     }
 
+#define INIT_SND_CONTROL_INTEGER_TLV(c, cname, cget, cput, cint, pval, pdata) \
+    {                                                                       \
+        c->iface = SNDRV_CTL_ELEM_IFACE_MIXER;                              \
+        c->access = SNDRV_CTL_ELEM_ACCESS_READWRITE |                       \
+                    SNDRV_CTL_ELEM_ACCESS_TLV_READ;                         \
+        c->type = SNDRV_CTL_ELEM_TYPE_INTEGER;                              \
+        c->name = cname; c->value = &cint; c->get = cget; c->put = cput;    \
+        c->private_value = pval; c->private_data = pdata;                   \
+    }
+
 #define INIT_SND_CONTROL_BYTES(c, cname, cget, cput, cint, pval, pdata)     \
     {                                                                       \
         c->iface = SNDRV_CTL_ELEM_IFACE_MIXER;                              \
@@ -171,6 +184,20 @@ struct pcm_plugin_hw_constraints {
     struct pcm_plugin_min_max period_bytes;
 };
 
+/** States of a PCM plugin, kept in @ref pcm_plugin.state.
+ * The plugin layer moves the plugin through setup, prepared and running.
+ * A plugin may move itself to running, when a transfer reaches the start
+ * threshold, and to xrun, after which it is prepared again.
+ * @ingroup libtinyalsa-pcm
+ */
+enum pcm_plugin_state {
+    PCM_PLUG_STATE_OPEN,
+    PCM_PLUG_STATE_SETUP,
+    PCM_PLUG_STATE_PREPARED,
+    PCM_PLUG_STATE_RUNNING,
+    PCM_PLUG_STATE_XRUN,
+};
+
 struct pcm_plugin {
     /** Card number for the pcm device */
     unsigned int card;
@@ -186,6 +213,34 @@ struct pcm_plugin {
     unsigned int state;
 };
 
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/** Gets an integer property of the plugin's device from the sound card definition.
+ * Plugins use it for settings of their own, added to the device definition.
+ * @param plugin The plugin, as set up by its open function.
+ * @param prop The name of the property.
+ * @param val Receives the value.
+ * @returns Zero on success, or a negative errno.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_plugin_get_int(struct pcm_plugin *plugin, const char *prop, int *val);
+
+/** Gets a string property of the plugin's device from the sound card definition.
+ * The string belongs to the card definition, which is kept while the PCM is open.
+ * @param plugin The plugin, as set up by its open function.
+ * @param prop The name of the property.
+ * @param val Receives the value.
+ * @returns Zero on success, or a negative errno.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_plugin_get_str(struct pcm_plugin *plugin, const char *prop, char **val);
+
+#if defined(__cplusplus)
+}  /* extern "C" */
+#endif
+
 typedef void (*mixer_event_callback)(struct mixer_plugin *);
 
 struct mixer_plugin_ops {
@@ -219,10 +274,14 @@ struct mixer_plugin {
 
     int eventfd;
     int subscribed;
+    /* Pending events, updated atomically by the event callback */
     int event_cnt;
 
     struct snd_control *controls;
     unsigned int num_controls;
+    /* Deprecated: no longer taken by the library, which counts events with
+     * atomics. Still initialized while the mixer is open, for plugins that
+     * lock it themselves. */
     pthread_mutex_t mutex;
 };
 
@@ -252,6 +311,15 @@ struct snd_value_int {
     int step;
 };
 
+/** Value of an integer or boolean control that has
+ * SNDRV_CTL_ELEM_ACCESS_TLV_READ access, such as a volume with a dB scale.
+ * The TLV container is laid out as by the macros in sound/tlv.h.
+ */
+struct snd_value_int_tlv {
+    struct snd_value_int integer;
+    const unsigned int *tlv;
+};
+
 /** Operations defined by the plugin.
  * */
 struct snd_node_ops {
@@ -590,12 +590,27 @@ int mixer_consume_event(struct mixer *mixer)
  * @ingroup libtinyalsa-mixer
  */
 int mixer_read_event(struct mixer *mixer, struct mixer_ctl_event *event)
+{
+    return mixer_read_events(mixer, event, 1);
+}
+
+/** Read a batch of mixer control events.
+ * Like @ref mixer_read_event, but reads as many of the pending events as
+ * fit in the buffer with a single read from the mixer.
+ *
+ * @param mixer A mixer handle.
+ * @param events Output parameter, filled with the events read.
+ * @param count The number of events that fit in events.
+ * @returns The number of events read. 0, if no pending event. -errno on failure.
+ * @ingroup libtinyalsa-mixer
+ */
+int mixer_read_events(struct mixer *mixer, struct mixer_ctl_event *events,
+                      unsigned int count)
 {
     struct mixer_ctl_group *grp = NULL;
-    struct snd_ctl_event ev;
     ssize_t bytes = 0;
 
-    if (!mixer || !event) {
+    if (!mixer || !events) {
         return -EINVAL;
     }
 
@@ -611,21 +626,18 @@ int mixer_read_event(struct mixer *mixer, struct mixer_ctl_event *event)
         }
     }
 #endif
-    if (grp) {
-        grp->event_cnt--;
-        bytes = grp->ops->read_event(grp->data, &ev, sizeof(ev));
-
-        if (bytes < 0) {
-            return -errno;
-        }
+    if (!grp || !count)
+        return 0;
 
-        if (bytes == sizeof(*event)) {
-            memcpy(event, &ev, sizeof(*event));
-            return 1;
-        }
+    grp->event_cnt--;
+    /* mixer_ctl_event mirrors snd_ctl_event */
+    bytes = grp->ops->read_event(grp->data, (struct snd_ctl_event *)events,
+                                 count * sizeof(*events));
+    if (bytes < 0) {
+        return -errno;
     }
 
-    return 0;
+    return bytes / sizeof(*events);
 }
 
 static unsigned int mixer_grp_get_count(struct mixer_ctl_group *grp)
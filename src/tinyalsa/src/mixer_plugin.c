@@ -139,34 +139,37 @@ static int mixer_plug_info_integer(struct snd_control *ctl,
 
 void mixer_plug_notifier_cb(struct mixer_plugin *plugin)
 {
-    pthread_mutex_lock(&plugin->mutex);
-    plugin->event_cnt++;
-    pthread_mutex_unlock(&plugin->mutex);
-    eventfd_write(plugin->eventfd, 1);
+    /* Only an event that finds none pending makes the eventfd readable */
+    if (__atomic_fetch_add(&plugin->event_cnt, 1, __ATOMIC_ACQ_REL) <= 0)
+        eventfd_write(plugin->eventfd, 1);
+}
+
+/* Drops read_cnt events from the pending count. The eventfd is cleared only
+   once the count drops to zero, and set again if an event was raised while
+   it was being cleared, so poll stays readable until all events are read. */
+static void mixer_plug_events_read(struct mixer_plugin *plugin, int read_cnt)
+{
+    eventfd_t evfd;
+
+    if (__atomic_sub_fetch(&plugin->event_cnt, read_cnt, __ATOMIC_ACQ_REL) > 0)
+        return;
+
+    eventfd_read(plugin->eventfd, &evfd);
+    if (__atomic_load_n(&plugin->event_cnt, __ATOMIC_ACQUIRE) > 0)
+        eventfd_write(plugin->eventfd, 1);
 }
 
-/* In consume_event/read, do not call eventfd_read until all events are read from list.
-   This will make poll getting unblocked until all events are read */
 static ssize_t mixer_plug_read_event(void *data, struct snd_ctl_event *ev, size_t size)
 {
     struct mixer_plug_data *plug_data = data;
     struct mixer_plugin *plugin = plug_data->plugin;
-    eventfd_t evfd;
     ssize_t result = 0;
-    unsigned int i, read_cnt;
 
     result = plug_data->ops->read_event(plugin, ev, size);
 
-    if (result > 0) {
-        read_cnt = result / sizeof(struct snd_ctl_event);
-        pthread_mutex_lock(&plugin->mutex);
-        plugin->event_cnt -= read_cnt;
-        pthread_mutex_unlock(&plugin->mutex);
-
-        for (i = 0; i < read_cnt; ++i) {
-            eventfd_read(plugin->eventfd, &evfd);
-        }
-    }
+    /* a read of no events clears a wakeup left by an event read early */
+    if (result >= 0)
+        mixer_plug_events_read(plugin, result / sizeof(struct snd_ctl_event));
 
     return result;
 }
@@ -176,7 +179,6 @@ static int mixer_plug_subscribe_events(struct mixer_plug_data *plug_data,
 {
     struct mixer_plugin *plugin = plug_data->plugin;
     eventfd_t evfd;
-    unsigned int i, count;
 
     if (*subscribe < 0 || *subscribe > 1) {
         *subscribe = plugin->subscribed;
@@ -188,13 +190,8 @@ static int mixer_plug_subscribe_events(struct mixer_plug_data *plug_data,
     } else if (plugin->subscribed && !*subscribe) {
         plug_data->ops->subscribe_events(plugin, NULL);
 
-        pthread_mutex_lock(&plugin->mutex);
-        count = plugin->event_cnt;
-        plugin->event_cnt = 0;
-        pthread_mutex_unlock(&plugin->mutex);
-        for (i = 0; i < count; ++i) {
-            eventfd_read(plugin->eventfd, &evfd);
-        }
+        __atomic_store_n(&plugin->event_cnt, 0, __ATOMIC_RELEASE);
+        eventfd_read(plugin->eventfd, &evfd);
     }
 
     plugin->subscribed = *subscribe;
@@ -220,12 +217,37 @@ static int mixer_plug_tlv_write(struct mixer_plug_data *plug_data,
     struct snd_control *ctl;
     struct snd_value_tlv_bytes *val_tlv;
 
+    if (tlv->numid >= plugin->num_controls)
+        return -EINVAL;
+
     ctl = plugin->controls + tlv->numid;
+    if (ctl->type != SNDRV_CTL_ELEM_TYPE_BYTES ||
+        !(ctl->access & SNDRV_CTL_ELEM_ACCESS_TLV_WRITE))
+        return -ENXIO;
+
     val_tlv = ctl->value;
 
     return val_tlv->put(plugin, ctl, tlv);
 }
 
+/* Returns the TLV container of an integer control, e.g. its dB scale */
+static int mixer_plug_tlv_read_integer(struct snd_control *ctl,
+                struct snd_ctl_tlv *tlv)
+{
+    struct snd_value_int_tlv *val = ctl->value;
+    unsigned int size;
+
+    if (!val->tlv)
+        return -ENXIO;
+
+    size = val->tlv[1] + 2 * sizeof(val->tlv[0]);
+    if (tlv->length < size)
+        return -ENOMEM;
+
+    memcpy(tlv->tlv, val->tlv, size);
+    return 0;
+}
+
 static int mixer_plug_tlv_read(struct mixer_plug_data *plug_data,
                 struct snd_ctl_tlv *tlv)
 {
@@ -233,7 +255,23 @@ static int mixer_plug_tlv_read(struct mixer_plug_data *plug_data,
     struct snd_control *ctl;
     struct snd_value_tlv_bytes *val_tlv;
 
+    if (tlv->numid >= plugin->num_controls)
+        return -EINVAL;
+
     ctl = plugin->controls + tlv->numid;
+    if (!(ctl->access & SNDRV_CTL_ELEM_ACCESS_TLV_READ))
+        return -ENXIO;
+
+    switch (ctl->type) {
+    case SNDRV_CTL_ELEM_TYPE_BYTES:
+        break;
+    case SNDRV_CTL_ELEM_TYPE_BOOLEAN:
+    case SNDRV_CTL_ELEM_TYPE_INTEGER:
+        return mixer_plug_tlv_read_integer(ctl, tlv);
+    default:
+        return -ENXIO;
+    }
+
     val_tlv = ctl->value;
 
     return val_tlv->get(plugin, ctl, tlv);
@@ -299,6 +337,7 @@ static int mixer_plug_get_elem_info(struct mixer_plug_data *plug_data,
         if (ret < 0)
             return ret;
         break;
+    case SNDRV_CTL_ELEM_TYPE_BOOLEAN:
     case SNDRV_CTL_ELEM_TYPE_INTEGER:
         ret = mixer_plug_info_integer(ctl, einfo);
         if (ret < 0)
@@ -341,10 +380,21 @@ static int mixer_plug_get_elem_list(struct mixer_plug_data *plug_data,
 static int mixer_plug_get_card_info(struct mixer_plug_data *plug_data,
                 struct snd_ctl_card_info *card_info)
 {
-    /*TODO: Fill card_info here from snd-card-def */
+    char *name;
+
     memset(card_info, 0, sizeof(*card_info));
     card_info->card = plug_data->card;
 
+    if (snd_utils_get_str(plug_data->mixer_node, "name", &name))
+        return 0;
+
+    strncpy((char *)card_info->id, name, sizeof(card_info->id) - 1);
+    strncpy((char *)card_info->name, name, sizeof(card_info->name) - 1);
+    strncpy((char *)card_info->longname, name,
+            sizeof(card_info->longname) - 1);
+    strncpy((char *)card_info->mixername, name,
+            sizeof(card_info->mixername) - 1);
+
     return 0;
 }
 
@@ -352,20 +402,14 @@ static void mixer_plug_close(void *data)
 {
     struct mixer_plug_data *plug_data = data;
     struct mixer_plugin *plugin = plug_data->plugin;
-    eventfd_t evfd;
-    unsigned int i, count;
+    int fd = plugin->eventfd;
 
-    pthread_mutex_lock(&plugin->mutex);
-    count = plugin->event_cnt;
-    pthread_mutex_unlock(&plugin->mutex);
     pthread_mutex_destroy(&plugin->mutex);
-
-    for (i = 0; i < count; ++i) {
-        eventfd_read(plugin->eventfd, &evfd);
-    }
-
     plug_data->ops->close(&plugin);
-    dlclose(plug_data->dl_hdl);
+    snd_utils_dlclose(plug_data->dl_hdl);
+    snd_utils_close_dev_node(plug_data->mixer_node);
+    if (fd >= 0)
+        close(fd);
 
     free(plug_data);
     plug_data = NULL;
@@ -453,7 +497,7 @@ int mixer_plugin_open(unsigned int card, void **data,
 
     }
 
-    dl_hdl = dlopen(so_name, RTLD_NOW);
+    dl_hdl = snd_utils_dlopen(so_name);
     if (!dl_hdl) {
         fprintf(stderr, "%s: unable to open %s\n",
                 __func__, so_name);
@@ -478,7 +522,7 @@ int mixer_plugin_open(unsigned int card, void **data,
     plug_data->plugin = plugin;
     plug_data->card = card;
     plug_data->dl_hdl = dl_hdl;
-    plugin->eventfd = eventfd(0, EFD_SEMAPHORE);
+    plugin->eventfd = eventfd(0, EFD_NONBLOCK);
     pthread_mutex_init(&plugin->mutex, NULL);
 
     *data = plug_data;
@@ -487,7 +531,7 @@ int mixer_plugin_open(unsigned int card, void **data,
     return 0;
 
 err_ops:
-    dlclose(dl_hdl);
+    snd_utils_dlclose(dl_hdl);
 err_dlopen:
 err_get_lib_name:
     snd_utils_close_dev_node(plug_data->mixer_node);
@@ -34,12 +34,17 @@
 #include <errno.h>
 #include <unistd.h>
 #include <poll.h>
+#include <pthread.h>
 
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <limits.h>
+#include <math.h>
+#include <stdint.h>
 
 #include <linux/ioctl.h>
 
@@ -255,6 +260,109 @@ static void param_init(struct snd_pcm_hw_params *p)
     p->info = ~0U;
 }
 
+/*
+ * A per-process cache of the hw_params negotiated by pcm_set_config() and of
+ * the limits returned by pcm_params_get(). Reopening a device with the same
+ * configuration hands the negotiated params straight to HW_PARAMS, and its
+ * limits are not queried again. The entries of a device are dropped when it
+ * cannot be opened or rejects its cached params.
+ */
+#define PCM_PARAMS_CACHE_SIZE 16
+
+/* The flags that change the negotiated params */
+#define PCM_PARAMS_CACHE_FLAGS (PCM_IN | PCM_MMAP | PCM_NOIRQ | PCM_NONINTERLEAVED)
+
+struct pcm_params_cache_entry {
+    int valid;
+    unsigned int card;
+    unsigned int device;
+    unsigned int flags;
+    /** Set for the limits of @ref pcm_params_get, which have no config */
+    int limits;
+    struct pcm_config config;
+    struct snd_pcm_hw_params params;
+};
+
+static pthread_mutex_t pcm_params_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct pcm_params_cache_entry pcm_params_cache[PCM_PARAMS_CACHE_SIZE];
+static unsigned int pcm_params_cache_next;
+
+/* Called with pcm_params_cache_lock held */
+static struct pcm_params_cache_entry *pcm_params_cache_lookup(unsigned int card,
+        unsigned int device, unsigned int flags, const struct pcm_config *config)
+{
+    struct pcm_params_cache_entry *entry;
+    unsigned int i;
+
+    flags &= PCM_PARAMS_CACHE_FLAGS;
+
+    for (i = 0; i < PCM_PARAMS_CACHE_SIZE; i++) {
+        entry = &pcm_params_cache[i];
+        if (!entry->valid || entry->card != card || entry->device != device ||
+            entry->flags != flags || entry->limits != !config)
+            continue;
+        if (!config)
+            return entry;
+        if (entry->config.format == config->format &&
+            entry->config.channels == config->channels &&
+            entry->config.rate == config->rate &&
+            entry->config.period_size == config->period_size &&
+            entry->config.period_count == config->period_count)
+            return entry;
+    }
+
+    return NULL;
+}
+
+static int pcm_params_cache_get(unsigned int card, unsigned int device, unsigned int flags,
+        const struct pcm_config *config, struct snd_pcm_hw_params *params)
+{
+    struct pcm_params_cache_entry *entry;
+
+    pthread_mutex_lock(&pcm_params_cache_lock);
+    entry = pcm_params_cache_lookup(card, device, flags, config);
+    if (entry)
+        *params = entry->params;
+    pthread_mutex_unlock(&pcm_params_cache_lock);
+
+    return entry != NULL;
+}
+
+static void pcm_params_cache_put(unsigned int card, unsigned int device, unsigned int flags,
+        const struct pcm_config *config, const struct snd_pcm_hw_params *params)
+{
+    struct pcm_params_cache_entry *entry;
+
+    pthread_mutex_lock(&pcm_params_cache_lock);
+    entry = pcm_params_cache_lookup(card, device, flags, config);
+    if (!entry) {
+        entry = &pcm_params_cache[pcm_params_cache_next];
+        pcm_params_cache_next = (pcm_params_cache_next + 1) % PCM_PARAMS_CACHE_SIZE;
+    }
+
+    entry->valid = 1;
+    entry->card = card;
+    entry->device = device;
+    entry->flags = flags & PCM_PARAMS_CACHE_FLAGS;
+    entry->limits = !config;
+    if (config)
+        entry->config = *config;
+    entry->params = *params;
+    pthread_mutex_unlock(&pcm_params_cache_lock);
+}
+
+static void pcm_params_cache_drop(unsigned int card, unsigned int device)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&pcm_params_cache_lock);
+    for (i = 0; i < PCM_PARAMS_CACHE_SIZE; i++) {
+        if (pcm_params_cache[i].card == card && pcm_params_cache[i].device == device)
+            pcm_params_cache[i].valid = 0;
+    }
+    pthread_mutex_unlock(&pcm_params_cache_lock);
+}
+
 static unsigned int pcm_format_to_alsa(enum pcm_format format)
 {
     switch (format) {
@@ -314,7 +422,11 @@ struct pcm {
     struct snd_pcm_mmap_control *mmap_control;
     struct snd_pcm_sync_ptr *sync_ptr;
     void *mmap_buffer;
-    unsigned int noirq_frames_per_msec;
+    /** Measured rate of a @ref PCM_NOIRQ stream, in frames per second */
+    double noirq_rate;
+    /** Hardware pointer and timestamp of the last rate measurement */
+    unsigned long noirq_hw_ptr;
+    long long noirq_tstamp_ns;
     /** The delay of the PCM, in terms of frames */
     long pcm_delay;
     /** The subdevice corresponding to the PCM */
@@ -325,13 +437,99 @@ struct pcm {
     void *data;
     /** Pointer to the pcm node from snd card definition */
     struct snd_node *snd_node;
+    /** Runtime statistics, kept if opened with @ref PCM_STATS */
+    struct pcm_stats stats;
+    /** Time the first transfer started, for @ref pcm_stats.active_ns */
+    unsigned long long stats_start_ns;
+    /** Buffer that @ref pcm_writen and @ref pcm_readn interleave through */
+    char *planar_buffer;
+    /** Size of planar_buffer, in bytes */
+    size_t planar_size;
+    /** Card and device the PCM was opened on */
+    unsigned int card;
+    unsigned int device;
+    /** The sw params last set, for changing the start threshold */
+    struct snd_pcm_sw_params sw_params;
+    /** How transfers recover from xruns, see @ref pcm_set_xrun_policy */
+    enum pcm_xrun_policy xrun_policy;
+    /** The safe level of the xrun policy, in frames; zero for the whole buffer */
+    unsigned int xrun_level;
+    /** The number of xruns in a row, each before a buffer was transferred */
+    unsigned int xrun_streak;
+    /** Frames transferred since recovering from the last xrun */
+    unsigned long long xrun_clean_frames;
+    /** The start threshold to restore once the stream runs clean, or zero */
+    unsigned long xrun_saved_threshold;
+    /** Time the xrun or suspend being recovered from was detected */
+    unsigned long long recovery_start_ns;
+    /** The errno value of the last error, zero if it had none */
+    int error_code;
+    /** For @ref PCM_RT, the format of the last error, until pcm_get_error formats it */
+    const char *error_fmt;
+    /** Ring of period stamps, see @ref pcm_set_period_stamps. The indexes
+     * count records and only grow: the transfers write the tail and the
+     * record being written, the reader writes the head. */
+    struct pcm_period_stamp *stamps;
+    unsigned int stamps_size;
+    unsigned long stamps_head;
+    unsigned long stamps_tail;
+    unsigned long stamps_writing;
+    /** Frames transferred since the period stamps were enabled */
+    unsigned long long stamp_frames;
+    /** Level meter, see @ref pcm_set_meter */
+    struct pcm_meter *meter;
+    /** The meter replaced last, which a reader may still be using */
+    struct pcm_meter *meter_old;
+};
+
+/* the levels of a channel over the current window */
+struct pcm_meter_acc {
+    /** The largest absolute sample value, relative to full scale */
+    float peak;
+    /** The number of samples at full scale */
+    unsigned int clips;
+    /** The sum of the squared samples, relative to full scale */
+    double sum;
+};
+
+/* the level meter of a PCM, see pcm_set_meter */
+struct pcm_meter {
+    enum pcm_format format;
+    unsigned int channels;
+    /** Bytes per sample */
+    unsigned int width;
+    /** One over full scale, in units of the format */
+    float scale;
+    /** Frames in each window */
+    unsigned int window;
+    /** Frames in the current window */
+    unsigned int count;
+    /** Frames metered since the meter was set */
+    unsigned long long frames;
+    struct pcm_meter_acc *acc;
+    /** Odd while the levels are being published */
+    unsigned int seq;
+    /** The frames metered up to the end of the published window */
+    unsigned long long levels_frames;
+    struct pcm_meter_level *levels;
 };
 
+static void pcm_meter_update(struct pcm_meter *meter, const char *data, unsigned int frames);
+static void pcm_meter_updaten(struct pcm_meter *meter, char *const *planes, unsigned int frames);
+
 static int oops(struct pcm *pcm, int e, const char *fmt, ...)
 {
     va_list ap;
     int sz;
 
+    pcm->error_code = e;
+    if (pcm->flags & PCM_RT) {
+        /* formatted by pcm_get_error, out of the real-time path */
+        pcm->error_fmt = fmt;
+        return -1;
+    }
+    pcm->error_fmt = NULL;
+
     va_start(ap, fmt);
     vsnprintf(pcm->error, PCM_ERROR_MAX, fmt, ap);
     va_end(ap);
@@ -343,6 +541,48 @@ static int oops(struct pcm *pcm, int e, const char *fmt, ...)
     return -1;
 }
 
+static unsigned long long pcm_stats_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void pcm_stats_ioctl(struct pcm *pcm)
+{
+    if (pcm->flags & PCM_STATS)
+        pcm->stats.ioctls++;
+}
+
+static void pcm_stats_event(struct pcm *pcm, int err)
+{
+    struct timespec *tstamp;
+
+    if (!(pcm->flags & PCM_STATS))
+        return;
+
+    if (err == EPIPE)
+        tstamp = &pcm->stats.xrun_tstamp[pcm->stats.xruns++ % PCM_STATS_EVENTS];
+    else
+        tstamp = &pcm->stats.suspend_tstamp[pcm->stats.suspends++ % PCM_STATS_EVENTS];
+    clock_gettime(CLOCK_MONOTONIC, tstamp);
+}
+
+static void pcm_stats_wakeup(struct pcm *pcm, int avail)
+{
+    unsigned int bucket;
+
+    pcm->stats.wakeups++;
+    if (avail < 0 || !pcm->buffer_size)
+        return;
+
+    bucket = (unsigned long long) avail * PCM_STATS_AVAIL_BUCKETS / pcm->buffer_size;
+    if (bucket >= PCM_STATS_AVAIL_BUCKETS)
+        bucket = PCM_STATS_AVAIL_BUCKETS - 1;
+    pcm->stats.avail_histogram[bucket]++;
+}
+
 /** Gets the buffer size of the PCM.
  * @param pcm A PCM handle.
  * @return The buffer size of the PCM.
@@ -409,6 +649,36 @@ int pcm_get_file_descriptor(const struct pcm *pcm)
     return pcm->fd;
 }
 
+/*
+ * Formats the error recorded by oops for a PCM_RT PCM. The values the format
+ * refers to were not kept, each conversion is shown as a question mark.
+ */
+static void pcm_format_error(struct pcm *pcm)
+{
+    const char *fmt = pcm->error_fmt;
+    size_t n = 0;
+
+    for (; *fmt && n < PCM_ERROR_MAX - 1; fmt++) {
+        if (*fmt != '%' || fmt[1] == '%') {
+            pcm->error[n++] = *fmt;
+            fmt += *fmt == '%';
+            continue;
+        }
+        while (fmt[1] && !strchr("diouxXeEfFgGaAcspn", fmt[1]))
+            fmt++;
+        if (*++fmt == '\0')
+            break;
+        pcm->error[n++] = '?';
+    }
+    while (n > 0 && pcm->error[n - 1] == '\n')
+        n--;
+    pcm->error[n] = '\0';
+
+    if (pcm->error_code)
+        snprintf(pcm->error + n, PCM_ERROR_MAX - n, ": %s", strerror(pcm->error_code));
+    pcm->error_fmt = NULL;
+}
+
 /** Gets the error message for the last error that occurred.
  * If no error occurred and this function is called, the results are undefined.
  * @param pcm A PCM handle.
@@ -417,9 +687,129 @@ int pcm_get_file_descriptor(const struct pcm *pcm)
  */
 const char* pcm_get_error(const struct pcm *pcm)
 {
+    if (pcm->error_fmt)
+        pcm_format_error((struct pcm *) pcm);
+
     return pcm->error;
 }
 
+/** Gets the error code of the last error that occurred.
+ * @param pcm A PCM handle.
+ * @return The errno value of the last error, or zero if it had none.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_get_error_code(const struct pcm *pcm)
+{
+    return pcm->error_code;
+}
+
+/*
+ * Faults in and locks a mapping for a PCM_RT PCM, so that the transfer path
+ * never waits on a page fault. Pages are written if the caller owns their
+ * contents, otherwise only read.
+ */
+static int pcm_rt_lock(void *addr, size_t bytes, int writable)
+{
+    size_t page_size = (size_t) sysconf(_SC_PAGE_SIZE);
+    volatile char *p = addr;
+    size_t i;
+
+    for (i = 0; i < bytes; i += page_size) {
+        if (writable)
+            p[i] = 0;
+        else
+            (void) p[i];
+    }
+    return mlock(addr, bytes);
+}
+
+/*
+ * Sets up what the transfer path of a PCM_RT PCM would otherwise allocate or
+ * fault in on first use: the planar buffer and the mmap buffer.
+ */
+static int pcm_rt_prepare(struct pcm *pcm)
+{
+    size_t size = pcm_frames_to_bytes(pcm, pcm->config.period_size);
+
+    if (pcm->planar_size < size) {
+        char *buffer = realloc(pcm->planar_buffer, size);
+        if (buffer == NULL)
+            return oops(pcm, ENOMEM, "failed to allocate planar buffer");
+        pcm->planar_buffer = buffer;
+        pcm->planar_size = size;
+    }
+    memset(pcm->planar_buffer, 0, pcm->planar_size);
+
+    /* the playback buffer is ours until started, capture only gets read */
+    if ((pcm->flags & PCM_MMAP) &&
+        pcm_rt_lock(pcm->mmap_buffer, pcm_frames_to_bytes(pcm, pcm->buffer_size),
+                    !(pcm->flags & PCM_IN)) != 0)
+        return oops(pcm, errno, "cannot lock mmap buffer");
+
+    return 0;
+}
+
+/* The longest buffer of the deep-buffer profile, for devices (such as
+ * plugins) without a real buffer that allow any size */
+#define PCM_DEEP_BUFFER_MAX_MS 2000
+
+/*
+ * Picks the deep-buffer config: the largest period, and then as many periods
+ * as the largest buffer holds, allowed for the format, channels, rate and
+ * access already in params. The caller is woken once all but one period of
+ * the buffer can be transferred, and playback starts once the buffer is full.
+ */
+static int pcm_set_deep_buffer(struct pcm *pcm, struct snd_pcm_hw_params *params)
+{
+    struct snd_pcm_hw_params refined = *params;
+    unsigned int frame_bytes = pcm_frames_to_bytes(pcm, 1);
+    unsigned long long buffer_max, period_size;
+    unsigned int period_count, periods_min, periods_max;
+
+    if (frame_bytes == 0)
+        return -EINVAL;
+
+    if (pcm->ops->ioctl(pcm->data, SNDRV_PCM_IOCTL_HW_REFINE, &refined)) {
+        int errno_copy = errno;
+        oops(pcm, errno, "cannot refine hw params");
+        return -errno_copy;
+    }
+
+    buffer_max = param_get_max(&refined, SNDRV_PCM_HW_PARAM_BUFFER_SIZE);
+    if (buffer_max > param_get_max(&refined, SNDRV_PCM_HW_PARAM_BUFFER_BYTES) / frame_bytes)
+        buffer_max = param_get_max(&refined, SNDRV_PCM_HW_PARAM_BUFFER_BYTES) / frame_bytes;
+    if (buffer_max > (unsigned long long) pcm->config.rate * PCM_DEEP_BUFFER_MAX_MS / 1000)
+        buffer_max = (unsigned long long) pcm->config.rate * PCM_DEEP_BUFFER_MAX_MS / 1000;
+
+    period_size = param_get_max(&refined, SNDRV_PCM_HW_PARAM_PERIOD_SIZE);
+    if (period_size > param_get_max(&refined, SNDRV_PCM_HW_PARAM_PERIOD_BYTES) / frame_bytes)
+        period_size = param_get_max(&refined, SNDRV_PCM_HW_PARAM_PERIOD_BYTES) / frame_bytes;
+
+    /* two periods at least, so there is one left queued when woken */
+    periods_min = param_get_min(&refined, SNDRV_PCM_HW_PARAM_PERIODS);
+    periods_max = param_get_max(&refined, SNDRV_PCM_HW_PARAM_PERIODS);
+    if (periods_min < 2 && periods_max >= 2)
+        periods_min = 2;
+
+    if (periods_min == 0 || period_size > buffer_max / periods_min)
+        period_size = periods_min ? buffer_max / periods_min : 0;
+    if (period_size == 0) {
+        oops(pcm, EINVAL, "no deep buffer config within the hw params limits");
+        return -EINVAL;
+    }
+    period_count = buffer_max / period_size > periods_max ? periods_max : buffer_max / period_size;
+
+    pcm->config.period_size = period_size;
+    pcm->config.period_count = period_count;
+    pcm->config.avail_min = period_size * (period_count > 1 ? period_count - 1 : 1);
+    pcm->config.start_threshold = (pcm->flags & PCM_IN) ? 1 : period_size * period_count;
+    pcm->config.stop_threshold = period_size * period_count;
+    pcm->config.silence_threshold = 0;
+    pcm->config.silence_size = 0;
+
+    return 0;
+}
+
 /** Sets the PCM configuration.
  * @param pcm A PCM handle.
  * @param config The configuration to use for the
@@ -447,14 +837,12 @@ int pcm_set_config(struct pcm *pcm, const struct pcm_config *config)
     } else
         pcm->config = *config;
 
-    struct snd_pcm_hw_params params;
+    struct snd_pcm_hw_params params, cached;
     param_init(&params);
     param_set_mask(&params, SNDRV_PCM_HW_PARAM_FORMAT,
                    pcm_format_to_alsa(config->format));
-    param_set_min(&params, SNDRV_PCM_HW_PARAM_PERIOD_SIZE, config->period_size);
     param_set_int(&params, SNDRV_PCM_HW_PARAM_CHANNELS,
                   config->channels);
-    param_set_int(&params, SNDRV_PCM_HW_PARAM_PERIODS, config->period_count);
     param_set_int(&params, SNDRV_PCM_HW_PARAM_RATE, config->rate);
 
     if (pcm->flags & PCM_NOIRQ) {
@@ -465,21 +853,53 @@ int pcm_set_config(struct pcm *pcm, const struct pcm_config *config)
         }
 
         params.flags |= SNDRV_PCM_HW_PARAMS_NO_PERIOD_WAKEUP;
-        pcm->noirq_frames_per_msec = config->rate / 1000;
+        pcm->noirq_rate = config->rate;
+        pcm->noirq_tstamp_ns = 0;
+    }
+
+    if ((pcm->flags & PCM_NONINTERLEAVED) && (pcm->flags & PCM_MMAP)) {
+        oops(pcm, EINVAL, "non-interleaved access only currently supported without mmap().");
+        return -EINVAL;
     }
 
     if (pcm->flags & PCM_MMAP)
         param_set_mask(&params, SNDRV_PCM_HW_PARAM_ACCESS,
                    SNDRV_PCM_ACCESS_MMAP_INTERLEAVED);
+    else if (pcm->flags & PCM_NONINTERLEAVED)
+        param_set_mask(&params, SNDRV_PCM_HW_PARAM_ACCESS,
+                   SNDRV_PCM_ACCESS_RW_NONINTERLEAVED);
     else
         param_set_mask(&params, SNDRV_PCM_HW_PARAM_ACCESS,
                    SNDRV_PCM_ACCESS_RW_INTERLEAVED);
 
+    if (pcm->flags & PCM_DEEP_BUFFER) {
+        int err = pcm_set_deep_buffer(pcm, &params);
+        if (err < 0)
+            return err;
+        config = &pcm->config;
+    }
+
+    param_set_min(&params, SNDRV_PCM_HW_PARAM_PERIOD_SIZE, config->period_size);
+    param_set_int(&params, SNDRV_PCM_HW_PARAM_PERIODS, config->period_count);
+
+    /* try the params negotiated by a previous open, then negotiate them */
+    if (pcm_params_cache_get(pcm->card, pcm->device, pcm->flags, config, &cached)) {
+        cached.rmask = ~0U;
+        if (pcm->ops->ioctl(pcm->data, SNDRV_PCM_IOCTL_HW_PARAMS, &cached) == 0) {
+            params = cached;
+            goto hw_params_set;
+        }
+        pcm_params_cache_drop(pcm->card, pcm->device);
+    }
+
     if (pcm->ops->ioctl(pcm->data, SNDRV_PCM_IOCTL_HW_PARAMS, &params)) {
         int errno_copy = errno;
         oops(pcm, errno, "cannot set hw params");
         return -errno_copy;
     }
+    pcm_params_cache_put(pcm->card, pcm->device, pcm->flags, config, &params);
+
+hw_params_set:
 
     /* get our refined hw_params */
     pcm->config.period_size = param_get_int(&params, SNDRV_PCM_HW_PARAM_PERIOD_SIZE);
@@ -538,6 +958,61 @@ int pcm_set_config(struct pcm *pcm, const struct pcm_config *config)
     }
 
     pcm->boundary = sparams.boundary;
+    pcm->sw_params = sparams;
+    pcm->xrun_saved_threshold = 0;
+
+    /* the meter follows the channels and format */
+    if (pcm->meter && pcm_set_meter(pcm, pcm->meter->window) != 0)
+        pcm_set_meter(pcm, 0);
+
+    if ((pcm->flags & PCM_RT) && pcm_rt_prepare(pcm) != 0)
+        return -pcm->error_code;
+
+    return 0;
+}
+
+/** Changes the thresholds of an open PCM, in any state.
+ * Unlike @ref pcm_set_config, the hardware parameters are kept, so the
+ * frames queued on a prepared or running PCM are not dropped.
+ * @param pcm A PCM handle.
+ * @param config The avail_min, start_threshold, stop_threshold,
+ *  silence_threshold and silence_size to use; the other members are
+ *  ignored. A zero avail_min, start_threshold or stop_threshold keeps the
+ *  current value.
+ * @return On success, zero; on failure, a negative errno value.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_set_thresholds(struct pcm *pcm, const struct pcm_config *config)
+{
+    struct snd_pcm_sw_params sparams = pcm->sw_params;
+
+    if (config->avail_min)
+        sparams.avail_min = config->avail_min;
+    if (config->start_threshold)
+        sparams.start_threshold = config->start_threshold;
+    if (config->stop_threshold)
+        sparams.stop_threshold = config->stop_threshold;
+    sparams.silence_threshold = config->silence_threshold;
+    sparams.silence_size = config->silence_size;
+
+    pcm_stats_ioctl(pcm);
+    if (pcm->ops->ioctl(pcm->data, SNDRV_PCM_IOCTL_SW_PARAMS, &sparams)) {
+        int errno_copy = errno;
+        oops(pcm, errno, "cannot set sw params");
+        return -errno_copy;
+    }
+
+    pcm->sw_params = sparams;
+    pcm->config.avail_min = sparams.avail_min;
+    pcm->config.start_threshold = sparams.start_threshold;
+    pcm->config.stop_threshold = sparams.stop_threshold;
+    pcm->config.silence_threshold = sparams.silence_threshold;
+    pcm->config.silence_size = sparams.silence_size;
+    /* the threshold the xrun policy would restore is replaced */
+    pcm->xrun_saved_threshold = 0;
+    if (pcm->mmap_control)
+        pcm->mmap_control->avail_min = sparams.avail_min;
+
     return 0;
 }
 
@@ -549,6 +1024,125 @@ unsigned int pcm_get_subdevice(const struct pcm *pcm)
     return pcm->subdevice;
 }
 
+/** Gets the number of xruns the PCM has recovered from since it was opened.
+ * Only xruns detected by the read and write functions are counted.
+ * @param pcm A PCM handle.
+ * @return The number of (under/over)runs that have occurred.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_get_xruns(const struct pcm *pcm)
+{
+    return pcm->xruns;
+}
+
+/** Gets the runtime statistics of a PCM.
+ * @param pcm A PCM handle, opened with @ref PCM_STATS.
+ * @param stats Receives a copy of the statistics.
+ * @return On success, zero; if @p pcm was not opened with @ref PCM_STATS, -EINVAL.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_get_stats(const struct pcm *pcm, struct pcm_stats *stats)
+{
+    if (!(pcm->flags & PCM_STATS))
+        return -EINVAL;
+
+    *stats = pcm->stats;
+    return 0;
+}
+
+/** Sets how the read and write functions recover from xruns.
+ * Each xrun that happens before a buffer of frames was transferred since the
+ * previous one doubles the safe level, up to the buffer size.
+ * PCMs opened with @ref PCM_NORESTART always report xruns.
+ * @param pcm A PCM handle.
+ * @param policy The recovery strategy.
+ * @param level The safe level for @ref PCM_XRUN_PREFILL and
+ *  @ref PCM_XRUN_RAISE_THRESHOLD, in frames; zero for the whole buffer.
+ * @return On success, zero; if @p level is larger than the buffer, -EINVAL.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_set_xrun_policy(struct pcm *pcm, enum pcm_xrun_policy policy, unsigned int level)
+{
+    if (policy > PCM_XRUN_REPORT || level > pcm->buffer_size)
+        return -EINVAL;
+
+    pcm->xrun_policy = policy;
+    pcm->xrun_level = level;
+    return 0;
+}
+
+/** Keeps a ring of the PCM position and time stamp at each period.
+ * After a read or write completes one or more periods, the hardware and
+ * application positions and the time stamp are recorded from the status
+ * of the PCM, which the kernel updates at each period. Where the status
+ * page is mapped this costs no ioctl; otherwise the status is synchronized
+ * once per record. When the ring is full, the oldest record is replaced.
+ * It must not be called while another thread reads, writes or takes stamps.
+ * @param pcm A PCM handle.
+ * @param count The number of records the ring holds; zero disables the stamps.
+ * @return On success, zero; if the ring could not be allocated, -ENOMEM.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_set_period_stamps(struct pcm *pcm, unsigned int count)
+{
+    struct pcm_period_stamp *stamps = NULL;
+
+    if (count) {
+        stamps = calloc(count, sizeof(*stamps));
+        if (stamps == NULL)
+            return -ENOMEM;
+    }
+
+    free(pcm->stamps);
+    pcm->stamps = stamps;
+    pcm->stamps_size = count;
+    pcm->stamps_head = 0;
+    pcm->stamps_tail = 0;
+    pcm->stamps_writing = 0;
+    pcm->stamp_frames = 0;
+    return 0;
+}
+
+/** Takes the oldest period stamps from the ring.
+ * It may be called from another thread than the one doing the reads or
+ * writes, such as that of an A/V sync consumer, but by one thread at a time.
+ * Records replaced while they are taken are skipped.
+ * @param pcm A PCM handle.
+ * @param stamps Receives the records, oldest first.
+ * @param count The maximum number of records to take.
+ * @return The number of records taken; if stamps are not enabled, -EINVAL.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_get_period_stamps(struct pcm *pcm, struct pcm_period_stamp *stamps, unsigned int count)
+{
+    unsigned long head = pcm->stamps_head, tail, writing;
+    unsigned int i, n;
+
+    if (pcm->stamps == NULL)
+        return -EINVAL;
+
+    for (;;) {
+        tail = __atomic_load_n(&pcm->stamps_tail, __ATOMIC_ACQUIRE);
+        /* the oldest records were replaced */
+        if (tail - head > pcm->stamps_size)
+            head = tail - pcm->stamps_size;
+
+        n = tail - head < count ? tail - head : count;
+        for (i = 0; i < n; i++)
+            stamps[i] = pcm->stamps[(head + i) % pcm->stamps_size];
+
+        /* a record started since then replaced the one at its index less the size */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        writing = __atomic_load_n(&pcm->stamps_writing, __ATOMIC_RELAXED);
+        if (writing <= head + pcm->stamps_size)
+            break;
+        head = writing - pcm->stamps_size;
+    }
+
+    __atomic_store_n(&pcm->stamps_head, head + n, __ATOMIC_RELAXED);
+    return n;
+}
+
 /** Determines the number of bits occupied by a @ref pcm_format.
  * @param format A PCM format.
  * @return The number of bits associated with @p format
@@ -605,12 +1199,14 @@ static int pcm_sync_ptr(struct pcm *pcm, int flags)
     if (pcm->sync_ptr == NULL) {
         /* status and control are mmapped */
         if (flags & SNDRV_PCM_SYNC_PTR_HWSYNC) {
+            pcm_stats_ioctl(pcm);
             if (pcm->ops->ioctl(pcm->data, SNDRV_PCM_IOCTL_HWSYNC) == -1) {
                 return oops(pcm, errno, "failed to sync hardware pointer");
             }
         }
     } else {
         pcm->sync_ptr->flags = flags;
+        pcm_stats_ioctl(pcm);
         if (pcm->ops->ioctl(pcm->data, SNDRV_PCM_IOCTL_SYNC_PTR,
                             pcm->sync_ptr) < 0) {
             return oops(pcm, errno, "failed to sync mmap ptr");
@@ -620,6 +1216,12 @@ static int pcm_sync_ptr(struct pcm *pcm, int flags)
     return 0;
 }
 
+/** Gets the state of a PCM, such as @ref PCM_STATE_RUNNING.
+ * The state is read again from the driver or plugin, the hardware pointer is not.
+ * @param pcm A PCM handle.
+ * @return The state on success, a negative number on failure.
+ * @ingroup libtinyalsa-pcm
+ */
 int pcm_state(struct pcm *pcm)
 {
     // Update the state only. Do not sync HW sync.
@@ -671,6 +1273,8 @@ mmap_error:
 
 static void pcm_hw_munmap_status(struct pcm *pcm) {
     if (pcm->sync_ptr) {
+        if (pcm->flags & PCM_RT)
+            munlock(pcm->sync_ptr, sizeof(*pcm->sync_ptr));
         free(pcm->sync_ptr);
         pcm->sync_ptr = NULL;
     } else {
@@ -708,6 +1312,13 @@ struct pcm_params *pcm_params_get(unsigned int card, unsigned int device,
     const struct pcm_ops *ops;
     int fd;
 
+    params = calloc(1, sizeof(struct snd_pcm_hw_params));
+    if (!params)
+        return NULL;
+
+    if (pcm_params_cache_get(card, device, flags & PCM_IN, NULL, params))
+        return (struct pcm_params *)params;
+
     ops = &hw_ops;
     fd = ops->open(card, device, flags, &data, snd_node);
 
@@ -731,10 +1342,6 @@ struct pcm_params *pcm_params_get(unsigned int card, unsigned int device,
         goto err_open;
     }
 
-    params = calloc(1, sizeof(struct snd_pcm_hw_params));
-    if (!params)
-        goto err_calloc;
-
     param_init(params);
     if (ops->ioctl(data, SNDRV_PCM_IOCTL_HW_REFINE, params)) {
         fprintf(stderr, "SNDRV_PCM_IOCTL_HW_REFINE error (%d)\n", errno);
@@ -747,17 +1354,20 @@ struct pcm_params *pcm_params_get(unsigned int card, unsigned int device,
 #endif
     ops->close(data);
 
+    pcm_params_cache_put(card, device, flags & PCM_IN, NULL, params);
     return (struct pcm_params *)params;
 
 err_hw_refine:
-    free(params);
-err_calloc:
 #ifdef TINYALSA_USES_PLUGINS
     if (snd_node)
         snd_utils_close_dev_node(snd_node);
 #endif
     ops->close(data);
+    free(params);
+    return NULL;
 err_open:
+    pcm_params_cache_drop(card, device);
+    free(params);
     return NULL;
 }
 
@@ -996,6 +1606,10 @@ int pcm_close(struct pcm *pcm)
     pcm->ops->close(pcm->data);
     pcm->buffer_size = 0;
     pcm->fd = -1;
+    free(pcm->planar_buffer);
+    free(pcm->stamps);
+    free(pcm->meter);
+    free(pcm->meter_old);
     free(pcm);
     return 0;
 }
@@ -1091,6 +1705,8 @@ struct pcm *pcm_open(unsigned int card, unsigned int device,
     }
 
     pcm->flags = flags;
+    pcm->card = card;
+    pcm->device = device;
 
     if (pcm->ops->ioctl(pcm->data, SNDRV_PCM_IOCTL_INFO, &info)) {
         oops(&bad_pcm, errno, "cannot get info");
@@ -1099,7 +1715,7 @@ struct pcm *pcm_open(unsigned int card, unsigned int device,
     pcm->subdevice = info.subdevice;
 
     if (pcm_set_config(pcm, config) != 0) {
-        memcpy(bad_pcm.error, pcm->error, sizeof(pcm->error));
+        memcpy(bad_pcm.error, pcm_get_error(pcm), sizeof(pcm->error));
         goto fail_close;
     }
 
@@ -1109,6 +1725,20 @@ struct pcm *pcm_open(unsigned int card, unsigned int device,
         goto fail;
     }
 
+    if (flags & PCM_RT) {
+        size_t page_size = (size_t) sysconf(_SC_PAGE_SIZE);
+
+        if (pcm->sync_ptr)
+            rc = pcm_rt_lock(pcm->sync_ptr, sizeof(*pcm->sync_ptr), 1);
+        else
+            rc = pcm_rt_lock(pcm->mmap_status, page_size, 0) ||
+                 pcm_rt_lock(pcm->mmap_control, page_size, 0);
+        if (rc != 0) {
+            oops(&bad_pcm, errno, "cannot lock status and control");
+            goto fail;
+        }
+    }
+
 #ifdef SNDRV_PCM_IOCTL_TTSTAMP
     if (pcm->flags & PCM_MONOTONIC) {
         int arg = SNDRV_PCM_TSTAMP_TYPE_MONOTONIC;
@@ -1134,6 +1764,9 @@ fail_close_dev_node:
     if (pcm->snd_node)
         snd_utils_close_dev_node(pcm->snd_node);
 #endif
+    /* the device may be gone, forget what was negotiated with it */
+    if (pcm->fd < 0)
+        pcm_params_cache_drop(card, device);
     free(pcm);
     return &bad_pcm;
 }
@@ -1192,6 +1825,7 @@ int pcm_unlink(struct pcm *pcm)
  */
 int pcm_prepare(struct pcm *pcm)
 {
+    pcm_stats_ioctl(pcm);
     if (pcm->ops->ioctl(pcm->data, SNDRV_PCM_IOCTL_PREPARE) < 0)
         return oops(pcm, errno, "cannot prepare channel");
 
@@ -1217,6 +1851,7 @@ int pcm_start(struct pcm *pcm)
         return -1;
 
     if (pcm->mmap_status->state != PCM_STATE_RUNNING) {
+        pcm_stats_ioctl(pcm);
         if (pcm->ops->ioctl(pcm->data, SNDRV_PCM_IOCTL_START) < 0)
             return oops(pcm, errno, "cannot start channel");
     }
@@ -1343,6 +1978,10 @@ static int pcm_areas_copy(struct pcm *pcm, unsigned int pcm_offset,
         memcpy((char*)pcm->mmap_buffer + pcm_offset_bytes,
                buf + src_offset_bytes,
                size_bytes);
+
+    /* while the copy is still in cache */
+    if (pcm->meter)
+        pcm_meter_update(pcm->meter, buf + src_offset_bytes, frames);
     return 0;
 }
 
@@ -1356,10 +1995,8 @@ int pcm_mmap_commit(struct pcm *pcm, unsigned int offset, unsigned int frames)
     /* update the application pointer in userspace and kernel */
     pcm_mmap_appl_forward(pcm, frames);
     ret = pcm_sync_ptr(pcm, 0);
-    if (ret != 0){
-        printf("%d\n", ret);
+    if (ret != 0)
         return ret;
-    }
 
     return frames;
 }
@@ -1456,6 +2093,7 @@ again:
 int pcm_wait(struct pcm *pcm, int timeout)
 {
     struct pollfd pfd;
+    unsigned long long start = 0;
     int err;
 
     pfd.fd = pcm->fd;
@@ -1463,7 +2101,11 @@ int pcm_wait(struct pcm *pcm, int timeout)
 
     do {
         /* let's wait for avail or timeout */
+        if (pcm->flags & PCM_STATS)
+            start = pcm_stats_now();
         err = pcm->ops->poll(pcm->data, &pfd, 1, timeout);
+        if (pcm->flags & PCM_STATS)
+            pcm->stats.blocked_ns += pcm_stats_now() - start;
         if (err < 0)
             return -errno;
 
@@ -1491,31 +2133,374 @@ int pcm_wait(struct pcm *pcm, int timeout)
     /* poll again if fd not ready for IO */
     } while (!(pfd.revents & (POLLIN | POLLOUT)));
 
+    if (pcm->flags & PCM_STATS)
+        pcm_stats_wakeup(pcm, pcm_avail_update(pcm));
+
     return 1;
 }
 
-/*
- * Transfer data to/from mmapped buffer. This imitates the
- * behavior of read/write system calls.
- *
- * However, this doesn't seems to offer any advantage over
- * the read/write syscalls. Should it be removed?
+/** A group of PCMs that are started together and waited on with one call.
+ * @ingroup libtinyalsa-pcm
+ */
+struct pcm_group {
+    /** The epoll instance all PCMs of the group are registered with */
+    int epoll_fd;
+    /** Non-zero while every PCM is linked to the first one */
+    int linked;
+    /** The number of PCMs in the group */
+    unsigned int count;
+    /** The number of plugin PCMs, which are polled instead of registered */
+    unsigned int plugins;
+    /** The PCMs, in the order they were added */
+    struct pcm *pcms[PCM_GROUP_MAX];
+};
+
+/** Creates an empty PCM group.
+ * @return On success, a PCM group; on failure, NULL with errno set.
+ * @ingroup libtinyalsa-pcm
  */
-static int pcm_mmap_transfer(struct pcm *pcm, void *buffer, unsigned int frames)
+struct pcm_group *pcm_group_open(void)
 {
-    int is_playback;
+    struct pcm_group *group = calloc(1, sizeof(*group));
 
-    int state;
-    unsigned int avail;
-    unsigned int user_offset = 0;
+    if (!group)
+        return NULL;
 
-    int err;
-    int transferred_frames;
+    group->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (group->epoll_fd < 0) {
+        free(group);
+        return NULL;
+    }
+    group->linked = 1;
+    return group;
+}
 
-    is_playback = !(pcm->flags & PCM_IN);
+/* how long a group with plugin PCMs waits on the others before polling them again */
+#define PCM_GROUP_PLUGIN_POLL_MS 1
 
-    if (frames == 0)
-        return 0;
+/* Unlinks the PCMs linked to the first one, ignoring those that never were */
+static void pcm_group_unlink(struct pcm_group *group)
+{
+    unsigned int i;
+
+    for (i = 1; i < group->count; i++) {
+        if (group->pcms[i]->ops == &hw_ops)
+            group->pcms[i]->ops->ioctl(group->pcms[i]->data, SNDRV_PCM_IOCTL_UNLINK);
+    }
+}
+
+/** Adds a PCM to a group.
+ * The PCM is linked to the first PCM of the group, if the driver supports it.
+ * Plugin PCMs have no file descriptor to wait on and cannot be linked: a group
+ * with any of them polls them every millisecond while it waits, and starts its
+ * PCMs one after the other.
+ * The group does not take ownership of @p pcm, it must be closed after the group.
+ * @param group A PCM group.
+ * @param pcm The PCM handle to add.
+ * @return On success, the index of @p pcm in the ready mask of @ref pcm_group_wait;
+ *  on failure, a negative number.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_group_add(struct pcm_group *group, struct pcm *pcm)
+{
+    struct epoll_event event;
+
+    if (!pcm_is_ready(pcm))
+        return -EINVAL;
+    if (group->count >= PCM_GROUP_MAX)
+        return -ENOSPC;
+
+    if (pcm->ops == &hw_ops) {
+        memset(&event, 0, sizeof(event));
+        event.events = (pcm->flags & PCM_IN ? EPOLLIN : EPOLLOUT) | EPOLLERR;
+        event.data.u32 = group->count;
+        if (epoll_ctl(group->epoll_fd, EPOLL_CTL_ADD, pcm->fd, &event) < 0)
+            return oops(pcm, errno, "cannot add PCM to group");
+    } else {
+        group->plugins++;
+    }
+
+    /* all linked or none, so that the group starts them one way or the other */
+    if (group->count > 0 && group->linked &&
+        (group->plugins || pcm_link(group->pcms[0], pcm) < 0)) {
+        pcm_group_unlink(group);
+        group->linked = 0;
+    }
+
+    group->pcms[group->count] = pcm;
+    return group->count++;
+}
+
+/** Starts all PCMs of a group.
+ * If the PCMs are linked they start in sync, otherwise one after the other.
+ * Playback PCMs should have data written before the group is started.
+ * @param group A PCM group.
+ * @return On success, zero; on failure, a negative number.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_group_start(struct pcm_group *group)
+{
+    unsigned int i;
+
+    if (group->count == 0)
+        return -EINVAL;
+
+    for (i = 0; i < group->count; i++) {
+        if (pcm_state(group->pcms[i]) == PCM_STATE_SETUP &&
+            pcm_prepare(group->pcms[i]) < 0)
+            return -1;
+    }
+
+    if (group->linked)
+        return pcm_start(group->pcms[0]);
+
+    for (i = 0; i < group->count; i++) {
+        if (pcm_start(group->pcms[i]) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/** Stops all PCMs of a group, dropping pending frames.
+ * @param group A PCM group.
+ * @return On success, zero; on failure, a negative number.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_group_stop(struct pcm_group *group)
+{
+    unsigned int i;
+    int ret = 0;
+
+    if (group->count == 0)
+        return -EINVAL;
+
+    if (group->linked)
+        return pcm_stop(group->pcms[0]);
+
+    for (i = 0; i < group->count; i++) {
+        if (pcm_stop(group->pcms[i]) < 0)
+            ret = -1;
+    }
+    return ret;
+}
+
+/** Waits until at least one PCM of a group is ready for a read or write operation.
+ * PCMs in an error state (e.g. after an xrun) are reported as ready,
+ * so that the next read or write recovers them.
+ * @param group A PCM group.
+ * @param timeout The maximum amount of time to wait for, in terms of milliseconds;
+ *  negative to wait indefinitely.
+ * @param ready_mask Receives a mask of the ready PCMs, bit n being the PCM at index n.
+ * @return The number of ready PCMs, zero if a timeout occurred,
+ *  or a negative number on error.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_group_wait(struct pcm_group *group, int timeout, unsigned int *ready_mask)
+{
+    struct epoll_event events[PCM_GROUP_MAX];
+    unsigned long long deadline = 0;
+    unsigned int mask = 0, i;
+    int n, wait;
+
+    *ready_mask = 0;
+    if (group->count == 0)
+        return -EINVAL;
+
+    if (group->plugins && timeout > 0)
+        deadline = pcm_stats_now() + timeout * 1000000ULL;
+
+    for (;;) {
+        for (i = 0; i < group->count && group->plugins; i++) {
+            struct pcm *pcm = group->pcms[i];
+            struct pollfd pfd;
+
+            if (pcm->ops == &hw_ops)
+                continue;
+            pfd.fd = pcm->fd;
+            pfd.events = (pcm->flags & PCM_IN ? POLLIN : POLLOUT) | POLLERR;
+            pfd.revents = 0;
+            if (pcm->ops->poll(pcm->data, &pfd, 1, 0) > 0 && pfd.revents)
+                mask |= 1U << i;
+        }
+
+        wait = timeout;
+        if (mask) {
+            wait = 0;
+        } else if (group->plugins && timeout != 0) {
+            wait = PCM_GROUP_PLUGIN_POLL_MS;
+            if (timeout > 0) {
+                unsigned long long now = pcm_stats_now();
+                long long left = now < deadline ? (deadline - now + 999999) / 1000000 : 0;
+                if (left < wait)
+                    wait = left;
+            }
+        }
+
+        /* without a hardware PCM, this only sleeps */
+        n = epoll_wait(group->epoll_fd, events, group->count, wait);
+        if (n < 0)
+            return -errno;
+        for (i = 0; i < (unsigned int) n; i++)
+            mask |= 1U << events[i].data.u32;
+
+        if (mask || !group->plugins || timeout == 0 ||
+            (timeout > 0 && pcm_stats_now() >= deadline))
+            break;
+    }
+
+    for (i = 0; i < group->count; i++) {
+        struct pcm *pcm = group->pcms[i];
+        if ((mask & (1U << i)) && (pcm->flags & PCM_STATS))
+            pcm_stats_wakeup(pcm, pcm_avail_update(pcm));
+    }
+
+    *ready_mask = mask;
+    return __builtin_popcount(mask);
+}
+
+/** Frees a PCM group, unlinking its PCMs.
+ * The PCMs themselves are not closed.
+ * @param group A PCM group, may be NULL.
+ * @ingroup libtinyalsa-pcm
+ */
+void pcm_group_close(struct pcm_group *group)
+{
+    if (!group)
+        return;
+
+    pcm_group_unlink(group);
+    close(group->epoll_fd);
+    free(group);
+}
+
+/* rate measurements shorter than this are too coarse to use */
+#define PCM_NOIRQ_RATE_WINDOW_NS 20000000LL
+/* the measured rate is trusted within this many parts per thousand of nominal */
+#define PCM_NOIRQ_RATE_LIMIT 50
+
+static long long pcm_timespec_to_ns(const struct timespec *ts)
+{
+    return ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+/*
+ * Tracks the actual rate of a NOIRQ stream from successive hardware pointer
+ * and timestamp pairs, so that wakeup predictions follow the device clock.
+ */
+static void pcm_noirq_update_rate(struct pcm *pcm, unsigned long hw_ptr, long long tstamp_ns)
+{
+    long long dt = tstamp_ns - pcm->noirq_tstamp_ns;
+    long frames;
+    double rate, limit;
+
+    if (!pcm->noirq_tstamp_ns || dt < 0 || dt > 1000000000LL) {
+        pcm->noirq_hw_ptr = hw_ptr;
+        pcm->noirq_tstamp_ns = tstamp_ns;
+        return;
+    }
+    if (dt < PCM_NOIRQ_RATE_WINDOW_NS)
+        return;
+
+    frames = hw_ptr - pcm->noirq_hw_ptr;
+    if (frames < 0)
+        frames += pcm->boundary;
+    pcm->noirq_hw_ptr = hw_ptr;
+    pcm->noirq_tstamp_ns = tstamp_ns;
+
+    rate = frames * 1e9 / dt;
+    limit = (double) pcm->config.rate * PCM_NOIRQ_RATE_LIMIT / 1000;
+    if (rate < pcm->config.rate - limit || rate > pcm->config.rate + limit)
+        return;
+
+    /* first order low pass, smooths out timestamp jitter */
+    pcm->noirq_rate += (rate - pcm->noirq_rate) / 8;
+}
+
+/*
+ * Sleeps until the hardware pointer of a NOIRQ stream is predicted to
+ * have advanced far enough for avail to reach avail_min. The prediction
+ * starts from the hardware pointer and timestamp of the last sync, using
+ * the measured rate of the stream, so the wakeup does not depend on the
+ * millisecond resolution of poll().
+ */
+static int pcm_noirq_wait(struct pcm *pcm, unsigned int avail)
+{
+    clockid_t clock = pcm->flags & PCM_MONOTONIC ? CLOCK_MONOTONIC : CLOCK_REALTIME;
+    struct timespec now, deadline;
+    long long now_ns, ref_ns, wake_ns;
+    int err;
+
+    clock_gettime(clock, &now);
+    now_ns = pcm_timespec_to_ns(&now);
+    ref_ns = pcm_timespec_to_ns(&pcm->mmap_status->tstamp);
+
+    /* without a recent timestamp, the pointer is as of now */
+    if (ref_ns <= 0 || ref_ns > now_ns ||
+        now_ns - ref_ns > (long long) pcm->buffer_size * 1000000000LL / pcm->config.rate)
+        ref_ns = now_ns;
+    else
+        pcm_noirq_update_rate(pcm, pcm->mmap_status->hw_ptr, ref_ns);
+
+    wake_ns = ref_ns + (long long) ((pcm->config.avail_min - avail) * 1e9 / pcm->noirq_rate);
+    if (wake_ns > now_ns) {
+        deadline.tv_sec = wake_ns / 1000000000LL;
+        deadline.tv_nsec = wake_ns % 1000000000LL;
+        err = clock_nanosleep(clock, TIMER_ABSTIME, &deadline, NULL);
+        if (err && err != EINTR)
+            return -err;
+        if (pcm->flags & PCM_STATS) {
+            clock_gettime(clock, &deadline);
+            pcm->stats.blocked_ns += pcm_timespec_to_ns(&deadline) - now_ns;
+        }
+    }
+
+    if (pcm_sync_ptr(pcm, SNDRV_PCM_SYNC_PTR_HWSYNC |
+                          SNDRV_PCM_SYNC_PTR_APPL |
+                          SNDRV_PCM_SYNC_PTR_AVAIL_MIN) < 0)
+        return -errno;
+    if (pcm->flags & PCM_STATS)
+        pcm_stats_wakeup(pcm, pcm_mmap_avail(pcm));
+
+    switch (pcm->mmap_status->state) {
+    case PCM_STATE_XRUN:
+        return -EPIPE;
+    case PCM_STATE_SUSPENDED:
+        return -ESTRPIPE;
+    case PCM_STATE_DISCONNECTED:
+        return -ENODEV;
+    default:
+        return 1;
+    }
+}
+
+/*
+ * Transfer data to/from mmapped buffer. This imitates the
+ * behavior of read/write system calls.
+ *
+ * However, this doesn't seems to offer any advantage over
+ * the read/write syscalls. Should it be removed?
+ */
+static int pcm_mmap_transfer(struct pcm *pcm, const struct iovec *iov, int iovcnt,
+                             unsigned int frames)
+{
+    int is_playback;
+
+    int state;
+    unsigned int avail;
+    unsigned int user_offset = 0;
+
+    /* the piece of iov being transferred, and the frames done from it */
+    int piece = 0;
+    unsigned int piece_offset = 0;
+    unsigned int piece_frames;
+
+    int err;
+    int transferred_frames;
+
+    is_playback = !(pcm->flags & PCM_IN);
+
+    if (frames == 0)
+        return 0;
 
     /* update hardware pointer and get state */
     err = pcm_sync_ptr(pcm, SNDRV_PCM_SYNC_PTR_HWSYNC |
@@ -1536,23 +2521,40 @@ static int pcm_mmap_transfer(struct pcm *pcm, void *buffer, unsigned int frames)
         }
     }
 
+    piece_frames = pcm_bytes_to_frames(pcm, iov[0].iov_len);
+
     while (frames) {
+        while (piece_offset == piece_frames && piece + 1 < iovcnt) {
+            piece++;
+            piece_offset = 0;
+            piece_frames = pcm_bytes_to_frames(pcm, iov[piece].iov_len);
+        }
+
         avail = pcm_mmap_avail(pcm);
 
-        if (avail < pcm->config.avail_min) {
-            int time = -1;
+        /*
+         * Like the kernel, only wait if the rest of the transfer does not fit,
+         * and until playback starts fill the buffer rather than wait for it.
+         */
+        if (avail < pcm->config.avail_min && avail < frames &&
+                !(is_playback && state == PCM_STATE_PREPARED && avail > 0)) {
+            /* a buffer already filled past the threshold, such as by a prefill */
+            if (is_playback && state == PCM_STATE_PREPARED &&
+                    pcm->buffer_size - avail >= pcm->config.start_threshold) {
+                if (pcm_start(pcm) < 0)
+                    break;
+                state = PCM_STATE_RUNNING;
+                continue;
+            }
             if (pcm->flags & PCM_NONBLOCK) {
                 errno = EAGAIN;
                 break;
             }
-	    if (pcm->flags & PCM_NOIRQ) {
-                time = (pcm->config.avail_min - avail) / pcm->noirq_frames_per_msec;
-	        /* check the wait time and ensure it's at least 1ms */
-	        if (time < 1)
-		    time = 1;
-	    }
-            /* based on the type and available data, wait dynamically */
-            err = pcm_wait(pcm, time);
+            /* without period interrupts, sleep until avail_min is predicted */
+            if (pcm->flags & PCM_NOIRQ)
+                err = pcm_noirq_wait(pcm, avail);
+            else
+                err = pcm_wait(pcm, -1);
             if (err < 0) {
                 errno = -err;
                 break;
@@ -1560,20 +2562,31 @@ static int pcm_mmap_transfer(struct pcm *pcm, void *buffer, unsigned int frames)
 	    continue;
         }
 
-        transferred_frames = pcm_mmap_transfer_areas(pcm, buffer, user_offset, frames);
+        /* copy straight between the piece and the ring buffer */
+        if (pcm->flags & PCM_STATS) {
+            unsigned long long start = pcm_stats_now();
+            transferred_frames = pcm_mmap_transfer_areas(pcm, iov[piece].iov_base, piece_offset,
+                                                         piece_frames - piece_offset);
+            pcm->stats.copy_ns += pcm_stats_now() - start;
+        } else {
+            transferred_frames = pcm_mmap_transfer_areas(pcm, iov[piece].iov_base, piece_offset,
+                                                         piece_frames - piece_offset);
+        }
         if (transferred_frames < 0) {
             break;
         }
 
+        piece_offset += transferred_frames;
         user_offset += transferred_frames;
         frames -= transferred_frames;
 
         /* start playback if written >= start_threshold */
         if (is_playback && state == PCM_STATE_PREPARED &&
-                pcm->buffer_size - avail >= pcm->config.start_threshold) {
+                pcm->buffer_size - avail + transferred_frames >= pcm->config.start_threshold) {
             if (pcm_start(pcm) < 0) {
                 break;
             }
+            state = PCM_STATE_RUNNING;
         }
     }
 
@@ -1641,7 +2654,7 @@ int pcm_mmap_get_hw_ptr(struct pcm* pcm, unsigned int *hw_ptr, struct timespec *
     return 0;
 }
 
-static int pcm_rw_transfer(struct pcm *pcm, void *data, unsigned int frames)
+static int pcm_rw_ioctl(struct pcm *pcm, void *data, unsigned int frames)
 {
     int is_playback;
 
@@ -1654,150 +2667,1395 @@ static int pcm_rw_transfer(struct pcm *pcm, void *data, unsigned int frames)
     transfer.frames = frames;
     transfer.result = 0;
 
-    res = pcm->ops->ioctl(pcm->data, is_playback
-                          ? SNDRV_PCM_IOCTL_WRITEI_FRAMES
-                          : SNDRV_PCM_IOCTL_READI_FRAMES, &transfer);
+    if (pcm->flags & PCM_STATS) {
+        unsigned long long start = pcm_stats_now();
+        pcm->stats.ioctls++;
+        res = pcm->ops->ioctl(pcm->data, is_playback
+                              ? SNDRV_PCM_IOCTL_WRITEI_FRAMES
+                              : SNDRV_PCM_IOCTL_READI_FRAMES, &transfer);
+        pcm->stats.blocked_ns += pcm_stats_now() - start;
+    } else {
+        res = pcm->ops->ioctl(pcm->data, is_playback
+                              ? SNDRV_PCM_IOCTL_WRITEI_FRAMES
+                              : SNDRV_PCM_IOCTL_READI_FRAMES, &transfer);
+    }
+
+    if (res != 0)
+        return -1;
 
-    return res == 0 ? (int) transfer.result : -1;
+    /* the kernel has just copied the frames, so they are in cache */
+    if (pcm->meter)
+        pcm_meter_update(pcm->meter, data, transfer.result);
+    return (int) transfer.result;
 }
 
-static int pcm_generic_transfer(struct pcm *pcm, void *data,
-                                unsigned int frames)
+/*
+ * Writes a PCM_DEEP_BUFFER playback stream in bursts: only as many frames as
+ * the buffer has room for are written, and once it is full the caller sleeps
+ * in pcm_wait until avail_min frames are free again, so that every wakeup is
+ * seen by the stats.
+ */
+static int pcm_burst_write(struct pcm *pcm, char *data, unsigned int frames)
 {
-    int res;
-
-#if UINT_MAX > TINYALSA_FRAMES_MAX
-    if (frames > TINYALSA_FRAMES_MAX)
-        return -EINVAL;
-#endif
-    if (frames > INT_MAX)
-        return -EINVAL;
-
-    if (pcm_state(pcm) == PCM_STATE_SETUP && pcm_prepare(pcm) != 0) {
-        return -1;
-    }
-
-again:
+    unsigned int written = 0;
+    unsigned int count;
+    int avail, state, res;
+
+    while (written < frames) {
+        if (pcm_sync_ptr(pcm, SNDRV_PCM_SYNC_PTR_HWSYNC |
+                              SNDRV_PCM_SYNC_PTR_APPL |
+                              SNDRV_PCM_SYNC_PTR_AVAIL_MIN) < 0)
+            break;
+        state = pcm->mmap_status->state;
+        avail = pcm_mmap_avail(pcm);
+        count = frames - written;
 
-    if (pcm->flags & PCM_MMAP)
-        res = pcm_mmap_transfer(pcm, data, frames);
-    else
-        res = pcm_rw_transfer(pcm, data, frames);
+        if (state == PCM_STATE_RUNNING && (unsigned int) avail < count &&
+                (unsigned int) avail < pcm->config.avail_min) {
+            res = pcm_wait(pcm, -1);
+            if (res < 0) {
+                errno = -res;
+                break;
+            }
+            continue;
+        }
 
-    if (res < 0) {
-        switch (errno) {
-        case EPIPE:
-            pcm->xruns++;
-            /* fallthrough */
-        case ESTRPIPE:
-            /*
-             * Try to restart if we are allowed to do so.
-             * Otherwise, return error.
-             */
-            if (pcm->flags & PCM_NORESTART || pcm_prepare(pcm))
-                return -1;
-            goto again;
-        case EAGAIN:
-            if (pcm->flags & PCM_NONBLOCK)
-                return -1;
-            /* fallthrough */
-        default:
-            return oops(pcm, errno, "cannot read/write stream data");
+        /* not running, let the kernel start the stream or report the xrun */
+        if (state == PCM_STATE_RUNNING || avail > 0) {
+            if (count > (unsigned int) avail)
+                count = avail;
         }
+
+        res = pcm_rw_ioctl(pcm, data + pcm_frames_to_bytes(pcm, written), count);
+        if (res < 0)
+            break;
+        written += res;
     }
 
-    return res;
+    return written ? (int) written : -1;
 }
 
-/** Writes audio samples to PCM.
- * If the PCM has not been started, it is started in this function.
- * This function is only valid for PCMs opened with the @ref PCM_OUT flag.
- * @param pcm A PCM handle.
- * @param data The audio sample array
- * @param frame_count The number of frames occupied by the sample array.
- *  This value should not be greater than @ref TINYALSA_FRAMES_MAX
- *  or INT_MAX.
- * @return On success, this function returns the number of frames written; otherwise, a negative number.
- * @ingroup libtinyalsa-pcm
- */
-int pcm_writei(struct pcm *pcm, const void *data, unsigned int frame_count)
+static int pcm_rw_transfer(struct pcm *pcm, void *data, unsigned int frames)
 {
-    if (pcm->flags & PCM_IN)
-        return -EINVAL;
+    if (!(pcm->flags & PCM_IN) && (pcm->flags & PCM_DEEP_BUFFER) &&
+            !(pcm->flags & PCM_NONBLOCK))
+        return pcm_burst_write(pcm, data, frames);
 
-    return pcm_generic_transfer(pcm, (void*) data, frame_count);
+    return pcm_rw_ioctl(pcm, data, frames);
 }
 
-/** Reads audio samples from PCM.
- * If the PCM has not been started, it is started in this function.
- * This function is only valid for PCMs opened with the @ref PCM_IN flag.
- * @param pcm A PCM handle.
- * @param data The audio sample array
- * @param frame_count The number of frames occupied by the sample array.
- *  This value should not be greater than @ref TINYALSA_FRAMES_MAX
- *  or INT_MAX.
- * @return On success, this function returns the number of frames written; otherwise, a negative number.
- * @ingroup libtinyalsa-pcm
+/*
+ * Transfers the pieces of iov with as few read/write calls as possible,
+ * merging pieces that are contiguous in memory.
  */
-int pcm_readi(struct pcm *pcm, void *data, unsigned int frame_count)
+static int pcm_rw_transferv(struct pcm *pcm, const struct iovec *iov, int iovcnt)
 {
-    if (!(pcm->flags & PCM_IN))
-        return -EINVAL;
+    int transferred = 0;
+    int i = 0;
 
-    return pcm_generic_transfer(pcm, data, frame_count);
+    while (i < iovcnt) {
+        char *base = iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+        unsigned int frames;
+        int res;
+
+        for (i++; i < iovcnt && (char *) iov[i].iov_base == base + len; i++)
+            len += iov[i].iov_len;
+
+        frames = pcm_bytes_to_frames(pcm, len);
+        if (frames == 0)
+            continue;
+
+        res = pcm_rw_transfer(pcm, base, frames);
+        if (res < 0)
+            return transferred ? transferred : -1;
+
+        transferred += res;
+        if ((unsigned int) res < frames)
+            break;
+    }
+
+    return transferred;
 }
 
-/** Writes audio samples to PCM.
- * If the PCM has not been started, it is started in this function.
- * This function is only valid for PCMs opened with the @ref PCM_OUT flag.
- * This function is not valid for PCMs opened with the @ref PCM_MMAP flag.
- * @param pcm A PCM handle.
- * @param data The audio sample array
- * @param count The number of bytes occupied by the sample array.
- * @return On success, this function returns zero; otherwise, a negative number.
- * @deprecated
- * @ingroup libtinyalsa-pcm
+/*
+ * Changes the start threshold of a prepared PCM, for the xrun policy.
  */
-int pcm_write(struct pcm *pcm, const void *data, unsigned int count)
+static int pcm_set_start_threshold(struct pcm *pcm, unsigned long threshold)
 {
-    unsigned int requested_frames = pcm_bytes_to_frames(pcm, count);
-    int ret = pcm_writei(pcm, data, requested_frames);
+    struct snd_pcm_sw_params sparams = pcm->sw_params;
 
-    if (ret < 0)
-        return ret;
+    sparams.start_threshold = threshold;
+    pcm_stats_ioctl(pcm);
+    if (pcm->ops->ioctl(pcm->data, SNDRV_PCM_IOCTL_SW_PARAMS, &sparams))
+        return oops(pcm, errno, "cannot set start threshold");
 
-    return ((unsigned int )ret == requested_frames) ? 0 : -EIO;
+    pcm->sw_params = sparams;
+    pcm->config.start_threshold = threshold;
+    return 0;
 }
 
-/** Reads audio samples from PCM.
- * If the PCM has not been started, it is started in this function.
- * This function is only valid for PCMs opened with the @ref PCM_IN flag.
- * This function is not valid for PCMs opened with the @ref PCM_MMAP flag.
- * @param pcm A PCM handle.
- * @param data The audio sample array
- * @param count The number of bytes occupied by the sample array.
- * @return On success, this function returns zero; otherwise, a negative number.
- * @deprecated
- * @ingroup libtinyalsa-pcm
+/* Silence written by the xrun policy, a block at a time */
+#define PCM_SILENCE_BYTES 16384
+#define PCM_SILENCE_MAX_CHANNELS 64
+
+static char pcm_silence[PCM_SILENCE_BYTES];
+
+/*
+ * Queues frames of silence on a prepared playback PCM, for the xrun policy.
+ * Does not allocate, so that recovering a PCM_RT stream stays real-time safe.
  */
-int pcm_read(struct pcm *pcm, void *data, unsigned int count)
+static int pcm_write_silence(struct pcm *pcm, unsigned int frames)
 {
-    unsigned int requested_frames = pcm_bytes_to_frames(pcm, count);
-    int ret = pcm_readi(pcm, data, requested_frames);
-
-    if (ret < 0)
-        return ret;
+    struct snd_xfern xfern;
+    void *bufs[PCM_SILENCE_MAX_CHANNELS];
+    unsigned int frame_bytes = pcm_frames_to_bytes(pcm, 1);
+    unsigned int written = 0;
+    unsigned int block, c;
+    int res = 0;
+
+    if (frame_bytes == 0)
+        return oops(pcm, EINVAL, "cannot write silence");
+
+    if (pcm->flags & PCM_NONINTERLEAVED) {
+        if (pcm->config.channels > PCM_SILENCE_MAX_CHANNELS)
+            return oops(pcm, EINVAL, "too many channels for silence");
+        for (c = 0; c < pcm->config.channels; c++)
+            bufs[c] = pcm_silence;
+        /* each plane only holds a channel's share of a frame */
+        block = PCM_SILENCE_BYTES / (frame_bytes / pcm->config.channels);
+    } else {
+        block = PCM_SILENCE_BYTES / frame_bytes;
+    }
+    if (block == 0)
+        return oops(pcm, EINVAL, "frames too large for silence");
+
+    while (written < frames) {
+        unsigned int count = frames - written < block ? frames - written : block;
+
+        if (pcm->flags & PCM_MMAP) {
+            res = pcm_mmap_transfer_areas(pcm, pcm_silence, 0, count);
+        } else if (pcm->flags & PCM_NONINTERLEAVED) {
+            xfern.bufs = bufs;
+            xfern.frames = count;
+            xfern.result = 0;
+            pcm_stats_ioctl(pcm);
+            res = pcm->ops->ioctl(pcm->data, SNDRV_PCM_IOCTL_WRITEN_FRAMES, &xfern);
+            res = res == 0 ? (int) xfern.result : -1;
+        } else {
+            res = pcm_rw_ioctl(pcm, pcm_silence, count);
+        }
+        if (res <= 0)
+            break;
+        written += res;
+    }
 
-    return ((unsigned int )ret == requested_frames) ? 0 : -EIO;
+    return res < 0 ? oops(pcm, errno, "cannot write silence") : 0;
 }
 
-/** Gets the delay of the PCM, in terms of frames.
- * @param pcm A PCM handle.
- * @returns On success, the delay of the PCM.
- *  On failure, a negative number.
- * @ingroup libtinyalsa-pcm
+/*
+ * Handles a failed read/write, with the error in errno.
+ * Returns zero if the stream was recovered and the transfer may be retried.
  */
-long pcm_get_delay(struct pcm *pcm)
+static int pcm_transfer_recover(struct pcm *pcm)
+{
+    unsigned int level, streak;
+    int err = errno;
+
+    switch (err) {
+    case EPIPE:
+        pcm->xruns++;
+        /* an xrun before a buffer was transferred since the last one */
+        if (pcm->xruns > 1 && pcm->xrun_clean_frames < pcm->buffer_size) {
+            pcm->xrun_streak++;
+            if (pcm->flags & PCM_STATS)
+                pcm->stats.consecutive_xruns++;
+        } else {
+            pcm->xrun_streak = 0;
+        }
+        /* fallthrough */
+    case ESTRPIPE:
+        pcm_stats_event(pcm, err);
+        /*
+         * Try to restart if we are allowed to do so.
+         * Otherwise, return error.
+         */
+        if (pcm->flags & PCM_NORESTART || pcm->xrun_policy == PCM_XRUN_REPORT) {
+            errno = err;
+            return -1;
+        }
+        if (pcm->flags & PCM_STATS)
+            pcm->recovery_start_ns = pcm_stats_now();
+        if (pcm_prepare(pcm))
+            return -1;
+        pcm->xrun_clean_frames = 0;
+
+        if ((pcm->flags & PCM_IN) || pcm->xrun_policy == PCM_XRUN_RESTART)
+            return 0;
+
+        /* the safe level, doubled for each xrun in a row */
+        level = pcm->xrun_level ? pcm->xrun_level : pcm->buffer_size;
+        for (streak = 0; streak < pcm->xrun_streak && level < pcm->buffer_size; streak++)
+            level *= 2;
+        if (level > pcm->buffer_size)
+            level = pcm->buffer_size;
+
+        if (pcm->xrun_policy == PCM_XRUN_PREFILL)
+            return pcm_write_silence(pcm, level);
+
+        if (level > pcm->config.start_threshold) {
+            if (!pcm->xrun_saved_threshold)
+                pcm->xrun_saved_threshold = pcm->config.start_threshold;
+            return pcm_set_start_threshold(pcm, level);
+        }
+        return 0;
+    case EAGAIN:
+        if (pcm->flags & PCM_NONBLOCK)
+            return -1;
+        /* fallthrough */
+    default:
+        return oops(pcm, errno, "cannot read/write stream data");
+    }
+}
+
+/*
+ * Records the period stamp of a transfer that completed one or more periods.
+ */
+static void pcm_period_stamp(struct pcm *pcm, int frames)
+{
+    unsigned long long period = pcm->config.period_size;
+    unsigned long long before = pcm->stamp_frames;
+    struct pcm_period_stamp *stamp;
+    unsigned long tail;
+
+    pcm->stamp_frames += frames;
+    if (period == 0 || before / period == pcm->stamp_frames / period)
+        return;
+
+    /* without the status page, read the kernel's status without touching its pointers */
+    if (pcm->sync_ptr)
+        pcm_sync_ptr(pcm, SNDRV_PCM_SYNC_PTR_APPL | SNDRV_PCM_SYNC_PTR_AVAIL_MIN);
+
+    /* a full ring replaces its oldest record, which a reader checks for after copying it */
+    tail = pcm->stamps_tail;
+    __atomic_store_n(&pcm->stamps_writing, tail + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    stamp = &pcm->stamps[tail % pcm->stamps_size];
+    stamp->frames = pcm->stamp_frames;
+    stamp->hw_ptr = pcm->mmap_status->hw_ptr;
+    stamp->appl_ptr = pcm->mmap_control->appl_ptr;
+    stamp->tstamp = pcm->mmap_status->tstamp;
+
+    __atomic_store_n(&pcm->stamps_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Accounts for a completed transfer: records the period stamp, ends the measure
+ * of a recovery, and restores the start threshold once the stream has run a
+ * second without xrun.
+ */
+static void pcm_transfer_done(struct pcm *pcm, int frames)
+{
+    if (pcm->stamps)
+        pcm_period_stamp(pcm, frames);
+
+    pcm->xrun_clean_frames += frames;
+
+    if (pcm->xrun_saved_threshold && pcm->xrun_clean_frames >= pcm->config.rate &&
+            pcm_set_start_threshold(pcm, pcm->xrun_saved_threshold) == 0)
+        pcm->xrun_saved_threshold = 0;
+
+    if (pcm->flags & PCM_STATS) {
+        unsigned long long now = pcm_stats_now();
+
+        pcm->stats.frames += frames;
+        pcm->stats.active_ns = now - pcm->stats_start_ns;
+        if (pcm->recovery_start_ns) {
+            unsigned long long recovery_ns = now - pcm->recovery_start_ns;
+
+            pcm->stats.recovery_ns += recovery_ns;
+            if (recovery_ns > pcm->stats.recovery_max_ns)
+                pcm->stats.recovery_max_ns = recovery_ns;
+            pcm->recovery_start_ns = 0;
+        }
+    }
+}
+
+static int pcm_generic_transferv(struct pcm *pcm, const struct iovec *iov, int iovcnt)
+{
+    unsigned int frame_bytes = pcm_frames_to_bytes(pcm, 1);
+    unsigned long frames = 0;
+    int i, res;
+
+    if (iovcnt <= 0 || frame_bytes == 0 || (pcm->flags & PCM_NONINTERLEAVED))
+        return -EINVAL;
+
+    for (i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len % frame_bytes)
+            return -EINVAL;
+        frames += iov[i].iov_len / frame_bytes;
+    }
+
+#if ULONG_MAX > TINYALSA_FRAMES_MAX
+    if (frames > TINYALSA_FRAMES_MAX)
+        return -EINVAL;
+#endif
+    if (frames > INT_MAX)
+        return -EINVAL;
+
+    if (pcm->flags & PCM_STATS) {
+        pcm->stats.transfers++;
+        if (!pcm->stats_start_ns)
+            pcm->stats_start_ns = pcm_stats_now();
+    }
+
+    if (pcm_state(pcm) == PCM_STATE_SETUP && pcm_prepare(pcm) != 0) {
+        return -1;
+    }
+
+again:
+
+    if (pcm->flags & PCM_MMAP)
+        res = pcm_mmap_transfer(pcm, iov, iovcnt, frames);
+    else
+        res = pcm_rw_transferv(pcm, iov, iovcnt);
+
+    if (res < 0) {
+        if (pcm_transfer_recover(pcm) == 0)
+            goto again;
+        return -1;
+    }
+
+    pcm_transfer_done(pcm, res);
+
+    return res;
+}
+
+static int pcm_generic_transfer(struct pcm *pcm, void *data,
+                                unsigned int frames)
+{
+    struct iovec iov;
+
+#if UINT_MAX > TINYALSA_FRAMES_MAX
+    if (frames > TINYALSA_FRAMES_MAX)
+        return -EINVAL;
+#endif
+    if (frames > INT_MAX)
+        return -EINVAL;
+
+    iov.iov_base = data;
+    iov.iov_len = (size_t) frames * pcm_frames_to_bytes(pcm, 1);
+    return pcm_generic_transferv(pcm, &iov, 1);
+}
+
+#ifdef __has_builtin
+#if __has_builtin(__builtin_shufflevector)
+#define PCM_SIMD_INTERLEAVE
+#endif
+#if __has_builtin(__builtin_convertvector)
+#define PCM_SIMD_METER
+#endif
+#endif
+
+#if defined(PCM_SIMD_INTERLEAVE) || defined(PCM_SIMD_METER)
+
+typedef int16_t pcm_v8hi __attribute__((vector_size(16)));
+typedef int32_t pcm_v4si __attribute__((vector_size(16)));
+typedef int64_t pcm_v2di __attribute__((vector_size(16)));
+
+/* the kernels must be inlined into a loop with constant channels and width */
+#define PCM_VINLINE static inline __attribute__((always_inline))
+
+PCM_VINLINE pcm_v4si pcm_vload(const char *p)
+{
+    pcm_v4si v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+PCM_VINLINE void pcm_vstore(char *p, pcm_v4si v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+#endif
+
+#ifdef PCM_SIMD_INTERLEAVE
+
+/*
+ * Interleaving is done on 16 byte vectors: adjacent channels are zipped
+ * sample by sample, then the pairs are zipped again at twice the width,
+ * and so on until whole frames are formed. Six channels are formed from
+ * three zipped pairs with a three way shuffle. Deinterleaving runs the
+ * same steps backwards.
+ */
+
+/* zips a and b in units of the given number of bytes */
+PCM_VINLINE void pcm_vzip(unsigned int unit, pcm_v4si a, pcm_v4si b,
+                            pcm_v4si *lo, pcm_v4si *hi)
+{
+    switch (unit) {
+    case 2:
+        *lo = (pcm_v4si) __builtin_shufflevector((pcm_v8hi) a, (pcm_v8hi) b,
+                                                 0, 8, 1, 9, 2, 10, 3, 11);
+        *hi = (pcm_v4si) __builtin_shufflevector((pcm_v8hi) a, (pcm_v8hi) b,
+                                                 4, 12, 5, 13, 6, 14, 7, 15);
+        break;
+    case 4:
+        *lo = __builtin_shufflevector(a, b, 0, 4, 1, 5);
+        *hi = __builtin_shufflevector(a, b, 2, 6, 3, 7);
+        break;
+    case 8:
+        *lo = (pcm_v4si) __builtin_shufflevector((pcm_v2di) a, (pcm_v2di) b, 0, 2);
+        *hi = (pcm_v4si) __builtin_shufflevector((pcm_v2di) a, (pcm_v2di) b, 1, 3);
+        break;
+    default:
+        *lo = a;
+        *hi = b;
+        break;
+    }
+}
+
+/* the inverse of pcm_vzip */
+PCM_VINLINE void pcm_vunzip(unsigned int unit, pcm_v4si lo, pcm_v4si hi,
+                              pcm_v4si *a, pcm_v4si *b)
+{
+    switch (unit) {
+    case 2:
+        *a = (pcm_v4si) __builtin_shufflevector((pcm_v8hi) lo, (pcm_v8hi) hi,
+                                                0, 2, 4, 6, 8, 10, 12, 14);
+        *b = (pcm_v4si) __builtin_shufflevector((pcm_v8hi) lo, (pcm_v8hi) hi,
+                                                1, 3, 5, 7, 9, 11, 13, 15);
+        break;
+    case 4:
+        *a = __builtin_shufflevector(lo, hi, 0, 2, 4, 6);
+        *b = __builtin_shufflevector(lo, hi, 1, 3, 5, 7);
+        break;
+    case 8:
+        *a = (pcm_v4si) __builtin_shufflevector((pcm_v2di) lo, (pcm_v2di) hi, 0, 2);
+        *b = (pcm_v4si) __builtin_shufflevector((pcm_v2di) lo, (pcm_v2di) hi, 1, 3);
+        break;
+    default:
+        *a = lo;
+        *b = hi;
+        break;
+    }
+}
+
+/* interleaves p, q and r in units of 4 or 8 bytes */
+PCM_VINLINE void pcm_vzip3(unsigned int unit, pcm_v4si p, pcm_v4si q, pcm_v4si r,
+                             pcm_v4si *out)
+{
+    if (unit == 4) {
+        out[0] = __builtin_shufflevector(__builtin_shufflevector(p, q, 0, 4, 1, 5),
+                                         r, 0, 1, 4, 2);
+        out[1] = __builtin_shufflevector(__builtin_shufflevector(p, q, 5, 2, 6, 6),
+                                         r, 0, 5, 1, 2);
+        out[2] = __builtin_shufflevector(__builtin_shufflevector(p, q, 3, 7, 0, 0),
+                                         r, 6, 0, 1, 7);
+    } else {
+        pcm_v2di p2 = (pcm_v2di) p, q2 = (pcm_v2di) q, r2 = (pcm_v2di) r;
+
+        out[0] = (pcm_v4si) __builtin_shufflevector(p2, q2, 0, 2);
+        out[1] = (pcm_v4si) __builtin_shufflevector(r2, p2, 0, 3);
+        out[2] = (pcm_v4si) __builtin_shufflevector(q2, r2, 1, 3);
+    }
+}
+
+/* the inverse of pcm_vzip3 */
+PCM_VINLINE void pcm_vunzip3(unsigned int unit, const pcm_v4si *in,
+                               pcm_v4si *p, pcm_v4si *q, pcm_v4si *r)
+{
+    if (unit == 4) {
+        *p = __builtin_shufflevector(__builtin_shufflevector(in[0], in[1], 0, 3, 6, 0),
+                                     in[2], 0, 1, 2, 5);
+        *q = __builtin_shufflevector(__builtin_shufflevector(in[0], in[1], 1, 4, 7, 0),
+                                     in[2], 0, 1, 2, 6);
+        *r = __builtin_shufflevector(__builtin_shufflevector(in[0], in[1], 2, 5, 0, 0),
+                                     in[2], 0, 1, 4, 7);
+    } else {
+        pcm_v2di i0 = (pcm_v2di) in[0], i1 = (pcm_v2di) in[1], i2 = (pcm_v2di) in[2];
+
+        *p = (pcm_v4si) __builtin_shufflevector(i0, i1, 0, 3);
+        *q = (pcm_v4si) __builtin_shufflevector(i0, i2, 1, 2);
+        *r = (pcm_v4si) __builtin_shufflevector(i1, i2, 0, 3);
+    }
+}
+
+/*
+ * Interleaves one block of 16 bytes from each of the channels into dst.
+ * The block has 16 / width frames.
+ */
+PCM_VINLINE void pcm_vinterleave_block(char *dst, char *const *src, size_t offset,
+                                         unsigned int channels, unsigned int width)
+{
+    pcm_v4si v[8], t[8];
+    unsigned int i;
+
+    for (i = 0; i < channels; i++)
+        v[i] = pcm_vload(src[i] + offset);
+
+    for (i = 0; i < channels; i += 2)
+        pcm_vzip(width, v[i], v[i + 1], &t[i], &t[i + 1]);
+
+    switch (channels) {
+    case 2:
+        v[0] = t[0];
+        v[1] = t[1];
+        break;
+    case 4:
+        pcm_vzip(2 * width, t[0], t[2], &v[0], &v[1]);
+        pcm_vzip(2 * width, t[1], t[3], &v[2], &v[3]);
+        break;
+    case 6:
+        pcm_vzip3(2 * width, t[0], t[2], t[4], &v[0]);
+        pcm_vzip3(2 * width, t[1], t[3], t[5], &v[3]);
+        break;
+    case 8:
+        pcm_vzip(2 * width, t[0], t[2], &v[0], &v[1]);
+        pcm_vzip(2 * width, t[1], t[3], &v[2], &v[3]);
+        pcm_vzip(2 * width, t[4], t[6], &v[4], &v[5]);
+        pcm_vzip(2 * width, t[5], t[7], &v[6], &v[7]);
+        pcm_vzip(4 * width, v[0], v[4], &t[0], &t[1]);
+        pcm_vzip(4 * width, v[1], v[5], &t[2], &t[3]);
+        pcm_vzip(4 * width, v[2], v[6], &t[4], &t[5]);
+        pcm_vzip(4 * width, v[3], v[7], &t[6], &t[7]);
+        memcpy(v, t, sizeof(v));
+        break;
+    }
+
+    for (i = 0; i < channels; i++)
+        pcm_vstore(dst + i * 16, v[i]);
+}
+
+/* the inverse of pcm_vinterleave_block */
+PCM_VINLINE void pcm_vdeinterleave_block(char *const *dst, const char *src, size_t offset,
+                                           unsigned int channels, unsigned int width)
+{
+    pcm_v4si v[8], t[8];
+    unsigned int i;
+
+    for (i = 0; i < channels; i++)
+        v[i] = pcm_vload(src + i * 16);
+
+    switch (channels) {
+    case 2:
+        t[0] = v[0];
+        t[1] = v[1];
+        break;
+    case 4:
+        pcm_vunzip(2 * width, v[0], v[1], &t[0], &t[2]);
+        pcm_vunzip(2 * width, v[2], v[3], &t[1], &t[3]);
+        break;
+    case 6:
+        pcm_vunzip3(2 * width, &v[0], &t[0], &t[2], &t[4]);
+        pcm_vunzip3(2 * width, &v[3], &t[1], &t[3], &t[5]);
+        break;
+    case 8:
+        pcm_vunzip(4 * width, v[0], v[1], &t[0], &t[4]);
+        pcm_vunzip(4 * width, v[2], v[3], &t[1], &t[5]);
+        pcm_vunzip(4 * width, v[4], v[5], &t[2], &t[6]);
+        pcm_vunzip(4 * width, v[6], v[7], &t[3], &t[7]);
+        pcm_vunzip(2 * width, t[0], t[1], &v[0], &v[2]);
+        pcm_vunzip(2 * width, t[2], t[3], &v[1], &v[3]);
+        pcm_vunzip(2 * width, t[4], t[5], &v[4], &v[6]);
+        pcm_vunzip(2 * width, t[6], t[7], &v[5], &v[7]);
+        memcpy(t, v, sizeof(t));
+        break;
+    }
+
+    for (i = 0; i < channels; i += 2)
+        pcm_vunzip(width, t[i], t[i + 1], &v[i], &v[i + 1]);
+
+    for (i = 0; i < channels; i++)
+        pcm_vstore(dst[i] + offset, v[i]);
+}
+
+/*
+ * Interleaves as many whole blocks as possible, returning the number of frames done.
+ * Each supported layout gets its own loop so the kernels are specialised.
+ */
+static unsigned int pcm_vinterleave(char *dst, char *const *src, size_t offset,
+                                    unsigned int frames, unsigned int channels,
+                                    unsigned int width)
+{
+    unsigned int blocks = frames * width / 16, i;
+
+#define PCM_VINTERLEAVE_CASE(c, w) \
+    case (c) << 4 | (w): \
+        for (i = 0; i < blocks; i++) \
+            pcm_vinterleave_block(dst + i * 16 * (c), src, offset + i * 16, (c), (w)); \
+        break
+
+    switch (channels << 4 | width) {
+    PCM_VINTERLEAVE_CASE(2, 2);
+    PCM_VINTERLEAVE_CASE(4, 2);
+    PCM_VINTERLEAVE_CASE(6, 2);
+    PCM_VINTERLEAVE_CASE(8, 2);
+    PCM_VINTERLEAVE_CASE(2, 4);
+    PCM_VINTERLEAVE_CASE(4, 4);
+    PCM_VINTERLEAVE_CASE(6, 4);
+    PCM_VINTERLEAVE_CASE(8, 4);
+    default:
+        return 0;
+    }
+#undef PCM_VINTERLEAVE_CASE
+
+    return blocks * 16 / width;
+}
+
+/* the inverse of pcm_vinterleave */
+static unsigned int pcm_vdeinterleave(char *const *dst, size_t offset, const char *src,
+                                      unsigned int frames, unsigned int channels,
+                                      unsigned int width)
+{
+    unsigned int blocks = frames * width / 16, i;
+
+#define PCM_VDEINTERLEAVE_CASE(c, w) \
+    case (c) << 4 | (w): \
+        for (i = 0; i < blocks; i++) \
+            pcm_vdeinterleave_block(dst, src + i * 16 * (c), offset + i * 16, (c), (w)); \
+        break
+
+    switch (channels << 4 | width) {
+    PCM_VDEINTERLEAVE_CASE(2, 2);
+    PCM_VDEINTERLEAVE_CASE(4, 2);
+    PCM_VDEINTERLEAVE_CASE(6, 2);
+    PCM_VDEINTERLEAVE_CASE(8, 2);
+    PCM_VDEINTERLEAVE_CASE(2, 4);
+    PCM_VDEINTERLEAVE_CASE(4, 4);
+    PCM_VDEINTERLEAVE_CASE(6, 4);
+    PCM_VDEINTERLEAVE_CASE(8, 4);
+    default:
+        return 0;
+    }
+#undef PCM_VDEINTERLEAVE_CASE
+
+    return blocks * 16 / width;
+}
+
+#endif
+
+/* interleaves frames from the planes in src, starting at src_offset, into dst */
+static void pcm_interleave(char *dst, char *const *src, unsigned int src_offset,
+                           unsigned int frames, unsigned int channels, unsigned int width)
+{
+    size_t offset = (size_t) src_offset * width;
+    unsigned int frame = 0, i;
+
+#ifdef PCM_SIMD_INTERLEAVE
+    frame = pcm_vinterleave(dst, src, offset, frames, channels, width);
+    dst += (size_t) frame * channels * width;
+    offset += (size_t) frame * width;
+#endif
+
+    for (; frame < frames; frame++) {
+        for (i = 0; i < channels; i++) {
+            memcpy(dst, src[i] + offset, width);
+            dst += width;
+        }
+        offset += width;
+    }
+}
+
+/* the inverse of pcm_interleave */
+static void pcm_deinterleave(char *const *dst, unsigned int dst_offset, const char *src,
+                             unsigned int frames, unsigned int channels, unsigned int width)
+{
+    size_t offset = (size_t) dst_offset * width;
+    unsigned int frame = 0, i;
+
+#ifdef PCM_SIMD_INTERLEAVE
+    frame = pcm_vdeinterleave(dst, offset, src, frames, channels, width);
+    src += (size_t) frame * channels * width;
+    offset += (size_t) frame * width;
+#endif
+
+    for (; frame < frames; frame++) {
+        for (i = 0; i < channels; i++) {
+            memcpy(dst[i] + offset, src, width);
+            src += width;
+        }
+        offset += width;
+    }
+}
+
+/*
+ * The level meter measures samples as the read and write functions transfer
+ * them, while they are in cache, and publishes the levels of each window
+ * under a sequence count, odd while they change, so that other threads can
+ * read them without a lock.
+ */
+
+/* the most vectors after which the channels of a vector repeat, see pcm_vmeter */
+#define PCM_METER_VECS 3
+/* the groups of vectors summed in float before being added to the window */
+#define PCM_METER_CHUNK 256
+
+/* returns one over full scale, or zero if the format cannot be metered */
+static float pcm_meter_scale(enum pcm_format format)
+{
+    switch (format) {
+    case PCM_FORMAT_S16_LE:
+        return 1.0f / 32768.0f;
+    case PCM_FORMAT_S24_LE:
+        return 1.0f / 8388608.0f;
+    case PCM_FORMAT_S32_LE:
+        return 1.0f / 2147483648.0f;
+    case PCM_FORMAT_FLOAT_LE:
+        return 1.0f;
+    default:
+        return 0.0f;
+    }
+}
+
+static void pcm_meter_sample(const struct pcm_meter *meter, struct pcm_meter_acc *acc,
+                             const char *p)
+{
+    int16_t s16;
+    uint32_t u32;
+    int32_t s;
+    float value;
+    int clip;
+
+    switch (meter->format) {
+    case PCM_FORMAT_S16_LE:
+        memcpy(&s16, p, sizeof(s16));
+        s = s16;
+        clip = s == INT16_MAX || s == INT16_MIN;
+        value = s * meter->scale;
+        break;
+    case PCM_FORMAT_S24_LE:
+        memcpy(&u32, p, sizeof(u32));
+        s = (int32_t) (u32 << 8) >> 8;
+        clip = s == 0x7fffff || s == -0x800000;
+        value = s * meter->scale;
+        break;
+    case PCM_FORMAT_S32_LE:
+        memcpy(&s, p, sizeof(s));
+        clip = s == INT32_MAX || s == INT32_MIN;
+        value = s * meter->scale;
+        break;
+    default:
+        memcpy(&value, p, sizeof(value));
+        clip = value >= 1.0f || value <= -1.0f;
+        break;
+    }
+
+    if (value < 0.0f)
+        value = -value;
+
+    if (value > acc->peak)
+        acc->peak = value;
+    acc->sum += (double) value * value;
+    acc->clips += clip;
+}
+
+#ifdef PCM_SIMD_METER
+
+typedef int16_t pcm_v4hi __attribute__((vector_size(8)));
+typedef uint32_t pcm_v4su __attribute__((vector_size(16)));
+typedef float pcm_v4sf __attribute__((vector_size(16)));
+
+/* loads four samples as float, in units of the format */
+PCM_VINLINE pcm_v4sf pcm_vmeter_load(enum pcm_format format, const char *p)
+{
+    pcm_v4hi h;
+
+    switch (format) {
+    case PCM_FORMAT_S16_LE:
+        memcpy(&h, p, sizeof(h));
+        return __builtin_convertvector(__builtin_convertvector(h, pcm_v4si), pcm_v4sf);
+    case PCM_FORMAT_S24_LE:
+        return __builtin_convertvector((pcm_v4si) ((pcm_v4su) pcm_vload(p) << 8) >> 8, pcm_v4sf);
+    case PCM_FORMAT_S32_LE:
+        return __builtin_convertvector(pcm_vload(p), pcm_v4sf);
+    default:
+        return (pcm_v4sf) pcm_vload(p);
+    }
+}
+
+/* returns the mask of the four samples that are at full scale */
+PCM_VINLINE pcm_v4si pcm_vmeter_clip(enum pcm_format format, const char *p)
+{
+    pcm_v4hi h;
+    pcm_v4si s;
+    pcm_v4sf f;
+
+    switch (format) {
+    case PCM_FORMAT_S16_LE:
+        memcpy(&h, p, sizeof(h));
+        s = __builtin_convertvector(h, pcm_v4si);
+        return (s == INT16_MAX) | (s == INT16_MIN);
+    case PCM_FORMAT_S24_LE:
+        s = (pcm_v4si) ((pcm_v4su) pcm_vload(p) << 8) >> 8;
+        return (s == 0x7fffff) | (s == -0x800000);
+    case PCM_FORMAT_S32_LE:
+        s = pcm_vload(p);
+        return (s == INT32_MAX) | (s == INT32_MIN);
+    default:
+        f = (pcm_v4sf) pcm_vload(p);
+        return (f >= 1.0f) | (f <= -1.0f);
+    }
+}
+
+/*
+ * Meters groups of vecs vectors, after which the channels of each lane repeat.
+ * Each lane of each vector of a group keeps its own levels, which are added
+ * to the levels of its channel every chunk. Clipping is rare, so the clips
+ * are only counted, in a second pass, in the chunks whose peak reaches
+ * full scale; an S32 sample rounds up to it when converted to float.
+ */
+PCM_VINLINE void pcm_vmeter_groups(struct pcm_meter *meter, const char *data, unsigned int groups,
+                                   unsigned int channels, unsigned int base,
+                                   enum pcm_format format, unsigned int vecs)
+{
+    unsigned int bytes = format == PCM_FORMAT_S16_LE ? 8 : 16;
+    float full = format == PCM_FORMAT_S16_LE ? 32767.0f :
+                 format == PCM_FORMAT_S24_LE ? 8388607.0f :
+                 format == PCM_FORMAT_S32_LE ? 2147483648.0f : 1.0f;
+    double scale2 = (double) meter->scale * meter->scale;
+    pcm_v4sf peak[PCM_METER_VECS], sum[PCM_METER_VECS];
+    pcm_v4si clips[PCM_METER_VECS], clipped;
+    unsigned int i, j, lane;
+
+    while (groups) {
+        unsigned int n = groups < PCM_METER_CHUNK ? groups : PCM_METER_CHUNK;
+        const char *chunk = data;
+
+        for (j = 0; j < vecs; j++) {
+            peak[j] = sum[j] = (pcm_v4sf) { 0.0f, 0.0f, 0.0f, 0.0f };
+            clips[j] = (pcm_v4si) { 0, 0, 0, 0 };
+        }
+
+        for (i = 0; i < n; i++) {
+            for (j = 0; j < vecs; j++) {
+                pcm_v4sf v = pcm_vmeter_load(format, data);
+                pcm_v4si a = (pcm_v4si) v & 0x7fffffff, above;
+
+                /* NaN is never above the peak */
+                above = (pcm_v4sf) a > peak[j];
+                peak[j] = (pcm_v4sf) ((a & above) | ((pcm_v4si) peak[j] & ~above));
+                sum[j] += v * v;
+                data += bytes;
+            }
+        }
+
+        clipped = (pcm_v4si) { 0, 0, 0, 0 };
+        for (j = 0; j < vecs; j++)
+            clipped |= peak[j] >= full;
+        if (clipped[0] | clipped[1] | clipped[2] | clipped[3]) {
+            for (i = 0; i < n; i++) {
+                for (j = 0; j < vecs; j++) {
+                    clips[j] -= pcm_vmeter_clip(format, chunk);
+                    chunk += bytes;
+                }
+            }
+        }
+
+        for (j = 0; j < vecs; j++) {
+            for (lane = 0; lane < 4; lane++) {
+                struct pcm_meter_acc *acc = &meter->acc[base + (j * 4 + lane) % channels];
+                float value = peak[j][lane] * meter->scale;
+
+                if (value > acc->peak)
+                    acc->peak = value;
+                acc->sum += sum[j][lane] * scale2;
+                acc->clips += clips[j][lane];
+            }
+        }
+
+        groups -= n;
+    }
+}
+
+/*
+ * Meters as many whole groups of vectors as possible, returning the number of frames done.
+ * Each supported layout gets its own loop so the kernels are specialised.
+ */
+static unsigned int pcm_vmeter(struct pcm_meter *meter, const char *data, unsigned int frames,
+                               unsigned int channels, unsigned int base)
+{
+    /* the lanes line up with the same channels again after the least common multiple */
+    unsigned int vecs = channels % 4 == 0 ? channels / 4 :
+                        channels % 2 == 0 ? channels / 2 : channels;
+    unsigned int groups;
+
+    if (vecs > PCM_METER_VECS)
+        return 0;
+    /* at least two vectors, so that two chains of additions run at once */
+    if (vecs == 1)
+        vecs = 2;
+    groups = frames * channels / (vecs * 4);
+
+#define PCM_VMETER_CASE(f, v) \
+    case (f) << 4 | (v): \
+        pcm_vmeter_groups(meter, data, groups, channels, base, (f), (v)); \
+        break
+
+    switch (meter->format << 4 | vecs) {
+    PCM_VMETER_CASE(PCM_FORMAT_S16_LE, 2);
+    PCM_VMETER_CASE(PCM_FORMAT_S16_LE, 3);
+    PCM_VMETER_CASE(PCM_FORMAT_S24_LE, 2);
+    PCM_VMETER_CASE(PCM_FORMAT_S24_LE, 3);
+    PCM_VMETER_CASE(PCM_FORMAT_S32_LE, 2);
+    PCM_VMETER_CASE(PCM_FORMAT_S32_LE, 3);
+    PCM_VMETER_CASE(PCM_FORMAT_FLOAT_LE, 2);
+    PCM_VMETER_CASE(PCM_FORMAT_FLOAT_LE, 3);
+    default:
+        return 0;
+    }
+#undef PCM_VMETER_CASE
+
+    return groups * vecs * 4 / channels;
+}
+
+#endif
+
+/* meters interleaved frames of the given channels, the first being channel base of the meter */
+static void pcm_meter_block(struct pcm_meter *meter, const char *data, unsigned int frames,
+                            unsigned int channels, unsigned int base)
+{
+    unsigned int frame = 0, i;
+
+#ifdef PCM_SIMD_METER
+    frame = pcm_vmeter(meter, data, frames, channels, base);
+    data += (size_t) frame * channels * meter->width;
+#endif
+
+    for (; frame < frames; frame++) {
+        for (i = 0; i < channels; i++) {
+            pcm_meter_sample(meter, &meter->acc[base + i], data);
+            data += meter->width;
+        }
+    }
+}
+
+/* counts frames into the window, publishing its levels when it is complete */
+static void pcm_meter_advance(struct pcm_meter *meter, unsigned int frames)
+{
+    unsigned int seq = meter->seq, i;
+
+    meter->frames += frames;
+    meter->count += frames;
+    if (meter->count < meter->window)
+        return;
+
+    __atomic_store_n(&meter->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for (i = 0; i < meter->channels; i++) {
+        meter->levels[i].peak = meter->acc[i].peak;
+        meter->levels[i].rms = (float) sqrt(meter->acc[i].sum / meter->window);
+        meter->levels[i].clips = meter->acc[i].clips;
+    }
+    meter->levels_frames = meter->frames;
+
+    __atomic_store_n(&meter->seq, seq + 2, __ATOMIC_RELEASE);
+
+    memset(meter->acc, 0, meter->channels * sizeof(*meter->acc));
+    meter->count = 0;
+}
+
+static void pcm_meter_update(struct pcm_meter *meter, const char *data, unsigned int frames)
+{
+    while (frames) {
+        unsigned int n = meter->window - meter->count;
+
+        if (n > frames)
+            n = frames;
+        pcm_meter_block(meter, data, n, meter->channels, 0);
+        pcm_meter_advance(meter, n);
+
+        data += (size_t) n * meter->channels * meter->width;
+        frames -= n;
+    }
+}
+
+/* the planar equivalent of pcm_meter_update, one channel per plane */
+static void pcm_meter_updaten(struct pcm_meter *meter, char *const *planes, unsigned int frames)
+{
+    size_t offset = 0;
+    unsigned int i;
+
+    while (frames) {
+        unsigned int n = meter->window - meter->count;
+
+        if (n > frames)
+            n = frames;
+        for (i = 0; i < meter->channels; i++)
+            pcm_meter_block(meter, planes[i] + offset, n, 1, i);
+        pcm_meter_advance(meter, n);
+
+        offset += (size_t) n * meter->width;
+        frames -= n;
+    }
+}
+
+/** Measures the levels of the frames transferred by the read and write functions.
+ * The peak, root mean square and number of clipped samples of each channel are
+ * measured over windows of frames, as the frames are copied, and the levels of
+ * the latest complete window can be read by any thread with @ref pcm_get_meter.
+ * Frames accessed directly through @ref pcm_mmap_begin are not measured.
+ * Supported formats are @ref PCM_FORMAT_S16_LE, @ref PCM_FORMAT_S24_LE,
+ * @ref PCM_FORMAT_S32_LE and @ref PCM_FORMAT_FLOAT_LE.
+ * Setting the configuration of the PCM restarts the meter. Another thread
+ * may read the meter meanwhile: the meter replaced is freed when the meter
+ * is next set, so a read must not last across two settings.
+ * @param pcm A PCM handle.
+ * @param window The number of frames in each window; zero disables the meter.
+ * @return On success, zero; if the format is not supported, -EINVAL;
+ *  if the meter could not be allocated, -ENOMEM.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_set_meter(struct pcm *pcm, unsigned int window)
+{
+    struct pcm_meter *meter = NULL;
+    unsigned int channels = pcm->config.channels;
+
+    if (window) {
+        float scale = pcm_meter_scale(pcm->config.format);
+
+        if (scale == 0.0f || channels == 0 || window > INT_MAX / channels)
+            return -EINVAL;
+
+        /* the levels follow the accumulators in the same allocation */
+        meter = calloc(1, sizeof(*meter) +
+                       channels * (sizeof(*meter->acc) + sizeof(*meter->levels)));
+        if (meter == NULL)
+            return -ENOMEM;
+
+        meter->format = pcm->config.format;
+        meter->channels = channels;
+        meter->width = pcm_format_to_bits(meter->format) / 8;
+        meter->scale = scale;
+        meter->window = window;
+        meter->acc = (struct pcm_meter_acc *) (meter + 1);
+        meter->levels = (struct pcm_meter_level *) (meter->acc + channels);
+    }
+
+    free(pcm->meter_old);
+    pcm->meter_old = __atomic_exchange_n(&pcm->meter, meter, __ATOMIC_ACQ_REL);
+    return 0;
+}
+
+/** Reads the levels of the latest complete window of the meter.
+ * This may be called from any thread, without blocking the transfers.
+ * Until a window completes, the levels are zero.
+ * @param pcm A PCM handle, with a meter set by @ref pcm_set_meter.
+ * @param levels Receives the levels of the first channels.
+ * @param count The maximum number of channels to read.
+ * @param frames If not NULL, receives the number of frames metered since
+ *  the meter was set, up to the end of the window.
+ * @return The number of channels read; if there is no meter, -EINVAL.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_get_meter(const struct pcm *pcm, struct pcm_meter_level *levels, unsigned int count,
+                  unsigned long long *frames)
+{
+    const struct pcm_meter *meter = __atomic_load_n(&pcm->meter, __ATOMIC_ACQUIRE);
+    unsigned long long levels_frames;
+    unsigned int seq;
+
+    if (meter == NULL)
+        return -EINVAL;
+
+    if (count > meter->channels)
+        count = meter->channels;
+
+    do {
+        seq = __atomic_load_n(&meter->seq, __ATOMIC_ACQUIRE);
+        memcpy(levels, meter->levels, count * sizeof(*levels));
+        levels_frames = meter->levels_frames;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || __atomic_load_n(&meter->seq, __ATOMIC_RELAXED) != seq);
+
+    if (frames)
+        *frames = levels_frames;
+    return count;
+}
+
+static int pcm_rw_transfern(struct pcm *pcm, void **data, unsigned int frames)
+{
+    int is_playback;
+
+    struct snd_xfern transfer;
+    int res;
+
+    is_playback = !(pcm->flags & PCM_IN);
+
+    transfer.bufs = data;
+    transfer.frames = frames;
+    transfer.result = 0;
+
+    if (pcm->flags & PCM_STATS) {
+        unsigned long long start = pcm_stats_now();
+        pcm->stats.ioctls++;
+        res = pcm->ops->ioctl(pcm->data, is_playback
+                              ? SNDRV_PCM_IOCTL_WRITEN_FRAMES
+                              : SNDRV_PCM_IOCTL_READN_FRAMES, &transfer);
+        pcm->stats.blocked_ns += pcm_stats_now() - start;
+    } else {
+        res = pcm->ops->ioctl(pcm->data, is_playback
+                              ? SNDRV_PCM_IOCTL_WRITEN_FRAMES
+                              : SNDRV_PCM_IOCTL_READN_FRAMES, &transfer);
+    }
+
+    if (res != 0)
+        return -1;
+
+    if (pcm->meter)
+        pcm_meter_updaten(pcm->meter, (char *const *) data, transfer.result);
+    return (int) transfer.result;
+}
+
+/*
+ * Transfers planar data, either directly to a @ref PCM_NONINTERLEAVED PCM
+ * or by interleaving it a chunk at a time through the planar buffer.
+ */
+static int pcm_generic_transfern(struct pcm *pcm, void **data, unsigned int frames)
+{
+    unsigned int channels = pcm->config.channels;
+    unsigned int frame_bytes = pcm_frames_to_bytes(pcm, 1);
+    unsigned int width, chunk, count = 0;
+    size_t size;
+    int res;
+
+#if UINT_MAX > TINYALSA_FRAMES_MAX
+    if (frames > TINYALSA_FRAMES_MAX)
+        return -EINVAL;
+#endif
+    if (frames > INT_MAX || data == NULL || channels == 0 || frame_bytes % channels)
+        return -EINVAL;
+
+    if (pcm->flags & PCM_NONINTERLEAVED) {
+        if (pcm->flags & PCM_STATS) {
+            pcm->stats.transfers++;
+            if (!pcm->stats_start_ns)
+                pcm->stats_start_ns = pcm_stats_now();
+        }
+
+        if (pcm_state(pcm) == PCM_STATE_SETUP && pcm_prepare(pcm) != 0)
+            return -1;
+again:
+        res = pcm_rw_transfern(pcm, data, frames);
+        if (res < 0) {
+            if (pcm_transfer_recover(pcm) == 0)
+                goto again;
+            return -1;
+        }
+
+        pcm_transfer_done(pcm, res);
+
+        return res;
+    }
+
+    /* a period at a time keeps the number of ioctls down and the chunk in cache */
+    size = (size_t) pcm->config.period_size * frame_bytes;
+    if (pcm->planar_size < size) {
+        char *buffer = realloc(pcm->planar_buffer, size);
+        if (buffer == NULL)
+            return oops(pcm, ENOMEM, "failed to allocate planar buffer");
+        pcm->planar_buffer = buffer;
+        pcm->planar_size = size;
+    }
+
+    width = frame_bytes / channels;
+    chunk = pcm->planar_size / frame_bytes;
+
+    while (count < frames) {
+        unsigned int n = frames - count < chunk ? frames - count : chunk;
+
+        if (!(pcm->flags & PCM_IN))
+            pcm_interleave(pcm->planar_buffer, (char *const *) data, count, n, channels, width);
+
+        res = pcm_generic_transfer(pcm, pcm->planar_buffer, n);
+        if (res < 0)
+            return count ? (int) count : res;
+
+        if (pcm->flags & PCM_IN)
+            pcm_deinterleave((char *const *) data, count, pcm->planar_buffer, res, channels, width);
+
+        count += res;
+        if ((unsigned int) res < n)
+            break;
+    }
+
+    return count;
+}
+
+/** Writes audio samples to PCM.
+ * If the PCM has not been started, it is started in this function.
+ * This function is only valid for PCMs opened with the @ref PCM_OUT flag.
+ * @param pcm A PCM handle.
+ * @param data The audio sample array
+ * @param frame_count The number of frames occupied by the sample array.
+ *  This value should not be greater than @ref TINYALSA_FRAMES_MAX
+ *  or INT_MAX.
+ * @return On success, this function returns the number of frames written; otherwise, a negative number.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_writei(struct pcm *pcm, const void *data, unsigned int frame_count)
+{
+    if (pcm->flags & PCM_IN)
+        return -EINVAL;
+
+    return pcm_generic_transfer(pcm, (void*) data, frame_count);
+}
+
+/** Reads audio samples from PCM.
+ * If the PCM has not been started, it is started in this function.
+ * This function is only valid for PCMs opened with the @ref PCM_IN flag.
+ * @param pcm A PCM handle.
+ * @param data The audio sample array
+ * @param frame_count The number of frames occupied by the sample array.
+ *  This value should not be greater than @ref TINYALSA_FRAMES_MAX
+ *  or INT_MAX.
+ * @return On success, this function returns the number of frames written; otherwise, a negative number.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_readi(struct pcm *pcm, void *data, unsigned int frame_count)
+{
+    if (!(pcm->flags & PCM_IN))
+        return -EINVAL;
+
+    return pcm_generic_transfer(pcm, data, frame_count);
+}
+
+/** Writes planar audio samples to PCM.
+ * Each channel is read from its own buffer.
+ * PCMs opened with the @ref PCM_NONINTERLEAVED flag are written directly.
+ * Otherwise, the samples are interleaved a period at a time before being written.
+ * If the PCM has not been started, it is started in this function.
+ * This function is only valid for PCMs opened with the @ref PCM_OUT flag.
+ * @param pcm A PCM handle.
+ * @param data An array of sample buffers, one for each channel.
+ * @param frame_count The number of frames in each buffer.
+ *  This value should not be greater than @ref TINYALSA_FRAMES_MAX
+ *  or INT_MAX.
+ * @return On success, this function returns the number of frames written; otherwise, a negative number.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_writen(struct pcm *pcm, void **data, unsigned int frame_count)
+{
+    if (pcm->flags & PCM_IN)
+        return -EINVAL;
+
+    return pcm_generic_transfern(pcm, data, frame_count);
+}
+
+/** Reads planar audio samples from PCM.
+ * Each channel is written to its own buffer.
+ * PCMs opened with the @ref PCM_NONINTERLEAVED flag are read directly.
+ * Otherwise, the samples are read a period at a time and deinterleaved.
+ * If the PCM has not been started, it is started in this function.
+ * This function is only valid for PCMs opened with the @ref PCM_IN flag.
+ * @param pcm A PCM handle.
+ * @param data An array of sample buffers, one for each channel.
+ * @param frame_count The number of frames each buffer can hold.
+ *  This value should not be greater than @ref TINYALSA_FRAMES_MAX
+ *  or INT_MAX.
+ * @return On success, this function returns the number of frames read; otherwise, a negative number.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_readn(struct pcm *pcm, void **data, unsigned int frame_count)
+{
+    if (!(pcm->flags & PCM_IN))
+        return -EINVAL;
+
+    return pcm_generic_transfern(pcm, data, frame_count);
+}
+
+/** Writes audio samples to PCM from several buffers.
+ * The buffers are played back in order, as if they were one interleaved array.
+ * For PCMs opened with the @ref PCM_MMAP flag, each buffer is copied straight into the ring buffer.
+ * Otherwise, buffers that are contiguous in memory are written with a single call.
+ * If the PCM has not been started, it is started in this function.
+ * This function is only valid for PCMs opened with the @ref PCM_OUT flag.
+ * @param pcm A PCM handle.
+ * @param iov The buffers, each of which holds a whole number of frames.
+ * @param iovcnt The number of buffers in iov.
+ * @return On success, this function returns the number of frames written; otherwise, a negative number.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_writev(struct pcm *pcm, const struct iovec *iov, int iovcnt)
+{
+    if (pcm->flags & PCM_IN)
+        return -EINVAL;
+
+    return pcm_generic_transferv(pcm, iov, iovcnt);
+}
+
+/** Reads audio samples from PCM into several buffers.
+ * The buffers are filled in order, as if they were one interleaved array.
+ * If the PCM has not been started, it is started in this function.
+ * This function is only valid for PCMs opened with the @ref PCM_IN flag.
+ * @param pcm A PCM handle.
+ * @param iov The buffers, each of which holds a whole number of frames.
+ * @param iovcnt The number of buffers in iov.
+ * @return On success, this function returns the number of frames read; otherwise, a negative number.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_readv(struct pcm *pcm, const struct iovec *iov, int iovcnt)
+{
+    if (!(pcm->flags & PCM_IN))
+        return -EINVAL;
+
+    return pcm_generic_transferv(pcm, iov, iovcnt);
+}
+
+/** Writes audio samples to PCM.
+ * If the PCM has not been started, it is started in this function.
+ * This function is only valid for PCMs opened with the @ref PCM_OUT flag.
+ * This function is not valid for PCMs opened with the @ref PCM_MMAP flag.
+ * @param pcm A PCM handle.
+ * @param data The audio sample array
+ * @param count The number of bytes occupied by the sample array.
+ * @return On success, this function returns zero; otherwise, a negative number.
+ * @deprecated
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_write(struct pcm *pcm, const void *data, unsigned int count)
+{
+    unsigned int requested_frames = pcm_bytes_to_frames(pcm, count);
+    int ret = pcm_writei(pcm, data, requested_frames);
+
+    if (ret < 0)
+        return ret;
+
+    return ((unsigned int )ret == requested_frames) ? 0 : -EIO;
+}
+
+/** Reads audio samples from PCM.
+ * If the PCM has not been started, it is started in this function.
+ * This function is only valid for PCMs opened with the @ref PCM_IN flag.
+ * This function is not valid for PCMs opened with the @ref PCM_MMAP flag.
+ * @param pcm A PCM handle.
+ * @param data The audio sample array
+ * @param count The number of bytes occupied by the sample array.
+ * @return On success, this function returns zero; otherwise, a negative number.
+ * @deprecated
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_read(struct pcm *pcm, void *data, unsigned int count)
+{
+    unsigned int requested_frames = pcm_bytes_to_frames(pcm, count);
+    int ret = pcm_readi(pcm, data, requested_frames);
+
+    if (ret < 0)
+        return ret;
+
+    return ((unsigned int )ret == requested_frames) ? 0 : -EIO;
+}
+
+/** Gets the delay of the PCM, in terms of frames.
+ * @param pcm A PCM handle.
+ * @returns On success, the delay of the PCM.
+ *  On failure, a negative number.
+ * @ingroup libtinyalsa-pcm
+ */
+long pcm_get_delay(struct pcm *pcm)
 {
     if (pcm->ops->ioctl(pcm->data, SNDRV_PCM_IOCTL_DELAY, &pcm->pcm_delay) < 0)
         return -1;
@@ -1805,6 +4063,657 @@ long pcm_get_delay(struct pcm *pcm)
     return pcm->pcm_delay;
 }
 
+/* length of the maximum length sequence, 2^12 - 1 */
+#define PCM_LATENCY_MLS_LENGTH 4095
+/* amplitude of the test signal, relative to full scale */
+#define PCM_LATENCY_LEVEL 0.5f
+/* share of the captured energy the test signal must account for */
+#define PCM_LATENCY_MIN_CORRELATION 0.5f
+
+struct pcm_latency_snapshot {
+    /* frames read when the snapshot was taken */
+    unsigned long read;
+    /* frames captured by the hardware at tstamp */
+    unsigned long hw_ptr;
+    struct timespec tstamp;
+};
+
+static float pcm_sample_to_float(const void *data, enum pcm_format format, unsigned int index)
+{
+    switch (format) {
+    case PCM_FORMAT_S16_LE:
+        return ((const int16_t *) data)[index] / 32768.0f;
+    case PCM_FORMAT_S24_LE:
+        return (int32_t) ((uint32_t) ((const int32_t *) data)[index] << 8) / 2147483648.0f;
+    case PCM_FORMAT_S32_LE:
+        return ((const int32_t *) data)[index] / 2147483648.0f;
+    case PCM_FORMAT_FLOAT_LE:
+        return ((const float *) data)[index];
+    default:
+        return 0.0f;
+    }
+}
+
+static void pcm_float_to_sample(void *data, enum pcm_format format, unsigned int index, float value)
+{
+    switch (format) {
+    case PCM_FORMAT_S16_LE:
+        ((int16_t *) data)[index] = (int16_t) (value * 32767.0f);
+        break;
+    case PCM_FORMAT_S24_LE:
+        ((int32_t *) data)[index] = (int32_t) (value * 8388607.0f);
+        break;
+    case PCM_FORMAT_S32_LE:
+        ((int32_t *) data)[index] = (int32_t) (value * 2147483647.0);
+        break;
+    case PCM_FORMAT_FLOAT_LE:
+        ((float *) data)[index] = value;
+        break;
+    default:
+        break;
+    }
+}
+
+static int pcm_latency_format_supported(enum pcm_format format)
+{
+    return format == PCM_FORMAT_S16_LE || format == PCM_FORMAT_S24_LE ||
+           format == PCM_FORMAT_S32_LE || format == PCM_FORMAT_FLOAT_LE;
+}
+
+static unsigned int pcm_latency_signal(enum pcm_latency_signal signal, float *ref)
+{
+    /* Galois LFSR for x^12 + x^11 + x^10 + x^4 + 1 */
+    unsigned int lfsr = 1, i;
+
+    if (signal == PCM_LATENCY_IMPULSE) {
+        ref[0] = 1.0f;
+        return 1;
+    }
+
+    for (i = 0; i < PCM_LATENCY_MLS_LENGTH; i++) {
+        ref[i] = (lfsr & 1) ? 1.0f : -1.0f;
+        lfsr = (lfsr >> 1) ^ ((lfsr & 1) ? 0xe08 : 0);
+    }
+    return PCM_LATENCY_MLS_LENGTH;
+}
+
+static long pcm_latency_frames_to_us(long frames, unsigned int rate)
+{
+    return (long) ((long long) frames * 1000000 / rate);
+}
+
+/** Measures the latency of a playback to capture path.
+ * A test signal is played on all channels of @p out while @p in is captured.
+ * The signal is located in the first channel of the capture by cross-correlation.
+ * Both PCMs are prepared and started by this function, and stopped on return.
+ * They must run at the same rate and use the same timestamp clock (see @ref PCM_MONOTONIC).
+ * Supported formats are @ref PCM_FORMAT_S16_LE, @ref PCM_FORMAT_S24_LE,
+ * @ref PCM_FORMAT_S32_LE and @ref PCM_FORMAT_FLOAT_LE.
+ * @param out A playback PCM handle.
+ * @param in A capture PCM handle, looped back to @p out.
+ * @param signal The test signal to play.
+ * @param latency Receives the measured latencies.
+ * @return On success, zero. On failure, a negative number;
+ *  the error message is set on @p in if the signal was not found, on @p out otherwise.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_measure_latency(struct pcm *out, struct pcm *in, enum pcm_latency_signal signal,
+                        struct pcm_latency *latency)
+{
+    struct pcm_latency_snapshot *snapshots = NULL, *snap;
+    struct timespec out_tstamp;
+    unsigned int out_period, in_period, out_buffer, rate, avail;
+    unsigned int out_channels, in_channels, sig_len, nsnapshots = 0, i, c;
+    unsigned long written = 0, read = 0, capture_len, sig_start = 0, out_hw_ptr = 0;
+    unsigned long sig_pos = 0, lag, best_lag = 0;
+    float *ref = NULL, *capture = NULL;
+    void *out_data = NULL, *in_data = NULL;
+    double ref_energy = 0.0, capture_energy = 0.0, best = 0.0;
+    long long ts_diff;
+    int xruns, ret = -1;
+
+    if (!pcm_is_ready(out) || !pcm_is_ready(in))
+        return -1;
+    if ((out->flags & PCM_IN) || !(in->flags & PCM_IN))
+        return oops(out, EINVAL, "expected a playback and a capture PCM");
+    if (out->config.rate != in->config.rate)
+        return oops(out, EINVAL, "rates differ (%u, %u)", out->config.rate, in->config.rate);
+    if ((out->flags & PCM_MONOTONIC) != (in->flags & PCM_MONOTONIC))
+        return oops(out, EINVAL, "PCMs use different timestamp clocks");
+    if (!pcm_latency_format_supported(out->config.format) ||
+        !pcm_latency_format_supported(in->config.format))
+        return oops(out, EINVAL, "unsupported format");
+
+    rate = out->config.rate;
+    out_period = out->config.period_size;
+    in_period = in->config.period_size;
+    out_buffer = pcm_get_buffer_size(out);
+    out_channels = out->config.channels;
+    in_channels = in->config.channels;
+
+    /* both buffers, the signal itself and a quarter second of path delay */
+    capture_len = out_buffer + pcm_get_buffer_size(in) + PCM_LATENCY_MLS_LENGTH + rate / 4;
+    capture_len = (capture_len + in_period - 1) / in_period * in_period;
+
+    ref = malloc(PCM_LATENCY_MLS_LENGTH * sizeof(*ref));
+    capture = malloc(capture_len * sizeof(*capture));
+    snapshots = malloc(capture_len / in_period * sizeof(*snapshots));
+    out_data = calloc(1, pcm_frames_to_bytes(out, out_period));
+    in_data = malloc(pcm_frames_to_bytes(in, in_period));
+    if (!ref || !capture || !snapshots || !out_data || !in_data) {
+        oops(out, ENOMEM, "cannot allocate latency buffers");
+        goto done;
+    }
+    sig_len = pcm_latency_signal(signal, ref);
+
+    if (pcm_prepare(out) < 0 || pcm_prepare(in) < 0)
+        goto done;
+    xruns = out->xruns + in->xruns;
+
+    /* prime the playback buffer with silence, this starts playback */
+    while (written < out_buffer) {
+        if (pcm_writei(out, out_data, out_period) < 0)
+            goto stop;
+        written += out_period;
+    }
+    if (pcm_start(out) < 0 || pcm_start(in) < 0)
+        goto stop;
+
+    while (read < capture_len) {
+        /* keep as many frames queued as the playback buffer holds */
+        if (written < read + out_buffer) {
+            if (written == out_buffer) {
+                if (pcm_get_htimestamp(out, &avail, &out_tstamp) < 0) {
+                    oops(out, errno, "cannot get playback timestamp");
+                    goto stop;
+                }
+                sig_start = written;
+                out_hw_ptr = written - (out_buffer - avail);
+                latency->output_frames = out_buffer - avail;
+            }
+            for (i = 0; i < out_period; i++) {
+                float value = 0.0f;
+                if (sig_start && sig_pos < sig_len)
+                    value = ref[sig_pos++] * PCM_LATENCY_LEVEL;
+                for (c = 0; c < out_channels; c++)
+                    pcm_float_to_sample(out_data, out->config.format, i * out_channels + c, value);
+            }
+            if (pcm_writei(out, out_data, out_period) < 0)
+                goto stop;
+            written += out_period;
+            continue;
+        }
+
+        if (pcm_readi(in, in_data, in_period) < 0)
+            goto stop;
+        for (i = 0; i < in_period; i++)
+            capture[read + i] = pcm_sample_to_float(in_data, in->config.format, i * in_channels);
+        read += in_period;
+
+        snap = &snapshots[nsnapshots++];
+        if (pcm_get_htimestamp(in, &avail, &snap->tstamp) < 0) {
+            oops(in, errno, "cannot get capture timestamp");
+            goto stop;
+        }
+        snap->read = read;
+        snap->hw_ptr = read + avail;
+    }
+
+    if (out->xruns + in->xruns != xruns) {
+        oops(out, EPIPE, "xrun during measurement");
+        goto stop;
+    }
+
+    /* cross-correlate the capture with the signal */
+    for (i = 0; i < sig_len; i++)
+        ref_energy += ref[i] * ref[i];
+    for (lag = 0; lag < capture_len; lag++)
+        capture_energy += capture[lag] * capture[lag];
+    for (lag = 0; lag + sig_len <= capture_len; lag++) {
+        double dot = 0.0;
+        for (i = 0; i < sig_len; i++)
+            dot += ref[i] * capture[lag + i];
+        if (dot * dot > best) {
+            best = dot * dot;
+            best_lag = lag;
+        }
+    }
+
+    latency->correlation = capture_energy > 0.0 ? best / (ref_energy * capture_energy) : 0.0f;
+    if (latency->correlation < PCM_LATENCY_MIN_CORRELATION) {
+        oops(in, ENODATA, "test signal not found (correlation %.2f)", latency->correlation);
+        goto stop;
+    }
+
+    /* the snapshot taken by the read that returned the signal */
+    for (snap = snapshots; snap->read <= best_lag; snap++)
+        ;
+
+    latency->input_frames = snap->hw_ptr - best_lag;
+    ts_diff = (snap->tstamp.tv_sec - out_tstamp.tv_sec) * 1000000000LL +
+              (snap->tstamp.tv_nsec - out_tstamp.tv_nsec);
+    latency->path_frames = ts_diff * rate / 1000000000LL +
+                           ((long) best_lag - (long) snap->hw_ptr) -
+                           ((long) sig_start - (long) out_hw_ptr);
+    latency->round_trip_frames = latency->output_frames + latency->path_frames +
+                                 latency->input_frames;
+
+    latency->output_us = pcm_latency_frames_to_us(latency->output_frames, rate);
+    latency->path_us = pcm_latency_frames_to_us(latency->path_frames, rate);
+    latency->input_us = pcm_latency_frames_to_us(latency->input_frames, rate);
+    latency->round_trip_us = pcm_latency_frames_to_us(latency->round_trip_frames, rate);
+    ret = 0;
+
+stop:
+    pcm_stop(out);
+    pcm_stop(in);
+done:
+    free(in_data);
+    free(out_data);
+    free(snapshots);
+    free(capture);
+    free(ref);
+    return ret;
+}
+
+/* the resampler interpolates between four frames, three of them from the previous period */
+#define PCM_BRIDGE_HISTORY 3
+/* the most the input clock may deviate from the output one, as a fraction */
+#define PCM_BRIDGE_MAX_DRIFT 0.01
+/* the most the fill level control may change the ratio by, as a fraction */
+#define PCM_BRIDGE_MAX_CORRECTION 0.002
+/* time constant of the fill level control loop, in seconds */
+#define PCM_BRIDGE_LOOP_S 4.0
+/* time constant of the fill level average, in seconds */
+#define PCM_BRIDGE_FILL_S 0.5
+/* the clocks are measured over one to two of these windows, in nanoseconds */
+#define PCM_BRIDGE_WINDOW_NS 10000000000LL
+/* how long a clock is measured before its rate is used, in nanoseconds */
+#define PCM_BRIDGE_MIN_WINDOW_NS 1000000000LL
+
+/* the rate of a PCM's clock, from the frames its hardware transferred by each time stamp */
+struct pcm_bridge_clock {
+    /* non-zero once the window has a start */
+    int started;
+    /* the start and middle of the window */
+    long long ref_frames;
+    long long ref_ns;
+    long long mid_frames;
+    long long mid_ns;
+    /* the measured frames per second, zero until measured */
+    double rate;
+};
+
+/** Moves audio from a capture PCM to a playback PCM running from another clock.
+ * @ingroup libtinyalsa-pcm
+ */
+struct pcm_bridge {
+    struct pcm *in;
+    struct pcm *out;
+    unsigned int channels;
+    unsigned int in_period;
+    unsigned int out_buffer;
+    /** The most frames resampling a period of input can produce */
+    unsigned int out_max;
+    /** The frames kept queued in the output buffer */
+    unsigned int target;
+    /** The input converted to float, after PCM_BRIDGE_HISTORY frames of the previous period */
+    float *history;
+    void *in_data;
+    void *out_data;
+    /** The input rate over the output rate */
+    double nominal;
+    /** The measured input rate over the output rate, relative to nominal */
+    double drift;
+    /** Input frames consumed per output frame */
+    double ratio;
+    /** Position of the next output frame, in input frames from the first new frame */
+    double phase;
+    /** The averaged fill level, and the integral of its error in frame seconds */
+    double fill;
+    double integral;
+    struct pcm_bridge_clock in_clock;
+    struct pcm_bridge_clock out_clock;
+    unsigned long long frames_in;
+    unsigned long long frames_out;
+    /** Xruns of both PCMs when the bridge was opened, and when the clocks were last reset */
+    int xruns_base;
+    int xruns_seen;
+    int started;
+};
+
+/** Opens a bridge from a capture PCM to a playback PCM.
+ * The bridge keeps @p target frames queued in the output buffer, however the
+ * clocks of the two PCMs drift apart. It measures the rate of each clock from
+ * its hardware position and time stamp, and resamples the input by their
+ * ratio, corrected by a proportional-integral control of the output fill level.
+ * The PCMs must have the same number of channels and use the same timestamp
+ * clock (see @ref PCM_MONOTONIC); their rates may differ.
+ * Supported formats are @ref PCM_FORMAT_S16_LE, @ref PCM_FORMAT_S24_LE,
+ * @ref PCM_FORMAT_S32_LE and @ref PCM_FORMAT_FLOAT_LE.
+ * @param in A capture PCM handle.
+ * @param out A playback PCM handle.
+ * @param target The frames to keep queued in the output buffer; zero for half of it.
+ * @return On success, a bridge; on failure, NULL, with the error message set on @p out.
+ * @ingroup libtinyalsa-pcm
+ */
+struct pcm_bridge *pcm_bridge_open(struct pcm *in, struct pcm *out, unsigned int target)
+{
+    struct pcm_bridge *bridge;
+    double min_ratio;
+
+    if (!pcm_is_ready(out) || !pcm_is_ready(in))
+        return NULL;
+    if ((out->flags & PCM_IN) || !(in->flags & PCM_IN)) {
+        oops(out, EINVAL, "expected a capture and a playback PCM");
+        return NULL;
+    }
+    if (out->config.channels != in->config.channels) {
+        oops(out, EINVAL, "channels differ (%u, %u)", in->config.channels, out->config.channels);
+        return NULL;
+    }
+    if ((out->flags & PCM_MONOTONIC) != (in->flags & PCM_MONOTONIC)) {
+        oops(out, EINVAL, "PCMs use different timestamp clocks");
+        return NULL;
+    }
+    if (!pcm_latency_format_supported(out->config.format) ||
+        !pcm_latency_format_supported(in->config.format)) {
+        oops(out, EINVAL, "unsupported format");
+        return NULL;
+    }
+
+    bridge = calloc(1, sizeof(*bridge));
+    if (bridge == NULL) {
+        oops(out, ENOMEM, "cannot allocate bridge");
+        return NULL;
+    }
+    bridge->in = in;
+    bridge->out = out;
+    bridge->channels = in->config.channels;
+    bridge->in_period = in->config.period_size;
+    bridge->out_buffer = pcm_get_buffer_size(out);
+    bridge->nominal = (double) in->config.rate / out->config.rate;
+    bridge->ratio = bridge->nominal;
+    bridge->drift = 1.0;
+
+    min_ratio = bridge->nominal * (1.0 - PCM_BRIDGE_MAX_DRIFT) * (1.0 - PCM_BRIDGE_MAX_CORRECTION);
+    bridge->out_max = (unsigned int) (bridge->in_period / min_ratio) + 2;
+
+    bridge->target = target ? target : bridge->out_buffer / 2;
+    if (bridge->target + bridge->out_max > bridge->out_buffer) {
+        oops(out, EINVAL, "target %u leaves no room for %u frames", bridge->target,
+             bridge->out_max);
+        goto fail;
+    }
+    bridge->fill = bridge->target;
+
+    bridge->history = calloc((size_t) (PCM_BRIDGE_HISTORY + bridge->in_period) * bridge->channels,
+                             sizeof(*bridge->history));
+    bridge->in_data = malloc(pcm_frames_to_bytes(in, bridge->in_period));
+    bridge->out_data = calloc(1, pcm_frames_to_bytes(out, bridge->out_max));
+    if (!bridge->history || !bridge->in_data || !bridge->out_data) {
+        oops(out, ENOMEM, "cannot allocate bridge buffers");
+        goto fail;
+    }
+
+    bridge->xruns_base = in->xruns + out->xruns;
+    return bridge;
+
+fail:
+    pcm_bridge_close(bridge);
+    return NULL;
+}
+
+/* queues the target level of silence and starts both PCMs */
+static int pcm_bridge_start(struct pcm_bridge *bridge)
+{
+    unsigned int queued = 0, frames;
+
+    if (pcm_prepare(bridge->out) < 0 || pcm_prepare(bridge->in) < 0)
+        return -1;
+
+    /* out_data is only written with frames produced, this is silence */
+    while (queued < bridge->target) {
+        frames = bridge->target - queued;
+        if (frames > bridge->out_max)
+            frames = bridge->out_max;
+        if (pcm_writei(bridge->out, bridge->out_data, frames) < 0)
+            return -1;
+        queued += frames;
+    }
+    bridge->frames_out += queued;
+
+    if (pcm_start(bridge->out) < 0 || pcm_start(bridge->in) < 0)
+        return -1;
+
+    bridge->xruns_seen = bridge->in->xruns + bridge->out->xruns;
+    bridge->started = 1;
+    return 0;
+}
+
+/* takes the frames transferred by the hardware of a PCM at its latest time stamp */
+static void pcm_bridge_clock_update(struct pcm_bridge_clock *clock, long long frames,
+                                    const struct timespec *tstamp)
+{
+    long long ns = tstamp->tv_sec * 1000000000LL + tstamp->tv_nsec;
+
+    if (!clock->started) {
+        clock->ref_frames = clock->mid_frames = frames;
+        clock->ref_ns = clock->mid_ns = ns;
+        clock->rate = 0.0;
+        clock->started = 1;
+        return;
+    }
+
+    if (ns - clock->ref_ns >= PCM_BRIDGE_MIN_WINDOW_NS)
+        clock->rate = (frames - clock->ref_frames) * 1e9 / (ns - clock->ref_ns);
+
+    /* slide the window, so it covers one to two windows of the latest stamps */
+    if (ns - clock->mid_ns >= PCM_BRIDGE_WINDOW_NS) {
+        clock->ref_frames = clock->mid_frames;
+        clock->ref_ns = clock->mid_ns;
+        clock->mid_frames = frames;
+        clock->mid_ns = ns;
+    }
+}
+
+/* resamples the new frames in the history into out_data, returns the frames produced */
+static unsigned int pcm_bridge_resample(struct pcm_bridge *bridge, unsigned int frames)
+{
+    enum pcm_format format = bridge->out->config.format;
+    unsigned int channels = bridge->channels;
+    unsigned int count = 0, i, c;
+    double phase = bridge->phase;
+    const float *x;
+    float f, y;
+
+    while (phase < frames && count < bridge->out_max) {
+        i = (unsigned int) phase;
+        f = (float) (phase - i);
+        /* frames i - 1 to i + 2 of the input, the output is between the middle two */
+        x = bridge->history + (size_t) i * channels;
+        for (c = 0; c < channels; c++) {
+            float xm1 = x[c], x0 = x[channels + c];
+            float x1 = x[2 * channels + c], x2 = x[3 * channels + c];
+
+            /* Catmull-Rom spline */
+            y = x0 + 0.5f * f * (x1 - xm1 + f * (2.0f * xm1 - 5.0f * x0 + 4.0f * x1 - x2 +
+                                 f * (3.0f * (x0 - x1) + x2 - xm1)));
+            if (y > 1.0f)
+                y = 1.0f;
+            else if (y < -1.0f)
+                y = -1.0f;
+            pcm_float_to_sample(bridge->out_data, format, count * channels + c, y);
+        }
+        count++;
+        phase += bridge->ratio;
+    }
+
+    bridge->phase = phase > frames ? phase - frames : 0.0;
+    memmove(bridge->history, bridge->history + (size_t) frames * channels,
+            PCM_BRIDGE_HISTORY * channels * sizeof(*bridge->history));
+    return count;
+}
+
+/*
+ * Estimates the frames the output played since its time stamp. The position
+ * only moves when the hardware reports it, a period at a time for some, and
+ * the fill level has to be measured between those moves to be steered on.
+ */
+static long pcm_bridge_played(struct pcm_bridge *bridge, const struct timespec *tstamp)
+{
+    clockid_t clock = bridge->out->flags & PCM_MONOTONIC ? CLOCK_MONOTONIC : CLOCK_REALTIME;
+    struct timespec now;
+    long long ns;
+    long frames;
+
+    clock_gettime(clock, &now);
+    ns = (now.tv_sec - tstamp->tv_sec) * 1000000000LL + (now.tv_nsec - tstamp->tv_nsec);
+    if (ns <= 0)
+        return 0;
+
+    frames = (long) (ns * bridge->out->config.rate / 1000000000LL);
+    if (frames > (long) bridge->out->config.period_size)
+        frames = bridge->out->config.period_size;
+    return frames;
+}
+
+/* steers the ratio by the measured drift and the output fill level */
+static void pcm_bridge_control(struct pcm_bridge *bridge, unsigned int frames, long fill)
+{
+    double dt = (double) frames / bridge->in->config.rate;
+    double rate = bridge->out->config.rate;
+    double kp = 1.0 / (PCM_BRIDGE_LOOP_S * rate);
+    /* critically damped, with the fill level integrating the ratio error */
+    double ki = 1.0 / (4.0 * PCM_BRIDGE_LOOP_S * PCM_BRIDGE_LOOP_S * rate);
+    double alpha = dt / PCM_BRIDGE_FILL_S;
+    double error, correction;
+
+    if (alpha > 1.0)
+        alpha = 1.0;
+    bridge->fill += alpha * (fill - bridge->fill);
+    error = bridge->fill - bridge->target;
+
+    bridge->integral += error * dt;
+    if (ki * bridge->integral > PCM_BRIDGE_MAX_CORRECTION)
+        bridge->integral = PCM_BRIDGE_MAX_CORRECTION / ki;
+    else if (ki * bridge->integral < -PCM_BRIDGE_MAX_CORRECTION)
+        bridge->integral = -PCM_BRIDGE_MAX_CORRECTION / ki;
+
+    /* a fill above the target means too many output frames, take more input for each */
+    correction = kp * error + ki * bridge->integral;
+    if (correction > PCM_BRIDGE_MAX_CORRECTION)
+        correction = PCM_BRIDGE_MAX_CORRECTION;
+    else if (correction < -PCM_BRIDGE_MAX_CORRECTION)
+        correction = -PCM_BRIDGE_MAX_CORRECTION;
+
+    /* while the clocks are measured again after an xrun, the last drift holds */
+    if (bridge->in_clock.rate > 0.0 && bridge->out_clock.rate > 0.0) {
+        bridge->drift = bridge->in_clock.rate / bridge->out_clock.rate / bridge->nominal;
+        if (bridge->drift > 1.0 + PCM_BRIDGE_MAX_DRIFT)
+            bridge->drift = 1.0 + PCM_BRIDGE_MAX_DRIFT;
+        else if (bridge->drift < 1.0 - PCM_BRIDGE_MAX_DRIFT)
+            bridge->drift = 1.0 - PCM_BRIDGE_MAX_DRIFT;
+    }
+
+    bridge->ratio = bridge->nominal * bridge->drift * (1.0 + correction);
+}
+
+/** Moves a period of frames from the input to the output of a bridge.
+ * The first call prepares both PCMs, queues the target level of silence on the
+ * output and starts them. The call then blocks until a period was captured.
+ * An xrun of either PCM is recovered from by the read and write functions, and
+ * restarts the measure of the clocks.
+ * @param bridge A bridge.
+ * @return On success, the number of frames written to the output; on failure,
+ *  a negative number, with the error message set on the PCM that failed.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_bridge_transfer(struct pcm_bridge *bridge)
+{
+    struct pcm *in = bridge->in, *out = bridge->out;
+    struct timespec tstamp;
+    unsigned int avail, frames, count, i;
+    int res, xruns;
+
+    if (!bridge->started && pcm_bridge_start(bridge) < 0)
+        return -1;
+
+    res = pcm_readi(in, bridge->in_data, bridge->in_period);
+    if (res < 0)
+        return res;
+    frames = res;
+    bridge->frames_in += frames;
+
+    /* the hardware positions are only comparable between xruns */
+    xruns = in->xruns + out->xruns;
+    if (xruns != bridge->xruns_seen) {
+        bridge->in_clock.started = 0;
+        bridge->out_clock.started = 0;
+        bridge->xruns_seen = xruns;
+    }
+
+    /* a PCM restarting after an xrun does not run at the rate of its clock */
+    if (pcm_get_htimestamp(in, &avail, &tstamp) == 0 &&
+        in->mmap_status->state == PCM_STATE_RUNNING)
+        pcm_bridge_clock_update(&bridge->in_clock, bridge->frames_in + avail, &tstamp);
+
+    for (i = 0; i < frames * bridge->channels; i++)
+        bridge->history[PCM_BRIDGE_HISTORY * bridge->channels + i] =
+                pcm_sample_to_float(bridge->in_data, in->config.format, i);
+    count = pcm_bridge_resample(bridge, frames);
+
+    res = pcm_writei(out, bridge->out_data, count);
+    if (res < 0)
+        return res;
+    bridge->frames_out += res;
+
+    if (pcm_get_htimestamp(out, &avail, &tstamp) == 0 &&
+        out->mmap_status->state == PCM_STATE_RUNNING) {
+        long fill = (long) bridge->out_buffer - (long) avail;
+
+        pcm_bridge_clock_update(&bridge->out_clock, bridge->frames_out - fill, &tstamp);
+        pcm_bridge_control(bridge, frames, fill - pcm_bridge_played(bridge, &tstamp));
+    }
+
+    return res;
+}
+
+/** Gets the state of a bridge.
+ * @param bridge A bridge.
+ * @param status Receives the state.
+ * @return Always zero.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_bridge_get_status(const struct pcm_bridge *bridge, struct pcm_bridge_status *status)
+{
+    memset(status, 0, sizeof(*status));
+    status->ratio = bridge->ratio;
+    status->drift_ppm = (bridge->drift - 1.0) * 1e6;
+    status->fill = bridge->fill;
+    status->target = bridge->target;
+    status->frames_in = bridge->frames_in;
+    status->frames_out = bridge->frames_out;
+    status->xruns = bridge->in->xruns + bridge->out->xruns - bridge->xruns_base;
+    return 0;
+}
+
+/** Frees a bridge.
+ * The PCMs are neither stopped nor closed.
+ * @param bridge A bridge, may be NULL.
+ * @ingroup libtinyalsa-pcm
+ */
+void pcm_bridge_close(struct pcm_bridge *bridge)
+{
+    if (bridge == NULL)
+        return;
+
+    free(bridge->out_data);
+    free(bridge->in_data);
+    free(bridge->history);
+    free(bridge);
+}
+
 // TODO: Currently in Android, there are some libraries using this function to control the driver.
 //   We should remove this function as soon as possible.
 int pcm_ioctl(struct pcm *pcm, int request, ...)
@@ -34,6 +34,7 @@
 #include <stdarg.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 #include <unistd.h>
 #include <poll.h>
 #include <dlfcn.h>
@@ -62,13 +63,6 @@ enum {
     PCM_PLUG_HW_PARAM_SELECT_VAL,
 };
 
-enum {
-    PCM_PLUG_STATE_OPEN,
-    PCM_PLUG_STATE_SETUP,
-    PCM_PLUG_STATE_PREPARED,
-    PCM_PLUG_STATE_RUNNING,
-};
-
 struct pcm_plug_data {
     unsigned int card;
     unsigned int device;
@@ -101,6 +95,8 @@ static int convert_plugin_to_pcm_state(int plugin_state)
         return PCM_STATE_PREPARED;
     case PCM_PLUG_STATE_OPEN:
         return PCM_STATE_OPEN;
+    case PCM_PLUG_STATE_XRUN:
+        return PCM_STATE_XRUN;
     default:
         break;
     }
@@ -114,7 +110,7 @@ static void pcm_plug_close(void *data)
     struct pcm_plugin *plugin = plug_data->plugin;
 
     plug_data->ops->close(plugin);
-    dlclose(plug_data->dl_hdl);
+    snd_utils_dlclose(plug_data->dl_hdl);
 
     free(plug_data);
 }
@@ -203,7 +199,20 @@ static int pcm_plug_frames_to_bytes(unsigned int frames,
 static int pcm_plug_bytes_to_frames(unsigned int size,
                                     unsigned int frame_bits)
 {
-    return (size * 8)  / frame_bits;
+    return ((unsigned long long)size * 8) / frame_bits;
+}
+
+static void pcm_plug_frames_to_time(const struct pcm_plugin_min_max *rate,
+                                    const struct pcm_plugin_min_max *frames,
+                                    struct pcm_plugin_min_max *time)
+{
+    unsigned long long min, max;
+
+    min = rate->max ? frames->min * 1000000ULL / rate->max : 0;
+    max = rate->min ? frames->max * 1000000ULL / rate->min : UINT_MAX;
+
+    time->min = min > 0 ? min : 1;
+    time->max = max < UINT_MAX ? max : UINT_MAX;
 }
 
 static int pcm_plug_get_params(struct pcm_plugin *plugin,
@@ -212,6 +221,7 @@ static int pcm_plug_get_params(struct pcm_plugin *plugin,
     struct pcm_plugin_min_max bw, ch, pb, periods;
     struct pcm_plugin_min_max val;
     struct pcm_plugin_min_max frame_bits, buffer_bytes;
+    struct pcm_plugin_min_max period_size, buffer_size;
 
     /*
      * populate the struct snd_pcm_hw_params structure
@@ -225,7 +235,7 @@ static int pcm_plug_get_params(struct pcm_plugin *plugin,
     pcm_plug_set_mask(params, SNDRV_PCM_HW_PARAM_FORMAT,
                       plugin->constraints->format);
     pcm_plug_set_mask(params, SNDRV_PCM_HW_PARAM_SUBFORMAT,
-                      SNDRV_PCM_SUBFORMAT_STD);
+                      1ULL << SNDRV_PCM_SUBFORMAT_STD);
 
     /* Set the standard interval params */
     pcm_plug_set_interval(params, SNDRV_PCM_HW_PARAM_SAMPLE_BITS,
@@ -265,6 +275,7 @@ static int pcm_plug_get_params(struct pcm_plugin *plugin,
     val.max = pcm_plug_bytes_to_frames(pb.max, frame_bits.min);
     pcm_plug_set_interval(params, SNDRV_PCM_HW_PARAM_PERIOD_SIZE,
                           &val, 1);
+    period_size = val;
 
     /* Calculate and set buffer_bytes */
     buffer_bytes.min = pb.min * periods.min;
@@ -277,6 +288,23 @@ static int pcm_plug_get_params(struct pcm_plugin *plugin,
     val.max = pcm_plug_bytes_to_frames(buffer_bytes.max, frame_bits.min);
     pcm_plug_set_interval(params, SNDRV_PCM_HW_PARAM_BUFFER_SIZE,
                           &val, 1);
+    buffer_size = val;
+
+    /* Calculate and set the period and buffer times in microseconds */
+    pcm_plug_frames_to_time(&plugin->constraints->rate, &period_size,
+                            &val);
+    pcm_plug_set_interval(params, SNDRV_PCM_HW_PARAM_PERIOD_TIME,
+                          &val, 0);
+    pcm_plug_frames_to_time(&plugin->constraints->rate, &buffer_size,
+                            &val);
+    pcm_plug_set_interval(params, SNDRV_PCM_HW_PARAM_BUFFER_TIME,
+                          &val, 0);
+
+    /* Leave the tick time unconstrained, as the kernel does */
+    val.min = 0;
+    val.max = UINT_MAX;
+    pcm_plug_set_interval(params, SNDRV_PCM_HW_PARAM_TICK_TIME,
+                          &val, 0);
     return 0;
 }
 
@@ -499,7 +527,10 @@ static int pcm_plug_hparams(struct pcm_plug_data *plug_data,
     struct pcm_plugin *plugin = plug_data->plugin;
     int rc;
 
-    if (plugin->state != PCM_PLUG_STATE_OPEN)
+    /* like the kernel, allow the parameters to change until started */
+    if (plugin->state != PCM_PLUG_STATE_OPEN &&
+        plugin->state != PCM_PLUG_STATE_SETUP &&
+        plugin->state != PCM_PLUG_STATE_PREPARED)
             return -EBADFD;
 
     params->rmask = ~0U;
@@ -525,7 +556,8 @@ static int pcm_plug_sparams(struct pcm_plug_data *plug_data,
 {
     struct pcm_plugin *plugin = plug_data->plugin;
 
-    if (plugin->state != PCM_PLUG_STATE_SETUP)
+    /* like the kernel, allow the parameters to change once hw params are set */
+    if (plugin->state < PCM_PLUG_STATE_SETUP)
         return -EBADFD;
 
     return plug_data->ops->sw_params(plugin, params);
@@ -551,6 +583,9 @@ static int pcm_plug_writei_frames(struct pcm_plug_data *plug_data,
 {
     struct pcm_plugin *plugin = plug_data->plugin;
 
+    if (plugin->state == PCM_PLUG_STATE_XRUN)
+        return -EPIPE;
+
     if (plugin->state != PCM_PLUG_STATE_PREPARED &&
         plugin->state != PCM_PLUG_STATE_RUNNING)
         return -EBADFD;
@@ -563,6 +598,9 @@ static int pcm_plug_readi_frames(struct pcm_plug_data *plug_data,
 {
     struct pcm_plugin *plugin = plug_data->plugin;
 
+    if (plugin->state == PCM_PLUG_STATE_XRUN)
+        return -EPIPE;
+
     if (plugin->state != PCM_PLUG_STATE_PREPARED &&
         plugin->state != PCM_PLUG_STATE_RUNNING)
         return -EBADFD;
@@ -586,7 +624,10 @@ static int pcm_plug_prepare(struct pcm_plug_data *plug_data)
     struct pcm_plugin *plugin = plug_data->plugin;
     int rc;
 
-    if (plugin->state != PCM_PLUG_STATE_SETUP)
+    /* like the kernel, allow preparing again to recover from an xrun */
+    if (plugin->state != PCM_PLUG_STATE_SETUP &&
+        plugin->state != PCM_PLUG_STATE_PREPARED &&
+        plugin->state != PCM_PLUG_STATE_XRUN)
         return -EBADFD;
 
     rc = plug_data->ops->prepare(plugin);
@@ -687,6 +728,10 @@ static int pcm_plug_ioctl(void *data, unsigned int cmd, ...)
         break;
     }
 
+    /* plugins return a negative errno, the pcm layer reads errno */
+    if (ret < -1)
+        errno = -ret;
+
     return ret;
 }
 
@@ -741,12 +786,10 @@ static int pcm_plug_open(unsigned int card, unsigned int device,
         goto err_get_lib;
     }
 
-    dl_hdl = dlopen(so_name, RTLD_NOW);
+    dl_hdl = snd_utils_dlopen(so_name);
     if (!dl_hdl) {
         fprintf(stderr, "%s: unable to open %s\n", __func__, so_name);
         goto err_dl_open;
-    } else {
-        fprintf(stderr, "%s: dlopen successful for %s\n", __func__, so_name);
     }
 
     dlerror();
@@ -778,7 +821,7 @@ static int pcm_plug_open(unsigned int card, unsigned int device,
 
 err_open:
 err_dlsym:
-    dlclose(dl_hdl);
+    snd_utils_dlclose(dl_hdl);
 err_get_lib:
 err_dl_open:
     free(plug_data);
@@ -786,6 +829,43 @@ err_dl_open:
     return rc;
 }
 
+int pcm_plugin_get_int(struct pcm_plugin *plugin, const char *prop, int *val)
+{
+    struct snd_node *node;
+    int rc;
+
+    if (!plugin || !prop || !val)
+        return -EINVAL;
+
+    node = snd_utils_open_pcm(plugin->card, plugin->device);
+    if (!node)
+        return -ENODEV;
+
+    rc = snd_utils_get_int(node, prop, val);
+    snd_utils_close_dev_node(node);
+
+    return rc;
+}
+
+int pcm_plugin_get_str(struct pcm_plugin *plugin, const char *prop, char **val)
+{
+    struct snd_node *node;
+    int rc;
+
+    if (!plugin || !prop || !val)
+        return -EINVAL;
+
+    /* the card definition outlives this node, the PCM holds a reference */
+    node = snd_utils_open_pcm(plugin->card, plugin->device);
+    if (!node)
+        return -ENODEV;
+
+    rc = snd_utils_get_str(node, prop, val);
+    snd_utils_close_dev_node(node);
+
+    return rc;
+}
+
 const struct pcm_ops plug_ops = {
     .open = pcm_plug_open,
     .close = pcm_plug_close,
@@ -31,7 +31,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #define SND_DLSYM(h, p, s, err) \
 do {                            \
@@ -41,6 +43,198 @@ do {                            \
         err = -ENODEV;            \
 } while(0)
 
+/*
+ * The card parser, the card definitions it returns and the plugin libraries
+ * are cached for the life of the process, so that opening a device does not
+ * load and parse them again. Entries are reference counted and stay cached
+ * when unused; the unused ones are released when tinyalsa is unloaded.
+ * A missing parser, or a card it does not describe, is cached as well, so
+ * that opening a hw device only looks for them once.
+ */
+
+/** A card definition returned by the parser */
+struct snd_card_entry {
+    unsigned int card;
+    /** The card definition, or NULL if the parser does not describe the card */
+    void *card_node;
+    unsigned int refs;
+    struct snd_card_entry *next;
+};
+
+/** A plugin library */
+struct snd_lib_entry {
+    char *so_name;
+    void *dl_hdl;
+    unsigned int refs;
+    struct snd_lib_entry *next;
+};
+
+static pthread_mutex_t snd_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+/** Handle of the card parser, or NULL if it is not loaded */
+static void *snd_parser_hdl;
+static const struct snd_node_ops *snd_parser_ops;
+/** Set when loading the card parser failed */
+static int snd_parser_missing;
+static struct snd_card_entry *snd_cards;
+static struct snd_lib_entry *snd_libs;
+
+/* Called with snd_cache_lock held */
+static int snd_utils_load_parser(void)
+{
+    int err;
+
+    if (snd_parser_hdl)
+        return 0;
+    if (snd_parser_missing)
+        return -ENODEV;
+
+    snd_parser_hdl = dlopen("libsndcardparser.so", RTLD_NOW);
+    if (!snd_parser_hdl) {
+        snd_parser_missing = 1;
+        return -ENODEV;
+    }
+
+    SND_DLSYM(snd_parser_hdl, snd_parser_ops, "snd_card_ops", err);
+    if (err < 0) {
+        dlclose(snd_parser_hdl);
+        snd_parser_hdl = NULL;
+        snd_parser_missing = 1;
+    }
+
+    return err;
+}
+
+static struct snd_card_entry *snd_utils_get_card(unsigned int card)
+{
+    struct snd_card_entry *entry;
+
+    pthread_mutex_lock(&snd_cache_lock);
+
+    for (entry = snd_cards; entry; entry = entry->next) {
+        if (entry->card == card)
+            goto found;
+    }
+
+    if (snd_utils_load_parser() < 0) {
+        entry = NULL;
+        goto out;
+    }
+
+    entry = calloc(1, sizeof(*entry));
+    if (!entry)
+        goto out;
+
+    entry->card = card;
+    entry->card_node = snd_parser_ops->open_card(card);
+    entry->next = snd_cards;
+    snd_cards = entry;
+
+found:
+    entry->refs++;
+out:
+    pthread_mutex_unlock(&snd_cache_lock);
+    return entry;
+}
+
+static void snd_utils_put_card(struct snd_card_entry *entry)
+{
+    pthread_mutex_lock(&snd_cache_lock);
+    entry->refs--;
+    pthread_mutex_unlock(&snd_cache_lock);
+}
+
+void *snd_utils_dlopen(const char *so_name)
+{
+    struct snd_lib_entry *entry;
+    void *dl_hdl = NULL;
+
+    pthread_mutex_lock(&snd_cache_lock);
+
+    for (entry = snd_libs; entry; entry = entry->next) {
+        if (!strcmp(entry->so_name, so_name))
+            goto found;
+    }
+
+    entry = calloc(1, sizeof(*entry));
+    if (!entry)
+        goto out;
+
+    entry->so_name = strdup(so_name);
+    entry->dl_hdl = dlopen(so_name, RTLD_NOW);
+    if (!entry->so_name || !entry->dl_hdl) {
+        if (entry->dl_hdl)
+            dlclose(entry->dl_hdl);
+        free(entry->so_name);
+        free(entry);
+        goto out;
+    }
+
+    entry->next = snd_libs;
+    snd_libs = entry;
+
+found:
+    entry->refs++;
+    dl_hdl = entry->dl_hdl;
+out:
+    pthread_mutex_unlock(&snd_cache_lock);
+    return dl_hdl;
+}
+
+void snd_utils_dlclose(void *dl_hdl)
+{
+    struct snd_lib_entry *entry;
+
+    pthread_mutex_lock(&snd_cache_lock);
+    for (entry = snd_libs; entry; entry = entry->next) {
+        if (entry->dl_hdl == dl_hdl) {
+            entry->refs--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&snd_cache_lock);
+}
+
+/* Releases the unused cache entries when tinyalsa is unloaded */
+__attribute__((destructor))
+static void snd_utils_release_cache(void)
+{
+    struct snd_card_entry **card = &snd_cards, *card_entry;
+    struct snd_lib_entry **lib = &snd_libs, *lib_entry;
+    int in_use = 0;
+
+    pthread_mutex_lock(&snd_cache_lock);
+
+    while ((card_entry = *card)) {
+        if (card_entry->refs) {
+            in_use = 1;
+            card = &card_entry->next;
+            continue;
+        }
+        if (card_entry->card_node)
+            snd_parser_ops->close_card(card_entry->card_node);
+        *card = card_entry->next;
+        free(card_entry);
+    }
+
+    if (snd_parser_hdl && !in_use) {
+        dlclose(snd_parser_hdl);
+        snd_parser_hdl = NULL;
+    }
+
+    while ((lib_entry = *lib)) {
+        if (lib_entry->refs) {
+            lib = &lib_entry->next;
+            continue;
+        }
+        dlclose(lib_entry->dl_hdl);
+        free(lib_entry->so_name);
+        *lib = lib_entry->next;
+        free(lib_entry);
+    }
+
+    pthread_mutex_unlock(&snd_cache_lock);
+}
+
 int snd_utils_get_int(struct snd_node *node, const char *prop, int *val)
 {
     if (!node || !node->card_node || !node->dev_node)
@@ -62,12 +256,7 @@ void snd_utils_close_dev_node(struct snd_node *node)
     if (!node)
         return;
 
-    if (node->card_node)
-        node->ops->close_card(node->card_node);
-
-    if (node->dl_hdl)
-        dlclose(node->dl_hdl);
-
+    snd_utils_put_card(node->card_entry);
     free(node);
 }
 
@@ -83,38 +272,25 @@ enum snd_node_type snd_utils_get_node_type(struct snd_node *node)
     return val;
 }
 
-static int snd_utils_resolve_symbols(struct snd_node *node)
-{
-    void *dl = node->dl_hdl;
-    int err;
-    SND_DLSYM(dl, node->ops, "snd_card_ops", err);
-    return err;
-}
-
 static struct snd_node *snd_utils_open_dev_node(unsigned int card,
                                                 unsigned int device,
                                                 int dev_type)
 {
     struct snd_node *node;
-    int rc = 0;
 
     node = calloc(1, sizeof(*node));
     if (!node)
         return NULL;
 
-    node->dl_hdl = dlopen("libsndcardparser.so", RTLD_NOW);
-    if (!node->dl_hdl) {
-        goto err_dl_open;
-    }
-
-    rc = snd_utils_resolve_symbols(node);
-    if (rc < 0)
-        goto err_resolve_symbols;
+    node->card_entry = snd_utils_get_card(card);
+    if (!node->card_entry)
+        goto err_get_card;
 
-    node->card_node = node->ops->open_card(card);
+    node->card_node = node->card_entry->card_node;
     if (!node->card_node)
-        goto err_resolve_symbols;
+        goto err_get_node;
 
+    node->ops = snd_parser_ops;
     if (dev_type == NODE_PCM) {
       node->dev_node = node->ops->get_pcm(node->card_node, device);
     } else {
@@ -127,12 +303,9 @@ static struct snd_node *snd_utils_open_dev_node(unsigned int card,
     return node;
 
 err_get_node:
-    node->ops->close_card(node->card_node);
-
-err_resolve_symbols:
-    dlclose(node->dl_hdl);
+    snd_utils_put_card(node->card_entry);
 
-err_dl_open:
+err_get_card:
     free(node);
     return NULL;
 }
@@ -42,8 +42,8 @@ struct snd_node {
     void *card_node;
     /** Pointer to device definition, either PCM or MIXER device */
     void *dev_node;
-    /** Pointer to the sound card parser library */
-    void *dl_hdl;
+    /** The cached card definition this node holds a reference to */
+    struct snd_card_entry *card_entry;
     /** A pointer to the operations structure. */
     const struct snd_node_ops* ops;
 };
@@ -71,4 +71,8 @@ int snd_utils_get_int(struct snd_node *node, const char *prop, int *val);
 
 int snd_utils_get_str(struct snd_node *node, const char *prop, char **val);
 
+void *snd_utils_dlopen(const char *so_name);
+
+void snd_utils_dlclose(void *dl_hdl);
+
 #endif /* end of TINYALSA_SRC_SND_CARD_UTILS_H */
@@ -46,9 +46,20 @@ namespace testing {
 #define TEST_LOOPBACK_CAPTURE_DEVICE 1
 #endif
 
+/* a PCM of a filter plugin, the softvol device of the virtual card by default */
+#ifndef TEST_FILTER_CARD
+#define TEST_FILTER_CARD 100
+#endif
+
+#ifndef TEST_FILTER_DEVICE
+#define TEST_FILTER_DEVICE 4
+#endif
+
 static constexpr unsigned int kLoopbackCard = TEST_LOOPBACK_CARD;
 static constexpr unsigned int kLoopbackPlaybackDevice = TEST_LOOPBACK_PLAYBACK_DEVICE;
 static constexpr unsigned int kLoopbackCaptureDevice = TEST_LOOPBACK_CAPTURE_DEVICE;
+static constexpr unsigned int kFilterCard = TEST_FILTER_CARD;
+static constexpr unsigned int kFilterDevice = TEST_FILTER_DEVICE;
 
 static constexpr unsigned int kDefaultChannels = 2;
 static constexpr unsigned int kDefaultSamplingRate = 48000;
@@ -64,6 +75,7 @@ static constexpr pcm_config kDefaultConfig = {
     .stop_threshold = kDefaultPeriodSize * kDefaultPeriodCount,
     .silence_threshold = 0,
     .silence_size = 0,
+    .avail_min = 0,
 };
 
 } // namespace testing
@@ -105,6 +105,8 @@ TEST(MixerTest, NullParametersCheck) {
     EXPECT_EQ(mixer_ctl_get_range_max(nullptr), -EINVAL);
     EXPECT_EQ(mixer_read_event(nullptr, reinterpret_cast<mixer_ctl_event *>(1)), -EINVAL);
     EXPECT_EQ(mixer_read_event(reinterpret_cast<mixer *>(1), nullptr), -EINVAL);
+    EXPECT_EQ(mixer_read_events(nullptr, reinterpret_cast<mixer_ctl_event *>(1), 1), -EINVAL);
+    EXPECT_EQ(mixer_read_events(reinterpret_cast<mixer *>(1), nullptr, 1), -EINVAL);
     EXPECT_EQ(mixer_consume_event(nullptr), -EINVAL);
 }
 
@@ -349,6 +351,47 @@ TEST_P(MixerControlsTest, Event) {
     mixer_ctl_set_percent(const_cast<mixer_ctl *>(control), 0, percent);
 }
 
+TEST_P(MixerControlsTest, EventBatch) {
+    const mixer_ctl *control = nullptr;
+    for (unsigned int i = 0; i < number_of_controls; ++i) {
+        std::string_view name{mixer_ctl_get_name(controls[i])};
+
+        if (name.find("Volume") != std::string_view::npos) {
+            control = controls[i];
+        }
+    }
+
+    if (control == nullptr) {
+        GTEST_SKIP() << "No volume control was found in the controls list.";
+    }
+
+    constexpr unsigned int kChanges = 16;
+    ASSERT_EQ(mixer_subscribe_events(mixer_object, 1), 0);
+    int percent = mixer_ctl_get_percent(control, 0);
+    for (unsigned int i = 0; i < kChanges; ++i) {
+        mixer_ctl_set_percent(const_cast<mixer_ctl *>(control), 0,
+                i % 2 ? k0Percent : k100Percent);
+    }
+
+    // the driver may merge the changes of a control into fewer events
+    mixer_ctl_event events[kChanges * 2];
+    unsigned int count = 0;
+    while (mixer_wait_event(mixer_object, 0) == 1) {
+        int ret = mixer_read_events(mixer_object, events + count, kChanges * 2 - count);
+        ASSERT_GE(ret, 0);
+        for (int i = 0; i < ret; ++i) {
+            EXPECT_STREQ(reinterpret_cast<const char *>(events[count + i].data.element.id.name),
+                    mixer_ctl_get_name(control));
+        }
+        count += ret;
+    }
+    EXPECT_GT(count, 0u);
+    EXPECT_LE(count, kChanges);
+
+    ASSERT_EQ(mixer_subscribe_events(mixer_object, 0), 0);
+    mixer_ctl_set_percent(const_cast<mixer_ctl *>(control), 0, percent);
+}
+
 INSTANTIATE_TEST_SUITE_P(
     MixerTest,
     MixerTest,
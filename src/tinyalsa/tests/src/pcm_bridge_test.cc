@@ -0,0 +1,106 @@
+/* pcm_group_test.c
+**
+** Copyright 2026, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+#include "pcm_test_device.h"
+
+#include <cstdlib>
+
+#include <gtest/gtest.h>
+
+#include "tinyalsa/pcm.h"
+
+namespace tinyalsa {
+namespace testing {
+
+class PcmBridgeTest : public ::testing::Test {
+  protected:
+    PcmBridgeTest() = default;
+    virtual ~PcmBridgeTest() = default;
+
+    void SetUp() override {
+        // runs the capture of the virtual card from a faster clock
+        setenv("TINYALSA_VPCM_CAPTURE_PPM", "5000", 1);
+        pcm_in = pcm_open(kLoopbackCard, kLoopbackCaptureDevice, PCM_IN, &kConfig);
+        unsetenv("TINYALSA_VPCM_CAPTURE_PPM");
+        ASSERT_TRUE(pcm_is_ready(pcm_in));
+        pcm_out = pcm_open(kLoopbackCard, kLoopbackPlaybackDevice, PCM_OUT, &kConfig);
+        ASSERT_TRUE(pcm_is_ready(pcm_out));
+    }
+
+    void TearDown() override {
+        pcm_close(pcm_in);
+        pcm_close(pcm_out);
+    }
+
+    // periods of margin against the scheduling of the test
+    static constexpr pcm_config kConfig = {
+        .channels = kDefaultChannels,
+        .rate = kDefaultSamplingRate,
+        .period_size = 512,
+        .period_count = 8,
+        .format = PCM_FORMAT_S16_LE,
+        .start_threshold = 0,
+        .stop_threshold = 0,
+        .silence_threshold = 0,
+        .silence_size = 0,
+    };
+
+    pcm *pcm_in;
+    pcm *pcm_out;
+};
+
+TEST_F(PcmBridgeTest, OpenRejectsSameDirection) {
+    EXPECT_EQ(pcm_bridge_open(pcm_out, pcm_out, 0), nullptr);
+    EXPECT_EQ(pcm_bridge_open(pcm_out, pcm_in, 0), nullptr);
+}
+
+TEST_F(PcmBridgeTest, OpenRejectsTargetWithoutRoom) {
+    EXPECT_EQ(pcm_bridge_open(pcm_in, pcm_out, pcm_get_buffer_size(pcm_out)), nullptr);
+}
+
+TEST_F(PcmBridgeTest, HoldsTargetAcrossClocks) {
+    pcm_bridge *bridge = pcm_bridge_open(pcm_in, pcm_out, 0);
+    ASSERT_NE(bridge, nullptr) << pcm_get_error(pcm_out);
+
+    // four seconds
+    unsigned int transfers = kConfig.rate * 4 / kConfig.period_size;
+    for (unsigned int i = 0; i < transfers; i++) {
+        ASSERT_GT(pcm_bridge_transfer(bridge), 0) << pcm_get_error(pcm_out);
+    }
+
+    pcm_bridge_status status;
+    ASSERT_EQ(pcm_bridge_get_status(bridge, &status), 0);
+    EXPECT_EQ(status.xruns, 0u);
+    EXPECT_NEAR(status.fill, status.target, kConfig.period_size);
+    // the input is resampled by the drift that was measured, and a fill correction
+    EXPECT_NEAR((status.ratio - 1.0) * 1e6, status.drift_ppm, 2500.0);
+
+    pcm_bridge_close(bridge);
+}
+
+} // namespace testing
+} // namespace tinyalsa
@@ -0,0 +1,130 @@
+/* pcm_group_test.c
+**
+** Copyright 2026, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+#include "pcm_test_device.h"
+
+#include <cstring>
+#include <memory>
+
+#include <gtest/gtest.h>
+
+#include "tinyalsa/pcm.h"
+
+namespace tinyalsa {
+namespace testing {
+
+class PcmGroupTest : public ::testing::Test {
+  protected:
+    PcmGroupTest() = default;
+    virtual ~PcmGroupTest() = default;
+
+    void SetUp() override {
+        pcm_in = pcm_open(kLoopbackCard, kLoopbackCaptureDevice, PCM_IN, &kDefaultConfig);
+        ASSERT_TRUE(pcm_is_ready(pcm_in));
+        pcm_out = pcm_open(kLoopbackCard, kLoopbackPlaybackDevice, PCM_OUT, &kDefaultConfig);
+        ASSERT_TRUE(pcm_is_ready(pcm_out));
+        group = pcm_group_open();
+        ASSERT_NE(group, nullptr);
+    }
+
+    void TearDown() override {
+        pcm_group_close(group);
+        pcm_close(pcm_in);
+        pcm_close(pcm_out);
+    }
+
+    pcm *pcm_in;
+    pcm *pcm_out;
+    pcm_group *group;
+};
+
+TEST_F(PcmGroupTest, AddReturnsIndex) {
+    EXPECT_EQ(pcm_group_add(group, pcm_out), 0);
+    EXPECT_EQ(pcm_group_add(group, pcm_in), 1);
+}
+
+TEST_F(PcmGroupTest, AddRejectsBadPcm) {
+    pcm *bad = pcm_open(1000, 1000, PCM_OUT, &kDefaultConfig);
+    ASSERT_FALSE(pcm_is_ready(bad));
+    EXPECT_LT(pcm_group_add(group, bad), 0);
+    pcm_close(bad);
+}
+
+TEST_F(PcmGroupTest, WaitOnEmptyGroup) {
+    unsigned int ready = 0;
+    EXPECT_LT(pcm_group_wait(group, 0, &ready), 0);
+    EXPECT_EQ(ready, 0U);
+}
+
+TEST_F(PcmGroupTest, WaitTimesOut) {
+    ASSERT_EQ(pcm_group_add(group, pcm_in), 0);
+
+    // Nothing was captured before the capture PCM is started.
+    unsigned int ready = 0;
+    EXPECT_EQ(pcm_group_wait(group, 20, &ready), 0);
+    EXPECT_EQ(ready, 0U);
+}
+
+TEST_F(PcmGroupTest, ServiceAllStreams) {
+    ASSERT_EQ(pcm_group_add(group, pcm_out), 0);
+    ASSERT_EQ(pcm_group_add(group, pcm_in), 1);
+
+    size_t buffer_size = pcm_frames_to_bytes(pcm_out, kDefaultPeriodSize);
+    auto buffer = std::make_unique<char[]>(buffer_size);
+    std::memset(buffer.get(), 0, buffer_size);
+
+    // Fill the playback buffer so that the streams can start together.
+    for (unsigned int i = 0; i < kDefaultPeriodCount; i++) {
+        ASSERT_EQ(pcm_writei(pcm_out, buffer.get(), kDefaultPeriodSize), (int) kDefaultPeriodSize);
+    }
+    ASSERT_EQ(pcm_group_start(group), 0);
+
+    unsigned int writes = 0, reads = 0;
+    // About half a second of audio, serviced from a single thread.
+    for (unsigned int i = 0; i < 50; i++) {
+        unsigned int ready = 0;
+        int n = pcm_group_wait(group, 1000, &ready);
+        ASSERT_GT(n, 0);
+        ASSERT_NE(ready, 0U);
+        ASSERT_EQ(ready & ~3U, 0U);
+        if (ready & 1U) {
+            ASSERT_EQ(pcm_writei(pcm_out, buffer.get(), kDefaultPeriodSize), (int) kDefaultPeriodSize);
+            writes++;
+        }
+        if (ready & 2U) {
+            ASSERT_EQ(pcm_readi(pcm_in, buffer.get(), kDefaultPeriodSize), (int) kDefaultPeriodSize);
+            reads++;
+        }
+    }
+    EXPECT_GT(writes, 0U);
+    EXPECT_GT(reads, 0U);
+    EXPECT_EQ(pcm_group_stop(group), 0);
+}
+
+} // namespace testing
+} // namespace tinyalsa
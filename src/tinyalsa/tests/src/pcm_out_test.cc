@@ -28,8 +28,12 @@
 #include "pcm_test_device.h"
 
 #include <chrono>
+#include <cmath>
 #include <cstring>
 #include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -166,6 +170,159 @@ TEST_F(PcmOutTest, Writei) {
     ASSERT_NEAR(difference.count() * 1000, expected_elapsed_time_ms.count(), 100);
 }
 
+TEST_F(PcmOutTest, XrunPolicyPrefill) {
+    unsigned int buffer_frames = pcm_get_buffer_size(pcm_object);
+    ASSERT_EQ(pcm_set_xrun_policy(pcm_object, PCM_XRUN_PREFILL, buffer_frames + 1), -EINVAL);
+    ASSERT_EQ(pcm_set_xrun_policy(pcm_object, PCM_XRUN_PREFILL, buffer_frames), 0);
+
+    size_t buffer_size = pcm_frames_to_bytes(pcm_object, kDefaultConfig.period_size);
+    auto buffer = std::make_unique<char[]>(buffer_size);
+    unsigned int frames = pcm_bytes_to_frames(pcm_object, buffer_size);
+
+    ASSERT_EQ(pcm_writei(pcm_object, buffer.get(), frames), frames);
+    // let the buffer run dry
+    std::this_thread::sleep_for(std::chrono::milliseconds(
+            buffer_frames * 2 * 1000 / kDefaultConfig.rate + 50));
+
+    // the write recovers by queueing a buffer of silence ahead of the frames
+    ASSERT_EQ(pcm_writei(pcm_object, buffer.get(), frames), frames);
+    ASSERT_EQ(pcm_get_xruns(pcm_object), 1);
+
+    unsigned int avail;
+    timespec tstamp;
+    ASSERT_EQ(pcm_get_htimestamp(pcm_object, &avail, &tstamp), 0);
+    ASSERT_LT(avail, buffer_frames - frames);
+}
+
+// the policy changes the start threshold of a prepared, then running, plugin PCM
+TEST(PcmOutFilterTest, XrunPolicyRaiseThreshold) {
+    pcm *pcm_object = pcm_open(kFilterCard, kFilterDevice, PCM_OUT, &kDefaultConfig);
+    ASSERT_NE(pcm_object, nullptr);
+    if (!pcm_is_ready(pcm_object)) {
+        pcm_close(pcm_object);
+        GTEST_SKIP() << "no filter plugin PCM";
+    }
+
+    unsigned int buffer_frames = pcm_get_buffer_size(pcm_object);
+    ASSERT_EQ(pcm_set_xrun_policy(pcm_object, PCM_XRUN_RAISE_THRESHOLD, 0), 0);
+
+    size_t buffer_size = pcm_frames_to_bytes(pcm_object, kDefaultConfig.period_size);
+    auto buffer = std::make_unique<char[]>(buffer_size);
+    unsigned int frames = pcm_bytes_to_frames(pcm_object, buffer_size);
+
+    ASSERT_EQ(pcm_writei(pcm_object, buffer.get(), frames), frames);
+    // let the buffer run dry
+    std::this_thread::sleep_for(std::chrono::milliseconds(
+            buffer_frames * 2 * 1000 / kDefaultConfig.rate + 50));
+
+    // the write recovers, and the stream starts again only once the buffer is full
+    ASSERT_EQ(pcm_writei(pcm_object, buffer.get(), frames), frames);
+    ASSERT_EQ(pcm_get_xruns(pcm_object), 1);
+    ASSERT_EQ(pcm_get_config(pcm_object)->start_threshold, buffer_frames);
+
+    // after a second without xrun, the threshold is restored on the running stream
+    for (unsigned int written = 0; written < 4 * kDefaultConfig.rate &&
+            pcm_get_config(pcm_object)->start_threshold != kDefaultConfig.start_threshold;
+            written += frames)
+        ASSERT_EQ(pcm_writei(pcm_object, buffer.get(), frames), frames);
+    EXPECT_EQ(pcm_get_config(pcm_object)->start_threshold, kDefaultConfig.start_threshold);
+    EXPECT_EQ(pcm_state(pcm_object), PCM_STATE_RUNNING);
+
+    ASSERT_EQ(pcm_close(pcm_object), 0);
+}
+
+TEST_F(PcmOutTest, PeriodStamps) {
+    constexpr unsigned int kStamps = 4;
+    pcm_period_stamp stamps[kStamps + 1];
+    ASSERT_EQ(pcm_get_period_stamps(pcm_object, stamps, kStamps), -EINVAL);
+    ASSERT_EQ(pcm_set_period_stamps(pcm_object, kStamps), 0);
+
+    // half periods, so every other write completes one
+    size_t buffer_size = pcm_frames_to_bytes(pcm_object, kDefaultConfig.period_size / 2);
+    auto buffer = std::make_unique<char[]>(buffer_size);
+    unsigned int frames = pcm_bytes_to_frames(pcm_object, buffer_size);
+    for (unsigned int i = 0; i < (kStamps + 2) * 2; i++) {
+        ASSERT_EQ(pcm_writei(pcm_object, buffer.get(), frames), frames);
+    }
+
+    // the oldest records were replaced
+    ASSERT_EQ(pcm_get_period_stamps(pcm_object, stamps, kStamps + 1), kStamps);
+    for (unsigned int i = 0; i < kStamps; i++) {
+        EXPECT_EQ(stamps[i].frames, (i + 3) * kDefaultConfig.period_size);
+        EXPECT_EQ(stamps[i].appl_ptr, stamps[i].frames);
+        EXPECT_LE(stamps[i].hw_ptr, stamps[i].appl_ptr);
+        if (i > 0) {
+            EXPECT_GE(stamps[i].hw_ptr, stamps[i - 1].hw_ptr);
+        }
+    }
+    ASSERT_EQ(pcm_get_period_stamps(pcm_object, stamps, kStamps), 0);
+}
+
+TEST_F(PcmOutTest, Meter) {
+    pcm_meter_level levels[kDefaultChannels + 1];
+    unsigned long long frames = 1;
+    ASSERT_EQ(pcm_get_meter(pcm_object, levels, kDefaultChannels, &frames), -EINVAL);
+    ASSERT_EQ(pcm_set_meter(pcm_object, kDefaultConfig.period_size), 0);
+    ASSERT_EQ(pcm_get_meter(pcm_object, levels, kDefaultChannels + 1, &frames),
+            static_cast<int>(kDefaultChannels));
+    EXPECT_EQ(frames, 0u);
+    EXPECT_EQ(levels[0].peak, 0.0f);
+
+    // a half scale square wave on the left, a few clipped samples on the right
+    constexpr unsigned int kClips = 10;
+    std::vector<int16_t> buffer(kDefaultConfig.period_size * kDefaultChannels);
+    for (unsigned int i = 0; i < kDefaultConfig.period_size; i++) {
+        buffer[i * kDefaultChannels] = (i & 1) ? -16384 : 16384;
+        buffer[i * kDefaultChannels + 1] = i < kClips ? INT16_MAX : 0;
+    }
+
+    // the window completes with the second write
+    unsigned int half = kDefaultConfig.period_size / 2;
+    ASSERT_EQ(pcm_writei(pcm_object, buffer.data(), half), static_cast<int>(half));
+    ASSERT_EQ(pcm_get_meter(pcm_object, levels, kDefaultChannels, &frames),
+            static_cast<int>(kDefaultChannels));
+    EXPECT_EQ(frames, 0u);
+    ASSERT_EQ(pcm_writei(pcm_object, &buffer[half * kDefaultChannels], half),
+            static_cast<int>(half));
+    ASSERT_EQ(pcm_get_meter(pcm_object, levels, kDefaultChannels, &frames),
+            static_cast<int>(kDefaultChannels));
+    EXPECT_EQ(frames, kDefaultConfig.period_size);
+
+    EXPECT_FLOAT_EQ(levels[0].peak, 0.5f);
+    EXPECT_FLOAT_EQ(levels[0].rms, 0.5f);
+    EXPECT_EQ(levels[0].clips, 0u);
+    EXPECT_FLOAT_EQ(levels[1].peak, 32767.0f / 32768.0f);
+    EXPECT_FLOAT_EQ(levels[1].rms, 32767.0f / 32768.0f *
+            std::sqrt(static_cast<float>(kClips) / kDefaultConfig.period_size));
+    EXPECT_EQ(levels[1].clips, kClips);
+
+    ASSERT_EQ(pcm_set_meter(pcm_object, 0), 0);
+    ASSERT_EQ(pcm_get_meter(pcm_object, levels, kDefaultChannels, &frames), -EINVAL);
+}
+
+TEST_F(PcmOutTest, Writen) {
+    constexpr uint32_t write_count = 20;
+
+    size_t plane_size = pcm_frames_to_bytes(pcm_object, kDefaultConfig.period_size) /
+            kDefaultConfig.channels;
+    std::vector<std::unique_ptr<char[]>> planes;
+    std::vector<void *> data;
+    for (uint32_t channel = 0; channel < kDefaultConfig.channels; ++channel) {
+        planes.push_back(std::make_unique<char[]>(plane_size));
+        for (uint32_t i = 0; i < plane_size; ++i) {
+            planes[channel][i] = static_cast<char>(i + channel);
+        }
+        data.push_back(planes[channel].get());
+    }
+
+    ASSERT_EQ(pcm_readn(pcm_object, data.data(), kDefaultConfig.period_size), -EINVAL);
+
+    for (uint32_t i = 0; i < write_count; ++i) {
+        ASSERT_EQ(pcm_writen(pcm_object, data.data(), kDefaultConfig.period_size),
+                static_cast<int>(kDefaultConfig.period_size));
+    }
+}
+
 class PcmOutMmapTest : public PcmOutTest {
   protected:
     PcmOutMmapTest() = default;
@@ -0,0 +1,315 @@
+/* pcm_rt_test.cc
+**
+** Copyright 2020, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+#include "pcm_test_device.h"
+
+#include <dlfcn.h>
+#include <pthread.h>
+
+#include <chrono>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "tinyalsa/pcm.h"
+
+// The functions below interpose the allocator, stdio and the formatting
+// functions of libc for the whole test binary. They forward to libc, and
+// count the calls made by a thread while it is armed.
+
+namespace {
+
+thread_local bool trap_armed;
+thread_local unsigned int trap_calls;
+
+// dlsym may allocate before the allocator is resolved
+alignas(std::max_align_t) char bootstrap_heap[4096];
+size_t bootstrap_used;
+
+bool from_bootstrap(const void *ptr) {
+    return static_cast<const char *>(ptr) >= bootstrap_heap &&
+            static_cast<const char *>(ptr) < bootstrap_heap + sizeof(bootstrap_heap);
+}
+
+void *bootstrap_alloc(size_t size) {
+    size = (size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+    if (bootstrap_used + size > sizeof(bootstrap_heap))
+        return nullptr;
+    void *ptr = bootstrap_heap + bootstrap_used;
+    bootstrap_used += size;
+    return ptr;
+}
+
+void trap() {
+    if (trap_armed)
+        trap_calls++;
+}
+
+void *(*next_malloc)(size_t);
+void *(*next_calloc)(size_t, size_t);
+void *(*next_realloc)(void *, size_t);
+void (*next_free)(void *);
+int (*next_vfprintf)(FILE *, const char *, va_list);
+int (*next_vsnprintf)(char *, size_t, const char *, va_list);
+int (*next_fputs)(const char *, FILE *);
+int (*next_puts)(const char *);
+size_t (*next_fwrite)(const void *, size_t, size_t, FILE *);
+char *(*next_strerror)(int);
+
+pthread_once_t resolve_once = PTHREAD_ONCE_INIT;
+// set on the thread that resolves the functions, while it calls dlsym
+thread_local bool resolving;
+
+template <typename F>
+void lookup(F &fn, const char *name) {
+    fn = reinterpret_cast<F>(dlsym(RTLD_NEXT, name));
+}
+
+void resolve_all() {
+    resolving = true;
+    lookup(next_malloc, "malloc");
+    lookup(next_calloc, "calloc");
+    lookup(next_realloc, "realloc");
+    lookup(next_free, "free");
+    lookup(next_vfprintf, "vfprintf");
+    lookup(next_vsnprintf, "vsnprintf");
+    lookup(next_fputs, "fputs");
+    lookup(next_puts, "puts");
+    lookup(next_fwrite, "fwrite");
+    lookup(next_strerror, "strerror");
+    resolving = false;
+}
+
+// other threads wait here until the functions are resolved
+void resolve() {
+    pthread_once(&resolve_once, resolve_all);
+}
+
+} // namespace
+
+extern "C" {
+
+void *malloc(size_t size) {
+    trap();
+    if (resolving)
+        return bootstrap_alloc(size);
+    resolve();
+    return next_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    trap();
+    if (resolving)
+        return bootstrap_alloc(count * size); // static, so already zeroed
+    resolve();
+    return next_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    trap();
+    if (resolving)
+        return nullptr;
+    resolve();
+    if (ptr != nullptr && from_bootstrap(ptr)) {
+        // the size is not known, copy up to the end of the bootstrap heap
+        size_t left = bootstrap_heap + sizeof(bootstrap_heap) - static_cast<char *>(ptr);
+        void *moved = next_malloc(size);
+        if (moved != nullptr)
+            memcpy(moved, ptr, size < left ? size : left);
+        return moved;
+    }
+    return next_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    trap();
+    if (ptr == nullptr || from_bootstrap(ptr) || resolving)
+        return;
+    resolve();
+    next_free(ptr);
+}
+
+int vfprintf(FILE *stream, const char *format, va_list ap) {
+    trap();
+    resolve();
+    return next_vfprintf(stream, format, ap);
+}
+
+int fprintf(FILE *stream, const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int ret = vfprintf(stream, format, ap);
+    va_end(ap);
+    return ret;
+}
+
+int printf(const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int ret = vfprintf(stdout, format, ap);
+    va_end(ap);
+    return ret;
+}
+
+int vsnprintf(char *str, size_t size, const char *format, va_list ap) {
+    trap();
+    resolve();
+    return next_vsnprintf(str, size, format, ap);
+}
+
+int snprintf(char *str, size_t size, const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int ret = vsnprintf(str, size, format, ap);
+    va_end(ap);
+    return ret;
+}
+
+int fputs(const char *s, FILE *stream) {
+    trap();
+    resolve();
+    return next_fputs(s, stream);
+}
+
+int puts(const char *s) {
+    trap();
+    resolve();
+    return next_puts(s);
+}
+
+size_t fwrite(const void *ptr, size_t size, size_t count, FILE *stream) {
+    trap();
+    resolve();
+    return next_fwrite(ptr, size, count, stream);
+}
+
+char *strerror(int errnum) noexcept {
+    trap();
+    resolve();
+    return next_strerror(errnum);
+}
+
+} // extern "C"
+
+namespace tinyalsa {
+namespace testing {
+
+class PcmRtTest : public ::testing::TestWithParam<unsigned int> {
+  protected:
+    PcmRtTest() : pcm_object(nullptr) {}
+    virtual ~PcmRtTest() = default;
+
+    virtual void SetUp() override {
+        pcm_object = pcm_open(kLoopbackCard, kLoopbackPlaybackDevice,
+                PCM_OUT | PCM_RT | GetParam(), &kDefaultConfig);
+        ASSERT_NE(pcm_object, nullptr);
+        ASSERT_TRUE(pcm_is_ready(pcm_object)) << pcm_get_error(pcm_object);
+
+        buffer_size = pcm_frames_to_bytes(pcm_object, kDefaultConfig.period_size);
+        buffer = std::make_unique<char[]>(buffer_size);
+        frames = pcm_bytes_to_frames(pcm_object, buffer_size);
+        buffer_frames = pcm_get_buffer_size(pcm_object);
+    }
+
+    virtual void TearDown() override {
+        ASSERT_EQ(pcm_close(pcm_object), 0);
+    }
+
+    void Arm() {
+        trap_calls = 0;
+        trap_armed = true;
+    }
+
+    unsigned int Disarm() {
+        trap_armed = false;
+        return trap_calls;
+    }
+
+    // pcm_writei() drives both the mmap and the rw PCMs
+    int Write() {
+        return pcm_writei(pcm_object, buffer.get(), frames);
+    }
+
+    void LetRunDry() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(
+                buffer_frames * 2 * 1000 / kDefaultConfig.rate + 50));
+    }
+
+    pcm *pcm_object;
+    size_t buffer_size;
+    std::unique_ptr<char[]> buffer;
+    unsigned int frames;
+    unsigned int buffer_frames;
+};
+
+TEST_P(PcmRtTest, WriteDoesNotAllocateOrFormat) {
+    ASSERT_EQ(pcm_set_xrun_policy(pcm_object, PCM_XRUN_PREFILL, 0), 0);
+
+    Arm();
+    for (unsigned int i = 0; i < kDefaultConfig.period_count; i++)
+        ASSERT_GE(Write(), 0);
+    LetRunDry();
+    // recovered by queueing a buffer of silence
+    int ret = Write();
+    unsigned int calls = Disarm();
+
+    ASSERT_GE(ret, 0) << pcm_get_error(pcm_object);
+    EXPECT_EQ(calls, 0u);
+    // the mmap transfer does not see the xrun of the loopback plugin
+    if (!(GetParam() & PCM_MMAP)) {
+        EXPECT_EQ(pcm_get_xruns(pcm_object), 1);
+    }
+}
+
+TEST_P(PcmRtTest, ErrorIsFormattedLazily) {
+    ASSERT_EQ(pcm_get_error_code(pcm_object), 0);
+
+    unsigned int hw_ptr;
+    timespec tstamp;
+    Arm();
+    int ret = pcm_mmap_get_hw_ptr(pcm_object, &hw_ptr, &tstamp);
+    unsigned int calls = Disarm();
+
+    // the stream is not running yet
+    ASSERT_LT(ret, 0);
+    EXPECT_EQ(calls, 0u);
+    EXPECT_EQ(pcm_get_error_code(pcm_object), ENOSYS);
+    EXPECT_EQ(std::string(pcm_get_error(pcm_object)),
+            std::string("invalid stream state ?: ") + std::strerror(ENOSYS));
+}
+
+INSTANTIATE_TEST_SUITE_P(Access, PcmRtTest, ::testing::Values(0u, PCM_MMAP));
+
+} // namespace testing
+} // namespace tinyalsa
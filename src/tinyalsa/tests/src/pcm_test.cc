@@ -159,5 +159,24 @@ TEST(PcmTest, OpenWithoutBlocking) {
     }
 }
 
+TEST(PcmTest, OpenWithDeepBuffer) {
+    pcm *pcm_object = pcm_open(kLoopbackCard, kLoopbackPlaybackDevice,
+            PCM_OUT | PCM_DEEP_BUFFER, &kDefaultConfig);
+    ASSERT_TRUE(pcm_is_ready(pcm_object));
+
+    const pcm_config *config = pcm_get_config(pcm_object);
+    ASSERT_NE(config, nullptr);
+    unsigned int buffer_size = config->period_size * config->period_count;
+    EXPECT_GE(buffer_size, kDefaultPeriodSize * kDefaultPeriodCount);
+    EXPECT_EQ(pcm_get_buffer_size(pcm_object), buffer_size);
+    if (config->period_count > 1) {
+        EXPECT_EQ(config->avail_min, buffer_size - config->period_size);
+    }
+    EXPECT_EQ(config->start_threshold, buffer_size);
+    EXPECT_EQ(config->stop_threshold, buffer_size);
+
+    ASSERT_EQ(pcm_close(pcm_object), 0);
+}
+
 } // namespace testing
 } // namespace tinyalsa
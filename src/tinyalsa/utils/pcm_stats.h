@@ -0,0 +1,80 @@
+/* pcm_stats.h
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+/* Prints the transfer statistics of a PCM, see pcm_get_stats(), to stderr.
+ * Shared by the utilities that play and capture. */
+
+#ifndef TINYALSA_UTILS_PCM_STATS_H
+#define TINYALSA_UTILS_PCM_STATS_H
+
+#include <tinyalsa/pcm.h>
+#include <stdio.h>
+#include <time.h>
+
+static void print_stats(struct pcm *pcm)
+{
+    struct pcm_stats stats;
+    unsigned int i, n;
+
+    if (pcm_get_stats(pcm, &stats) < 0)
+        return;
+
+    fprintf(stderr, "PCM stats: %llu transfers, %llu frames, %.2f ioctls per transfer\n",
+            stats.transfers, stats.frames,
+            stats.transfers ? (double)stats.ioctls / stats.transfers : 0.0);
+    fprintf(stderr, "  %u xruns, %u suspends, %.1f ms blocked, %.1f ms copying\n",
+            stats.xruns, stats.suspends, stats.blocked_ns / 1e6, stats.copy_ns / 1e6);
+    if (stats.xruns + stats.suspends)
+        fprintf(stderr, "  %u consecutive xruns, %.2f ms mean and %.2f ms max recovery\n",
+                stats.consecutive_xruns, stats.recovery_ns / 1e6 / (stats.xruns + stats.suspends),
+                stats.recovery_max_ns / 1e6);
+
+    n = stats.xruns < PCM_STATS_EVENTS ? stats.xruns : PCM_STATS_EVENTS;
+    for (i = stats.xruns - n; i < stats.xruns; i++) {
+        const struct timespec *ts = &stats.xrun_tstamp[i % PCM_STATS_EVENTS];
+        fprintf(stderr, "  xrun %u at %lld.%06ld\n", i + 1, (long long)ts->tv_sec,
+                ts->tv_nsec / 1000);
+    }
+    n = stats.suspends < PCM_STATS_EVENTS ? stats.suspends : PCM_STATS_EVENTS;
+    for (i = stats.suspends - n; i < stats.suspends; i++) {
+        const struct timespec *ts = &stats.suspend_tstamp[i % PCM_STATS_EVENTS];
+        fprintf(stderr, "  suspend %u at %lld.%06ld\n", i + 1, (long long)ts->tv_sec,
+                ts->tv_nsec / 1000);
+    }
+
+    if (stats.wakeups) {
+        fprintf(stderr, "  avail at %u wakeups (eighths of buffer):", stats.wakeups);
+        for (i = 0; i < PCM_STATS_AVAIL_BUCKETS; i++)
+            fprintf(stderr, " %u", stats.avail_histogram[i]);
+        fprintf(stderr, "\n");
+        if (stats.active_ns)
+            fprintf(stderr, "  %.2f wakeups per second\n", stats.wakeups * 1e9 / stats.active_ns);
+    }
+}
+
+#endif /* TINYALSA_UTILS_PCM_STATS_H */
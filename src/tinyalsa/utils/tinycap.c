@@ -35,9 +35,12 @@
 #include <signal.h>
 #include <string.h>
 #include <limits.h>
+#include <pthread.h>
+#include <time.h>
 
 #define OPTPARSE_IMPLEMENTATION
 #include "optparse.h"
+#include "pcm_stats.h"
 
 #define ID_RIFF 0x46464952
 #define ID_WAVE 0x45564157
@@ -46,6 +49,16 @@
 
 #define FORMAT_PCM 1
 
+/* FLAC encoding: fixed linear prediction and Rice coded residuals.
+ * Frames are encoded in fixed size blocks on a separate thread so the
+ * capture loop only has to copy samples. */
+#define FLAC_BLOCK_SIZE 4096
+#define FLAC_MAX_CHANNELS 8
+#define FLAC_MAX_FIXED_ORDER 4
+#define FLAC_MAX_PARTITION_ORDER 8
+#define FLAC_QUEUE_DEPTH 16
+#define FLAC_STREAMINFO_SIZE 34
+
 struct wav_header {
     uint32_t riff_id;
     uint32_t riff_sz;
@@ -62,14 +75,65 @@ struct wav_header {
     uint32_t data_sz;
 };
 
+struct flac_block {
+    unsigned char *data;
+    unsigned int frames;
+};
+
+struct flac_bitwriter {
+    unsigned char *buf;
+    size_t pos;
+    uint64_t acc;
+    unsigned int bits;
+};
+
+struct flac_encoder {
+    FILE *file;
+    bool seekable;
+    unsigned int channels;
+    unsigned int rate;
+    /* bits per sample stored in the stream (16 or 24) */
+    unsigned int bps;
+    /* bytes per sample in the captured data (2 or 4) */
+    unsigned int sample_bytes;
+
+    uint64_t total_frames;
+    uint32_t frame_number;
+    uint32_t min_frame_bytes;
+    uint32_t max_frame_bytes;
+    uint64_t bytes_written;
+    bool write_error;
+
+    /* encoder thread scratch buffers */
+    int32_t *samples[FLAC_MAX_CHANNELS + 2];
+    int32_t *residual;
+    unsigned char *frame_buf;
+    double encode_seconds;
+
+    /* blocks handed over from the capture loop */
+    struct flac_block blocks[FLAC_QUEUE_DEPTH];
+    unsigned int head;
+    unsigned int count;
+    bool finished;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+};
+
 int capturing = 1;
 int prinfo = 1;
 
-unsigned int capture_sample(FILE *file, unsigned int card, unsigned int device,
+unsigned int capture_sample(FILE *file, struct flac_encoder *enc,
+                            unsigned int card, unsigned int device,
                             bool use_mmap, unsigned int channels, unsigned int rate,
                             enum pcm_format format, unsigned int period_size,
                             unsigned int period_count, unsigned int capture_time);
 
+struct flac_encoder *flac_encoder_open(FILE *file, unsigned int channels,
+                                       unsigned int rate, enum pcm_format format);
+int flac_encoder_write(struct flac_encoder *enc, const void *data, unsigned int frames);
+int flac_encoder_close(struct flac_encoder *enc);
+
 void sigint_handler(int sig)
 {
     if (sig == SIGINT){
@@ -91,14 +155,17 @@ int main(int argc, char **argv)
     unsigned int period_count = 4;
     unsigned int capture_time = UINT_MAX;
     bool use_mmap = false;
+    bool use_flac = false;
     enum pcm_format format;
     int no_header = 0, c;
     struct optparse opts;
+    struct flac_encoder *enc = NULL;
 
     if (argc < 2) {
         fprintf(stderr, "Usage: %s {file.wav | --} [-D card] [-d device] [-M] [-c channels] "
-                "[-r rate] [-b bits] [-p period_size] [-n n_periods] [-t time_in_seconds]\n\n"
-                "Use -- for filename to send raw PCM to stdout\n", argv[0]);
+                "[-r rate] [-b bits] [-p period_size] [-n n_periods] [-t time_in_seconds] [-F]\n\n"
+                "Use -- for filename to send raw PCM to stdout\n"
+                "Use -F to encode to FLAC instead of wav/raw PCM\n", argv[0]);
         return 1;
     }
 
@@ -116,7 +183,7 @@ int main(int argc, char **argv)
 
     /* parse command line arguments */
     optparse_init(&opts, argv + 1);
-    while ((c = optparse(&opts, "D:d:c:r:b:p:n:t:M")) != -1) {
+    while ((c = optparse(&opts, "D:d:c:r:b:p:n:t:MF")) != -1) {
         switch (c) {
         case 'd':
             device = atoi(opts.optarg);
@@ -145,6 +212,9 @@ int main(int argc, char **argv)
         case 'M':
             use_mmap = true;
             break;
+        case 'F':
+            use_flac = true;
+            break;
         case '?':
             fprintf(stderr, "%s\n", opts.errmsg);
             return EXIT_FAILURE;
@@ -181,6 +251,22 @@ int main(int argc, char **argv)
     header.block_align = channels * (header.bits_per_sample / 8);
     header.data_id = ID_DATA;
 
+    if (use_flac) {
+        if (format == PCM_FORMAT_S32_LE || channels > FLAC_MAX_CHANNELS) {
+            fprintf(stderr, "FLAC encoding supports up to 24 bits and %d channels.\n",
+                    FLAC_MAX_CHANNELS);
+            fclose(file);
+            return 1;
+        }
+        enc = flac_encoder_open(file, channels, rate, format);
+        if (!enc) {
+            fprintf(stderr, "Unable to start FLAC encoder\n");
+            fclose(file);
+            return 1;
+        }
+        no_header = 1;
+    }
+
     /* leave enough room for header */
     if (!no_header) {
         fseek(file, sizeof(struct wav_header), SEEK_SET);
@@ -188,13 +274,16 @@ int main(int argc, char **argv)
 
     /* install signal handler and begin capturing */
     signal(SIGINT, sigint_handler);
-    frames = capture_sample(file, card, device, use_mmap,
+    frames = capture_sample(file, enc, card, device, use_mmap,
                             header.num_channels, header.sample_rate,
                             format, period_size, period_count, capture_time);
     if (prinfo) {
         printf("Captured %u frames\n", frames);
     }
 
+    if (enc && flac_encoder_close(enc) < 0)
+        fprintf(stderr, "Error writing FLAC stream\n");
+
     /* write header now all information is known */
     if (!no_header) {
         header.data_sz = frames * header.block_align;
@@ -208,7 +297,8 @@ int main(int argc, char **argv)
     return 0;
 }
 
-unsigned int capture_sample(FILE *file, unsigned int card, unsigned int device,
+unsigned int capture_sample(FILE *file, struct flac_encoder *enc,
+                            unsigned int card, unsigned int device,
                             bool use_mmap, unsigned int channels, unsigned int rate,
                             enum pcm_format format, unsigned int period_size,
                             unsigned int period_count, unsigned int capture_time)
@@ -232,7 +322,7 @@ unsigned int capture_sample(FILE *file, unsigned int card, unsigned int device,
     config.stop_threshold = 0;
     config.silence_threshold = 0;
 
-    pcm_open_flags = PCM_IN;
+    pcm_open_flags = PCM_IN | PCM_STATS;
     if (use_mmap)
         pcm_open_flags |= PCM_MMAP;
 
@@ -270,7 +360,12 @@ unsigned int capture_sample(FILE *file, unsigned int card, unsigned int device,
         if ((total_frames_read / rate) >= capture_time) {
             capturing = 0;
         }
-        if (fwrite(buffer, bytes_per_frame, frames_read, file) != frames_read) {
+        if (enc) {
+            if (flac_encoder_write(enc, buffer, frames_read) < 0) {
+                fprintf(stderr,"Error encoding samples\n");
+                break;
+            }
+        } else if (fwrite(buffer, bytes_per_frame, frames_read, file) != frames_read) {
             fprintf(stderr,"Error writing samples - %d (%s)\n", errno,
                     strerror(errno));
             break;
@@ -278,7 +373,649 @@ unsigned int capture_sample(FILE *file, unsigned int card, unsigned int device,
     }
 
     free(buffer);
+    print_stats(pcm);
     pcm_close(pcm);
     return total_frames_read;
 }
 
+
+static uint8_t flac_crc8_table[256];
+static uint16_t flac_crc16_table[256];
+
+static void flac_crc_init(void)
+{
+    unsigned int i, j;
+
+    for (i = 0; i < 256; i++) {
+        uint8_t crc8 = i;
+        uint16_t crc16 = i << 8;
+        for (j = 0; j < 8; j++) {
+            crc8 = (crc8 & 0x80) ? (crc8 << 1) ^ 0x07 : crc8 << 1;
+            crc16 = (crc16 & 0x8000) ? (crc16 << 1) ^ 0x8005 : crc16 << 1;
+        }
+        flac_crc8_table[i] = crc8;
+        flac_crc16_table[i] = crc16;
+    }
+}
+
+static uint8_t flac_crc8(const unsigned char *buf, size_t len)
+{
+    uint8_t crc = 0;
+
+    while (len--)
+        crc = flac_crc8_table[crc ^ *buf++];
+    return crc;
+}
+
+static uint16_t flac_crc16(const unsigned char *buf, size_t len)
+{
+    uint16_t crc = 0;
+
+    while (len--)
+        crc = (crc << 8) ^ flac_crc16_table[(crc >> 8) ^ *buf++];
+    return crc;
+}
+
+static void bw_put(struct flac_bitwriter *bw, uint32_t value, unsigned int bits)
+{
+    if (bits == 0)
+        return;
+    bw->acc = (bw->acc << bits) | (value & (0xffffffffu >> (32 - bits)));
+    bw->bits += bits;
+    while (bw->bits >= 8) {
+        bw->bits -= 8;
+        bw->buf[bw->pos++] = (unsigned char)(bw->acc >> bw->bits);
+    }
+}
+
+static void bw_put_unary(struct flac_bitwriter *bw, uint32_t zeros)
+{
+    while (zeros >= 31) {
+        bw_put(bw, 0, 31);
+        zeros -= 31;
+    }
+    bw_put(bw, 1, zeros + 1);
+}
+
+static void bw_align(struct flac_bitwriter *bw)
+{
+    if (bw->bits)
+        bw_put(bw, 0, 8 - bw->bits);
+}
+
+static void bw_put_utf8(struct flac_bitwriter *bw, uint32_t value)
+{
+    unsigned int bytes, i;
+
+    if (value < 0x80) {
+        bw_put(bw, value, 8);
+        return;
+    }
+    if (value < 0x800)
+        bytes = 2;
+    else if (value < 0x10000)
+        bytes = 3;
+    else if (value < 0x200000)
+        bytes = 4;
+    else if (value < 0x4000000)
+        bytes = 5;
+    else
+        bytes = 6;
+
+    bw_put(bw, (0xff00 >> bytes) | (value >> (6 * (bytes - 1))), 8);
+    for (i = bytes - 1; i > 0; i--)
+        bw_put(bw, 0x80 | ((value >> (6 * (i - 1))) & 0x3f), 8);
+}
+
+static uint32_t zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static void flac_fixed_residual(const int32_t *x, unsigned int n,
+                                unsigned int order, int32_t *res)
+{
+    unsigned int i;
+
+    switch (order) {
+    case 0:
+        for (i = 0; i < n; i++)
+            res[i] = x[i];
+        break;
+    case 1:
+        for (i = 1; i < n; i++)
+            res[i] = x[i] - x[i-1];
+        break;
+    case 2:
+        for (i = 2; i < n; i++)
+            res[i] = x[i] - 2 * x[i-1] + x[i-2];
+        break;
+    case 3:
+        for (i = 3; i < n; i++)
+            res[i] = x[i] - 3 * (x[i-1] - x[i-2]) - x[i-3];
+        break;
+    default:
+        for (i = 4; i < n; i++)
+            res[i] = x[i] - 4 * (x[i-1] + x[i-3]) + 6 * x[i-2] + x[i-4];
+        break;
+    }
+}
+
+/* Picks the fixed predictor order with the smallest total residual
+ * magnitude, and returns an estimate of the bits needed to code it. */
+static unsigned int flac_fixed_best_order(const int32_t *x, unsigned int n,
+                                          uint64_t *est_bits)
+{
+    uint64_t err[FLAC_MAX_FIXED_ORDER + 1] = { 0 };
+    unsigned int i, order, best = 0;
+    int64_t e0, e1, e2, e3, e4;
+    int64_t p0, p1, p2, p3;
+    uint64_t mean;
+    unsigned int k = 0;
+
+    if (n <= FLAC_MAX_FIXED_ORDER) {
+        *est_bits = (uint64_t)n * 32;
+        return 0;
+    }
+
+    p0 = x[3];
+    p1 = x[3] - x[2];
+    p2 = p1 - (x[2] - x[1]);
+    p3 = p2 - (x[2] - x[1] - (x[1] - x[0]));
+    for (i = FLAC_MAX_FIXED_ORDER; i < n; i++) {
+        e0 = x[i];
+        e1 = e0 - p0;
+        e2 = e1 - p1;
+        e3 = e2 - p2;
+        e4 = e3 - p3;
+        err[0] += e0 < 0 ? -e0 : e0;
+        err[1] += e1 < 0 ? -e1 : e1;
+        err[2] += e2 < 0 ? -e2 : e2;
+        err[3] += e3 < 0 ? -e3 : e3;
+        err[4] += e4 < 0 ? -e4 : e4;
+        p0 = e0;
+        p1 = e1;
+        p2 = e2;
+        p3 = e3;
+    }
+
+    for (order = 1; order <= FLAC_MAX_FIXED_ORDER; order++) {
+        if (err[order] < err[best])
+            best = order;
+    }
+
+    mean = 2 * err[best] / (n - FLAC_MAX_FIXED_ORDER);
+    while (k < 30 && (mean >> k) > 1)
+        k++;
+    *est_bits = (uint64_t)n * (k + 1) + ((2 * err[best]) >> k);
+    return best;
+}
+
+static unsigned int flac_rice_param(uint64_t sum, unsigned int count, uint64_t *bits)
+{
+    unsigned int k = 0;
+    uint64_t best_bits, b;
+
+    best_bits = count + sum;
+    while (k < 30) {
+        b = (uint64_t)count * (k + 2) + (sum >> (k + 1));
+        if (b >= best_bits)
+            break;
+        best_bits = b;
+        k++;
+    }
+    *bits = best_bits;
+    return k;
+}
+
+/* Chooses the Rice partition order and parameters for the residual.
+ * The estimate is an upper bound on the bits actually written. */
+static uint64_t flac_rice_partition(const int32_t *res, unsigned int n,
+                                    unsigned int order, unsigned int *best_porder,
+                                    unsigned int *params)
+{
+    uint64_t sums[1 << FLAC_MAX_PARTITION_ORDER];
+    unsigned int tmp_params[1 << FLAC_MAX_PARTITION_ORDER];
+    unsigned int max_porder = 0, porder, p, i, parts, size, start, end;
+    uint64_t best = UINT64_MAX;
+
+    while (max_porder < FLAC_MAX_PARTITION_ORDER &&
+           (n % (2u << max_porder)) == 0 && (n >> (max_porder + 1)) > order)
+        max_porder++;
+
+    parts = 1 << max_porder;
+    size = n >> max_porder;
+    for (p = 0; p < parts; p++) {
+        start = p == 0 ? order : p * size;
+        end = (p + 1) * size;
+        sums[p] = 0;
+        for (i = start; i < end; i++)
+            sums[p] += zigzag(res[i]);
+    }
+
+    for (porder = max_porder + 1; porder-- > 0;) {
+        uint64_t total = 0, bits;
+        unsigned int wide = 0;
+
+        parts = 1 << porder;
+        size = n >> porder;
+        for (p = 0; p < parts; p++) {
+            unsigned int count = p == 0 ? size - order : size;
+            tmp_params[p] = flac_rice_param(sums[p], count, &bits);
+            if (tmp_params[p] > 14)
+                wide = 1;
+            total += bits;
+        }
+        total += (uint64_t)parts * (wide ? 5 : 4);
+        if (total < best) {
+            best = total;
+            *best_porder = porder;
+            memcpy(params, tmp_params, parts * sizeof(*params));
+        }
+
+        /* merge neighbouring partitions for the next lower order */
+        for (p = 0; p < parts / 2; p++)
+            sums[p] = sums[2 * p] + sums[2 * p + 1];
+    }
+
+    return best + 6;
+}
+
+static void flac_put_residual(struct flac_bitwriter *bw, const int32_t *res,
+                              unsigned int n, unsigned int order,
+                              unsigned int porder, const unsigned int *params)
+{
+    unsigned int parts = 1 << porder, size = n >> porder;
+    unsigned int p, i, wide = 0;
+
+    for (p = 0; p < parts; p++) {
+        if (params[p] > 14)
+            wide = 1;
+    }
+
+    bw_put(bw, wide, 2);
+    bw_put(bw, porder, 4);
+    for (p = 0; p < parts; p++) {
+        unsigned int k = params[p];
+        unsigned int start = p == 0 ? order : p * size;
+        unsigned int end = (p + 1) * size;
+
+        bw_put(bw, k, wide ? 5 : 4);
+        for (i = start; i < end; i++) {
+            uint32_t u = zigzag(res[i]);
+            bw_put_unary(bw, u >> k);
+            bw_put(bw, u, k);
+        }
+    }
+}
+
+static void flac_put_subframe(struct flac_encoder *enc, struct flac_bitwriter *bw,
+                              const int32_t *x, unsigned int n, unsigned int bps)
+{
+    unsigned int params[1 << FLAC_MAX_PARTITION_ORDER];
+    unsigned int i, order, porder = 0;
+    uint64_t est;
+
+    for (i = 1; i < n && x[i] == x[0]; i++)
+        ;
+    if (i == n) {
+        bw_put(bw, 0x00, 8); /* CONSTANT */
+        bw_put(bw, x[0], bps);
+        return;
+    }
+
+    order = flac_fixed_best_order(x, n, &est);
+    if (n > order) {
+        flac_fixed_residual(x, n, order, enc->residual);
+        est = flac_rice_partition(enc->residual, n, order, &porder, params);
+        est += (uint64_t)order * bps + 8;
+    }
+
+    if (n <= order || est >= (uint64_t)n * bps + 8) {
+        bw_put(bw, 0x02, 8); /* VERBATIM */
+        for (i = 0; i < n; i++)
+            bw_put(bw, x[i], bps);
+        return;
+    }
+
+    bw_put(bw, 0x10 | (order << 1), 8); /* FIXED */
+    for (i = 0; i < order; i++)
+        bw_put(bw, x[i], bps);
+    flac_put_residual(bw, enc->residual, n, order, porder, params);
+}
+
+static unsigned int flac_rate_code(unsigned int rate)
+{
+    switch (rate) {
+    case 88200: return 1;
+    case 176400: return 2;
+    case 192000: return 3;
+    case 8000: return 4;
+    case 16000: return 5;
+    case 22050: return 6;
+    case 24000: return 7;
+    case 32000: return 8;
+    case 44100: return 9;
+    case 48000: return 10;
+    case 96000: return 11;
+    default: return 0; /* taken from STREAMINFO */
+    }
+}
+
+static int flac_encode_block(struct flac_encoder *enc, const unsigned char *data,
+                             unsigned int n)
+{
+    struct flac_bitwriter bw = { .buf = enc->frame_buf };
+    unsigned int ch, i, channels = enc->channels;
+    unsigned int assignment = channels - 1;
+    size_t header_len;
+    uint16_t crc;
+
+    /* deinterleave, sign extending 24 bit samples */
+    if (enc->sample_bytes == 2) {
+        const int16_t *src = (const int16_t *)data;
+        for (i = 0; i < n; i++)
+            for (ch = 0; ch < channels; ch++)
+                enc->samples[ch][i] = *src++;
+    } else {
+        const int32_t *src = (const int32_t *)data;
+        for (i = 0; i < n; i++)
+            for (ch = 0; ch < channels; ch++)
+                enc->samples[ch][i] = (int32_t)((uint32_t)*src++ << 8) >> 8;
+    }
+
+    /* pick the cheapest stereo decorrelation */
+    if (channels == 2) {
+        int32_t *l = enc->samples[0], *r = enc->samples[1];
+        int32_t *mid = enc->samples[2], *side = enc->samples[3];
+        uint64_t cl, cr, cm, cs, best;
+
+        for (i = 0; i < n; i++) {
+            mid[i] = (l[i] + r[i]) >> 1;
+            side[i] = l[i] - r[i];
+        }
+        flac_fixed_best_order(l, n, &cl);
+        flac_fixed_best_order(r, n, &cr);
+        flac_fixed_best_order(mid, n, &cm);
+        flac_fixed_best_order(side, n, &cs);
+
+        best = cl + cr;
+        if (cl + cs < best) {
+            best = cl + cs;
+            assignment = 8;
+        }
+        if (cr + cs < best) {
+            best = cr + cs;
+            assignment = 9;
+        }
+        if (cm + cs < best)
+            assignment = 10;
+    }
+
+    /* frame header */
+    bw_put(&bw, 0xfff8, 16);
+    if (n == FLAC_BLOCK_SIZE)
+        bw_put(&bw, 12, 4);
+    else if (n <= 256)
+        bw_put(&bw, 6, 4);
+    else
+        bw_put(&bw, 7, 4);
+    bw_put(&bw, flac_rate_code(enc->rate), 4);
+    bw_put(&bw, assignment, 4);
+    bw_put(&bw, enc->bps == 16 ? 4 : 6, 3);
+    bw_put(&bw, 0, 1);
+    bw_put_utf8(&bw, enc->frame_number);
+    if (n != FLAC_BLOCK_SIZE)
+        bw_put(&bw, n - 1, n <= 256 ? 8 : 16);
+    header_len = bw.pos;
+    bw_put(&bw, flac_crc8(bw.buf, header_len), 8);
+
+    switch (assignment) {
+    case 8:
+        flac_put_subframe(enc, &bw, enc->samples[0], n, enc->bps);
+        flac_put_subframe(enc, &bw, enc->samples[3], n, enc->bps + 1);
+        break;
+    case 9:
+        flac_put_subframe(enc, &bw, enc->samples[3], n, enc->bps + 1);
+        flac_put_subframe(enc, &bw, enc->samples[1], n, enc->bps);
+        break;
+    case 10:
+        flac_put_subframe(enc, &bw, enc->samples[2], n, enc->bps);
+        flac_put_subframe(enc, &bw, enc->samples[3], n, enc->bps + 1);
+        break;
+    default:
+        for (ch = 0; ch < channels; ch++)
+            flac_put_subframe(enc, &bw, enc->samples[ch], n, enc->bps);
+        break;
+    }
+
+    bw_align(&bw);
+    crc = flac_crc16(bw.buf, bw.pos);
+    bw_put(&bw, crc, 16);
+
+    if (fwrite(bw.buf, 1, bw.pos, enc->file) != bw.pos)
+        return -1;
+
+    if (enc->frame_number == 0 || bw.pos < enc->min_frame_bytes)
+        enc->min_frame_bytes = bw.pos;
+    if (bw.pos > enc->max_frame_bytes)
+        enc->max_frame_bytes = bw.pos;
+    enc->bytes_written += bw.pos;
+    enc->total_frames += n;
+    enc->frame_number++;
+    return 0;
+}
+
+static void flac_put_streaminfo(struct flac_encoder *enc, unsigned char *buf)
+{
+    struct flac_bitwriter bw = { .buf = buf };
+    unsigned int block = FLAC_BLOCK_SIZE;
+
+    if (enc->frame_number == 1 && enc->total_frames < FLAC_BLOCK_SIZE)
+        block = enc->total_frames;
+
+    bw_put(&bw, block, 16);
+    bw_put(&bw, block, 16);
+    bw_put(&bw, enc->min_frame_bytes, 24);
+    bw_put(&bw, enc->max_frame_bytes, 24);
+    bw_put(&bw, enc->rate, 20);
+    bw_put(&bw, enc->channels - 1, 3);
+    bw_put(&bw, enc->bps - 1, 5);
+    bw_put(&bw, (uint32_t)(enc->total_frames >> 32), 4);
+    bw_put(&bw, (uint32_t)enc->total_frames, 32);
+    /* MD5 signature left unset (all zero) */
+    memset(buf + bw.pos, 0, FLAC_STREAMINFO_SIZE - bw.pos);
+}
+
+static void *flac_encoder_thread(void *arg)
+{
+    struct flac_encoder *enc = arg;
+    struct timespec start, end;
+
+    for (;;) {
+        struct flac_block *block;
+        int err;
+
+        pthread_mutex_lock(&enc->lock);
+        while (enc->count == 0 && !enc->finished)
+            pthread_cond_wait(&enc->cond, &enc->lock);
+        if (enc->count == 0) {
+            pthread_mutex_unlock(&enc->lock);
+            break;
+        }
+        block = &enc->blocks[enc->head];
+        pthread_mutex_unlock(&enc->lock);
+
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+        err = flac_encode_block(enc, block->data, block->frames);
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+        enc->encode_seconds += (end.tv_sec - start.tv_sec) +
+                               (end.tv_nsec - start.tv_nsec) / 1e9;
+
+        pthread_mutex_lock(&enc->lock);
+        if (err < 0)
+            enc->write_error = true;
+        block->frames = 0;
+        enc->head = (enc->head + 1) % FLAC_QUEUE_DEPTH;
+        enc->count--;
+        pthread_cond_broadcast(&enc->cond);
+        pthread_mutex_unlock(&enc->lock);
+    }
+
+    return NULL;
+}
+
+static void flac_encoder_free(struct flac_encoder *enc)
+{
+    unsigned int i;
+
+    for (i = 0; i < FLAC_MAX_CHANNELS + 2; i++)
+        free(enc->samples[i]);
+    for (i = 0; i < FLAC_QUEUE_DEPTH; i++)
+        free(enc->blocks[i].data);
+    free(enc->residual);
+    free(enc->frame_buf);
+    free(enc);
+}
+
+struct flac_encoder *flac_encoder_open(FILE *file, unsigned int channels,
+                                       unsigned int rate, enum pcm_format format)
+{
+    struct flac_encoder *enc;
+    unsigned char header[8 + FLAC_STREAMINFO_SIZE];
+    unsigned int i;
+
+    enc = calloc(1, sizeof(*enc));
+    if (!enc)
+        return NULL;
+
+    enc->file = file;
+    enc->channels = channels;
+    enc->rate = rate;
+    enc->bps = format == PCM_FORMAT_S16_LE ? 16 : 24;
+    enc->sample_bytes = format == PCM_FORMAT_S16_LE ? 2 : 4;
+    enc->seekable = ftell(file) >= 0;
+
+    for (i = 0; i < channels + (channels == 2 ? 2 : 0); i++) {
+        enc->samples[i] = malloc(FLAC_BLOCK_SIZE * sizeof(int32_t));
+        if (!enc->samples[i])
+            goto fail;
+    }
+    for (i = 0; i < FLAC_QUEUE_DEPTH; i++) {
+        enc->blocks[i].data = malloc(FLAC_BLOCK_SIZE * channels * enc->sample_bytes);
+        if (!enc->blocks[i].data)
+            goto fail;
+    }
+    enc->residual = malloc(FLAC_BLOCK_SIZE * sizeof(int32_t));
+    /* worst case is a verbatim frame plus headers */
+    enc->frame_buf = malloc(FLAC_BLOCK_SIZE * channels * 4 + 64);
+    if (!enc->residual || !enc->frame_buf)
+        goto fail;
+
+    flac_crc_init();
+
+    memcpy(header, "fLaC", 4);
+    header[4] = 0x80; /* last metadata block, STREAMINFO */
+    header[5] = 0;
+    header[6] = 0;
+    header[7] = FLAC_STREAMINFO_SIZE;
+    flac_put_streaminfo(enc, header + 8);
+    if (fwrite(header, 1, sizeof(header), file) != sizeof(header))
+        goto fail;
+
+    pthread_mutex_init(&enc->lock, NULL);
+    pthread_cond_init(&enc->cond, NULL);
+    if (pthread_create(&enc->thread, NULL, flac_encoder_thread, enc) != 0) {
+        pthread_cond_destroy(&enc->cond);
+        pthread_mutex_destroy(&enc->lock);
+        goto fail;
+    }
+
+    return enc;
+
+fail:
+    flac_encoder_free(enc);
+    return NULL;
+}
+
+/* Copies captured frames into the block being filled and hands full
+ * blocks over to the encoder thread. */
+int flac_encoder_write(struct flac_encoder *enc, const void *data, unsigned int frames)
+{
+    const unsigned char *src = data;
+    unsigned int frame_bytes = enc->channels * enc->sample_bytes;
+
+    while (frames) {
+        struct flac_block *block;
+        unsigned int n;
+        bool error;
+
+        pthread_mutex_lock(&enc->lock);
+        while (enc->count == FLAC_QUEUE_DEPTH)
+            pthread_cond_wait(&enc->cond, &enc->lock);
+        block = &enc->blocks[(enc->head + enc->count) % FLAC_QUEUE_DEPTH];
+        error = enc->write_error;
+        pthread_mutex_unlock(&enc->lock);
+        if (error)
+            return -1;
+
+        n = FLAC_BLOCK_SIZE - block->frames;
+        if (n > frames)
+            n = frames;
+        memcpy(block->data + block->frames * frame_bytes, src, n * frame_bytes);
+        block->frames += n;
+        src += n * frame_bytes;
+        frames -= n;
+
+        if (block->frames == FLAC_BLOCK_SIZE) {
+            pthread_mutex_lock(&enc->lock);
+            enc->count++;
+            pthread_cond_broadcast(&enc->cond);
+            pthread_mutex_unlock(&enc->lock);
+        }
+    }
+
+    return 0;
+}
+
+int flac_encoder_close(struct flac_encoder *enc)
+{
+    unsigned char streaminfo[FLAC_STREAMINFO_SIZE];
+    struct flac_block *block;
+    double seconds;
+    int ret = 0;
+
+    pthread_mutex_lock(&enc->lock);
+    block = &enc->blocks[(enc->head + enc->count) % FLAC_QUEUE_DEPTH];
+    if (enc->count < FLAC_QUEUE_DEPTH && block->frames)
+        enc->count++;
+    enc->finished = true;
+    pthread_cond_broadcast(&enc->cond);
+    pthread_mutex_unlock(&enc->lock);
+    pthread_join(enc->thread, NULL);
+
+    if (enc->write_error)
+        ret = -1;
+
+    /* patch in the sizes now that the whole stream is known */
+    if (enc->seekable && fseek(enc->file, 8, SEEK_SET) == 0) {
+        flac_put_streaminfo(enc, streaminfo);
+        if (fwrite(streaminfo, 1, sizeof(streaminfo), enc->file) != sizeof(streaminfo))
+            ret = -1;
+        fseek(enc->file, 0, SEEK_END);
+    }
+
+    if (prinfo && enc->total_frames) {
+        seconds = (double)enc->total_frames / enc->rate;
+        printf("Encoded %.1f s of audio in %.2f s of CPU (%.1fx real time), "
+               "compression ratio %.2f:1\n", seconds, enc->encode_seconds,
+               enc->encode_seconds > 0 ? seconds / enc->encode_seconds : 0.0,
+               (double)(enc->total_frames * enc->channels * enc->sample_bytes) /
+               (enc->bytes_written + 8 + FLAC_STREAMINFO_SIZE));
+    }
+
+    pthread_cond_destroy(&enc->cond);
+    pthread_mutex_destroy(&enc->lock);
+    flac_encoder_free(enc);
+    return ret;
+}
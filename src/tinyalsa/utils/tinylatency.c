@@ -0,0 +1,541 @@
+/* tinylatency.c
+**
+** Copyright 2026, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+#include <tinyalsa/asoundlib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define OPTPARSE_IMPLEMENTATION
+#include "optparse.h"
+
+#define NSEC_PER_SEC 1000000000LL
+
+/* smallest period size worth trying */
+#define TUNE_MIN_PERIOD_SIZE 16
+#define TUNE_MAX_CANDIDATES 256
+
+struct tune_candidate {
+    unsigned int period_size;
+    unsigned int period_count;
+};
+
+struct tune_result {
+    int xruns;
+    int error;
+    unsigned int wakeups;
+    /* deviation of the wakeup interval from the period time */
+    double jitter_avg_us;
+    double jitter_max_us;
+};
+
+static long long timespec_to_ns(const struct timespec *ts)
+{
+    return ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return timespec_to_ns(&ts);
+}
+
+/* Keeps the CPU busy until the deadline, standing in for the work an
+ * audio client does for every period. */
+static void burn_cpu(long long deadline_ns)
+{
+    volatile unsigned int sink = 0;
+
+    while (now_ns() < deadline_ns) {
+        unsigned int i;
+        for (i = 0; i < 1000; i++)
+            sink += i;
+    }
+}
+
+static enum pcm_format bits_to_format(unsigned int bits)
+{
+    switch (bits) {
+    case 32:
+        return PCM_FORMAT_S32_LE;
+    case 24:
+        return PCM_FORMAT_S24_LE;
+    case 16:
+        return PCM_FORMAT_S16_LE;
+    default:
+        return PCM_FORMAT_INVALID;
+    }
+}
+
+static const char *format_to_string(enum pcm_format format)
+{
+    switch (format) {
+    case PCM_FORMAT_S32_LE:
+        return "PCM_FORMAT_S32_LE";
+    case PCM_FORMAT_S24_LE:
+        return "PCM_FORMAT_S24_LE";
+    default:
+        return "PCM_FORMAT_S16_LE";
+    }
+}
+
+/* Plays silence with the given configuration while loading the CPU for
+ * load percent of every period. */
+static int tune_run(unsigned int card, unsigned int device, unsigned int flags,
+                    const struct pcm_config *config, unsigned int seconds,
+                    unsigned int load, struct tune_result *result)
+{
+    struct pcm *pcm;
+    void *buffer;
+    unsigned int size, periods, i;
+    long long period_ns, load_ns, last = 0, jitter_sum = 0, jitter_max = 0;
+
+    memset(result, 0, sizeof(*result));
+
+    pcm = pcm_open(card, device, PCM_OUT | PCM_MONOTONIC | flags, config);
+    if (!pcm_is_ready(pcm)) {
+        fprintf(stderr, "Unable to open PCM device %u (%s)\n", device, pcm_get_error(pcm));
+        pcm_close(pcm);
+        return -1;
+    }
+
+    size = pcm_frames_to_bytes(pcm, config->period_size);
+    buffer = calloc(1, size);
+    if (!buffer) {
+        fprintf(stderr, "Unable to allocate %u bytes\n", size);
+        pcm_close(pcm);
+        return -1;
+    }
+
+    period_ns = config->period_size * NSEC_PER_SEC / config->rate;
+    load_ns = period_ns * load / 100;
+    periods = (unsigned long long)seconds * config->rate / config->period_size;
+
+    for (i = 0; i < periods; i++) {
+        long long now;
+
+        if (pcm_writei(pcm, buffer, config->period_size) < 0) {
+            fprintf(stderr, "Error playing sample: %s\n", pcm_get_error(pcm));
+            result->error = 1;
+            break;
+        }
+        now = now_ns();
+
+        /* writes only block once the buffer has been filled */
+        if (i > config->period_count) {
+            long long deviation = now - last - period_ns;
+            if (deviation < 0)
+                deviation = -deviation;
+            jitter_sum += deviation;
+            if (deviation > jitter_max)
+                jitter_max = deviation;
+            result->wakeups++;
+        }
+        last = now;
+
+        burn_cpu(now + load_ns);
+    }
+
+    result->xruns = pcm_get_xruns(pcm);
+    if (result->wakeups) {
+        result->jitter_avg_us = jitter_sum / 1000.0 / result->wakeups;
+        result->jitter_max_us = jitter_max / 1000.0;
+    }
+
+    free(buffer);
+    pcm_close(pcm);
+    return 0;
+}
+
+static int candidate_compare(const void *a, const void *b)
+{
+    const struct tune_candidate *ca = a;
+    const struct tune_candidate *cb = b;
+    unsigned int la = ca->period_size * ca->period_count;
+    unsigned int lb = cb->period_size * cb->period_count;
+
+    if (la != lb)
+        return la < lb ? -1 : 1;
+    /* at equal latency prefer fewer wakeups */
+    return ca->period_size < cb->period_size ? 1 : (ca->period_size > cb->period_size ? -1 : 0);
+}
+
+/* Collects power of two period sizes and the period counts the device
+ * supports, ordered by buffer latency. */
+static unsigned int tune_candidates(const struct pcm_params *params, unsigned int rate,
+                                    unsigned int max_count, struct tune_candidate *candidates)
+{
+    unsigned int size_min = pcm_params_get_min(params, PCM_PARAM_PERIOD_SIZE);
+    unsigned int size_max = pcm_params_get_max(params, PCM_PARAM_PERIOD_SIZE);
+    unsigned int count_min = pcm_params_get_min(params, PCM_PARAM_PERIODS);
+    unsigned int count_max = pcm_params_get_max(params, PCM_PARAM_PERIODS);
+    unsigned int size, count, n = 0;
+
+    if (size_min < TUNE_MIN_PERIOD_SIZE)
+        size_min = TUNE_MIN_PERIOD_SIZE;
+    if (size_max > rate)
+        size_max = rate;
+    if (count_min < 2)
+        count_min = 2;
+    if (count_max > max_count)
+        count_max = max_count;
+
+    for (size = TUNE_MIN_PERIOD_SIZE; size <= size_max; size *= 2) {
+        if (size < size_min)
+            continue;
+        for (count = count_min; count <= count_max && n < TUNE_MAX_CANDIDATES; count++) {
+            candidates[n].period_size = size;
+            candidates[n].period_count = count;
+            n++;
+        }
+    }
+
+    qsort(candidates, n, sizeof(*candidates), candidate_compare);
+    return n;
+}
+
+static void tune_usage(const char *argv0)
+{
+    fprintf(stderr, "Usage: %s tune [options]\n", argv0);
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "-D | --card <card number>     The card to use\n");
+    fprintf(stderr, "-d | --device <device number> The device to use\n");
+    fprintf(stderr, "-c | --channels <count>       The number of channels\n");
+    fprintf(stderr, "-r | --rate <rate>            The sample rate (Hz)\n");
+    fprintf(stderr, "-b | --bits <bit count>       The number of bits in one sample\n");
+    fprintf(stderr, "-l | --load <percent>         CPU load per period (default 50)\n");
+    fprintf(stderr, "-t | --time <seconds>         Duration of each trial (default 2)\n");
+    fprintf(stderr, "-n | --max-periods <count>    Largest period count to try (default 4)\n");
+    fprintf(stderr, "-M | --mmap                   Use memory mapped IO to play audio\n");
+}
+
+static int tune_main(const char *argv0, char **argv)
+{
+    struct optparse opts;
+    struct optparse_long long_options[] = {
+        { "card",         'D', OPTPARSE_REQUIRED },
+        { "device",       'd', OPTPARSE_REQUIRED },
+        { "channels",     'c', OPTPARSE_REQUIRED },
+        { "rate",         'r', OPTPARSE_REQUIRED },
+        { "bits",         'b', OPTPARSE_REQUIRED },
+        { "load",         'l', OPTPARSE_REQUIRED },
+        { "time",         't', OPTPARSE_REQUIRED },
+        { "max-periods",  'n', OPTPARSE_REQUIRED },
+        { "mmap",         'M', OPTPARSE_NONE     },
+        { "help",         'h', OPTPARSE_NONE     },
+        { 0, 0, 0 }
+    };
+    struct tune_candidate candidates[TUNE_MAX_CANDIDATES];
+    struct pcm_config config;
+    struct pcm_params *params;
+    struct tune_result result;
+    unsigned int card = 0, device = 0, bits = 16, load = 50, seconds = 2, max_count = 4;
+    unsigned int flags = 0, count, i;
+    int c;
+
+    memset(&config, 0, sizeof(config));
+    config.channels = 2;
+    config.rate = 48000;
+
+    optparse_init(&opts, argv);
+    while ((c = optparse_long(&opts, long_options, NULL)) != -1) {
+        switch (c) {
+        case 'D':
+            card = atoi(opts.optarg);
+            break;
+        case 'd':
+            device = atoi(opts.optarg);
+            break;
+        case 'c':
+            config.channels = atoi(opts.optarg);
+            break;
+        case 'r':
+            config.rate = atoi(opts.optarg);
+            break;
+        case 'b':
+            bits = atoi(opts.optarg);
+            break;
+        case 'l':
+            load = atoi(opts.optarg);
+            break;
+        case 't':
+            seconds = atoi(opts.optarg);
+            break;
+        case 'n':
+            max_count = atoi(opts.optarg);
+            break;
+        case 'M':
+            flags |= PCM_MMAP;
+            break;
+        case 'h':
+            tune_usage(argv0);
+            return EXIT_SUCCESS;
+        case '?':
+            fprintf(stderr, "%s\n", opts.errmsg);
+            return EXIT_FAILURE;
+        }
+    }
+
+    config.format = bits_to_format(bits);
+    if (config.format == PCM_FORMAT_INVALID) {
+        fprintf(stderr, "%u bits is not supported.\n", bits);
+        return EXIT_FAILURE;
+    }
+    if (load >= 100 || seconds == 0 || config.rate == 0) {
+        tune_usage(argv0);
+        return EXIT_FAILURE;
+    }
+
+    params = pcm_params_get(card, device, PCM_OUT);
+    if (!params) {
+        fprintf(stderr, "Unable to get parameters of card %u, device %u\n", card, device);
+        return EXIT_FAILURE;
+    }
+    count = tune_candidates(params, config.rate, max_count, candidates);
+    pcm_params_free(params);
+
+    printf("Tuning card %u, device %u: %u ch, %u hz, %u bit, %u%% load, %u s per trial\n",
+           card, device, config.channels, config.rate, bits, load, seconds);
+    printf("%12s %12s %12s %6s %14s %14s\n", "period_size", "period_count",
+           "latency (ms)", "xruns", "jitter avg (us)", "jitter max (us)");
+
+    for (i = 0; i < count; i++) {
+        config.period_size = candidates[i].period_size;
+        config.period_count = candidates[i].period_count;
+
+        if (tune_run(card, device, flags, &config, seconds, load, &result) < 0)
+            continue;
+
+        printf("%12u %12u %12.2f %6d %14.1f %14.1f\n", config.period_size,
+               config.period_count,
+               config.period_size * config.period_count * 1000.0 / config.rate,
+               result.xruns, result.jitter_avg_us, result.jitter_max_us);
+
+        if (!result.error && result.xruns == 0) {
+            printf("\nstruct pcm_config config = { .channels = %u, .rate = %u, "
+                   ".period_size = %u, .period_count = %u, .format = %s };\n",
+                   config.channels, config.rate, config.period_size,
+                   config.period_count, format_to_string(config.format));
+            return EXIT_SUCCESS;
+        }
+    }
+
+    fprintf(stderr, "No configuration ran without xruns\n");
+    return EXIT_FAILURE;
+}
+
+static void measure_usage(const char *argv0)
+{
+    fprintf(stderr, "Usage: %s measure [options]\n", argv0);
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "-D | --card <card number>         The playback card\n");
+    fprintf(stderr, "-d | --device <device number>     The playback device\n");
+    fprintf(stderr, "-C | --capture-card <card>        The capture card (default: playback card)\n");
+    fprintf(stderr, "-i | --capture-device <device>    The capture device (default: playback device)\n");
+    fprintf(stderr, "-c | --channels <count>           The number of channels\n");
+    fprintf(stderr, "-r | --rate <rate>                The sample rate (Hz)\n");
+    fprintf(stderr, "-b | --bits <bit count>           The number of bits in one sample\n");
+    fprintf(stderr, "-p | --period-size <size>         The size of the PCM's period\n");
+    fprintf(stderr, "-n | --period-count <count>       The number of PCM periods\n");
+    fprintf(stderr, "-I | --impulse                    Play an impulse instead of an MLS\n");
+    fprintf(stderr, "-N | --runs <count>               Number of measurements (default 1)\n");
+}
+
+static int measure_main(const char *argv0, char **argv)
+{
+    struct optparse opts;
+    struct optparse_long long_options[] = {
+        { "card",           'D', OPTPARSE_REQUIRED },
+        { "device",         'd', OPTPARSE_REQUIRED },
+        { "capture-card",   'C', OPTPARSE_REQUIRED },
+        { "capture-device", 'i', OPTPARSE_REQUIRED },
+        { "channels",       'c', OPTPARSE_REQUIRED },
+        { "rate",           'r', OPTPARSE_REQUIRED },
+        { "bits",           'b', OPTPARSE_REQUIRED },
+        { "period-size",    'p', OPTPARSE_REQUIRED },
+        { "period-count",   'n', OPTPARSE_REQUIRED },
+        { "impulse",        'I', OPTPARSE_NONE     },
+        { "runs",           'N', OPTPARSE_REQUIRED },
+        { "help",           'h', OPTPARSE_NONE     },
+        { 0, 0, 0 }
+    };
+    enum pcm_latency_signal signal = PCM_LATENCY_MLS;
+    struct pcm_latency latency;
+    struct pcm_config config;
+    struct pcm *out, *in;
+    unsigned int card = 0, device = 0, bits = 16, runs = 1, run, ok = 0;
+    int capture_card = -1, capture_device = -1;
+    long min_us = 0, max_us = 0, sum_us = 0;
+    int c, ret = EXIT_FAILURE;
+
+    memset(&config, 0, sizeof(config));
+    config.channels = 2;
+    config.rate = 48000;
+    config.period_size = 1024;
+    config.period_count = 2;
+
+    optparse_init(&opts, argv);
+    while ((c = optparse_long(&opts, long_options, NULL)) != -1) {
+        switch (c) {
+        case 'D':
+            card = atoi(opts.optarg);
+            break;
+        case 'd':
+            device = atoi(opts.optarg);
+            break;
+        case 'C':
+            capture_card = atoi(opts.optarg);
+            break;
+        case 'i':
+            capture_device = atoi(opts.optarg);
+            break;
+        case 'c':
+            config.channels = atoi(opts.optarg);
+            break;
+        case 'r':
+            config.rate = atoi(opts.optarg);
+            break;
+        case 'b':
+            bits = atoi(opts.optarg);
+            break;
+        case 'p':
+            config.period_size = atoi(opts.optarg);
+            break;
+        case 'n':
+            config.period_count = atoi(opts.optarg);
+            break;
+        case 'I':
+            signal = PCM_LATENCY_IMPULSE;
+            break;
+        case 'N':
+            runs = atoi(opts.optarg);
+            break;
+        case 'h':
+            measure_usage(argv0);
+            return EXIT_SUCCESS;
+        case '?':
+            fprintf(stderr, "%s\n", opts.errmsg);
+            return EXIT_FAILURE;
+        }
+    }
+
+    config.format = bits_to_format(bits);
+    if (config.format == PCM_FORMAT_INVALID) {
+        fprintf(stderr, "%u bits is not supported.\n", bits);
+        return EXIT_FAILURE;
+    }
+    if (capture_card < 0)
+        capture_card = card;
+    if (capture_device < 0)
+        capture_device = device;
+
+    out = pcm_open(card, device, PCM_OUT | PCM_MONOTONIC, &config);
+    if (!pcm_is_ready(out)) {
+        fprintf(stderr, "Unable to open playback PCM %u,%u (%s)\n", card, device,
+                pcm_get_error(out));
+        pcm_close(out);
+        return EXIT_FAILURE;
+    }
+    in = pcm_open(capture_card, capture_device, PCM_IN | PCM_MONOTONIC, &config);
+    if (!pcm_is_ready(in)) {
+        fprintf(stderr, "Unable to open capture PCM %d,%d (%s)\n", capture_card,
+                capture_device, pcm_get_error(in));
+        goto close;
+    }
+
+    printf("Measuring %u,%u -> %d,%d: %u ch, %u hz, %u bit, %u x %u frames, %s\n",
+           card, device, capture_card, capture_device, config.channels, config.rate, bits,
+           config.period_count, config.period_size,
+           signal == PCM_LATENCY_MLS ? "MLS" : "impulse");
+    printf("%4s %18s %18s %18s %18s %12s\n", "run", "output", "path", "input",
+           "round trip", "correlation");
+
+    for (run = 0; run < runs; run++) {
+        if (pcm_measure_latency(out, in, signal, &latency) < 0) {
+            fprintf(stderr, "Measurement %u failed: %s / %s\n", run,
+                    pcm_get_error(out), pcm_get_error(in));
+            continue;
+        }
+
+        printf("%4u %6ld (%6ld us) %6ld (%6ld us) %6ld (%6ld us) %6ld (%6ld us) %12.3f\n", run,
+               latency.output_frames, latency.output_us, latency.path_frames, latency.path_us,
+               latency.input_frames, latency.input_us, latency.round_trip_frames,
+               latency.round_trip_us, latency.correlation);
+
+        if (!ok || latency.round_trip_us < min_us)
+            min_us = latency.round_trip_us;
+        if (!ok || latency.round_trip_us > max_us)
+            max_us = latency.round_trip_us;
+        sum_us += latency.round_trip_us;
+        ok++;
+    }
+
+    if (ok) {
+        if (runs > 1)
+            printf("\nround trip: min %ld us, avg %ld us, max %ld us over %u runs\n",
+                   min_us, sum_us / (long) ok, max_us, ok);
+        ret = ok == runs ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+close:
+    pcm_close(in);
+    pcm_close(out);
+    return ret;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "Usage: %s <command> [options]\n", argv0);
+    fprintf(stderr, "commands:\n");
+    fprintf(stderr, "tune     Find the smallest period configuration that plays without xruns\n");
+    fprintf(stderr, "measure  Measure the round trip latency of a playback to capture path\n");
+    fprintf(stderr, "Use '%s <command> -h' for the options of a command.\n", argv0);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (strcmp(argv[1], "tune") == 0)
+        return tune_main(argv[0], argv + 1);
+    if (strcmp(argv[1], "measure") == 0)
+        return measure_main(argv[0], argv + 1);
+
+    if (strcmp(argv[1], "-h") != 0 && strcmp(argv[1], "--help") != 0) {
+        fprintf(stderr, "Unknown command '%s'\n", argv[1]);
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    usage(argv[0]);
+    return EXIT_SUCCESS;
+}
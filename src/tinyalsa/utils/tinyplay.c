@@ -27,18 +27,22 @@
 */
 
 #include <tinyalsa/asoundlib.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #define OPTPARSE_IMPLEMENTATION
 #include "optparse.h"
+#include "pcm_stats.h"
 
 struct cmd {
-    const char *filename;
+    const char **filenames;
+    unsigned int num_files;
     const char *filetype;
     unsigned int card;
     unsigned int device;
@@ -50,11 +54,12 @@ struct cmd {
 
 void cmd_init(struct cmd *cmd)
 {
-    cmd->filename = NULL;
+    cmd->filenames = NULL;
+    cmd->num_files = 0;
     cmd->filetype = NULL;
     cmd->card = 0;
     cmd->device = 0;
-    cmd->flags = PCM_OUT;
+    cmd->flags = PCM_OUT | PCM_STATS;
     cmd->config.period_size = 1024;
     cmd->config.period_count = 2;
     cmd->config.channels = 2;
@@ -96,8 +101,14 @@ struct chunk_fmt {
     uint16_t bits_per_sample;
 };
 
-struct ctx {
-    struct pcm *pcm;
+#define TRACK_QUEUE_SLOTS 4
+#define TRACK_CHUNK_BYTES (64 * 1024)
+
+struct track {
+    const char *filename;
+    const char *filetype;
+    struct pcm_config config;
+    unsigned int bits;
 
     struct riff_wave_header wave_header;
     struct chunk_header chunk_header;
@@ -107,6 +118,41 @@ struct ctx {
     size_t file_size;
 };
 
+enum chunk_type {
+    /** A track starts; the chunk holds its name and format */
+    CHUNK_TRACK,
+    /** Audio data of the current track */
+    CHUNK_DATA,
+    /** No more tracks */
+    CHUNK_END,
+};
+
+struct chunk {
+    enum chunk_type type;
+    const char *filename;
+    struct pcm_config config;
+    unsigned int bits;
+    size_t size;
+    char *data;
+    size_t bytes;
+};
+
+/* Reads the tracks on a thread, so the next track is opened and buffered
+ * while the current one is still playing. */
+struct reader {
+    const struct cmd *cmd;
+    const char **filenames;
+    unsigned int num_files;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct chunk slots[TRACK_QUEUE_SLOTS];
+    unsigned int head;
+    unsigned int count;
+    bool stop;
+};
+
 static bool is_wave_file(const char *filetype)
 {
     return filetype != NULL && strcmp(filetype, "wav") == 0;
@@ -128,33 +174,33 @@ static enum pcm_format signed_pcm_bits_to_format(int bits)
     }
 }
 
-static int parse_wave_file(struct ctx *ctx, const char *filename)
+static int parse_wave_file(struct track *track, const char *filename)
 {
-    if (fread(&ctx->wave_header, sizeof(ctx->wave_header), 1, ctx->file) != 1){
+    if (fread(&track->wave_header, sizeof(track->wave_header), 1, track->file) != 1){
         fprintf(stderr, "error: '%s' does not contain a riff/wave header\n", filename);
         return -1;
     }
 
-    if (ctx->wave_header.riff_id != ID_RIFF || ctx->wave_header.wave_id != ID_WAVE) {
+    if (track->wave_header.riff_id != ID_RIFF || track->wave_header.wave_id != ID_WAVE) {
         fprintf(stderr, "error: '%s' is not a riff/wave file\n", filename);
         return -1;
     }
 
     bool more_chunks = true;
     do {
-        if (fread(&ctx->chunk_header, sizeof(ctx->chunk_header), 1, ctx->file) != 1) {
+        if (fread(&track->chunk_header, sizeof(track->chunk_header), 1, track->file) != 1) {
             fprintf(stderr, "error: '%s' does not contain a data chunk\n", filename);
             return -1;
         }
-        switch (ctx->chunk_header.id) {
+        switch (track->chunk_header.id) {
         case ID_FMT:
-            if (fread(&ctx->chunk_fmt, sizeof(ctx->chunk_fmt), 1, ctx->file) != 1) {
+            if (fread(&track->chunk_fmt, sizeof(track->chunk_fmt), 1, track->file) != 1) {
                 fprintf(stderr, "error: '%s' has incomplete format chunk\n", filename);
                 return -1;
             }
             /* If the format header is larger, skip the rest */
-            if (ctx->chunk_header.sz > sizeof(ctx->chunk_fmt)) {
-                fseek(ctx->file, ctx->chunk_header.sz - sizeof(ctx->chunk_fmt), SEEK_CUR);
+            if (track->chunk_header.sz > sizeof(track->chunk_fmt)) {
+                fseek(track->file, track->chunk_header.sz - sizeof(track->chunk_fmt), SEEK_CUR);
             }
             break;
         case ID_DATA:
@@ -163,92 +209,262 @@ static int parse_wave_file(struct ctx *ctx, const char *filename)
             break;
         default:
             /* Unknown chunk, skip bytes */
-            fseek(ctx->file, ctx->chunk_header.sz, SEEK_CUR);
+            fseek(track->file, track->chunk_header.sz, SEEK_CUR);
         }
     } while (more_chunks);
 
+    /* A missing format chunk leaves these zero too */
+    if (track->chunk_fmt.num_channels == 0 || track->chunk_fmt.bits_per_sample == 0) {
+        fprintf(stderr, "error: '%s' has no channels or no sample bits\n", filename);
+        return -1;
+    }
+
     return 0;
 }
 
-static int ctx_init(struct ctx* ctx, struct cmd *cmd)
+static int track_open(struct track *track, const struct cmd *cmd, const char *filename)
 {
-    unsigned int bits = cmd->bits;
-    struct pcm_config *config = &cmd->config;
+    struct pcm_config *config = &track->config;
     bool is_float = cmd->is_float;
 
-    if (cmd->filename == NULL) {
-        fprintf(stderr, "filename not specified\n");
-        return -1;
+    memset(track, 0, sizeof(*track));
+    track->filename = filename;
+    track->config = cmd->config;
+    track->bits = cmd->bits;
+
+    track->filetype = cmd->filetype;
+    if (track->filetype == NULL && (track->filetype = strrchr(filename, '.')) != NULL) {
+        track->filetype++;
     }
-    if (strcmp(cmd->filename, "-") == 0) {
-        ctx->file = stdin;
+
+    if (strcmp(filename, "-") == 0) {
+        track->file = stdin;
+        track->file_size = SIZE_MAX;
     } else {
-        ctx->file = fopen(cmd->filename, "rb");
-        fseek(ctx->file, 0L, SEEK_END);
-        ctx->file_size = ftell(ctx->file);
-        fseek(ctx->file, 0L, SEEK_SET);
+        track->file = fopen(filename, "rb");
+        if (track->file != NULL) {
+            fseek(track->file, 0L, SEEK_END);
+            track->file_size = ftell(track->file);
+            fseek(track->file, 0L, SEEK_SET);
+        }
     }
 
-    if (ctx->file == NULL) {
-        fprintf(stderr, "failed to open '%s'\n", cmd->filename);
+    if (track->file == NULL) {
+        fprintf(stderr, "failed to open '%s'\n", filename);
         return -1;
     }
 
-    if (is_wave_file(cmd->filetype)) {
-        if (parse_wave_file(ctx, cmd->filename) != 0) {
-            fclose(ctx->file);
+    if (is_wave_file(track->filetype)) {
+        if (parse_wave_file(track, filename) != 0) {
+            fclose(track->file);
             return -1;
         }
-        config->channels = ctx->chunk_fmt.num_channels;
-        config->rate = ctx->chunk_fmt.sample_rate;
-        bits = ctx->chunk_fmt.bits_per_sample;
-        is_float = ctx->chunk_fmt.audio_format == WAVE_FORMAT_IEEE_FLOAT;
-        ctx->file_size = (size_t) ctx->chunk_header.sz;
+        config->channels = track->chunk_fmt.num_channels;
+        config->rate = track->chunk_fmt.sample_rate;
+        track->bits = track->chunk_fmt.bits_per_sample;
+        is_float = track->chunk_fmt.audio_format == WAVE_FORMAT_IEEE_FLOAT;
+        track->file_size = (size_t) track->chunk_header.sz;
     }
 
     if (is_float) {
         config->format = PCM_FORMAT_FLOAT_LE;
     } else {
-        config->format = signed_pcm_bits_to_format(bits);
+        config->format = signed_pcm_bits_to_format(track->bits);
         if (config->format == -1) {
-            fprintf(stderr, "bit count '%u' not supported\n", bits);
-            fclose(ctx->file);
+            fprintf(stderr, "'%s': bit count '%u' not supported\n", filename, track->bits);
+            fclose(track->file);
             return -1;
         }
     }
 
-    ctx->pcm = pcm_open(cmd->card,
-                        cmd->device,
-                        cmd->flags,
-                        config);
-    if (!pcm_is_ready(ctx->pcm)) {
-        fprintf(stderr, "failed to open for pcm %u,%u. %s\n",
-                cmd->card, cmd->device,
-                pcm_get_error(ctx->pcm));
-        fclose(ctx->file);
-        pcm_close(ctx->pcm);
-        return -1;
+    return 0;
+}
+
+static void track_close(struct track *track)
+{
+    if (track->file != NULL && track->file != stdin) {
+        fclose(track->file);
     }
+    track->file = NULL;
+}
 
-    return 0;
+/* Waits for a free slot; returns NULL if the reader is stopped */
+static struct chunk *reader_acquire(struct reader *reader)
+{
+    struct chunk *chunk = NULL;
+
+    pthread_mutex_lock(&reader->lock);
+    while (!reader->stop && reader->count == TRACK_QUEUE_SLOTS) {
+        pthread_cond_wait(&reader->cond, &reader->lock);
+    }
+    if (!reader->stop) {
+        chunk = &reader->slots[(reader->head + reader->count) % TRACK_QUEUE_SLOTS];
+    }
+    pthread_mutex_unlock(&reader->lock);
+
+    return chunk;
+}
+
+static void reader_commit(struct reader *reader)
+{
+    pthread_mutex_lock(&reader->lock);
+    reader->count++;
+    pthread_cond_broadcast(&reader->cond);
+    pthread_mutex_unlock(&reader->lock);
+}
+
+/* Waits for the next chunk; returns NULL if the reader is stopped */
+static struct chunk *reader_peek(struct reader *reader)
+{
+    struct chunk *chunk = NULL;
+
+    pthread_mutex_lock(&reader->lock);
+    while (!reader->stop && reader->count == 0) {
+        pthread_cond_wait(&reader->cond, &reader->lock);
+    }
+    if (!reader->stop) {
+        chunk = &reader->slots[reader->head];
+    }
+    pthread_mutex_unlock(&reader->lock);
+
+    return chunk;
 }
 
-void ctx_free(struct ctx *ctx)
+static void reader_release(struct reader *reader)
 {
-    if (ctx == NULL) {
+    pthread_mutex_lock(&reader->lock);
+    reader->head = (reader->head + 1) % TRACK_QUEUE_SLOTS;
+    reader->count--;
+    pthread_cond_broadcast(&reader->cond);
+    pthread_mutex_unlock(&reader->lock);
+}
+
+static void reader_stop(struct reader *reader)
+{
+    pthread_mutex_lock(&reader->lock);
+    reader->stop = true;
+    pthread_cond_broadcast(&reader->cond);
+    pthread_mutex_unlock(&reader->lock);
+}
+
+static void read_track(struct reader *reader, struct track *track)
+{
+    struct chunk *chunk;
+    size_t frame_bytes, remaining, read_size;
+
+    frame_bytes = track->config.channels * pcm_format_to_bits(track->config.format) / 8;
+    remaining = track->file_size;
+
+    chunk = reader_acquire(reader);
+    if (chunk == NULL) {
         return;
     }
-    if (ctx->pcm != NULL) {
-        pcm_close(ctx->pcm);
+    chunk->type = CHUNK_TRACK;
+    chunk->filename = track->filename;
+    chunk->config = track->config;
+    chunk->bits = track->bits;
+    chunk->size = track->file_size;
+    reader_commit(reader);
+
+    while (remaining > 0) {
+        chunk = reader_acquire(reader);
+        if (chunk == NULL) {
+            return;
+        }
+        /* whole frames only, the PCM is written in frames */
+        read_size = TRACK_CHUNK_BYTES / frame_bytes * frame_bytes;
+        if (read_size > remaining) {
+            read_size = remaining;
+        }
+        chunk->type = CHUNK_DATA;
+        chunk->bytes = fread(chunk->data, 1, read_size, track->file);
+        if (chunk->bytes == 0) {
+            return;
+        }
+        if (remaining != SIZE_MAX) {
+            remaining -= chunk->bytes;
+        }
+        reader_commit(reader);
     }
-    if (ctx->file != NULL) {
-        fclose(ctx->file);
+}
+
+static void *reader_thread(void *arg)
+{
+    struct reader *reader = arg;
+    struct track track;
+    struct chunk *chunk;
+    unsigned int i;
+
+    for (i = 0; i < reader->num_files; i++) {
+        if (track_open(&track, reader->cmd, reader->filenames[i]) < 0) {
+            continue;
+        }
+        read_track(reader, &track);
+        track_close(&track);
+    }
+
+    chunk = reader_acquire(reader);
+    if (chunk != NULL) {
+        chunk->type = CHUNK_END;
+        reader_commit(reader);
+    }
+
+    return NULL;
+}
+
+static int reader_start(struct reader *reader, const struct cmd *cmd,
+                        const char **filenames, unsigned int num_files)
+{
+    unsigned int i;
+
+    memset(reader, 0, sizeof(*reader));
+    reader->cmd = cmd;
+    reader->filenames = filenames;
+    reader->num_files = num_files;
+
+    for (i = 0; i < TRACK_QUEUE_SLOTS; i++) {
+        reader->slots[i].data = malloc(TRACK_CHUNK_BYTES);
+        if (reader->slots[i].data == NULL) {
+            fprintf(stderr, "unable to allocate %d bytes\n", TRACK_CHUNK_BYTES);
+            goto err_free;
+        }
+    }
+
+    pthread_mutex_init(&reader->lock, NULL);
+    pthread_cond_init(&reader->cond, NULL);
+    if (pthread_create(&reader->thread, NULL, reader_thread, reader) != 0) {
+        fprintf(stderr, "unable to start the reader thread\n");
+        pthread_cond_destroy(&reader->cond);
+        pthread_mutex_destroy(&reader->lock);
+        goto err_free;
+    }
+
+    return 0;
+
+err_free:
+    for (i = 0; i < TRACK_QUEUE_SLOTS; i++) {
+        free(reader->slots[i].data);
+    }
+    return -1;
+}
+
+static void reader_free(struct reader *reader)
+{
+    unsigned int i;
+
+    reader_stop(reader);
+    pthread_join(reader->thread, NULL);
+    pthread_cond_destroy(&reader->cond);
+    pthread_mutex_destroy(&reader->lock);
+
+    for (i = 0; i < TRACK_QUEUE_SLOTS; i++) {
+        free(reader->slots[i].data);
     }
 }
 
 static int close = 0;
 
-int play_sample(struct ctx *ctx);
+int play_tracks(struct cmd *cmd);
 
 void stream_close(int sig)
 {
@@ -259,7 +475,7 @@ void stream_close(int sig)
 
 void print_usage(const char *argv0)
 {
-    fprintf(stderr, "usage: %s file.wav [options]\n", argv0);
+    fprintf(stderr, "usage: %s file.wav [file.wav ...] [options]\n", argv0);
     fprintf(stderr, "options:\n");
     fprintf(stderr, "-D | --card   <card number>    The card to receive the audio\n");
     fprintf(stderr, "-d | --device <device number>  The device to receive the audio\n");
@@ -271,13 +487,66 @@ void print_usage(const char *argv0)
     fprintf(stderr, "-b | --bits <bit-count>        The number of bits in one sample\n");
     fprintf(stderr, "-f | --float                   The frames are in floating-point PCM\n");
     fprintf(stderr, "-M | --mmap                    Use memory mapped IO to play audio\n");
+    fprintf(stderr, "-B | --deep-buffer             Use the largest buffer, waking up rarely\n");
+    fprintf(stderr, "-l | --playlist <file>         Play the files listed in a file, one per line\n");
+}
+
+static int add_file(struct cmd *cmd, const char *filename)
+{
+    const char **filenames;
+
+    filenames = realloc(cmd->filenames, (cmd->num_files + 1) * sizeof(*filenames));
+    if (filenames == NULL) {
+        fprintf(stderr, "unable to allocate the file list\n");
+        return -1;
+    }
+    filenames[cmd->num_files++] = filename;
+    cmd->filenames = filenames;
+    return 0;
+}
+
+/* Adds the files named in a playlist; blank lines and lines starting
+ * with '#' are ignored. The names are never freed, they live until exit. */
+static int read_playlist(struct cmd *cmd, const char *playlist)
+{
+    char line[4096];
+    char *filename;
+    size_t len;
+    FILE *file;
+    int ret = 0;
+
+    file = fopen(playlist, "r");
+    if (file == NULL) {
+        fprintf(stderr, "failed to open playlist '%s'\n", playlist);
+        return -1;
+    }
+
+    while (ret == 0 && fgets(line, sizeof(line), file) != NULL) {
+        len = strcspn(line, "\r\n");
+        line[len] = '\0';
+        if (len == 0 || line[0] == '#') {
+            continue;
+        }
+        filename = strdup(line);
+        if (filename == NULL) {
+            fprintf(stderr, "unable to allocate the file list\n");
+            ret = -1;
+            break;
+        }
+        ret = add_file(cmd, filename);
+    }
+
+    fclose(file);
+    return ret;
 }
 
 int main(int argc, char **argv)
 {
     int c;
+    int ret;
+    const char *filename;
+    const char *playlist = NULL;
     struct cmd cmd;
-    struct ctx ctx;
     struct optparse opts;
     struct optparse_long long_options[] = {
         { "card",         'D', OPTPARSE_REQUIRED },
@@ -290,6 +559,8 @@ int main(int argc, char **argv)
         { "bits",         'b', OPTPARSE_REQUIRED },
         { "float",        'f', OPTPARSE_NONE     },
         { "mmap",         'M', OPTPARSE_NONE     },
+        { "deep-buffer",  'B', OPTPARSE_NONE     },
+        { "playlist",     'l', OPTPARSE_REQUIRED },
         { "help",         'h', OPTPARSE_NONE     },
         { 0, 0, 0 }
     };
@@ -328,7 +599,7 @@ int main(int argc, char **argv)
             }
             break;
         case 'c':
-            if (sscanf(opts.optarg, "%u", &cmd.config.channels) != 1) {
+            if (sscanf(opts.optarg, "%u", &cmd.config.channels) != 1 || cmd.config.channels == 0) {
                 fprintf(stderr, "failed parsing channel count '%s'\n", argv[1]);
                 return EXIT_FAILURE;
             }
@@ -354,6 +625,12 @@ int main(int argc, char **argv)
         case 'M':
             cmd.flags |= PCM_MMAP;
             break;
+        case 'B':
+            cmd.flags |= PCM_DEEP_BUFFER;
+            break;
+        case 'l':
+            playlist = opts.optarg;
+            break;
         case 'h':
             print_usage(argv[0]);
             return EXIT_SUCCESS;
@@ -362,36 +639,28 @@ int main(int argc, char **argv)
             return EXIT_FAILURE;
         }
     }
-    cmd.filename = optparse_arg(&opts);
+    while ((filename = optparse_arg(&opts)) != NULL) {
+        if (add_file(&cmd, filename) < 0) {
+            return EXIT_FAILURE;
+        }
+    }
+    if (playlist != NULL && read_playlist(&cmd, playlist) < 0) {
+        return EXIT_FAILURE;
+    }
 
-    if (cmd.filename != NULL && cmd.filetype == NULL &&
-        (cmd.filetype = strrchr(cmd.filename, '.')) != NULL) {
-        cmd.filetype++;
+    if (cmd.num_files == 0) {
+        fprintf(stderr, "filename not specified\n");
+        return EXIT_FAILURE;
     }
 
     cmd.config.silence_threshold = cmd.config.period_size * cmd.config.period_count;
     cmd.config.stop_threshold = cmd.config.period_size * cmd.config.period_count;
     cmd.config.start_threshold = cmd.config.period_size;
 
-    if (ctx_init(&ctx, &cmd) < 0) {
-        return EXIT_FAILURE;
-    }
-
-    printf("playing '%s': %u ch, %u hz, %u-bit ", cmd.filename, cmd.config.channels,
-            cmd.config.rate, pcm_format_to_bits(cmd.config.format));
-    if (cmd.config.format == PCM_FORMAT_FLOAT_LE) {
-        printf("floating-point PCM\n");
-    } else {
-        printf("signed PCM\n");
-    }
-
-    if (play_sample(&ctx) < 0) {
-        ctx_free(&ctx);
-        return EXIT_FAILURE;
-    }
+    ret = play_tracks(&cmd);
+    free(cmd.filenames);
 
-    ctx_free(&ctx);
-    return EXIT_SUCCESS;
+    return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
 int check_param(struct pcm_params *params, unsigned int param, unsigned int value,
@@ -443,60 +712,166 @@ int sample_is_playable(const struct cmd *cmd)
     return can_play;
 }
 
-int play_sample(struct ctx *ctx)
+static bool same_format(const struct pcm_config *a, const struct pcm_config *b)
 {
-    char *buffer;
-    bool is_stdin_source = ctx->file == stdin;
-    size_t buffer_size = 0;
-    size_t num_read = 0;
-    size_t remaining_data_size = is_stdin_source ? SIZE_MAX : ctx->file_size;
-    size_t played_data_size = 0;
-    size_t read_size = 0;
-    const struct pcm_config *config = pcm_get_config(ctx->pcm);
+    return a->channels == b->channels && a->rate == b->rate && a->format == b->format;
+}
 
-    if (config == NULL) {
-        fprintf(stderr, "unable to get pcm config\n");
-        return -1;
+static long long elapsed_ns(const struct timespec *from, const struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1000000000LL + (to->tv_nsec - from->tv_nsec);
+}
+
+static void print_played(size_t played_data_size, size_t remaining_data_size)
+{
+    printf("Played %zu bytes. ", played_data_size);
+    if (remaining_data_size == SIZE_MAX) {
+        printf("\n");
+    } else {
+        printf("Remains %zu bytes.\n", remaining_data_size);
     }
+}
+
+static void print_track(const struct chunk *chunk)
+{
+    printf("playing '%s': %u ch, %u hz, %u-bit ", chunk->filename, chunk->config.channels,
+            chunk->config.rate, pcm_format_to_bits(chunk->config.format));
+    if (chunk->config.format == PCM_FORMAT_FLOAT_LE) {
+        printf("floating-point PCM\n");
+    } else {
+        printf("signed PCM\n");
+    }
+}
+
+/* Plays the tracks queued by the reader thread. The PCM is kept open, and
+ * the next track written straight after the current one, for as long as
+ * the tracks share a format; it is drained and reopened otherwise.
+ *
+ * At each track boundary the gap is estimated from the time the queued
+ * frames of the previous track ran out to the time the first frames of the
+ * next one were written, and printed in frames. */
+int play_tracks(struct cmd *cmd)
+{
+    struct reader reader;
+    struct chunk *chunk;
+    struct pcm *pcm = NULL;
+    struct pcm_config config;
+    struct timespec last_write, now, tstamp;
+    unsigned int avail;
+    unsigned int queued = 0;
+    unsigned int tracks = 0;
+    unsigned long long gap_total = 0;
+    bool reopened = false;
+    bool first_write = false;
+    size_t played_data_size = 0;
+    size_t remaining_data_size = 0;
+    int ret = 0;
 
-    buffer_size = pcm_frames_to_bytes(ctx->pcm, config->period_size);
-    buffer = malloc(buffer_size);
-    if (!buffer) {
-        fprintf(stderr, "unable to allocate %zu bytes\n", buffer_size);
+    if (reader_start(&reader, cmd, cmd->filenames, cmd->num_files) < 0) {
         return -1;
     }
 
     /* catch ctrl-c to shutdown cleanly */
     signal(SIGINT, stream_close);
 
-    do {
-        read_size = remaining_data_size > buffer_size ? buffer_size : remaining_data_size;
-        num_read = fread(buffer, 1, read_size, ctx->file);
-        if (num_read > 0) {
-            int written_frames = pcm_writei(ctx->pcm, buffer,
-                    pcm_bytes_to_frames(ctx->pcm, num_read));
+    while (!close && (chunk = reader_peek(&reader)) != NULL && chunk->type != CHUNK_END) {
+        if (chunk->type == CHUNK_TRACK) {
+            if (tracks > 0) {
+                print_played(played_data_size, remaining_data_size);
+            }
+            reopened = pcm == NULL || !same_format(&config, &chunk->config);
+            if (reopened && pcm != NULL) {
+                pcm_drain(pcm);
+                clock_gettime(CLOCK_MONOTONIC, &last_write);
+                queued = 0;
+                print_stats(pcm);
+                pcm_close(pcm);
+                pcm = NULL;
+            }
+            if (pcm == NULL) {
+                config = chunk->config;
+                pcm = pcm_open(cmd->card, cmd->device, cmd->flags, &config);
+                if (!pcm_is_ready(pcm)) {
+                    fprintf(stderr, "failed to open for pcm %u,%u. %s\n",
+                            cmd->card, cmd->device, pcm_get_error(pcm));
+                    pcm_close(pcm);
+                    pcm = NULL;
+                    ret = -1;
+                    break;
+                }
+                if (cmd->flags & PCM_DEEP_BUFFER) {
+                    const struct pcm_config *deep = pcm_get_config(pcm);
+                    printf("deep buffer: %u periods of %u frames, waking at %lu frames free\n",
+                            deep->period_count, deep->period_size, deep->avail_min);
+                }
+            }
+            print_track(chunk);
+            first_write = tracks++ > 0;
+            played_data_size = 0;
+            remaining_data_size = chunk->size;
+        } else if (pcm != NULL) {
+            unsigned int frames;
+            int written_frames = 0;
+
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (first_write) {
+                /* the previous track ran out once its queued frames were played */
+                long long gap_ns = elapsed_ns(&last_write, &now) -
+                        (long long)queued * 1000000000LL / config.rate;
+                unsigned long long gap = gap_ns > 0 ?
+                        (unsigned long long)gap_ns * config.rate / 1000000000ULL : 0;
+
+                printf("gap: %llu frames (%s)\n", gap, reopened ? "reopened" : "same PCM");
+                gap_total += gap;
+                first_write = false;
+            }
+
+            /* a write cut short by an xrun is carried on after the recovery */
+            for (frames = 0; frames < pcm_bytes_to_frames(pcm, chunk->bytes);
+                    frames += written_frames) {
+                written_frames = pcm_writei(pcm, chunk->data + pcm_frames_to_bytes(pcm, frames),
+                        pcm_bytes_to_frames(pcm, chunk->bytes) - frames);
+                if (written_frames < 0) {
+                    break;
+                }
+            }
             if (written_frames < 0) {
-                fprintf(stderr, "error playing sample. %s\n", pcm_get_error(ctx->pcm));
+                fprintf(stderr, "error playing sample. %s\n", pcm_get_error(pcm));
+                ret = -1;
                 break;
             }
 
-            if (!is_stdin_source) {
-                remaining_data_size -= num_read;
+            clock_gettime(CLOCK_MONOTONIC, &last_write);
+            queued = 0;
+            if (pcm_get_htimestamp(pcm, &avail, &tstamp) == 0 &&
+                    avail < pcm_get_buffer_size(pcm)) {
+                queued = pcm_get_buffer_size(pcm) - avail;
+            }
+
+            played_data_size += pcm_frames_to_bytes(pcm, frames);
+            if (remaining_data_size != SIZE_MAX) {
+                remaining_data_size -= chunk->bytes;
             }
-            played_data_size += pcm_frames_to_bytes(ctx->pcm, written_frames);
         }
-    } while (!close && num_read > 0 && remaining_data_size > 0);
+        reader_release(&reader);
+    }
 
-    printf("Played %zu bytes. ", played_data_size);
-    if (is_stdin_source) {
-        printf("\n");
-    } else {
-        printf("Remains %zu bytes.\n", remaining_data_size);
+    if (tracks > 0) {
+        print_played(played_data_size, remaining_data_size);
+    }
+    if (tracks > 1) {
+        printf("%u tracks, %llu frames of gaps in total\n", tracks, gap_total);
     }
 
-    pcm_wait(ctx->pcm, -1);
+    reader_free(&reader);
 
-    free(buffer);
-    return 0;
-}
+    if (pcm != NULL) {
+        if (!close) {
+            pcm_drain(pcm);
+        }
+        print_stats(pcm);
+        pcm_close(pcm);
+    }
 
+    return ret;
+}
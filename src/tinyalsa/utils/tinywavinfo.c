@@ -26,18 +26,48 @@
 ** DAMAGE.
 */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
-#include <signal.h>
 #include <math.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define OPTPARSE_IMPLEMENTATION
+#include "optparse.h"
 
 #define ID_RIFF 0x46464952
 #define ID_WAVE 0x45564157
 #define ID_FMT  0x20746d66
 #define ID_DATA 0x61746164
 
+#define WAVE_FORMAT_PCM 0x0001
+#define WAVE_FORMAT_IEEE_FLOAT 0x0003
+#define WAVE_FORMAT_EXTENSIBLE 0xfffe
+
+#define MAX_CHANNELS 32
+#define MAX_THREADS 64
+
+/* Samples are processed in vectors of VEC_WIDTH floats. A group of
+ * lcm(channels, VEC_WIDTH) samples maps every vector lane to a fixed
+ * channel, so interleaved data needs no shuffling. */
+#define VEC_WIDTH 4
+#define MAX_LANES (MAX_CHANNELS * VEC_WIDTH)
+#define MAX_VECS (MAX_LANES / VEC_WIDTH)
+
+/* groups accumulated in float before being folded into doubles */
+#define GROUPS_PER_BLOCK 1024
+
+typedef float v4sf __attribute__((vector_size(VEC_WIDTH * sizeof(float))));
+typedef int32_t v4si __attribute__((vector_size(VEC_WIDTH * sizeof(int32_t))));
+
 struct riff_wave_header {
     uint32_t riff_id;
     uint32_t riff_sz;
@@ -58,167 +88,530 @@ struct chunk_fmt {
     uint16_t bits_per_sample;
 };
 
-static int close = 0;
+enum sample_type {
+    SAMPLE_S16,
+    SAMPLE_S24_3,
+    SAMPLE_S32,
+    SAMPLE_FLOAT,
+};
+
+struct wav_stats {
+    double sum[MAX_CHANNELS];
+    double sum_sq[MAX_CHANNELS];
+    float peak[MAX_CHANNELS];
+};
+
+struct wav_file {
+    const char *filename;
+    unsigned char *map;
+    size_t map_size;
+    struct chunk_fmt fmt;
+    enum sample_type type;
+    unsigned int sample_bytes;
+    const unsigned char *data;
+    size_t samples;
+    struct wav_stats stats;
+    int error;
+};
+
+struct range_job {
+    const struct wav_file *wav;
+    size_t first;
+    size_t last;
+    struct wav_stats stats;
+};
 
-void analyse_sample(FILE *file, unsigned int channels, unsigned int bits,
-                    unsigned int data_chunk_size);
+struct file_pool {
+    struct wav_file *files;
+    unsigned int count;
+    unsigned int next;
+    pthread_mutex_t lock;
+};
 
-void stream_close(int sig)
+static unsigned int gcd(unsigned int a, unsigned int b)
 {
-    /* allow the stream to be closed gracefully */
-    signal(sig, SIG_IGN);
-    close = 1;
+    while (b) {
+        unsigned int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
 }
 
-size_t xfread(void *ptr, size_t size, size_t nmemb, FILE *stream)
+static unsigned int group_lanes(unsigned int channels)
 {
-    size_t sz = fread(ptr, size, nmemb, stream);
+    return channels / gcd(channels, VEC_WIDTH) * VEC_WIDTH;
+}
 
-    if (sz != nmemb && ferror(stream)) {
-        fprintf(stderr, "Error: fread failed\n");
-        exit(1);
+static float sample_scale(enum sample_type type)
+{
+    switch (type) {
+    case SAMPLE_S16:
+        return 1.0f / 32768.0f;
+    case SAMPLE_S24_3:
+    case SAMPLE_S32:
+        /* 24 bit samples are loaded into the top of a 32 bit word */
+        return 1.0f / 2147483648.0f;
+    default:
+        return 1.0f;
     }
-    return sz;
 }
 
-int main(int argc, char **argv)
+static inline int32_t load_s24_3(const unsigned char *p)
 {
-    FILE *file;
-    struct riff_wave_header riff_wave_header;
-    struct chunk_header chunk_header;
-    struct chunk_fmt chunk_fmt;
-    char *filename;
-    int more_chunks = 1;
+    return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24);
+}
 
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s file.wav \n", argv[0]);
-        return 1;
+static float load_scalar(enum sample_type type, const unsigned char *p)
+{
+    int16_t s16;
+    int32_t s32;
+    float f;
+
+    switch (type) {
+    case SAMPLE_S16:
+        memcpy(&s16, p, sizeof(s16));
+        return s16;
+    case SAMPLE_S24_3:
+        return load_s24_3(p);
+    case SAMPLE_S32:
+        memcpy(&s32, p, sizeof(s32));
+        return s32;
+    default:
+        memcpy(&f, p, sizeof(f));
+        return f;
     }
+}
 
-    filename = argv[1];
-    file = fopen(filename, "rb");
-    if (!file) {
-        fprintf(stderr, "Unable to open file '%s'\n", filename);
-        return 1;
-    }
+static inline v4sf load_s16(const unsigned char *p)
+{
+    int16_t s[VEC_WIDTH];
+    memcpy(s, p, sizeof(s));
+    v4si v = { s[0], s[1], s[2], s[3] };
+    return __builtin_convertvector(v, v4sf);
+}
 
-    xfread(&riff_wave_header, sizeof(riff_wave_header), 1, file);
-    if ((riff_wave_header.riff_id != ID_RIFF) ||
-        (riff_wave_header.wave_id != ID_WAVE)) {
-        fprintf(stderr, "Error: '%s' is not a riff/wave file\n", filename);
-        fclose(file);
-        return 1;
-    }
+static inline v4sf load_s24(const unsigned char *p)
+{
+    v4si v = { load_s24_3(p), load_s24_3(p + 3), load_s24_3(p + 6), load_s24_3(p + 9) };
+    return __builtin_convertvector(v, v4sf);
+}
 
-    do {
-        xfread(&chunk_header, sizeof(chunk_header), 1, file);
+static inline v4sf load_s32(const unsigned char *p)
+{
+    v4si v;
+    memcpy(&v, p, sizeof(v));
+    return __builtin_convertvector(v, v4sf);
+}
 
-        switch (chunk_header.id) {
-        case ID_FMT:
-            xfread(&chunk_fmt, sizeof(chunk_fmt), 1, file);
-            /* If the format header is larger, skip the rest */
-            if (chunk_header.sz > sizeof(chunk_fmt))
-                fseek(file, chunk_header.sz - sizeof(chunk_fmt), SEEK_CUR);
-            break;
-        case ID_DATA:
-            /* Stop looking for chunks */
-            more_chunks = 0;
-            break;
-        default:
-            /* Unknown chunk, skip bytes */
-            fseek(file, chunk_header.sz, SEEK_CUR);
-        }
-    } while (more_chunks);
+static inline v4sf load_float(const unsigned char *p)
+{
+    v4sf v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
 
-    printf("Input File       : %s \n", filename);
-    printf("Channels         : %u \n", chunk_fmt.num_channels);
-    printf("Sample Rate      : %u \n", chunk_fmt.sample_rate);
-    printf("Bits per sample  : %u \n\n", chunk_fmt.bits_per_sample);
+static inline v4sf vec_max(v4sf a, v4sf b)
+{
+    v4si m = a > b;
+    return (v4sf)(((v4si)a & m) | ((v4si)b & ~m));
+}
 
-    analyse_sample(file, chunk_fmt.num_channels, chunk_fmt.bits_per_sample,
-                    chunk_header.sz);
+static inline v4sf vec_abs(v4sf a)
+{
+    const v4si mask = { INT32_MAX, INT32_MAX, INT32_MAX, INT32_MAX };
+    return (v4sf)((v4si)a & mask);
+}
 
-    fclose(file);
+/* Accumulates sum, sum of squares and peak of n groups per lane. */
+#define ANALYSE_GROUPS(load, bytes)                                         \
+    for (g = 0; g < n; g++) {                                               \
+        for (v = 0; v < vecs; v++) {                                        \
+            v4sf x = load(p) * scale;                                       \
+            sum[v] += x;                                                    \
+            sum_sq[v] += x * x;                                             \
+            peak[v] = vec_max(peak[v], vec_abs(x));                         \
+            p += VEC_WIDTH * (bytes);                                       \
+        }                                                                   \
+    }
 
-    return 0;
+static void analyse_range(const struct wav_file *wav, size_t first, size_t last,
+                          struct wav_stats *stats)
+{
+    unsigned int channels = wav->fmt.num_channels;
+    unsigned int lanes = group_lanes(channels);
+    unsigned int vecs = lanes / VEC_WIDTH;
+    unsigned int bytes = wav->sample_bytes;
+    const float s = sample_scale(wav->type);
+    const v4sf scale = { s, s, s, s };
+    const unsigned char *p = wav->data + first * bytes;
+    size_t groups = (last - first) / lanes;
+    size_t i;
+    unsigned int lane, v, g, n;
+
+    memset(stats, 0, sizeof(*stats));
+
+    while (groups) {
+        v4sf sum[MAX_VECS] = { { 0 } };
+        v4sf sum_sq[MAX_VECS] = { { 0 } };
+        v4sf peak[MAX_VECS] = { { 0 } };
+
+        n = groups > GROUPS_PER_BLOCK ? GROUPS_PER_BLOCK : groups;
+        switch (wav->type) {
+        case SAMPLE_S16:
+            ANALYSE_GROUPS(load_s16, 2);
+            break;
+        case SAMPLE_S24_3:
+            ANALYSE_GROUPS(load_s24, 3);
+            break;
+        case SAMPLE_S32:
+            ANALYSE_GROUPS(load_s32, 4);
+            break;
+        case SAMPLE_FLOAT:
+            ANALYSE_GROUPS(load_float, 4);
+            break;
+        }
+        groups -= n;
+
+        for (lane = 0; lane < lanes; lane++) {
+            unsigned int ch = lane % channels;
+            stats->sum[ch] += sum[lane / VEC_WIDTH][lane % VEC_WIDTH];
+            stats->sum_sq[ch] += sum_sq[lane / VEC_WIDTH][lane % VEC_WIDTH];
+            if (peak[lane / VEC_WIDTH][lane % VEC_WIDTH] > stats->peak[ch])
+                stats->peak[ch] = peak[lane / VEC_WIDTH][lane % VEC_WIDTH];
+        }
+    }
+
+    /* samples that do not fill a whole group */
+    for (i = (p - wav->data) / bytes; i < last; i++, p += bytes) {
+        unsigned int ch = (i - first) % channels;
+        float x = load_scalar(wav->type, p) * s;
+        stats->sum[ch] += x;
+        stats->sum_sq[ch] += x * x;
+        if (fabsf(x) > stats->peak[ch])
+            stats->peak[ch] = fabsf(x);
+    }
 }
 
-void analyse_sample(FILE *file, unsigned int channels, unsigned int bits,
-                    unsigned int data_chunk_size)
+static void merge_stats(struct wav_stats *dst, const struct wav_stats *src,
+                        unsigned int channels)
 {
-    void *buffer;
-    int size;
-    int num_read;
-    unsigned int i;
     unsigned int ch;
-    int frame_size = 1024;
-    unsigned int bytes_per_sample = 0;
-    float *power;
-    int total_sample_per_channel;
-    float normalization_factor;
 
-    if (bits == 32)
-        bytes_per_sample = 4;
-    else if (bits == 16)
-        bytes_per_sample = 2;
+    for (ch = 0; ch < channels; ch++) {
+        dst->sum[ch] += src->sum[ch];
+        dst->sum_sq[ch] += src->sum_sq[ch];
+        if (src->peak[ch] > dst->peak[ch])
+            dst->peak[ch] = src->peak[ch];
+    }
+}
 
-    normalization_factor = (float)pow(2.0, (bits-1));
+static void *range_thread(void *arg)
+{
+    struct range_job *job = arg;
 
-    size = channels * bytes_per_sample * frame_size;
+    analyse_range(job->wav, job->first, job->last, &job->stats);
+    return NULL;
+}
 
-    buffer = malloc(size);
-    if (!buffer) {
-        fprintf(stderr, "Unable to allocate %d bytes\n", size);
-        free(buffer);
+/* Splits a file into group aligned ranges, one per thread, and sums
+ * the partial results. */
+static void analyse_file(struct wav_file *wav, unsigned int threads)
+{
+    struct range_job jobs[MAX_THREADS];
+    pthread_t tids[MAX_THREADS];
+    bool started[MAX_THREADS] = { false };
+    unsigned int lanes = group_lanes(wav->fmt.num_channels);
+    size_t groups = wav->samples / lanes;
+    size_t per_thread;
+    unsigned int t;
+
+    memset(&wav->stats, 0, sizeof(wav->stats));
+
+    if (threads > groups / GROUPS_PER_BLOCK)
+        threads = groups / GROUPS_PER_BLOCK;
+    if (threads <= 1) {
+        analyse_range(wav, 0, wav->samples, &wav->stats);
         return;
     }
 
-    power = (float *) calloc(channels, sizeof(float));
+    per_thread = groups / threads;
+    for (t = 0; t < threads; t++) {
+        jobs[t].wav = wav;
+        jobs[t].first = t * per_thread * lanes;
+        jobs[t].last = t == threads - 1 ? wav->samples : (t + 1) * per_thread * lanes;
+        if (t > 0 && pthread_create(&tids[t], NULL, range_thread, &jobs[t]) == 0)
+            started[t] = true;
+        else
+            range_thread(&jobs[t]);
+    }
 
-    total_sample_per_channel = data_chunk_size / (channels * bytes_per_sample);
+    merge_stats(&wav->stats, &jobs[0].stats, wav->fmt.num_channels);
+    for (t = 1; t < threads; t++) {
+        if (started[t])
+            pthread_join(tids[t], NULL);
+        merge_stats(&wav->stats, &jobs[t].stats, wav->fmt.num_channels);
+    }
+}
+
+static int open_wav(struct wav_file *wav)
+{
+    const struct riff_wave_header *riff;
+    struct chunk_header chunk;
+    struct stat st;
+    size_t offset;
+    int have_fmt = 0;
+    int fd;
+
+    fd = open(wav->filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Unable to open file '%s'\n", wav->filename);
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*riff)) {
+        fprintf(stderr, "Error: '%s' is not a riff/wave file\n", wav->filename);
+        close(fd);
+        return -1;
+    }
 
-    /* catch ctrl-c to shutdown cleanly */
-    signal(SIGINT, stream_close);
+    wav->map_size = st.st_size;
+    wav->map = mmap(NULL, wav->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (wav->map == MAP_FAILED) {
+        fprintf(stderr, "Error: unable to map '%s': %s\n", wav->filename, strerror(errno));
+        wav->map = NULL;
+        return -1;
+    }
+    posix_madvise(wav->map, wav->map_size, POSIX_MADV_SEQUENTIAL);
 
-    do {
-        num_read = xfread(buffer, 1, size, file);
-        if (num_read > 0) {
-            if (2 == bytes_per_sample) {
-                short *buffer_ptr = (short *)buffer;
-                for (i = 0; i < num_read / bytes_per_sample; i += channels) {
-                    for (ch = 0; ch < channels; ch++) {
-                        int temp = *buffer_ptr++;
-                        /* Signal Normalization */
-                        float f = (float) temp / normalization_factor;
-                        *(power + ch) += (float) (f * f);
-                    }
-                }
-            }
-            if (4 == bytes_per_sample) {
-                int *buffer_ptr = (int *)buffer;
-                for (i = 0; i < num_read / bytes_per_sample; i += channels) {
-                    for (ch = 0; ch < channels; ch++) {
-                        int temp = *buffer_ptr++;
-                        /* Signal Normalization */
-                        float f = (float) temp / normalization_factor;
-                        *(power + ch) += (float) (f * f);
-                    }
-                }
+    riff = (const struct riff_wave_header *)wav->map;
+    if (riff->riff_id != ID_RIFF || riff->wave_id != ID_WAVE) {
+        fprintf(stderr, "Error: '%s' is not a riff/wave file\n", wav->filename);
+        return -1;
+    }
+
+    offset = sizeof(*riff);
+    for (;;) {
+        if (offset + sizeof(chunk) > wav->map_size) {
+            fprintf(stderr, "Error: '%s' does not contain a data chunk\n", wav->filename);
+            return -1;
+        }
+        memcpy(&chunk, wav->map + offset, sizeof(chunk));
+        offset += sizeof(chunk);
+
+        if (chunk.id == ID_FMT) {
+            if (chunk.sz < sizeof(wav->fmt) || offset + chunk.sz > wav->map_size) {
+                fprintf(stderr, "Error: '%s' has incomplete format chunk\n", wav->filename);
+                return -1;
             }
+            memcpy(&wav->fmt, wav->map + offset, sizeof(wav->fmt));
+            /* the sub format GUID starts with the actual format tag */
+            if (wav->fmt.audio_format == WAVE_FORMAT_EXTENSIBLE && chunk.sz >= 26)
+                memcpy(&wav->fmt.audio_format, wav->map + offset + 24, sizeof(uint16_t));
+            have_fmt = 1;
+        } else if (chunk.id == ID_DATA) {
+            break;
         }
-    }while (!close && num_read > 0);
+        /* skip chunk, including its pad byte */
+        offset += chunk.sz + (chunk.sz & 1);
+    }
+
+    if (!have_fmt) {
+        fprintf(stderr, "Error: '%s' has no format chunk\n", wav->filename);
+        return -1;
+    }
+
+    switch (wav->fmt.bits_per_sample) {
+    case 16:
+        wav->type = SAMPLE_S16;
+        break;
+    case 24:
+        wav->type = SAMPLE_S24_3;
+        break;
+    case 32:
+        wav->type = wav->fmt.audio_format == WAVE_FORMAT_IEEE_FLOAT ? SAMPLE_FLOAT : SAMPLE_S32;
+        break;
+    default:
+        fprintf(stderr, "Error: '%s' has unsupported %u bits per sample\n",
+                wav->filename, wav->fmt.bits_per_sample);
+        return -1;
+    }
+    if (wav->fmt.num_channels == 0 || wav->fmt.num_channels > MAX_CHANNELS) {
+        fprintf(stderr, "Error: '%s' has unsupported channel count %u\n",
+                wav->filename, wav->fmt.num_channels);
+        return -1;
+    }
+
+    wav->sample_bytes = wav->fmt.bits_per_sample / 8;
+    wav->data = wav->map + offset;
+    if (chunk.sz > wav->map_size - offset)
+        chunk.sz = wav->map_size - offset;
+    /* only whole frames are analysed */
+    wav->samples = chunk.sz / (wav->sample_bytes * wav->fmt.num_channels) *
+                   wav->fmt.num_channels;
+    return 0;
+}
+
+static void close_wav(struct wav_file *wav)
+{
+    if (wav->map)
+        munmap(wav->map, wav->map_size);
+    wav->map = NULL;
+}
+
+static void print_wav(const struct wav_file *wav)
+{
+    unsigned int ch, channels = wav->fmt.num_channels;
+    size_t frames = wav->samples / channels;
+
+    printf("Input File       : %s \n", wav->filename);
+    printf("Channels         : %u \n", channels);
+    printf("Sample Rate      : %u \n", wav->fmt.sample_rate);
+    printf("Bits per sample  : %u%s \n\n", wav->fmt.bits_per_sample,
+           wav->type == SAMPLE_FLOAT ? " (float)" : "");
 
     for (ch = 0; ch < channels; ch++) {
-        float average_power = 10 * log10((*(power + ch)) / total_sample_per_channel);
-        if(isinf (average_power)) {
+        float average_power = 10 * log10(wav->stats.sum_sq[ch] / frames);
+        float peak = 20 * log10(wav->stats.peak[ch]);
+
+        if (isinf(average_power)) {
             printf("Channel [%2u] Average Power : NO signal or ZERO signal\n", ch);
-        } else {
-            printf("Channel [%2u] Average Power : %.2f dB\n", ch, average_power);
+            continue;
         }
+        printf("Channel [%2u] Average Power : %.2f dB\n", ch, average_power);
+        printf("Channel [%2u] Peak Level    : %.2f dBFS\n", ch, peak);
+        printf("Channel [%2u] DC Offset     : %.6f\n", ch, wav->stats.sum[ch] / frames);
     }
+}
+
+static void *file_thread(void *arg)
+{
+    struct file_pool *pool = arg;
 
-    free(buffer);
-    free(power);
+    for (;;) {
+        struct wav_file *wav;
 
+        pthread_mutex_lock(&pool->lock);
+        wav = pool->next < pool->count ? &pool->files[pool->next++] : NULL;
+        pthread_mutex_unlock(&pool->lock);
+        if (!wav)
+            break;
+
+        wav->error = open_wav(wav);
+        if (!wav->error)
+            analyse_file(wav, 1);
+        close_wav(wav);
+    }
+    return NULL;
+}
+
+static void print_usage(const char *argv0)
+{
+    fprintf(stderr, "Usage: %s [-j jobs] file.wav [file.wav ...]\n", argv0);
+    fprintf(stderr, "-j | --jobs <count>  Number of threads (default: online CPUs)\n");
+    fprintf(stderr, "                     A single file is split across the threads,\n");
+    fprintf(stderr, "                     several files are analysed in parallel.\n");
 }
 
+int main(int argc, char **argv)
+{
+    struct optparse opts;
+    struct optparse_long long_options[] = {
+        { "jobs", 'j', OPTPARSE_REQUIRED },
+        { "help", 'h', OPTPARSE_NONE     },
+        { 0, 0, 0 }
+    };
+    struct file_pool pool;
+    pthread_t tids[MAX_THREADS];
+    struct timespec start, end;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int jobs = cpus > 0 ? cpus : 1;
+    unsigned int i, started = 0;
+    uint64_t bytes = 0;
+    double seconds;
+    char *arg;
+    int c, ret = 0;
+
+    if (argc < 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    optparse_init(&opts, argv);
+    while ((c = optparse_long(&opts, long_options, NULL)) != -1) {
+        switch (c) {
+        case 'j':
+            if (sscanf(opts.optarg, "%u", &jobs) != 1 || jobs == 0) {
+                fprintf(stderr, "failed parsing job count '%s'\n", opts.optarg);
+                return 1;
+            }
+            break;
+        case 'h':
+            print_usage(argv[0]);
+            return 0;
+        case '?':
+            fprintf(stderr, "%s\n", opts.errmsg);
+            return 1;
+        }
+    }
+    if (jobs > MAX_THREADS)
+        jobs = MAX_THREADS;
+
+    memset(&pool, 0, sizeof(pool));
+    pool.files = calloc(argc, sizeof(*pool.files));
+    if (!pool.files) {
+        fprintf(stderr, "Unable to allocate file list\n");
+        return 1;
+    }
+    while ((arg = optparse_arg(&opts)) != NULL)
+        pool.files[pool.count++].filename = arg;
+    if (pool.count == 0) {
+        print_usage(argv[0]);
+        free(pool.files);
+        return 1;
+    }
+    pthread_mutex_init(&pool.lock, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (pool.count == 1) {
+        struct wav_file *wav = &pool.files[0];
+        wav->error = open_wav(wav);
+        if (!wav->error)
+            analyse_file(wav, jobs);
+        close_wav(wav);
+    } else {
+        if (jobs > pool.count)
+            jobs = pool.count;
+        for (i = 1; i < jobs; i++) {
+            if (pthread_create(&tids[i], NULL, file_thread, &pool) != 0)
+                break;
+            started++;
+        }
+        file_thread(&pool);
+        for (i = 1; i <= started; i++)
+            pthread_join(tids[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    pthread_mutex_destroy(&pool.lock);
+
+    for (i = 0; i < pool.count; i++) {
+        struct wav_file *wav = &pool.files[i];
+        if (wav->error) {
+            ret = 1;
+            continue;
+        }
+        if (i > 0)
+            printf("\n");
+        print_wav(wav);
+        bytes += (uint64_t)wav->samples * wav->sample_bytes;
+    }
+
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    if (bytes && seconds > 0) {
+        printf("\nAnalysed %.1f MB in %.3f s (%.2f GB/s)\n",
+               bytes / 1e6, seconds, bytes / seconds / 1e9);
+    }
+
+    free(pool.files);
+    return ret;
+}